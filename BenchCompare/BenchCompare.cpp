@@ -0,0 +1,432 @@
+// Compares two benchmark.json files written by the simulation (B in the app).
+//
+//   BenchCompare <baseline.json> <current.json> [--threshold <percent>] [--sigma <k>] [--allow-missing]
+//
+// Per metric the median and MAD of the samples are compared. A metric only counts as slower when the
+// median moved by more than <threshold> percent AND by more than <k> times the combined noise of both runs,
+// so a noisy machine needs a bigger change before it fails the gate.
+// Hardware counter metrics are compared the same way: "*.ipc" regresses when it drops and
+// "*.llc_misses_per_particle" when it rises, so a phase turning memory bound shows even if its time hides it.
+// A baseline metric the current run doesn't have fails the gate too, a dropped phase or counter could hide
+// anything. --allow-missing only lists them, for a change that drops one on purpose.
+// Both runs must be of the same scene, execution mode and thread count.
+// Exit code: 0 nothing significant got slower, 1 at least one regression or missing metric, 2 bad input.
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+	// Just enough JSON for the benchmark files: objects, arrays, numbers, strings and literals
+	struct JsonValue
+	{
+		enum class Type { Null, Number, String, Array, Object, Bool };
+
+		Type type = Type::Null;
+		double number = 0.0;
+		std::string text;
+		std::vector<JsonValue> items;
+		std::vector<std::pair<std::string, JsonValue>> members;
+
+		const JsonValue* find(const char* key) const
+		{
+			for (const std::pair<std::string, JsonValue>& member : members)
+			{
+				if (member.first == key)
+				{
+					return &member.second;
+				}
+			}
+			return nullptr;
+		}
+	};
+
+	class JsonParser
+	{
+	public:
+		explicit JsonParser(const std::string& source) : source(source) {}
+
+		bool parse(JsonValue& out)
+		{
+			if (!parseValue(out))
+			{
+				return false;
+			}
+			skipSpace();
+			return at == source.size();
+		}
+
+		size_t getPosition() const { return at; }
+
+	private:
+		void skipSpace()
+		{
+			while (at < source.size() && isspace((unsigned char)source[at]))
+			{
+				at++;
+			}
+		}
+
+		bool consume(char c)
+		{
+			skipSpace();
+			if (at < source.size() && source[at] == c)
+			{
+				at++;
+				return true;
+			}
+			return false;
+		}
+
+		bool parseString(std::string& out)
+		{
+			if (!consume('"'))
+			{
+				return false;
+			}
+			while (at < source.size() && source[at] != '"')
+			{
+				char c = source[at++];
+				if (c == '\\' && at < source.size())
+				{
+					c = source[at++];
+					switch (c)
+					{
+					case 'n': c = '\n'; break;
+					case 't': c = '\t'; break;
+					case 'r': c = '\r'; break;
+					case 'u': at += 4; c = '?'; break;
+					default: break;
+					}
+				}
+				out.push_back(c);
+			}
+			return at++ < source.size();
+		}
+
+		bool parseValue(JsonValue& out)
+		{
+			skipSpace();
+			if (at >= source.size())
+			{
+				return false;
+			}
+
+			const char c = source[at];
+			if (c == '{')
+			{
+				at++;
+				out.type = JsonValue::Type::Object;
+				if (consume('}'))
+				{
+					return true;
+				}
+				do
+				{
+					std::pair<std::string, JsonValue> member;
+					if (!parseString(member.first) || !consume(':') || !parseValue(member.second))
+					{
+						return false;
+					}
+					out.members.push_back(std::move(member));
+				} while (consume(','));
+				return consume('}');
+			}
+			if (c == '[')
+			{
+				at++;
+				out.type = JsonValue::Type::Array;
+				if (consume(']'))
+				{
+					return true;
+				}
+				do
+				{
+					out.items.emplace_back();
+					if (!parseValue(out.items.back()))
+					{
+						return false;
+					}
+				} while (consume(','));
+				return consume(']');
+			}
+			if (c == '"')
+			{
+				out.type = JsonValue::Type::String;
+				return parseString(out.text);
+			}
+			if (source.compare(at, 4, "true") == 0 || source.compare(at, 5, "false") == 0)
+			{
+				out.type = JsonValue::Type::Bool;
+				out.number = source[at] == 't' ? 1.0 : 0.0;
+				at += source[at] == 't' ? 4 : 5;
+				return true;
+			}
+			if (source.compare(at, 4, "null") == 0)
+			{
+				at += 4;
+				return true;
+			}
+
+			char* end = nullptr;
+			out.type = JsonValue::Type::Number;
+			out.number = strtod(source.c_str() + at, &end);
+			if (end == source.c_str() + at)
+			{
+				return false;
+			}
+			at = end - source.c_str();
+			return true;
+		}
+
+		const std::string& source;
+		size_t at = 0;
+	};
+
+	struct Benchmark
+	{
+		std::map<std::string, std::vector<double>> metrics;
+		std::vector<std::string> order;
+		// info.scene, empty for files written before scenes existed
+		std::string scene;
+		// info.execution_mode and info.threads, -1 for files written before they were recorded
+		double executionMode = -1.0;
+		double threads = -1.0;
+	};
+
+	bool loadBenchmark(const char* path, Benchmark& out)
+	{
+		std::ifstream file(path);
+		if (!file)
+		{
+			fprintf(stderr, "BenchCompare: can't open %s\n", path);
+			return false;
+		}
+
+		std::stringstream buffer;
+		buffer << file.rdbuf();
+		const std::string source = buffer.str();
+
+		JsonValue root;
+		JsonParser parser(source);
+		if (!parser.parse(root))
+		{
+			fprintf(stderr, "BenchCompare: %s is not valid JSON (near byte %zu)\n", path, parser.getPosition());
+			return false;
+		}
+
+		const JsonValue* metrics = root.find("metrics");
+		if (metrics == nullptr || metrics->type != JsonValue::Type::Object)
+		{
+			fprintf(stderr, "BenchCompare: %s has no \"metrics\" object\n", path);
+			return false;
+		}
+
+		const JsonValue* info = root.find("info");
+		const JsonValue* scene = info != nullptr ? info->find("scene") : nullptr;
+		if (scene != nullptr && scene->type == JsonValue::Type::String)
+		{
+			out.scene = scene->text;
+		}
+		for (std::pair<const char*, double*> setting : { std::make_pair("execution_mode", &out.executionMode), std::make_pair("threads", &out.threads) })
+		{
+			const JsonValue* value = info != nullptr ? info->find(setting.first) : nullptr;
+			if (value != nullptr && value->type == JsonValue::Type::Number)
+			{
+				*setting.second = value->number;
+			}
+		}
+
+		for (const std::pair<std::string, JsonValue>& metric : metrics->members)
+		{
+			std::vector<double>& samples = out.metrics[metric.first];
+			for (const JsonValue& sample : metric.second.items)
+			{
+				if (sample.type == JsonValue::Type::Number)
+				{
+					samples.push_back(sample.number);
+				}
+			}
+			out.order.push_back(metric.first);
+		}
+		return true;
+	}
+
+	double median(std::vector<double> values)
+	{
+		if (values.empty())
+		{
+			return 0.0;
+		}
+
+		const size_t middle = values.size() / 2;
+		std::nth_element(values.begin(), values.begin() + middle, values.end());
+		const double upper = values[middle];
+		if (values.size() % 2 == 1)
+		{
+			return upper;
+		}
+		return (upper + *std::max_element(values.begin(), values.begin() + middle)) / 2.0;
+	}
+
+	double medianAbsoluteDeviation(const std::vector<double>& values, double centre)
+	{
+		std::vector<double> deviations;
+		deviations.reserve(values.size());
+		for (double value : values)
+		{
+			deviations.push_back(std::fabs(value - centre));
+		}
+		return median(deviations);
+	}
+
+	// Standard error of the median, from the MAD scaled to a normal sigma
+	double medianError(double mad, size_t samples)
+	{
+		const double sigma = 1.4826 * mad;
+		return 1.2533 * sigma / std::sqrt((double)std::max<size_t>(samples, 1));
+	}
+
+	bool endsWith(const std::string& name, const char* suffix)
+	{
+		const size_t length = strlen(suffix);
+		return name.size() >= length && name.compare(name.size() - length, length, suffix) == 0;
+	}
+
+	// Timings print in microseconds, counter ratios as they are
+	bool isCounter(const std::string& name)
+	{
+		return endsWith(name, ".ipc") || endsWith(name, ".llc_misses_per_particle");
+	}
+
+	void printUsage()
+	{
+		fprintf(stderr, "usage: BenchCompare <baseline.json> <current.json> [--threshold <percent>] [--sigma <k>] [--allow-missing]\n");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	double thresholdPercent = 5.0;
+	double sigmaMultiple = 3.0;
+	bool allowMissing = false;
+	std::vector<const char*> paths;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+		{
+			thresholdPercent = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--sigma") == 0 && i + 1 < argc)
+		{
+			sigmaMultiple = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--allow-missing") == 0)
+		{
+			allowMissing = true;
+		}
+		else
+		{
+			paths.push_back(argv[i]);
+		}
+	}
+
+	if (paths.size() != 2)
+	{
+		printUsage();
+		return 2;
+	}
+
+	Benchmark baseline;
+	Benchmark current;
+	if (!loadBenchmark(paths[0], baseline) || !loadBenchmark(paths[1], current))
+	{
+		return 2;
+	}
+
+	// Timings of different scenes say nothing about each other
+	if (baseline.scene != current.scene)
+	{
+		fprintf(stderr, "BenchCompare: scenes differ (\"%s\" against \"%s\")\n", baseline.scene.c_str(), current.scene.c_str());
+		return 2;
+	}
+	// Nor do timings over a different number of threads or a different kernel path
+	if (baseline.executionMode != current.executionMode || baseline.threads != current.threads)
+	{
+		fprintf(stderr, "BenchCompare: runs differ (execution mode %g, %g threads against execution mode %g, %g threads)\n",
+			baseline.executionMode, baseline.threads, current.executionMode, current.threads);
+		return 2;
+	}
+
+	printf("%-48s %12s %12s %9s %9s  %s\n", "metric", "base (us)", "current (us)", "delta", "noise", "result");
+
+	int regressions = 0;
+	int missing = 0;
+	for (const std::string& name : baseline.order)
+	{
+		const std::vector<double>& before = baseline.metrics[name];
+		auto found = current.metrics.find(name);
+		if (found == current.metrics.end() || found->second.empty() || before.empty())
+		{
+			printf("%-48s %12s %12s %9s %9s  %s\n", name.c_str(), "-", "-", "-", "-", allowMissing ? "missing" : "MISSING");
+			missing += allowMissing ? 0 : 1;
+			continue;
+		}
+		const std::vector<double>& after = found->second;
+
+		const double medianBefore = median(before);
+		const double medianAfter = median(after);
+		const double noise = std::sqrt(std::pow(medianError(medianAbsoluteDeviation(before, medianBefore), before.size()), 2.0)
+			+ std::pow(medianError(medianAbsoluteDeviation(after, medianAfter), after.size()), 2.0));
+
+		const double delta = medianAfter - medianBefore;
+		const double deltaPercent = medianBefore > 0.0 ? delta / medianBefore * 100.0 : 0.0;
+		const double noisePercent = medianBefore > 0.0 ? noise / medianBefore * 100.0 : 0.0;
+
+		const bool significant = std::fabs(delta) > sigmaMultiple * noise && std::fabs(deltaPercent) > thresholdPercent;
+		// Fewer instructions per cycle is the worse way round
+		const bool worse = endsWith(name, ".ipc") ? delta < 0.0 : delta > 0.0;
+		const char* result = "same";
+		if (significant)
+		{
+			result = worse ? "SLOWER" : "faster";
+			regressions += worse ? 1 : 0;
+		}
+
+		const double scale = isCounter(name) ? 1.0 : 1000.0;
+		printf("%-48s %12.2f %12.2f %+8.1f%% %8.1f%%  %s\n", name.c_str(), medianBefore / scale, medianAfter / scale, deltaPercent, noisePercent, result);
+	}
+
+	for (const std::string& name : current.order)
+	{
+		if (baseline.metrics.find(name) == baseline.metrics.end())
+		{
+			printf("%-48s %12s %12.2f %9s %9s  %s\n", name.c_str(), "-", median(current.metrics[name]) / (isCounter(name) ? 1.0 : 1000.0), "-", "-", "new");
+		}
+	}
+
+	if (regressions > 0 || missing > 0)
+	{
+		if (regressions > 0)
+		{
+			printf("\n%d metric(s) slower than the baseline beyond %.1f%% and %.1f sigma\n", regressions, thresholdPercent, sigmaMultiple);
+		}
+		if (missing > 0)
+		{
+			printf("\n%d baseline metric(s) missing from the current run\n", missing);
+		}
+		return 1;
+	}
+
+	printf("\nNo significant regressions\n");
+	return 0;
+}
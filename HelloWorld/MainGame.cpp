@@ -4,7 +4,21 @@
 #include "particle.h"
 #include "boundary.h"
 #include "Simulation.h"
+#include "surfaceRenderer.h"
+#include "particleRenderer.h"
+#include "stampCache.h"
+#include "frameStats.h"
+#include "profiler.h"
+#include "benchmark.h"
+#include "validation.h"
+#include "threadPool.h"
+#include "scene.h"
+#include "particleGenerators.h"
+#include "settledCache.h"
+#include "rewindBuffer.h"
+#include "slabRun.h"
 #include <cmath>
+#include <fstream>
 
 //const int DISPLAY_WIDTH = 1920;	//School
 //const int DISPLAY_HEIGHT = 1080;	//School
@@ -16,8 +30,29 @@ const int DISPLAY_SCALE = 1;
 
 double dt = 0.016667;
 
-double Max = 0.0;
-double Min = 100.0;
+// The solver runs at a fixed step, frames draw positions blended between the last two steps
+double simStep = 1.0 / 60.0;
+double accumulator = 0.0;
+const int maxStepsPerFrame = 4;
+
+// Which of the frame recorder windows the overlay shows, cycled with H
+int statsWindow = 1;
+bool bShowProfiler = false;
+bool bShowCounters = false;
+
+// Z cycles fluid sleeping off, on, and on with the sleeping regions shaded. Scenes can start with it on.
+int sleepMode = 0;
+const int defaultSleepSteps = 60;
+
+// The weak scaling test with W goes up to this many processes, doubled with U and back to 2 after 16
+int weakScalingProcesses = 4;
+
+// E writes every step's stats to step_stats.jsonl, a line each, for telemetry that wants every step
+std::ofstream stepLog;
+
+// Result of the last differential test run with V
+std::string validationResult = "";
+bool bValidationPassed = false;
 
 std::vector<uint32_t> circles;
 int size = 0;
@@ -27,17 +62,33 @@ int RowSize = 20;
 const short gap = 10;
 
 bool bPaused = true;
+bool bDrawSurface = false;
+
+// Scene files from Data/Scenes, cycled with L. -1 is the grid built from the globals above
+std::vector<std::string> sceneFiles;
+int sceneIndex = -1;
+Fluid::Scene scene;
+std::string sceneError = "";
+
+// S starts the default grid already relaxed, from Data/Cache after the first time
+bool bPreSettle = false;
+const int preSettleSteps = 300;
+std::string settleState = "";
+
+// Every step since the scene was loaded, J steps back and K scrubs back while paused
+Fluid::RewindBuffer history;
+uint64_t historyStep = 0;
 
 /* 
  * TODOS:
  *  - Achive pure density (Grid stacking correctly)
  *  - Make it work with 9.82 F gravity (or 98.2)
- *  - Spatial Neighborhood search with hash functions.
+ *  - Spatial Neighborhood search with hash functions. (Uniform grid, toggle with G)
  *  - Correct stacking.
- *  - Particle Blending through alpha channel.
+ *  - Particle Blending through alpha channel. (Surface renderer, toggle with F)
  *  - Data oriented design for everything.
  *		- Create one read and one write buffer for Position, Velocity, Density etc.
- *  - Multithread system through the data oriented design pattern.
+ *  - Multithread system through the data oriented design pattern. (Thread pool, cycle modes with X)
  *  - Display more information on the screen from the simulation.
 */
 
@@ -58,41 +109,305 @@ void GenerateGrid()
 	int totalHeight = ceil((float)ParticleAmmount / (float)RowSize);
 	int TotalOffsetFromCenterHeight = totalHeight * gap;
 
-	for (int i = 0; i < ParticleAmmount; i++)
+	int worldOffsetX = (DISPLAY_WIDTH / 2) - ((TotalOffsetFromCenterWidth - gap) / 2.0f);
+	int worldOffsetY = (DISPLAY_HEIGHT / 2) - ((TotalOffsetFromCenterHeight - gap) / 2.0f);
+
+	// One allocation and a parallel fill instead of growing three vectors a particle at a time
+	const uint32_t count = (uint32_t)std::max(ParticleAmmount, 0);
+	const uint32_t first = Render::CreateGrid(count, (uint32_t)std::max(RowSize, 1), { (float)worldOffsetX, (float)worldOffsetY }, gap);
+	Fluid::Simulation::getInstance().AddCircles(first, count);
+	circles.resize(count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		circles[i] = first + i;
+	}
+	size = count;
+}
+
+void DrawPhaseCounters(Point2f pos)
+{
+	const Fluid::Simulation& simulation = Fluid::Simulation::getInstance();
+	const float particles = (float)std::max(simulation.GetParticleCount(), 1u);
+
+	std::string header = "Step counters: " + std::string(Stats::HardwareCounters::forThisThread().getBackendName());
+	Play::DrawDebugText(pos, header.c_str(), Play::cWhite, false);
+
+	char line[160];
+	int row = 1;
+	for (int i = 0; i < (int)Fluid::StepPhase::Count; i++)
+	{
+		const Stats::CounterSample& sample = simulation.GetPhaseCounters((Fluid::StepPhase)i);
+		if (sample.nanoseconds == 0)
+		{
+			continue;
+		}
+
+		int length = snprintf(line, sizeof(line), "%-20s %7.3f ms", Fluid::StepPhaseName((Fluid::StepPhase)i), sample.milliseconds());
+		if (sample.hasInstructions)
+		{
+			length += snprintf(line + length, sizeof(line) - length, "  IPC %4.2f", sample.ipc());
+		}
+		else if (sample.hasCycles)
+		{
+			length += snprintf(line + length, sizeof(line) - length, "  cycles %llu", (unsigned long long)sample.cycles);
+		}
+		if (sample.hasCacheMisses)
+		{
+			length += snprintf(line + length, sizeof(line) - length, "  LLC miss per p %5.3f", sample.cacheMisses / particles);
+		}
+		if (sample.hasBranchMisses)
+		{
+			snprintf(line + length, sizeof(line) - length, "  br miss per p %5.3f", sample.branchMisses / particles);
+		}
+
+		Play::DrawDebugText({ pos.x, pos.y + 15.0f * row++ }, line, Play::cWhite, false);
+	}
+
+	const Fluid::StepStats& stats = simulation.GetLastStepStats();
+	snprintf(line, sizeof(line), "Pairs tested %llu  in radius %llu  neighbours avg %.1f max %u",
+		(unsigned long long)stats.candidatePairs, (unsigned long long)stats.pairsInRadius, stats.averageNeighbours, stats.maxNeighbours);
+	Play::DrawDebugText({ pos.x, pos.y + 15.0f * row++ }, line, Play::cWhite, false);
+	snprintf(line, sizeof(line), "Collisions %u  springs %u  created %u  broken %u  buffers %.1f KB  grid chunks %u  asleep %u",
+		stats.boundaryCollisions, stats.springCount, stats.springsCreated, stats.springsBroken, stats.arenaBytes / 1024.0f, stats.gridChunks, stats.sleepingParticles);
+	Play::DrawDebugText({ pos.x, pos.y + 15.0f * row++ }, line, Play::cWhite, false);
+	if (simulation.IsPaging())
+	{
+		snprintf(line, sizeof(line), "Paged %.1f MB  pages read ahead %u  released %u",
+			stats.pagedBytes / (1024.0f * 1024.0f), stats.pagesPrefetched, stats.pagesReleased);
+		Play::DrawDebugText({ pos.x, pos.y + 15.0f * row++ }, line, Play::cWhite, false);
+	}
+	if (stats.numaNodes > 0)
+	{
+		int length = stats.remotePageFraction >= 0.0f
+			? snprintf(line, sizeof(line), "NUMA nodes %u  remote pages %.0f%%  particles/s", stats.numaNodes, stats.remotePageFraction * 100.0f)
+			: snprintf(line, sizeof(line), "NUMA nodes %u  remote pages n/a  particles/s", stats.numaNodes);
+		for (uint32_t node = 0; node < stats.numaNodes && length < (int)sizeof(line); node++)
+		{
+			length += snprintf(line + length, sizeof(line) - length, "  node %u %.1fM", node, stats.nodeParticlesPerSecond[node] / 1e6f);
+		}
+		Play::DrawDebugText({ pos.x, pos.y + 15.0f * row++ }, line, Play::cWhite, false);
+	}
+}
+
+void FindScenes()
+{
+	sceneFiles.clear();
+	std::error_code error;
+	for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator("Data/Scenes", error))
+	{
+		if (entry.path().extension() == ".scene")
+		{
+			sceneFiles.push_back(entry.path().string());
+		}
+	}
+	std::sort(sceneFiles.begin(), sceneFiles.end());
+}
+
+// Loads a scene from the catalogue, or the default grid for -1
+void LoadScene(int index)
+{
+	const Vector2f centre = { DISPLAY_WIDTH / 2, DISPLAY_HEIGHT / 2 };
+	sceneError.clear();
+
+	Fluid::SceneDescription description;
+	if (index >= 0 && !Fluid::LoadSceneFile(sceneFiles[index], description, sceneError))
+	{
+		return;
+	}
+
+	sceneIndex = index;
+	Render::ClearParticles();
+	Fluid::Simulation::getInstance().ClearData();
+	circles.clear();
+	size = 0;
+
+	if (index < 0)
+	{
+		scene = Fluid::Scene();
+		Render::Boundary::instance().resize(400, 400);
+		Render::Boundary::instance().move(centre);
+		Render::Boundary::instance().setMotion(Render::BoundaryMotion());
+		Render::Boundary::instance().setPeriodic(false, false);
+		Fluid::Simulation::getInstance().SetParameters(Fluid::SolverParameters());
+		Fluid::ObstacleField::instance().clear();
+		Fluid::RigidBodies::instance().clear();
+		GenerateGrid();
+
+		settleState.clear();
+		if (bPreSettle)
+		{
+			const bool cached = Fluid::SettledStateCache::instance().settle(preSettleSteps, 1.0f / Fluid::SolverParameters().stepRate);
+			settleState = cached ? " (settled, cached)" : " (settled)";
+		}
+	}
+	else
 	{
-		int localX = i % RowSize;
-		int localY = i / RowSize;
+		scene.apply(description, centre);
+		sceneError = scene.getWarning();
+		settleState.clear();
+		if (description.settleSteps > 0)
+		{
+			settleState = scene.wasSettleCached() ? " (settled, cached)" : " (settled)";
+		}
+	}
+
+	simStep = 1.0 / Fluid::Simulation::getInstance().GetParameters().stepRate;
+	accumulator = 0.0;
+	sleepMode = Fluid::Simulation::getInstance().GetParameters().sleepSteps > 0 ? 1 : 0;
+
+	history.clear();
+	historyStep = 0;
+	history.record(historyStep);
+}
+
+// One fixed step plus what follows it, the emitters and the rewind history
+void StepSimulation()
+{
+	Fluid::Simulation::getInstance().Update((float)simStep);
+	scene.emit((float)simStep);
+	historyStep++;
+	history.record(historyStep);
+}
+
+// Runs a fixed scene for a set number of steps and writes every sample to benchmark.json,
+// compare two of those with BenchCompare to catch regressions
+void RunBenchmark()
+{
+	const int warmupSteps = 30;
+	const int sampleSteps = 200;
+	const float benchStep = 1.0f / 60.0f;
+
+	// The loaded scene from the start, or the default 400 particle grid, compare runs of the same scene only
+	const int savedAmount = ParticleAmmount;
+	const int savedRowSize = RowSize;
+	ParticleAmmount = 400;
+	RowSize = 20;
+	LoadScene(sceneIndex);
+
+	Stats::BenchmarkResult result;
+	result.setInfo("scene", sceneIndex >= 0 ? scene.getDescription().name : std::string("Default grid"));
+	result.setInfo("particles", Fluid::Simulation::getInstance().GetParticleCount());
+	result.setInfo("steps", sampleSteps);
+	result.setInfo("dt", benchStep);
+	result.setInfo("grid_search", Fluid::Simulation::getInstance().GetNeighbourSearch() == Fluid::NeighbourSearch::Grid ? 1.0 : 0.0);
+	result.setInfo("execution_mode", (double)Fluid::Simulation::getInstance().GetExecutionMode());
+	result.setInfo("threads", Fluid::ThreadPool::instance().getThreadCount());
+	result.setInfo("numa_placement", Fluid::Simulation::getInstance().IsNumaPlacement() ? 1.0 : 0.0);
+
+	Fluid::Simulation& simulation = Fluid::Simulation::getInstance();
+	for (int i = 0; i < warmupSteps; i++)
+	{
+		simulation.Update(benchStep);
+		scene.emit(benchStep);
+	}
+
+	Render::ParticleRenderer& particleRenderer = Render::ParticleRenderer::instance();
+	const Render::ColourMode savedMode = particleRenderer.getMode();
+	PixelData* target = PlayGraphics::Instance().GetDrawingBuffer();
+
+	auto timed = [&result](const char* metric, auto&& work)
+	{
+		const uint64_t begin = Stats::Profiler::now();
+		work();
+		result.add(metric, Stats::Profiler::now() - begin);
+	};
+
+	for (int i = 0; i < sampleSteps; i++)
+	{
+		const Fluid::StepStats& stats = simulation.Update(benchStep);
+		scene.emit(benchStep);
+		result.add("Step", stats.totalNanoseconds);
+		for (int p = 0; p < (int)Fluid::StepPhase::Count; p++)
+		{
+			// Phases that are switched off in the solver would only add zeros
+			if (stats.phaseNanoseconds[p] > 0)
+			{
+				const std::string name = std::string("Step.") + Fluid::StepPhaseName((Fluid::StepPhase)p);
+				result.add(name, stats.phaseNanoseconds[p]);
+
+				// Only where the platform has the counters, a memory bound slowdown shows as IPC dropping and misses rising
+				const Stats::CounterSample& counters = simulation.GetPhaseCounters((Fluid::StepPhase)p);
+				if (counters.hasCycles && counters.hasInstructions)
+				{
+					result.addCounter(name + ".ipc", counters.ipc());
+				}
+				if (counters.hasCacheMisses)
+				{
+					result.addCounter(name + ".llc_misses_per_particle", (double)counters.cacheMisses / std::max(1u, simulation.GetParticleCount()));
+				}
+			}
+		}
+
+		// The blit paths all draw into the back buffer, the frame clears it again afterwards
+		const Fluid::ParticleArray<Vector2f>& positions = simulation.GetRenderPositions(1.0f);
+		timed("Blit.Clear", [] { Play::ClearDrawingBuffer(Play::cBlack); });
+		particleRenderer.setMode(Render::ColourMode::Solid);
+		timed("Blit.Particles solid", [&] { particleRenderer.draw(target, positions, PIX_CYAN); });
+		particleRenderer.setMode(Render::ColourMode::Speed);
+		timed("Blit.Particles colour mapped", [&] { particleRenderer.draw(target, positions, PIX_CYAN); });
+		timed("Blit.Surface", [&] { Render::SurfaceRenderer::instance().draw(target, positions, PIX_CYAN); });
+		timed("Blit.Debug text", [] { Play::DrawDebugText({ 10, 10 }, "BENCHMARK 0123456789", Play::cWhite, false); });
+	}
 
-		int XOffset = localX * gap;
-		int YOffset = localY * gap;
+	particleRenderer.setMode(savedMode);
+	ParticleAmmount = savedAmount;
+	RowSize = savedRowSize;
+	LoadScene(sceneIndex);
 
-		int worldOffsetX = (DISPLAY_WIDTH / 2) - ((TotalOffsetFromCenterWidth - gap) / 2.0f);
-		int worldOffsetY = (DISPLAY_HEIGHT / 2) - ((TotalOffsetFromCenterHeight - gap) / 2.0f);
-		int x = worldOffsetX + XOffset;
-		int y = worldOffsetY + YOffset;
+	result.writeJson("benchmark.json");
+}
 
-		uint32_t id = Render::CreateParticle({ x, y });
-		circles.push_back(id);
-		Fluid::Simulation::getInstance().AddCircle(id);
-		size++;
+// Weak scaling of the slab decomposition: the loaded scene, or dam_break_small for the default grid, one copy
+// a process side by side for 1, 2, 4... up to weakScalingProcesses processes, sharing this pool's threads.
+// Writes every sample to weak_scaling.json, flat step times as processes are added mean the exchange keeps up.
+void RunWeakScalingTest()
+{
+	Fluid::SlabRunOptions options;
+	options.sceneFile = sceneIndex >= 0 ? sceneFiles[sceneIndex] : std::string("Data/Scenes/dam_break_small.scene");
+	options.mode = Fluid::Simulation::getInstance().GetExecutionMode();
+	options.threads = Fluid::ThreadPool::instance().getThreadCount();
+
+	Stats::BenchmarkResult result;
+	const bool ran = Fluid::RunWeakScaling(options, weakScalingProcesses, result);
+	if (ran)
+	{
+		result.writeJson("weak_scaling.json");
 	}
+	validationResult = ran ? "Weak scaling: up to " + std::to_string(weakScalingProcesses) + " processes written to weak_scaling.json" : "Weak scaling: FAILED to start";
+	bValidationPassed = ran;
+
+	// The runs leave the tiled scene behind
+	LoadScene(sceneIndex);
 }
 
 // The entry point for a PlayBuffer program
-void MainGameEntry( PLAY_IGNORE_COMMAND_LINE )
+void MainGameEntry( int argc, char* argv[] )
 {
+	// A rank of a weak scaling run, started by RunWeakScalingTest, has no window
+	if (Fluid::RunSlabRankFromCommandLine(argc, argv))
+	{
+		exit(0);
+	}
+
+	FindScenes();
 	GenerateGrid();
 
 	Render::Boundary::instance().resize(400, 400);
 	Render::Boundary::instance().move({ DISPLAY_WIDTH /2, DISPLAY_HEIGHT /2 });
 
 	Play::CreateManager( DISPLAY_WIDTH, DISPLAY_HEIGHT, DISPLAY_SCALE );
+	Render::SurfaceRenderer::instance().resize(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+	Render::StampCache::instance().build(1, 8);
 }
 
 // Called by PlayBuffer every frame (60 times a second!)
 bool MainGameUpdate( float elapsedTime )
 {
-	auto timeStart = std::chrono::steady_clock::now();
+	// Time since the previous frame started, includes the wait for the frame cap
+	dt = elapsedTime;
+	Stats::FrameRecorder& recorder = Stats::FrameRecorder::instance();
+	recorder.record(Stats::Phase::Frame, elapsedTime);
+
 	Play::ClearDrawingBuffer( Play::cBlack );
 
 	//Simulation
@@ -103,92 +418,356 @@ bool MainGameUpdate( float elapsedTime )
 		bPaused = !bPaused;
 	}
 
-	auto timeStartOld = std::chrono::steady_clock::now();
-	if (bPaused && (Play::KeyPressed(0x4E) || Play::KeyDown(0x4D)))
+	// T switches the solver between 60 and 30 steps a second
+	if (Play::KeyPressed(0x54))
 	{
-		Fluid::Simulation::getInstance().Update(dt);
+		simStep = simStep < 1.0 / 45.0 ? 1.0 / 30.0 : 1.0 / 60.0;
+		accumulator = 0.0;
 	}
-	else if (!bPaused)
+
+	auto timeStartOld = std::chrono::steady_clock::now();
+	float alpha = 1.0f;
 	{
-		Fluid::Simulation::getInstance().Update(dt);
+		PROFILE_ZONE("Simulation");
+		if (bPaused && (Play::KeyPressed(0x4E) || Play::KeyDown(0x4D)))
+		{
+			StepSimulation();
+			accumulator = 0.0;
+		}
+		else if (bPaused && (Play::KeyPressed(0x4A) || Play::KeyDown(0x4B)))
+		{
+			// Back through the history, N or M carry on from here and drop the steps after it
+			if (historyStep > history.getFirstStep() && history.restore(historyStep - 1))
+			{
+				historyStep--;
+			}
+			accumulator = 0.0;
+		}
+		else if (!bPaused)
+		{
+			accumulator += dt;
+
+			int steps = 0;
+			while (accumulator >= simStep && steps < maxStepsPerFrame)
+			{
+				StepSimulation();
+				accumulator -= simStep;
+				steps++;
+			}
+
+			// Too far behind, drop the time instead of spiralling
+			if (accumulator >= simStep)
+			{
+				accumulator = 0.0;
+			}
+
+			alpha = (float)(accumulator / simStep);
+		}
 	}
 	auto timeEndOld = std::chrono::steady_clock::now();
 
 	if (Play::KeyPressed(VK_RIGHT))
 	{
 		ParticleAmmount++;
-		GenerateGrid();
+		LoadScene(-1);
 	}
 	if (Play::KeyPressed(VK_LEFT))
 	{
 		ParticleAmmount--;
-		GenerateGrid();
+		LoadScene(-1);
 	}
 	if (Play::KeyPressed(VK_UP))
 	{
 		RowSize++;
-		GenerateGrid();
+		LoadScene(-1);
 	}
 	if (Play::KeyPressed(VK_DOWN))
 	{
 		RowSize--;
-		GenerateGrid();
+		LoadScene(-1);
 	}
 
 	if (Play::KeyPressed(0x52))
 	{
 		dt = 0.016667;
-		GenerateGrid();
+		LoadScene(sceneIndex);
+	}
+
+	if (Play::KeyPressed(0x53))
+	{
+		bPreSettle = !bPreSettle;
+		if (sceneIndex < 0)
+		{
+			LoadScene(-1);
+		}
+	}
+
+	// L steps through the scene files, then back to the default grid
+	if (Play::KeyPressed(0x4C))
+	{
+		FindScenes();
+		LoadScene(sceneIndex + 1 < (int)sceneFiles.size() ? sceneIndex + 1 : -1);
+	}
+
+	if (Play::KeyPressed(0x46))
+	{
+		bDrawSurface = !bDrawSurface;
+	}
+
+	if (Play::KeyPressed(0x43))
+	{
+		Render::ParticleRenderer::instance().cycleMode();
+	}
+
+	// [ and ] change the drawn particle radius
+	if (Play::KeyPressed(0xDB))
+	{
+		Render::ParticleRenderer::instance().setRadius(Render::ParticleRenderer::instance().getRadius() - 1);
+	}
+	if (Play::KeyPressed(0xDD))
+	{
+		Render::ParticleRenderer::instance().setRadius(Render::ParticleRenderer::instance().getRadius() + 1);
+	}
+
+	if (Play::KeyPressed(0x48))
+	{
+		statsWindow = (statsWindow + 1) % (int)recorder.getWindows().size();
+	}
+
+	// P shows the zone timing bar, O writes the captured frames as a Chrome trace
+	if (Play::KeyPressed(0x50))
+	{
+		bShowProfiler = !bShowProfiler;
+	}
+	if (Play::KeyPressed(0x4F))
+	{
+		Stats::Profiler::instance().exportChromeTrace("profile_trace.json");
+	}
+
+	// B runs the benchmark, the scene is reset afterwards
+	if (Play::KeyPressed(0x42))
+	{
+		RunBenchmark();
+		accumulator = 0.0;
+	}
+
+	// G switches between the grid neighbour search and the brute force reference
+	if (Play::KeyPressed(0x47))
+	{
+		Fluid::Simulation& simulation = Fluid::Simulation::getInstance();
+		simulation.SetNeighbourSearch(simulation.GetNeighbourSearch() == Fluid::NeighbourSearch::Grid ? Fluid::NeighbourSearch::Reference : Fluid::NeighbourSearch::Grid);
+	}
+
+	// V checks the accelerated kernels against the reference and writes differential_report.txt
+	if (Play::KeyPressed(0x56))
+	{
+		Fluid::DifferentialTest test({});
+		test.addDefaultScenes();
+		test.run();
+		test.writeReport("differential_report.txt");
+		bValidationPassed = test.passed();
+		validationResult = bValidationPassed ? "Differential test: PASS" : "Differential test: FAIL";
+
+		// The test leaves its last scene behind
+		LoadScene(sceneIndex);
+	}
+
+	// X cycles Serial, Parallel and Deterministic execution
+	if (Play::KeyPressed(0x58))
+	{
+		Fluid::Simulation& simulation = Fluid::Simulation::getInstance();
+		simulation.SetExecutionMode((Fluid::ExecutionMode)(((int)simulation.GetExecutionMode() + 1) % 3));
+	}
+
+	// D hashes the state after N steps at several thread counts and writes determinism_report.txt
+	if (Play::KeyPressed(0x44))
+	{
+		Fluid::DeterminismOptions options;
+		options.threadCounts.push_back(std::thread::hardware_concurrency());
+		Fluid::DeterminismTest test(options);
+		test.run();
+		test.writeReport("determinism_report.txt");
+		bValidationPassed = test.passed();
+		validationResult = bValidationPassed ? "Determinism test: PASS" : "Determinism test: FAIL";
+
+		LoadScene(sceneIndex);
+	}
+
+	// W runs the slab decomposition weak scaling test and writes weak_scaling.json
+	if (Play::KeyPressed(0x57))
+	{
+		RunWeakScalingTest();
+	}
+
+	// U doubles the processes the weak scaling test goes up to
+	if (Play::KeyPressed(0x55))
+	{
+		weakScalingProcesses = weakScalingProcesses >= 16 ? 2 : weakScalingProcesses * 2;
+		validationResult = "Weak scaling: up to " + std::to_string(weakScalingProcesses) + " processes";
+		bValidationPassed = true;
+	}
+
+	// A pins the threads and places the particles on the NUMA node of the thread stepping them
+	if (Play::KeyPressed(0x41))
+	{
+		Fluid::Simulation& simulation = Fluid::Simulation::getInstance();
+		simulation.SetNumaPlacement(!simulation.IsNumaPlacement());
+	}
+
+	// I shows the per phase counters and stats of the last step
+	if (Play::KeyPressed(0x49))
+	{
+		bShowCounters = !bShowCounters;
+	}
+
+	// E starts or stops the step log
+	if (Play::KeyPressed(0x45))
+	{
+		Fluid::Simulation& simulation = Fluid::Simulation::getInstance();
+		if (stepLog.is_open())
+		{
+			simulation.SetStepCallback(nullptr);
+			stepLog.close();
+			validationResult = "Step log: written to step_stats.jsonl";
+			bValidationPassed = true;
+		}
+		else
+		{
+			stepLog.open("step_stats.jsonl", std::ios::out | std::ios::app);
+			if (stepLog)
+			{
+				simulation.SetStepCallback([](const Fluid::StepStats& stats)
+				{
+					stats.writeJson(stepLog);
+					stepLog << '\n';
+				});
+			}
+			validationResult = stepLog ? "Step log: writing step_stats.jsonl" : "Step log: FAILED to open step_stats.jsonl";
+			bValidationPassed = (bool)stepLog;
+		}
+	}
+
+	if (Play::KeyPressed(0x5A))
+	{
+		sleepMode = (sleepMode + 1) % 3;
+		Fluid::Simulation& simulation = Fluid::Simulation::getInstance();
+		Fluid::SolverParameters parameters = simulation.GetParameters();
+		const int steps = sleepMode > 0 ? (parameters.sleepSteps > 0 ? parameters.sleepSteps : defaultSleepSteps) : 0;
+		if (steps != parameters.sleepSteps)
+		{
+			parameters.sleepSteps = steps;
+			simulation.SetParameters(parameters);
+		}
 	}
 
 
 	//Vector2f pos = { Render::GetParticle(22).pos.x, Render::GetParticle(22).pos.y };
 	//Play::DrawFilledCircle(pos, 16.0f, Play::cRed, 0.5f);
-	for (int i = 0; i < circles.size(); i++)
+	auto timeStartRender = std::chrono::steady_clock::now();
 	{
-		Render::particle& p = Render::GetParticle(i);
-		Vector2f pos = { p.pos.x, p.pos.y };
-		Play::FastDrawFilledCircle(pos, Play::cCyan);
+		PROFILE_ZONE("Render");
+		const Fluid::ParticleArray<Vector2f>& positions = Fluid::Simulation::getInstance().GetRenderPositions(alpha);
+		if (sleepMode == 2)
+		{
+			Fluid::Simulation::getInstance().GetSleepRegions().draw();
+		}
+		if (bDrawSurface)
+		{
+			Render::SurfaceRenderer::instance().draw(PlayGraphics::Instance().GetDrawingBuffer(), positions, PIX_CYAN);
+		}
+		else
+		{
+			Render::ParticleRenderer::instance().draw(PlayGraphics::Instance().GetDrawingBuffer(), positions, PIX_CYAN);
+		}
 	}
 	//Play::DrawFilledCircle({ DISPLAY_WIDTH / 2.0f, DISPLAY_HEIGHT / 2.0f }, 10.0f, Play::cWhite, 1.0f);
 
 
 	double elapseOld = std::chrono::duration<double>(timeEndOld - timeStartOld).count();
+	recorder.record(Stats::Phase::Simulation, elapseOld);
 
 	Render::Boundary::instance().draw();
-	if (elapseOld < Min)
-	{
-		Min = elapseOld;
-	}
-	if (elapseOld > Max)
-	{
-		Max = elapseOld;
-	}
+	Fluid::ObstacleField::instance().draw();
+	Fluid::RigidBodies::instance().draw();
 
-	int fps = 1 / dt;
+	// From the median frame interval, a single slow frame should not make the counter jump
+	const Stats::Summary frameSummary = recorder.summary(Stats::Phase::Frame, statsWindow);
+	int fps = frameSummary.p50 > 0.0f ? (int)(1000.0f / frameSummary.p50) : 0;
 	std::string text = "fps: " + std::to_string(fps);
 	std::string textdt = "DT: " + std::to_string(dt);
-	std::string textNew = "Elapsed function: " + std::to_string(elapseOld);
-	std::string textMin = "Min time: " + std::to_string(Min);
-	std::string textMax = "Max time: " + std::to_string(Max);
-	std::string textballs = "Particle Amount: " + std::to_string(ParticleAmmount);
+	std::string textStep = "Sim rate: " + std::to_string((int)std::round(1.0 / simStep)) + " Hz";
+	std::string textballs = "Particle Amount: " + std::to_string(Fluid::Simulation::getInstance().GetParticleCount());
+	char textHistory[96];
+	snprintf(textHistory, sizeof(textHistory), "History: step %llu of %llu - %llu, %u KB, %.1fx", (unsigned long long)historyStep,
+		(unsigned long long)history.getFirstStep(), (unsigned long long)history.getLastStep(), (unsigned)(history.getBytes() / 1024), history.getCompressionRatio());
+	std::string textScene = (sceneIndex >= 0 ? "Scene: " + scene.getDescription().name : "Scene: Default grid") + settleState;
 	std::string textPaused = (bPaused == true) ? "Paused" : "Running";
+	std::string textRender = bDrawSurface ? "Render: Surface" : "Render: Particles";
+	std::string textSearch = Fluid::Simulation::getInstance().GetNeighbourSearch() == Fluid::NeighbourSearch::Grid ? "Neighbours: Grid" : "Neighbours: Reference";
+	if (sleepMode > 0)
+	{
+		textSearch += "  Sleeping: " + std::to_string(Fluid::Simulation::getInstance().GetLastStepStats().sleepingParticles);
+	}
+	const char* executionNames[] = { "Serial", "Parallel", "Deterministic" };
+	std::string textExecution = "Execution: " + std::string(executionNames[(int)Fluid::Simulation::getInstance().GetExecutionMode()]);
+	if (Fluid::Simulation::getInstance().GetExecutionMode() != Fluid::ExecutionMode::Serial)
+	{
+		textExecution += " (" + std::to_string(Fluid::ThreadPool::instance().getThreadCount()) + " threads"
+			+ (Fluid::Simulation::getInstance().IsNumaPlacement() ? ", pinned)" : ")");
+	}
+	const Render::ParticleRenderer& particleRenderer = Render::ParticleRenderer::instance();
+	std::string textColour = "Colour: " + std::string(particleRenderer.getModeName());
+	if (particleRenderer.getMode() != Render::ColourMode::Solid)
+	{
+		textColour += " (" + std::to_string(particleRenderer.getRangeMin()) + " - " + std::to_string(particleRenderer.getRangeMax()) + ")";
+	}
 
 	Play::DrawDebugText({ 10, 10 }, text.c_str(), fps < 25 ? Play::cRed : Play::cWhite, false);
 	Play::DrawDebugText({ 10, 25 }, textdt.c_str(), fps < 25 ? Play::cRed : Play::cWhite, false);
+	Play::DrawDebugText({ 10, 40 }, textStep.c_str(), Play::cWhite, false);
 
-	Play::DrawDebugText({ 10, DISPLAY_HEIGHT - 25 }, textNew.c_str(), fps < 25 ? Play::cRed : Play::cWhite, false);
-	Play::DrawDebugText({ 225, DISPLAY_HEIGHT - 25 }, textMin.c_str(), fps < 25 ? Play::cRed : Play::cWhite, false);
-	Play::DrawDebugText({ 400, DISPLAY_HEIGHT - 25 }, textMax.c_str(), fps < 25 ? Play::cRed : Play::cWhite, false);
+	{
+		PROFILE_ZONE("Overlay");
+		recorder.drawOverlay({ 10, DISPLAY_HEIGHT - 100 }, statsWindow);
+		if (bShowProfiler)
+		{
+			Stats::Profiler::instance().drawTimingBar({ 10, DISPLAY_HEIGHT - 140 }, { 400, 20 });
+		}
+		if (bShowCounters)
+		{
+			DrawPhaseCounters({ DISPLAY_WIDTH - 520, 245 });
+		}
+	}
 	Play::DrawDebugText({ DISPLAY_WIDTH - 300, 10 }, textballs.c_str(), Play::cWhite, false);
 	Play::DrawDebugText({ DISPLAY_WIDTH - 300, 35 }, textPaused.c_str(), bPaused ? Play::cRed : Play::cGreen, false);
+	Play::DrawDebugText({ DISPLAY_WIDTH - 300, 60 }, textRender.c_str(), Play::cWhite, false);
+	Play::DrawDebugText({ DISPLAY_WIDTH - 300, 85 }, textColour.c_str(), Play::cWhite, false);
+	Play::DrawDebugText({ DISPLAY_WIDTH - 300, 110 }, textSearch.c_str(), Play::cWhite, false);
+	Play::DrawDebugText({ DISPLAY_WIDTH - 300, 135 }, textExecution.c_str(), Play::cWhite, false);
+	Play::DrawDebugText({ DISPLAY_WIDTH - 300, 160 }, textScene.c_str(), Play::cWhite, false);
+	Play::DrawDebugText({ DISPLAY_WIDTH - 300, 185 }, textHistory, Play::cWhite, false);
+	if (!validationResult.empty())
+	{
+		Play::DrawDebugText({ DISPLAY_WIDTH - 300, 210 }, validationResult.c_str(), bValidationPassed ? Play::cGreen : Play::cRed, false);
+	}
+	if (!sceneError.empty())
+	{
+		Play::DrawDebugText({ 10, 70 }, sceneError.c_str(), Play::cRed, false);
+	}
 
 	Play::DrawDebugText({ DISPLAY_WIDTH / 2, 10 }, "Fluid Simulation By Alexander Marklund (Allkams)!");
 	Play::DrawDebugText({ DISPLAY_WIDTH / 2, 25 }, "Created with Playbuffer");
 
-	Play::PresentDrawingBuffer();
+	auto timeStartPresent = std::chrono::steady_clock::now();
+	recorder.record(Stats::Phase::Render, std::chrono::duration<double>(timeStartPresent - timeStartRender).count());
+
+	{
+		PROFILE_ZONE("Present");
+		Play::PresentDrawingBuffer();
+	}
 	auto timeEnd = std::chrono::steady_clock::now();
-	dt = std::chrono::duration<double>(timeEnd - timeStart).count();
+	recorder.record(Stats::Phase::Present, std::chrono::duration<double>(timeEnd - timeStartPresent).count());
+	Stats::Profiler::instance().endFrame();
 
 	return Play::KeyDown( VK_ESCAPE );
 }
@@ -196,6 +775,10 @@ bool MainGameUpdate( float elapsedTime )
 // Gets called once when the player quits the game 
 int MainGameExit( void )
 {
+	Stats::FrameRecorder::instance().dumpCsv("frame_times.csv");
+	Stats::FrameRecorder::instance().dumpJson("frame_times.json");
+	Stats::Profiler::instance().exportChromeTrace("profile_trace.json");
+
 	Play::DestroyManager();
 	return PLAY_OK;
 }
@@ -3,6 +3,10 @@
 #include "Simulation.h"
 #include "math.h"
 #include "boundary.h"
+#include "profiler.h"
+#include "threadPool.h"
+#include "numaTopology.h"
+#include <algorithm>
 
 namespace Fluid
 {
@@ -23,93 +27,578 @@ namespace Fluid
 	// - Resolve collisions
 	// - For each particle, use prev position and curret to compute next velocity.
 
-	void Simulation::Update(float deltatime)
+	const StepStats& Simulation::Update(float deltatime)
 	{
+		PROFILE_ZONE("Step");
+		const uint64_t stepBegin = Stats::Profiler::now();
 		//updateNeighbours();
 
-		const float dampFactor = 0.95f;
-		std::vector<Vector2f> prevPositons;
-		for (int i = 0; i < circleIDs.size(); i++)
+		for (Stats::CounterSample& counters : phaseCounters)
 		{
-			Render::particle& particle = Render::GetParticle(i);
-			particle.vel.y += 40.0f * 0.01667f;
+			counters.clear();
+		}
+		Render::Boundary::instance().advance(deltatime);
+		periodic = Render::Boundary::instance().getPeriodic();
+		if (pager.needsSort(circleCount))
+		{
+			sortIntoBands();
 		}
+		pager.stepped();
+		sleepRegions.begin(circleCount, getSleepSteps(), periodic);
+		const bool sleeping = sleepRegions.any();
 
-		//applyViscosity(0.01667f);
+		if (executionMode != ExecutionMode::Serial)
+		{
+			const uint32_t threads = IsNumaPlacement() ? ThreadPool::instance().getThreadCount() : 0;
+			threadParticles.assign(threads, 0);
+			threadNanoseconds.assign(threads, 0);
+			stepParallel(deltatime);
+			sleepRegions.end(circleCount, prevPositions, parameters.sleepDistance, getSleepSteps());
+			finishStepStats(deltatime, stepBegin);
+			return lastStepStats;
+		}
 
-		for (int i = 0; i < circleIDs.size(); i++)
 		{
-			Render::particle& particle = Render::GetParticle(i);
-			prevPositons.push_back(particle.pos);
-			particle.pos += 0.01667f * particle.vel;
+			PROFILE_ZONE("Gravity");
+			Stats::ScopedCounters counters(phaseCounters[(int)StepPhase::Gravity]);
+			pager.beginSweep();
+			for (int i = 0; i < circleCount; i++)
+			{
+				pager.reach(i);
+				if (sleeping && sleepRegions.isAsleep(i))
+				{
+					continue;
+				}
+				Render::particle& particle = Render::GetParticle(i);
+				particle.vel.y += parameters.gravity * deltatime;
+			}
+		}
 
+		//applyViscosity(deltatime);
+
+		// Kept after the step so the renderer can blend between this and the new position
+		{
+			PROFILE_ZONE("Predict");
+			Stats::ScopedCounters counters(phaseCounters[(int)StepPhase::Predict]);
+			prevPositions.resize(circleCount);
+			pager.beginSweep();
+			for (int i = 0; i < circleCount; i++)
+			{
+				pager.reach(i);
+				Render::particle& particle = Render::GetParticle(i);
+				prevPositions[i] = particle.pos;
+				if (!sleeping || !sleepRegions.isAsleep(i))
+				{
+					particle.pos += deltatime * particle.vel;
+				}
+			}
+			RigidBodies::instance().predict(deltatime, parameters.gravity);
 		}
 
-		//springAdjustment(0.01667f);
-		//springDisplacement(0.01667f);
-		doubleDensityRelaxation(0.01667f);
+		//springAdjustment(deltatime);
+		//springDisplacement(deltatime);
+		doubleDensityRelaxation(deltatime);
 
 		//Collision towards boundaries
-		for (int i = 0; i < circleIDs.size(); i++)
 		{
-			Render::particle& particle = Render::GetParticle(i);
+			PROFILE_ZONE("Collisions");
+			Stats::ScopedCounters counters(phaseCounters[(int)StepPhase::Collisions]);
+			collideBodies(deltatime);
+			uint32_t collisions = 0;
+			float energy = 0.0f;
+			pager.beginSweep();
+			for (int i = 0; i < circleCount; i++)
+			{
+				pager.reach(i);
+				if (sleeping && sleepRegions.isAsleep(i))
+				{
+					continue;
+				}
+				Render::particle& particle = Render::GetParticle(i);
+				collisions += resolveBoundary(particle, prevPositions[i], deltatime) ? 1 : 0;
+				energy += 0.5f * dot(particle.vel, particle.vel);
+			}
+			StepCounters::local().boundaryCollisions += collisions;
+			kineticEnergy = energy;
+		}
+
+		sleepRegions.end(circleCount, prevPositions, parameters.sleepDistance, getSleepSteps());
+		finishStepStats(deltatime, stepBegin);
+		return lastStepStats;
+	}
+
+	bool Simulation::resolveBoundary(Render::particle& particle, const Vector2f& prevPos, float dt) const
+	{
+		const float dampFactor = parameters.wallDamping;
+
+		particle.vel = (particle.pos - prevPos) / dt;
+		particle.vel *= parameters.velocityDamping;
 
-			particle.vel = (particle.pos - prevPositons[i]) / 0.01667f;
-			particle.vel *= 0.99f;
+		// Obstacles first, one lookup in the baked distance field however many there are
+		const float radius = parameters.particleRadius;
+		const ObstacleField& obstacles = ObstacleField::instance();
+		bool collided = obstacles.isBaked() && obstacles.collide(particle.pos, particle.vel, radius, dampFactor);
 
-			// Collision resolver, simple edition
-			Point2D& topLeft = Render::Boundary::instance().getTopLeft();
-			Point2D& bottomRight = Render::Boundary::instance().getBottomRight();
-			if (particle.pos.x - 4 < topLeft.x)
+		if (Render::Boundary::instance().isMoving())
+		{
+			return resolveMovingBoundary(particle, prevPos, dt) || collided;
+		}
+
+		// Collision resolver, simple edition
+		Point2D& topLeft = Render::Boundary::instance().getTopLeft();
+		Point2D& bottomRight = Render::Boundary::instance().getBottomRight();
+		if (!periodic.x && particle.pos.x - radius < topLeft.x)
+		{
+			particle.pos.x = topLeft.x + radius;
+			particle.vel.x = -particle.vel.x * dampFactor;
+			collided = true;
+		}
+		else if (!periodic.x && particle.pos.x + radius >= bottomRight.x)
+		{
+			particle.pos.x = bottomRight.x - radius;
+			particle.vel.x = -particle.vel.x * dampFactor;
+			collided = true;
+		}
+
+		if (!periodic.y && particle.pos.y - radius < topLeft.y)
+		{
+			particle.pos.y = topLeft.y + radius;
+			particle.vel.y = -particle.vel.y * dampFactor;
+			collided = true;
+		}
+		else if (!periodic.y && particle.pos.y + radius >= bottomRight.y)
+		{
+			particle.pos.y = bottomRight.y - radius;
+			particle.vel.y = -particle.vel.y * dampFactor;
+			collided = true;
+		}
+
+		// Through a wrapped side and back in at the other, not a collision
+		periodic.wrap(particle.pos);
+
+		return collided;
+	}
+
+	// The walls stand still in the box's own frame, so the particle's path relative to them runs from its
+	// previous position in the box as it was to its new position in the box as it is. Clipping that path
+	// at the first wall it crosses works however far the box or the particle moved in the step, and the
+	// velocity bounces relative to the wall, so a wall moving into the fluid pushes it along.
+	bool Simulation::resolveMovingBoundary(Render::particle& particle, const Vector2f& prevPos, float dt) const
+	{
+		const Render::Boundary& boundary = Render::Boundary::instance();
+		const float dampFactor = parameters.wallDamping;
+		const float radius = parameters.particleRadius;
+		const Vector2f half = boundary.getHalfSize();
+		const float low[2] = { radius - half.x, radius - half.y };
+		const float high[2] = { half.x - radius, half.y - radius };
+
+		const Vector2f startLocal = boundary.toPreviousLocal(prevPos);
+		const Vector2f endLocal = boundary.toLocal(particle.pos);
+		float start[2] = { startLocal.x, startLocal.y };
+		float end[2] = { endLocal.x, endLocal.y };
+		// A particle left outside by a resize starts from the nearest point inside
+		for (int axis = 0; axis < 2; axis++)
+		{
+			start[axis] = std::max(low[axis], std::min(high[axis], start[axis]));
+		}
+
+		// -1 against the low wall of an axis, 1 against the high one
+		int hit[2] = { 0, 0 };
+		for (int bounce = 0; bounce < 2; bounce++)
+		{
+			float first = 1.0f;
+			int hitAxis = -1;
+			float wall = 0.0f;
+			for (int axis = 0; axis < 2; axis++)
 			{
-				particle.pos.x = topLeft.x + 4;
-				particle.vel.x = -particle.vel.x * dampFactor;
+				const float bound = end[axis] < low[axis] ? low[axis] : (end[axis] > high[axis] ? high[axis] : end[axis]);
+				if (bound == end[axis])
+				{
+					continue;
+				}
+				const float t = (bound - start[axis]) / (end[axis] - start[axis]);
+				if (hitAxis < 0 || t < first)
+				{
+					first = t;
+					hitAxis = axis;
+					wall = bound;
+				}
 			}
-			else if (particle.pos.x + 4 >= bottomRight.x)
+			if (hitAxis < 0)
 			{
-				particle.pos.x = bottomRight.x - 4;
-				particle.vel.x = -particle.vel.x * dampFactor;
+				break;
 			}
 
-			if (particle.pos.y - 4 < topLeft.y)
-			{
-				particle.pos.y = topLeft.y + 4;
-				particle.vel.y = -particle.vel.y * dampFactor;
-			}
-			else if (particle.pos.y + 4 >= bottomRight.y)
+			// Onto the wall where it crossed, then on along the wall with whatever motion is left
+			for (int axis = 0; axis < 2; axis++)
 			{
-				particle.pos.y = bottomRight.y - 4;
-				particle.vel.y = -particle.vel.y * dampFactor;
+				start[axis] += (end[axis] - start[axis]) * first;
 			}
+			start[hitAxis] = wall;
+			end[hitAxis] = wall;
+			hit[hitAxis] = wall == low[hitAxis] ? -1 : 1;
+		}
+
+		if (hit[0] == 0 && hit[1] == 0)
+		{
+			return false;
+		}
+
+		const Vector2f local = { end[0], end[1] };
+		const Vector2f wallVelocity = (boundary.toWorld(local) - boundary.toPreviousWorld(local)) / dt;
+		const float c = std::cos(boundary.getAngle());
+		const float s = std::sin(boundary.getAngle());
+		const Vector2f relative = particle.vel - wallVelocity;
+		Vector2f bounced = { c * relative.x + s * relative.y, -s * relative.x + c * relative.y };
+		// Only what is still heading into the wall bounces
+		if (hit[0] * bounced.x > 0.0f)
+		{
+			bounced.x = -bounced.x * dampFactor;
+		}
+		if (hit[1] * bounced.y > 0.0f)
+		{
+			bounced.y = -bounced.y * dampFactor;
+		}
+
+		particle.pos = boundary.toWorld(local);
+		particle.vel = Vector2f(c * bounced.x - s * bounced.y, s * bounced.x + c * bounced.y) + wallVelocity;
+		return true;
+	}
+
+	// Before the per particle collisions, so a particle a body pushed gets its velocity from the push
+	// and the walls still have the last word
+	void Simulation::collideBodies(float dt)
+	{
+		RigidBodies& bodies = RigidBodies::instance();
+		if (bodies.isEmpty())
+		{
+			return;
+		}
+
+		PROFILE_ZONE("Bodies");
+		const uint32_t count = circleCount;
+		// The grid from the relaxation, unless the serial reference search never built one
+		if (executionMode == ExecutionMode::Serial && neighbourSearch == NeighbourSearch::Reference)
+		{
+			neighbourGrid.build(count, interactionRadius, periodic);
+		}
+		StepCounters::local().bodyContacts += bodies.collideParticles(neighbourGrid, count, parameters.particleRadius, interactionRadius, executionMode != ExecutionMode::Serial);
+		bodies.solve(dt, parameters.velocityDamping);
+	}
+
+	void Simulation::finishStepStats(float dt, uint64_t stepBegin)
+	{
+		StepCounters counters;
+		StepCounters::mergeAndClear(counters);
+
+		StepStats& stats = lastStepStats;
+		stats.step = stepIndex++;
+		stats.dt = dt;
+		stats.particles = circleCount;
+		stats.candidatePairs = counters.candidatePairs;
+		stats.pairsInRadius = counters.pairsInRadius;
+		stats.averageNeighbours = stats.particles > 0 ? (float)counters.pairsInRadius / stats.particles : 0.0f;
+		stats.maxNeighbours = counters.maxNeighbours;
+		stats.springsCreated = counters.springsCreated;
+		stats.springsBroken = counters.springsBroken;
+		stats.springCount = (uint32_t)springPairs.size();
+		stats.boundaryCollisions = counters.boundaryCollisions;
+		stats.bodyContacts = counters.bodyContacts;
+		stats.kineticEnergy = kineticEnergy;
+		stats.threads = executionMode == ExecutionMode::Serial ? 1 : ThreadPool::instance().getThreadCount();
+
+		for (int p = 0; p < (int)StepPhase::Count; p++)
+		{
+			stats.phaseNanoseconds[p] = phaseCounters[p].nanoseconds;
+		}
+		stats.totalNanoseconds = Stats::Profiler::now() - stepBegin;
+
+		stats.arenaBytes = springPairs.capacity() * sizeof(SpringPair)
+			+ prevPositions.capacity() * sizeof(Vector2f)
+			+ renderPositions.capacity() * sizeof(Vector2f)
+			+ neighbourGrid.getMemoryBytes();
+		stats.gridChunks = neighbourGrid.getChunkCount();
+		stats.sleepingParticles = sleepRegions.getSleepingParticles();
+		stats.pagedBytes = Render::GetPagedParticleBytes();
+		pager.takeCounts(stats.pagesPrefetched, stats.pagesReleased);
+		measurePlacement(stats);
+
+		if (stepCallback)
+		{
+			stepCallback(stats);
 		}
 	}
 
 	void Simulation::AddCircle(uint32_t cID)
 	{
-		circleIDs.push_back(cID);
+		// Ids are the store's indices, the particles are the first circleCount of it
+		circleCount++;
+	}
+
+	void Simulation::AddCircles(uint32_t first, uint32_t count)
+	{
+		circleCount += count;
 	}
 
 	void Simulation::ClearData()
 	{
-		circleIDs.clear();
+		circleCount = 0;
 		springPairs.clear();
 		neighbourList.clear();
+		prevPositions.clear();
+		lastStepStats = StepStats();
+		stepIndex = 0;
+		sleepRegions.wakeAll();
+		// Runs of the same scene sort on the same steps
+		pager.reset();
+	}
+
+	bool Simulation::SetPaging(const std::string& directory, size_t residentBytes)
+	{
+		// The scratch file takes the store over from placed pages
+		if (!directory.empty())
+		{
+			SetNumaPlacement(false);
+		}
+		const bool paged = Render::SetParticlePaging(directory);
+		pager.setEnabled(Render::IsParticlePaging(), residentBytes);
+		return paged;
+	}
+
+	bool Simulation::SetNumaPlacement(bool place)
+	{
+		if (!Render::SetParticlePlacement(place))
+		{
+			return false;
+		}
+		ThreadPool::instance().setPinned(place);
+		pager.setBanded(place);
+		return true;
+	}
+
+	void Simulation::measurePlacement(StepStats& stats) const
+	{
+		stats.numaNodes = 0;
+		stats.remotePageFraction = -1.0f;
+		std::fill(std::begin(stats.nodeParticlesPerSecond), std::end(stats.nodeParticlesPerSecond), 0.0f);
+		if (!IsNumaPlacement() || executionMode == ExecutionMode::Serial || threadParticles.size() != ThreadPool::instance().getThreadCount())
+		{
+			return;
+		}
+
+		// Particles a second of chunk time, per node the threads on it ran on
+		const ThreadPool& pool = ThreadPool::instance();
+		stats.numaNodes = std::min<uint32_t>(NumaTopology::instance().getNodeCount(), StepStats::maxNumaNodes);
+		uint64_t nodeParticles[StepStats::maxNumaNodes] = {};
+		uint64_t nodeNanoseconds[StepStats::maxNumaNodes] = {};
+		for (uint32_t thread = 0; thread < (uint32_t)threadParticles.size(); thread++)
+		{
+			const uint32_t node = std::min<uint32_t>(pool.getThreadNode(thread), StepStats::maxNumaNodes - 1);
+			nodeParticles[node] += threadParticles[thread];
+			nodeNanoseconds[node] += threadNanoseconds[thread];
+		}
+		for (uint32_t node = 0; node < stats.numaNodes; node++)
+		{
+			stats.nodeParticlesPerSecond[node] = nodeNanoseconds[node] > 0 ? (float)(nodeParticles[node] * 1e9 / nodeNanoseconds[node]) : 0.0f;
+		}
+
+		// A sample of the particle pages, each against the node of the thread whose chunk starts on it
+		const uint32_t count = circleCount;
+		const uint32_t samples = std::min(count, placementSamples);
+		const size_t pageSize = NumaTopology::getPageSize();
+		const uint32_t chunk = getChunkSize();
+		const uint32_t chunks = (count + chunk - 1) / chunk;
+		const void* pages[placementSamples];
+		int pageNodes[placementSamples];
+		uint32_t owners[placementSamples];
+		for (uint32_t i = 0; i < samples; i++)
+		{
+			const uint32_t particle = (uint32_t)((uint64_t)i * count / samples);
+			pages[i] = (const void*)((uintptr_t)&Render::GetParticle(particle) & ~(uintptr_t)(pageSize - 1));
+			owners[i] = pool.getChunkThread(particle / chunk, chunks);
+		}
+		if (samples == 0 || !NumaTopology::queryPageNodes(pages, samples, pageNodes))
+		{
+			return;
+		}
+		// The pages come back with the OS's node numbers
+		const NumaTopology& topology = NumaTopology::instance();
+		uint32_t known = 0;
+		uint32_t remote = 0;
+		for (uint32_t i = 0; i < samples; i++)
+		{
+			if (pageNodes[i] >= 0)
+			{
+				known++;
+				remote += pageNodes[i] != topology.getNodeId(pool.getThreadNode(owners[i])) ? 1 : 0;
+			}
+		}
+		stats.remotePageFraction = known > 0 ? (float)remote / known : -1.0f;
+	}
+
+	void Simulation::sortIntoBands()
+	{
+		PROFILE_ZONE("Sort");
+		const uint32_t count = circleCount;
+		pager.sort(count, interactionRadius, periodic, pagingDestination);
+		moveParticles(pagingDestination.data(), count);
+	}
+
+	bool Simulation::ReorderParticles(const uint32_t* order, uint32_t count)
+	{
+		if (count != circleCount)
+		{
+			return false;
+		}
+		// Unfilled slots double as the seen marks, the store's reorders trust their permutation
+		const uint32_t unseen = ~0u;
+		std::vector<uint32_t> destination(count, unseen);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			if (order[i] >= count || destination[order[i]] != unseen)
+			{
+				return false;
+			}
+			destination[order[i]] = i;
+		}
+		return moveParticles(destination.data(), count);
+	}
+
+	bool Simulation::moveParticles(const uint32_t* destination, uint32_t count)
+	{
+		if (count != circleCount || !Render::ReorderParticles(destination, count))
+		{
+			return false;
+		}
+		for (SpringPair& pair : springPairs)
+		{
+			pair.index1 = destination[pair.index1];
+			pair.index2 = destination[pair.index2];
+		}
+		sleepRegions.reorder(destination, count);
+		// Or a frame drawn before the next step would blend each particle from another's old place
+		if (prevPositions.size() == count)
+		{
+			prevPositions.reorder(destination, count, reorderMoves);
+		}
+		particleOrder++;
+		return true;
+	}
+
+	void Simulation::TruncateParticles(uint32_t count)
+	{
+		if (count >= circleCount)
+		{
+			return;
+		}
+
+		Render::TruncateParticles(count);
+		circleCount = count;
+		prevPositions.resize(std::min<size_t>(prevPositions.size(), count));
+		springPairs.erase(std::remove_if(springPairs.begin(), springPairs.end(), [count](const SpringPair& pair)
+		{
+			return pair.index1 >= count || pair.index2 >= count;
+		}), springPairs.end());
+		particleOrder++;
+	}
+
+	int Simulation::getSleepSteps() const
+	{
+		// The reference loops stay the plain original step
+		if (executionMode == ExecutionMode::Serial && neighbourSearch == NeighbourSearch::Reference)
+		{
+			return 0;
+		}
+		return parameters.sleepSteps;
+	}
+
+	const ParticleArray<Vector2f>& Simulation::GetRenderPositions(float alpha)
+	{
+		renderPositions.resize(circleCount);
+
+		// Nothing to blend from until the first step after a reset
+		if (prevPositions.size() != circleCount)
+		{
+			for (int i = 0; i < circleCount; i++)
+			{
+				renderPositions[i] = Render::GetParticle(i).pos;
+			}
+			return renderPositions;
+		}
+
+		// A particle that wrapped blends the short way through the edge, not back across the box
+		if (periodic.any())
+		{
+			for (int i = 0; i < circleCount; i++)
+			{
+				Vector2f blended = prevPositions[i] + periodic.minimumImage(Render::GetParticle(i).pos - prevPositions[i]) * alpha;
+				periodic.wrap(blended);
+				renderPositions[i] = blended;
+			}
+			return renderPositions;
+		}
+
+		for (int i = 0; i < circleCount; i++)
+		{
+			const Vector2f& current = Render::GetParticle(i).pos;
+			renderPositions[i] = prevPositions[i] + (current - prevPositions[i]) * alpha;
+		}
+		return renderPositions;
 	}
 
 	double distance(const Render::particle& p1, const Render::particle& p2) {
 		return std::sqrt((p1.pos.x - p2.pos.x) * (p1.pos.x - p2.pos.x) + (p1.pos.y - p2.pos.y) * (p1.pos.y - p2.pos.y));
 	}
 
+	// From one particle to the other, to the nearest copy of it on wrapped axes
+	static Vector2f separation(const Render::particle& from, const Render::particle& to, const Render::PeriodicDomain& periodic)
+	{
+		return periodic.any() ? periodic.minimumImage(to.pos - from.pos) : to.pos - from.pos;
+	}
+
+	// Every pairwise kernel measures through here, so a periodic box sees neighbours across its edges
+	static double distance(const Render::particle& p1, const Render::particle& p2, const Render::PeriodicDomain& periodic)
+	{
+		return periodic.any() ? (double)separation(p1, p2, periodic).Length() : distance(p1, p2);
+	}
+
+	static Vector2f relaxationDisplacement(float dt, float P, float pNear, const Vector2f& q)
+	{
+		// Coincident particles have no direction to push along
+		if (q.x == 0.0f && q.y == 0.0f)
+		{
+			return { 0.0f, 0.0f };
+		}
+		Vector2f qN = q;
+		qN.Normalize();
+		return (dt * dt) * (P * (Vector2f(1, 1) - q) + pNear * ((Vector2f(1, 1) - q) * (Vector2f(1, 1) - q))) * qN;
+	}
+
 	void Simulation::applyViscosity(float dt)
+	{
+		PROFILE_ZONE("Viscosity");
+		Stats::ScopedCounters counters(phaseCounters[(int)StepPhase::Viscosity]);
+		if (neighbourSearch == NeighbourSearch::Reference)
+		{
+			applyViscosityReference(dt);
+		}
+		else
+		{
+			applyViscosityGrid(dt);
+		}
+	}
+
+	// Brute force O(n^2), kept as the reference the accelerated kernels are checked against
+	void Simulation::applyViscosityReference(float dt)
 	{
 		const float alfa = 10.0f;
 		const float beta = 0.0f;
 
-		for (int i = 0; i < circleIDs.size(); i++)
+		for (int i = 0; i < circleCount; i++)
 		{
 			//auto it = neighbourList.find(i);
 			Render::particle& particle = Render::GetParticle(i);
-			for (int j = i + 1; j < circleIDs.size(); j++)
+			for (int j = i + 1; j < circleCount; j++)
 			{
 				if (i == j)
 				{
@@ -118,11 +607,11 @@ namespace Fluid
 				Render::particle& neighbour = Render::GetParticle(j);
 
 				//const float distance = distance;
-				const float influense = distance(particle, neighbour) / interactionRadius;
+				const float influense = distance(particle, neighbour, periodic) / interactionRadius;
 
 				if (influense <= 1)
 				{
-					const Vector2f q = (neighbour.pos - particle.pos) / interactionRadius;
+					const Vector2f q = separation(particle, neighbour, periodic) / interactionRadius;
 					Vector2f qN = q;
 					qN.Normalize();
 
@@ -165,17 +654,32 @@ namespace Fluid
 	}
 
 	void Simulation::springAdjustment(float dt)
+	{
+		PROFILE_ZONE("Spring adjustment");
+		Stats::ScopedCounters counters(phaseCounters[(int)StepPhase::SpringAdjustment]);
+		if (neighbourSearch == NeighbourSearch::Reference)
+		{
+			springAdjustmentReference(dt);
+		}
+		else
+		{
+			springAdjustmentGrid(dt);
+		}
+	}
+
+	// Brute force O(n^2), kept as the reference the accelerated kernels are checked against
+	void Simulation::springAdjustmentReference(float dt)
 	{
 		const float yieldRatio = 0.2f;
 		const float Stretch = 0.3f;
 		const float Compress = 0.3f;
 		const Vector2f L = {16.0f,16.0f};
 
-		for (uint32_t i = 0; i < circleIDs.size(); i++)
+		for (uint32_t i = 0; i < circleCount; i++)
 		{
 			Render::particle& particle = Render::GetParticle(i);
 
-			for (uint32_t j = 0; j < circleIDs.size(); j++)
+			for (uint32_t j = 0; j < circleCount; j++)
 			{
 				if (i == j)
 				{
@@ -185,7 +689,7 @@ namespace Fluid
 				Render::particle& neighbour = Render::GetParticle(j);
 				
 
-				float dist = distance(particle, neighbour);
+				float dist = distance(particle, neighbour, periodic);
 				const float influense = dist / interactionRadius;
 
 				if (influense <= 1)
@@ -196,6 +700,7 @@ namespace Fluid
 					int id = getPairID(springPairs, pairToInsert);
   					if (id == -1) {
 						springPairs.push_back(pairToInsert);
+						StepCounters::local().springsCreated++;
 						//id = springPairs.size() - 1;
 						continue;
 					}
@@ -223,41 +728,67 @@ namespace Fluid
 			}
 		}
 
+		removeBrokenSprings();
+	}
+
+	void Simulation::removeBrokenSprings()
+	{
 		for (auto it = springPairs.begin(); it != springPairs.end();)
 		{
 			if (it->restSpring.x > interactionRadius && it->restSpring.y > interactionRadius)
 			{
 				it = springPairs.erase(it);
+				StepCounters::local().springsBroken++;
 				continue;
 			}
 			
 			++it;
 		}
-
 	}
 
 	void Simulation::doubleDensityRelaxation(float dt)
 	{
-		const float pressureMultiplier = 4.0f; // Adjust as needed
-		const float pressureNearMultiplier = 16.0f; // Adjust as needed
+		PROFILE_ZONE("Relaxation");
+		Stats::ScopedCounters counters(phaseCounters[(int)StepPhase::Relaxation]);
+		if (neighbourSearch == NeighbourSearch::Reference)
+		{
+			doubleDensityRelaxationReference(dt);
+		}
+		else
+		{
+			doubleDensityRelaxationGrid(dt);
+		}
+	}
+
+	// Brute force O(n^2), kept as the reference the accelerated kernels are checked against
+	void Simulation::doubleDensityRelaxationReference(float dt)
+	{
+		const float pressureMultiplier = parameters.pressure;
+		const float pressureNearMultiplier = parameters.nearPressure;
+		StepCounters& stepCounters = StepCounters::local();
 
-		for (int i = 0; i < circleIDs.size(); i++)
+		for (int i = 0; i < circleCount; i++)
 		{
 			Render::particle& particle = Render::GetParticle(i);
 
 			float d = 0.0f;
 			float dNear = 0.0f;
+			uint32_t candidates = 0;
+			uint32_t neighbours = 0;
 
-			for (int j = 0; j < circleIDs.size(); j++)
+			for (int j = 0; j < circleCount; j++)
 			{
 				if (j == i)
 					continue;
 
+				candidates++;
 				Render::particle& neighbour = Render::GetParticle(j);
-				float dist = distance(particle, neighbour);
+				float dist = distance(particle, neighbour, periodic);
 				if (dist > interactionRadius)
 					continue;
 
+				neighbours++;
+
 				const float influense = dist / interactionRadius;
 
 				if (influense <= 1.0f)
@@ -267,26 +798,39 @@ namespace Fluid
 				}
 			}
 
-			const float P = pressureMultiplier * (d - 50.0f);
+			stepCounters.candidatePairs += candidates;
+			stepCounters.pairsInRadius += neighbours;
+			stepCounters.maxNeighbours = std::max(stepCounters.maxNeighbours, neighbours);
+
+			const float P = pressureMultiplier * (d - parameters.restDensity);
 			const float pNear = pressureNearMultiplier * dNear;
 
+			// Kept on the particle for the colour mapped renderer
+			particle.d = d;
+			particle.dNear = dNear;
+			particle.p = P;
+
 			Vector2f dx = { 0, 0 };
 
-			for (int j = 0; j < circleIDs.size(); j++)
+			for (int j = 0; j < circleCount; j++)
 			{
 				if (j == i)
 					continue;
 
 				Render::particle& neighbour = Render::GetParticle(j);
 
-				const float dist = distance(particle, neighbour);
+				const float dist = distance(particle, neighbour, periodic);
 
 				if (dist > interactionRadius)
 					continue;
 
-				const Vector2f q = (neighbour.pos - particle.pos) / interactionRadius;
+				const Vector2f q = separation(particle, neighbour, periodic) / interactionRadius;
 				Vector2f qN = q;
-				qN.Normalize();
+				// Coincident particles have no direction to push along, and push with nothing
+				if (q.x != 0.0f || q.y != 0.0f)
+				{
+					qN.Normalize();
+				}
 				const float influense = q.Length();
 
 				if (influense <= 1.0f)
@@ -301,8 +845,568 @@ namespace Fluid
 		}
 	}
 
+	// The accelerated kernels below do exactly what the reference ones do, only the candidates
+	// come from the neighbour grid. Candidates are visited in ascending index order like the
+	// brute force loops so updates land in the same order and the results match the reference.
+
+	void Simulation::applyViscosityGrid(float dt)
+	{
+		const float alfa = 10.0f;
+		const float beta = 0.0f;
+
+		neighbourGrid.build(circleCount, interactionRadius, periodic);
+
+		for (int i = 0; i < circleCount; i++)
+		{
+			Render::particle& particle = Render::GetParticle(i);
+			neighbourGrid.gather(i, candidates);
+			for (uint32_t j : candidates)
+			{
+				if (j <= (uint32_t)i)
+				{
+					continue;
+				}
+				Render::particle& neighbour = Render::GetParticle(j);
+
+				const float influense = distance(particle, neighbour, periodic) / interactionRadius;
+
+				if (influense <= 1)
+				{
+					const Vector2f q = separation(particle, neighbour, periodic) / interactionRadius;
+					Vector2f qN = q;
+					qN.Normalize();
+
+					float u = dot((particle.vel - neighbour.vel), qN);
+					if (u > 0)
+					{
+						Vector2f I = dt * (1 - influense) * ((alfa * u) + (beta * (u * u))) * qN;
+						particle.vel -= I / 2.0f;
+						neighbour.vel += I / 2.0f;
+					}
+				}
+			}
+		}
+	}
+
+	void Simulation::springAdjustmentGrid(float dt)
+	{
+		const float yieldRatio = 0.2f;
+		const float Stretch = 0.3f;
+		const float Compress = 0.3f;
+		const Vector2f L = { 16.0f,16.0f };
+
+		neighbourGrid.build(circleCount, interactionRadius, periodic);
+
+		for (uint32_t i = 0; i < circleCount; i++)
+		{
+			Render::particle& particle = Render::GetParticle(i);
+			neighbourGrid.gather(i, candidates);
+
+			for (uint32_t j : candidates)
+			{
+				if (i == j)
+				{
+					continue;
+				}
+
+				Render::particle& neighbour = Render::GetParticle(j);
+
+				float dist = distance(particle, neighbour, periodic);
+				const float influense = dist / interactionRadius;
+
+				if (influense <= 1)
+				{
+					Vector2f particleDist = Vector2f(abs(neighbour.pos.x - particle.pos.x), abs(neighbour.pos.y - particle.pos.y));
+
+					SpringPair pairToInsert = SpringPair(i, j, Vector2f(interactionRadius, interactionRadius));
+					int id = getPairID(springPairs, pairToInsert);
+					if (id == -1)
+					{
+						springPairs.push_back(pairToInsert);
+						StepCounters::local().springsCreated++;
+						continue;
+					}
+
+					SpringPair& pair = springPairs[id];
+
+					Vector2f Deform = yieldRatio * pair.restSpring;
+
+					if (particleDist.Length() > (L + Deform).Length())	// Stretch
+					{
+						pair.restSpring += dt * Stretch * (particleDist - L - Deform);
+					}
+					else if (particleDist.Length() < (L - Deform).Length())	// Compress
+					{
+						pair.restSpring -= dt * Compress * (L - Deform - particleDist);
+					}
+				}
+			}
+		}
+
+		removeBrokenSprings();
+	}
+
+	void Simulation::doubleDensityRelaxationGrid(float dt)
+	{
+		const float pressureMultiplier = parameters.pressure;
+		const float pressureNearMultiplier = parameters.nearPressure;
+		StepCounters& stepCounters = StepCounters::local();
+
+		// The sweep moves particles as it goes, so the cells are padded by how far any particle may get from where
+		// the grid saw it. Once one gets further the grid is built again, the candidates stay a superset of the
+		// particles in radius and the sweep matches the reference bit for bit.
+		const uint32_t count = circleCount;
+		const float slack = interactionRadius * relaxationSlack;
+		const float slackSqr = slack * slack;
+		auto buildGrid = [&]()
+		{
+			neighbourGrid.build(count, interactionRadius + 2.0f * slack, periodic);
+			gridPositions.resize(count);
+			for (uint32_t j = 0; j < count; j++)
+			{
+				gridPositions[j] = Render::GetParticle(j).pos;
+			}
+		};
+		// Built once whatever sleeps, the bodies take their contacts from it after
+		buildGrid();
+		bool stale = false;
+		const bool sleeping = sleepRegions.any();
+
+		pager.beginSweep();
+		for (int i = 0; i < circleCount; i++)
+		{
+			pager.reach(i);
+			// Sleeping particles keep their last density and pressure and are not moved
+			if (sleeping && sleepRegions.isAsleep(i))
+			{
+				continue;
+			}
+			if (stale)
+			{
+				buildGrid();
+				stale = false;
+			}
+			Render::particle& particle = Render::GetParticle(i);
+			neighbourGrid.gather(i, candidates);
+
+			float d = 0.0f;
+			float dNear = 0.0f;
+			uint32_t neighbours = 0;
+
+			for (uint32_t j : candidates)
+			{
+				if (j == (uint32_t)i)
+					continue;
+
+				Render::particle& neighbour = Render::GetParticle(j);
+				float dist = distance(particle, neighbour, periodic);
+				if (dist > interactionRadius)
+					continue;
+
+				neighbours++;
+
+				const float influense = dist / interactionRadius;
+
+				if (influense <= 1.0f)
+				{
+					d += powf(1 - influense, 2);
+					dNear += powf(1 - influense, 3);
+				}
+			}
+
+			stepCounters.candidatePairs += candidates.size() - 1;
+			stepCounters.pairsInRadius += neighbours;
+			stepCounters.maxNeighbours = std::max(stepCounters.maxNeighbours, neighbours);
+
+			const float P = pressureMultiplier * (d - parameters.restDensity);
+			const float pNear = pressureNearMultiplier * dNear;
+
+			particle.d = d;
+			particle.dNear = dNear;
+			particle.p = P;
+
+			Vector2f dx = { 0, 0 };
+
+			for (uint32_t j : candidates)
+			{
+				if (j == (uint32_t)i)
+					continue;
+
+				Render::particle& neighbour = Render::GetParticle(j);
+
+				const float dist = distance(particle, neighbour, periodic);
+
+				if (dist > interactionRadius)
+					continue;
+
+				const Vector2f q = separation(particle, neighbour, periodic) / interactionRadius;
+				Vector2f qN = q;
+				// Coincident particles have no direction to push along, and push with nothing
+				if (q.x != 0.0f || q.y != 0.0f)
+				{
+					qN.Normalize();
+				}
+				const float influense = q.Length();
+
+				if (influense <= 1.0f)
+				{
+					const Vector2f D = (dt * dt) * (P * (Vector2f(1, 1) - q) + pNear * ((Vector2f(1, 1) - q) * (Vector2f(1, 1) - q))) * qN;
+					dx += D / 2.0f;
+					if (sleeping && sleepRegions.isAsleep(j))
+					{
+						// A sleeping neighbour stays put and pushes back with the pressure it fell asleep with
+						dx -= relaxationDisplacement(dt, neighbour.p, pressureNearMultiplier * neighbour.dNear, separation(neighbour, particle, periodic) / interactionRadius) / 2.0f;
+					}
+					else
+					{
+						neighbour.pos -= D / 2.0f;
+						stale = stale || (neighbour.pos - gridPositions[j]).LengthSqr() > slackSqr;
+					}
+				}
+			}
+
+			particle.pos += dx;
+			stale = stale || (particle.pos - gridPositions[i]).LengthSqr() > slackSqr;
+		}
+	}
+
+	static void atomicAdd(std::atomic<float>& target, float value)
+	{
+		float current = target.load(std::memory_order_relaxed);
+		while (!target.compare_exchange_weak(current, current + value, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	void Simulation::parallelChunks(const std::function<void(uint32_t begin, uint32_t end, uint32_t chunk)>& work)
+	{
+		const uint32_t count = circleCount;
+		const uint32_t chunk = getChunkSize();
+		const uint32_t chunks = (count + chunk - 1) / chunk;
+
+		// Chunks are handed out in order, one still running is at most a chunk a thread behind the newest
+		pager.beginSweep((ThreadPool::instance().getThreadCount() * chunk >> ParticlePager::pageShift) + 1);
+		// Sized for the pool at the start of the step, a phase run on its own since may have a different pool
+		const bool measuring = !threadParticles.empty() && threadParticles.size() == ThreadPool::instance().getThreadCount();
+		ThreadPool::instance().run(chunks, [&](uint32_t index)
+		{
+			pager.reach(index * chunk);
+			const uint32_t begin = index * chunk;
+			const uint32_t end = std::min(count, (index + 1) * chunk);
+			if (!measuring)
+			{
+				work(begin, end, index);
+				return;
+			}
+			// Each thread only adds to its own counts
+			const uint64_t start = Stats::Profiler::now();
+			work(begin, end, index);
+			const uint32_t thread = ThreadPool::getCurrentThread();
+			threadParticles[thread] += end - begin;
+			threadNanoseconds[thread] += Stats::Profiler::now() - start;
+		});
+	}
+
+	uint32_t Simulation::getChunkSize() const
+	{
+		// Deterministic chunks never depend on the thread count, the other mode hands every thread one slice
+		if (executionMode == ExecutionMode::Deterministic)
+		{
+			return deterministicChunkSize;
+		}
+		const uint32_t threads = ThreadPool::instance().getThreadCount();
+		const uint32_t slice = std::max(1u, (circleCount + threads - 1) / threads);
+		// Paged, no chunk is bigger than a page so the pager sees the sweep move along
+		return pager.isEnabled() ? std::min(slice, ParticlePager::pageParticles) : slice;
+	}
+
+	uint32_t Simulation::getChunkCount() const
+	{
+		const uint32_t chunk = getChunkSize();
+		return (circleCount + chunk - 1) / chunk;
+	}
+
+	// Both parallel modes relax Jacobi style: densities and displacements come from the positions after
+	// prediction and are applied together at the end, so no particle sees another one half way through.
+	// That is a different (order free) scheme than the serial Gauss-Seidel relaxation, results differ from Serial.
+	//
+	// Parallel: every pair is computed once and the reaction is scattered into the neighbour with atomic float adds,
+	// the order of those adds and of the energy sum changes from run to run.
+	// Deterministic: fixed chunks, each particle gathers both halves of every pair and only writes itself,
+	// reductions are kept per chunk and summed in chunk order. Same bits for any thread count.
+	void Simulation::stepParallel(float dt)
+	{
+		const uint32_t count = circleCount;
+		const bool deterministic = executionMode == ExecutionMode::Deterministic;
+		const float pressureMultiplier = parameters.pressure;
+		const float pressureNearMultiplier = parameters.nearPressure;
+		// Sleeping particles are left out of every loop, and only ever read as neighbours
+		const SleepRegions* sleep = sleepRegions.any() ? &sleepRegions : nullptr;
+
+		{
+			PROFILE_ZONE("Gravity");
+			Stats::ScopedCounters counters(phaseCounters[(int)StepPhase::Gravity]);
+			parallelChunks([dt, gravity = parameters.gravity, sleep](uint32_t begin, uint32_t end, uint32_t)
+			{
+				for (uint32_t i = begin; i < end; i++)
+				{
+					if (!sleep || !sleep->isAsleep(i))
+					{
+						Render::GetParticle(i).vel.y += gravity * dt;
+					}
+				}
+			});
+		}
+
+		{
+			PROFILE_ZONE("Predict");
+			Stats::ScopedCounters counters(phaseCounters[(int)StepPhase::Predict]);
+			prevPositions.resize(count);
+			parallelChunks([this, dt, sleep](uint32_t begin, uint32_t end, uint32_t)
+			{
+				for (uint32_t i = begin; i < end; i++)
+				{
+					Render::particle& particle = Render::GetParticle(i);
+					prevPositions[i] = particle.pos;
+					if (!sleep || !sleep->isAsleep(i))
+					{
+						particle.pos += dt * particle.vel;
+					}
+				}
+			});
+			RigidBodies::instance().predict(dt, parameters.gravity);
+		}
+
+		{
+			PROFILE_ZONE("Relaxation");
+			Stats::ScopedCounters counters(phaseCounters[(int)StepPhase::Relaxation]);
+			neighbourGrid.build(count, interactionRadius, periodic);
+
+			// Densities, every particle only writes its own
+			parallelChunks([&](uint32_t begin, uint32_t end, uint32_t)
+			{
+				static thread_local std::vector<uint32_t> localCandidates;
+				StepCounters& stepCounters = StepCounters::local();
+
+				for (uint32_t i = begin; i < end; i++)
+				{
+					if (sleep && sleep->isAsleep(i))
+					{
+						continue;
+					}
+					Render::particle& particle = Render::GetParticle(i);
+					neighbourGrid.gather(i, localCandidates);
+
+					float d = 0.0f;
+					float dNear = 0.0f;
+					uint32_t neighbours = 0;
+					for (uint32_t j : localCandidates)
+					{
+						if (j == i)
+							continue;
+
+						const float dist = (float)distance(particle, Render::GetParticle(j), periodic);
+						if (dist > interactionRadius)
+							continue;
+
+						neighbours++;
+						const float influense = dist / interactionRadius;
+						d += powf(1 - influense, 2);
+						dNear += powf(1 - influense, 3);
+					}
+
+					stepCounters.candidatePairs += localCandidates.size() - 1;
+					stepCounters.pairsInRadius += neighbours;
+					stepCounters.maxNeighbours = std::max(stepCounters.maxNeighbours, neighbours);
+
+					particle.d = d;
+					particle.dNear = dNear;
+					particle.p = pressureMultiplier * (d - parameters.restDensity);
+				}
+			});
+
+			if (deterministic)
+			{
+				displacements.resize(count);
+				parallelChunks([&](uint32_t begin, uint32_t end, uint32_t)
+				{
+					static thread_local std::vector<uint32_t> localCandidates;
+					for (uint32_t i = begin; i < end; i++)
+					{
+						if (sleep && sleep->isAsleep(i))
+						{
+							displacements[i] = { 0.0f, 0.0f };
+							continue;
+						}
+						const Render::particle& particle = Render::GetParticle(i);
+						neighbourGrid.gather(i, localCandidates);
+
+						Vector2f dx = { 0, 0 };
+						for (uint32_t j : localCandidates)
+						{
+							if (j == i)
+								continue;
+
+							const Render::particle& neighbour = Render::GetParticle(j);
+							if (distance(particle, neighbour, periodic) > interactionRadius)
+								continue;
+
+							// Our push on the neighbour, and the neighbour's push back on us when it is the centre
+							const Vector2f q = separation(particle, neighbour, periodic) / interactionRadius;
+							if (q.Length() <= 1.0f)
+							{
+								dx += relaxationDisplacement(dt, particle.p, pressureNearMultiplier * particle.dNear, q) / 2.0f;
+							}
+							const Vector2f qBack = separation(neighbour, particle, periodic) / interactionRadius;
+							if (qBack.Length() <= 1.0f)
+							{
+								dx -= relaxationDisplacement(dt, neighbour.p, pressureNearMultiplier * neighbour.dNear, qBack) / 2.0f;
+							}
+						}
+						displacements[i] = dx;
+					}
+				});
+
+				parallelChunks([this](uint32_t begin, uint32_t end, uint32_t)
+				{
+					for (uint32_t i = begin; i < end; i++)
+					{
+						Render::GetParticle(i).pos += displacements[i];
+					}
+				});
+			}
+			else
+			{
+				scatter.resize(count);
+				for (uint32_t i = 0; i < count; i++)
+				{
+					scatter[i].x.store(0.0f, std::memory_order_relaxed);
+					scatter[i].y.store(0.0f, std::memory_order_relaxed);
+				}
+
+				parallelChunks([&](uint32_t begin, uint32_t end, uint32_t)
+				{
+					static thread_local std::vector<uint32_t> localCandidates;
+					for (uint32_t i = begin; i < end; i++)
+					{
+						if (sleep && sleep->isAsleep(i))
+						{
+							continue;
+						}
+						const Render::particle& particle = Render::GetParticle(i);
+						const float pNear = pressureNearMultiplier * particle.dNear;
+						neighbourGrid.gather(i, localCandidates);
+
+						Vector2f dx = { 0, 0 };
+						for (uint32_t j : localCandidates)
+						{
+							if (j == i)
+								continue;
+
+							const Render::particle& neighbour = Render::GetParticle(j);
+							if (distance(particle, neighbour, periodic) > interactionRadius)
+								continue;
+
+							const Vector2f q = separation(particle, neighbour, periodic) / interactionRadius;
+							if (q.Length() <= 1.0f)
+							{
+								const Vector2f D = relaxationDisplacement(dt, particle.p, pNear, q) / 2.0f;
+								dx += D;
+								if (sleep && sleep->isAsleep(j))
+								{
+									// Its half of the pair, as the deterministic gather does it
+									dx -= relaxationDisplacement(dt, neighbour.p, pressureNearMultiplier * neighbour.dNear, separation(neighbour, particle, periodic) / interactionRadius) / 2.0f;
+								}
+								else
+								{
+									atomicAdd(scatter[j].x, -D.x);
+									atomicAdd(scatter[j].y, -D.y);
+								}
+							}
+						}
+						atomicAdd(scatter[i].x, dx.x);
+						atomicAdd(scatter[i].y, dx.y);
+					}
+				});
+
+				parallelChunks([this](uint32_t begin, uint32_t end, uint32_t)
+				{
+					for (uint32_t i = begin; i < end; i++)
+					{
+						Render::particle& particle = Render::GetParticle(i);
+						particle.pos.x += scatter[i].x.load(std::memory_order_relaxed);
+						particle.pos.y += scatter[i].y.load(std::memory_order_relaxed);
+					}
+				});
+			}
+		}
+
+		{
+			PROFILE_ZONE("Collisions");
+			Stats::ScopedCounters counters(phaseCounters[(int)StepPhase::Collisions]);
+			collideBodies(dt);
+
+			chunkEnergy.assign(getChunkCount(), 0.0f);
+			std::atomic<float> energy{ 0.0f };
+			parallelChunks([&](uint32_t begin, uint32_t end, uint32_t chunk)
+			{
+				uint32_t collisions = 0;
+				float partial = 0.0f;
+				for (uint32_t i = begin; i < end; i++)
+				{
+					if (sleep && sleep->isAsleep(i))
+					{
+						continue;
+					}
+					Render::particle& particle = Render::GetParticle(i);
+					collisions += resolveBoundary(particle, prevPositions[i], dt) ? 1 : 0;
+					partial += 0.5f * dot(particle.vel, particle.vel);
+				}
+				StepCounters::local().boundaryCollisions += collisions;
+
+				if (deterministic)
+				{
+					chunkEnergy[chunk] = partial;
+				}
+				else
+				{
+					atomicAdd(energy, partial);
+				}
+			});
+
+			if (deterministic)
+			{
+				float total = 0.0f;
+				for (float partial : chunkEnergy)
+				{
+					total += partial;
+				}
+				kineticEnergy = total;
+			}
+			else
+			{
+				kineticEnergy = energy.load();
+			}
+		}
+	}
+
+	void Simulation::RunPhase(StepPhase phase, float dt)
+	{
+		periodic = Render::Boundary::instance().getPeriodic();
+		switch (phase)
+		{
+		case StepPhase::Viscosity: applyViscosity(dt); break;
+		case StepPhase::SpringAdjustment: springAdjustment(dt); break;
+		case StepPhase::SpringDisplacement: springDisplacement(dt); break;
+		case StepPhase::Relaxation: doubleDensityRelaxation(dt); break;
+		default: break;
+		}
+	}
+
 	void Simulation::springDisplacement(float dt)
 	{
+		PROFILE_ZONE("Spring displacement");
+		Stats::ScopedCounters counters(phaseCounters[(int)StepPhase::SpringDisplacement]);
 		const float springConstant = 1.0f;
 
 		for (const auto& springPair : springPairs)
@@ -310,9 +1414,9 @@ namespace Fluid
 			Render::particle& particle = Render::GetParticle(springPair.index1);
 			Render::particle& neighbour = Render::GetParticle(springPair.index2);
 
-			float dist = distance(particle, neighbour);
+			float dist = distance(particle, neighbour, periodic);
 
-			const Vector2f q = (neighbour.pos - particle.pos) / interactionRadius;
+			const Vector2f q = separation(particle, neighbour, periodic) / interactionRadius;
 			Vector2f qN = q;
 			qN.Normalize();
 
@@ -327,15 +1431,15 @@ namespace Fluid
 	{
 		// Something incorrect here...
 		neighbourList.clear();
-		for (int i = 0; i < circleIDs.size(); i++)
+		for (int i = 0; i < circleCount; i++)
 		{
 			Render::particle& particle = Render::GetParticle(i);
 			neighbourList[i] = {};
-			for (int j = 0; j < circleIDs.size(); j++)
+			for (int j = 0; j < circleCount; j++)
 			{
 				Render::particle& neighbour = Render::GetParticle(j);
 
-				const float dist = distance(particle, neighbour);
+				const float dist = distance(particle, neighbour, periodic);
 
 				if (dist <= interactionRadius)
 				{
@@ -1,36 +1,200 @@
 #pragma once
+#include <atomic>
+#include <memory>
 #include <vector>
 #include <unordered_set>
 #include <unordered_map>
 #include "Play.h"
 #include "particle.h"
 #include "springPair.h"
+#include "perfCounters.h"
+#include "stepStats.h"
+#include "neighbourGrid.h"
+#include "boundary.h"
+#include "obstacles.h"
+#include "rigidBodies.h"
+#include "sleepRegions.h"
+#include "particlePager.h"
+#include "particleArray.h"
+#include <functional>
+#include <string>
 
 namespace Fluid
 {
+	enum class NeighbourSearch
+	{
+		Reference,	// Every pair, the original O(n^2) loops
+		Grid
+	};
+
+	enum class ExecutionMode
+	{
+		Serial,			// The original single threaded step
+		Parallel,		// Thread pool, fastest, results vary with thread count and timing
+		Deterministic	// Thread pool, same bits for any thread count
+	};
+
+	// Tunables of the step, scenes can override any of them
+	struct SolverParameters
+	{
+		float gravity = 40.0f;
+		float restDensity = 50.0f;
+		float pressure = 4.0f;
+		float nearPressure = 16.0f;
+		float velocityDamping = 0.99f;
+		float wallDamping = 0.95f;
+		// How far particles are kept from walls and obstacles
+		float particleRadius = 4.0f;
+		// Fixed steps a second the game loop should run at
+		float stepRate = 60.0f;
+		// Steps a region of fluid has to stay calm before it sleeps, 0 never sleeps. Needs the grid search.
+		int sleepSteps = 0;
+		// Pixels, particles that stay this close to where they were when their region started counting are calm
+		float sleepDistance = 1.0f;
+	};
 
 	class Simulation
 	{
 	public:
 		static Simulation& getInstance();
-		void Update(float deltaTime);
+		const StepStats& Update(float deltaTime);
 
 		void AddCircle(uint32_t cID);
+		// Adds the particles first..first+count, as made by Render::CreateParticles
+		void AddCircles(uint32_t first, uint32_t count);
 		void ClearData();
 
+		// Positions blended between the previous and the latest step, alpha is how far the
+		// frame has come into the next fixed step (0 = previous step, 1 = latest step)
+		const ParticleArray<Vector2f>& GetRenderPositions(float alpha);
+
+		// Wall clock and, where the platform allows, hardware counters for each phase of the last step
+		const Stats::CounterSample& GetPhaseCounters(StepPhase phase) const { return phaseCounters[(int)phase]; }
+		uint32_t GetParticleCount() const { return circleCount; }
+		float GetInteractionRadius() const { return interactionRadius; }
+		const StepStats& GetLastStepStats() const { return lastStepStats; }
+
+		void SetParameters(const SolverParameters& newParameters) { parameters = newParameters; sleepRegions.wakeAll(); }
+		const SolverParameters& GetParameters() const { return parameters; }
+		const SleepRegions& GetSleepRegions() const { return sleepRegions; }
+
+		void SetNeighbourSearch(NeighbourSearch search) { neighbourSearch = search; }
+		NeighbourSearch GetNeighbourSearch() const { return neighbourSearch; }
+		// Dense or chunked grid cells, Auto picks by how spread out the particles are
+		void SetGridLayout(NeighbourGrid::Layout layout) { neighbourGrid.setLayout(layout); }
+		NeighbourGrid::Layout GetGridLayout() const { return neighbourGrid.getLayout(); }
+
+		// Particles in the pages of a scratch file in directory, for runs bigger than memory, or back in memory for
+		// an empty directory. Pages are let go behind each sweep once the particles outgrow residentBytes.
+		// False if the scratch file can't be made, the particles then stay in memory.
+		bool SetPaging(const std::string& directory, size_t residentBytes);
+		bool IsPaging() const { return pager.isEnabled(); }
+		// Goes up whenever the particles are reordered or cut short, for anything keeping particle indices between steps
+		uint32_t GetParticleOrder() const { return particleOrder; }
+		// The particle that was at order[i] goes to i, springs and sleeping follow. False if order doesn't hold
+		// every particle once, or the store had no room to reorder, nothing has changed then.
+		bool ReorderParticles(const uint32_t* order, uint32_t count);
+		// Drops every particle from count on, with any spring to them
+		void TruncateParticles(uint32_t count);
+
+		// For machines with several NUMA nodes: pins the pool's threads, gives each the same share of the particles
+		// every step and keeps that share one strip of space by sorting into bands, and places the particles' pages
+		// on the node of the thread that steps them. Off while paging, false if the pages couldn't be made.
+		bool SetNumaPlacement(bool place);
+		bool IsNumaPlacement() const { return Render::IsParticlePlacement(); }
+
+		// The parallel modes use ThreadPool::instance(), set its thread count there
+		void SetExecutionMode(ExecutionMode mode) { executionMode = mode; }
+		ExecutionMode GetExecutionMode() const { return executionMode; }
+
+		// Runs one of the pairwise phases (viscosity, springs, relaxation) on its own, for the differential tests
+		void RunPhase(StepPhase phase, float dt);
+		const std::vector<SpringPair>& GetSpringPairs() const { return springPairs; }
+		// For restoring a saved state, the pairs must index particles already added
+		void SetSpringPairs(const SpringPair* pairs, size_t count) { springPairs.assign(pairs, pairs + count); }
+		// Called at the end of every step, for telemetry that wants every step rather than the latest
+		void SetStepCallback(std::function<void(const StepStats&)> callback) { stepCallback = callback; }
+
 	private:
 
 		void applyViscosity(float dt);
 		void springAdjustment(float dt);
 		void doubleDensityRelaxation(float dt);
 		void springDisplacement(float dt);
+		void removeBrokenSprings();
+
+		void applyViscosityReference(float dt);
+		void springAdjustmentReference(float dt);
+		void doubleDensityRelaxationReference(float dt);
+
+		void applyViscosityGrid(float dt);
+		void springAdjustmentGrid(float dt);
+		void doubleDensityRelaxationGrid(float dt);
+
+		void stepParallel(float dt);
+		void parallelChunks(const std::function<void(uint32_t begin, uint32_t end, uint32_t chunk)>& work);
+		uint32_t getChunkSize() const;
+		uint32_t getChunkCount() const;
+		bool resolveBoundary(Render::particle& particle, const Vector2f& prevPos, float dt) const;
+		bool resolveMovingBoundary(Render::particle& particle, const Vector2f& prevPos, float dt) const;
+		void collideBodies(float dt);
 
 		void updateNeighbours();
+		// Into bands for the pager or for placement, with everything that names particles by index following them
+		void sortIntoBands();
+		// Particle i goes to destination[i], as ReorderParticles
+		bool moveParticles(const uint32_t* destination, uint32_t count);
+		// The placement figures of the step, nothing while placement is off or the step serial
+		void measurePlacement(StepStats& stats) const;
+		// The regions' sleep steps for this step, none for the reference search
+		int getSleepSteps() const;
+		void finishStepStats(float dt, uint64_t stepBegin);
 
 		const float interactionRadius = 16.0f;
+		SolverParameters parameters;
+		// The boundary's wrapped axes, taken at the start of every step
+		Render::PeriodicDomain periodic;
 
-		std::vector<uint32_t> circleIDs;
+		// Every buffer with an element per particle is a ParticleArray, so it goes to a scratch file with the
+		// particles while paging
+		uint32_t circleCount = 0;
 		std::vector<SpringPair> springPairs;
+		ParticleArray<Vector2f> prevPositions;
+		ParticleArray<Vector2f> renderPositions;
+		Stats::CounterSample phaseCounters[(int)StepPhase::Count];
+		StepStats lastStepStats;
+		uint64_t stepIndex = 0;
+		std::function<void(const StepStats&)> stepCallback;
+
+		NeighbourSearch neighbourSearch = NeighbourSearch::Grid;
+		NeighbourGrid neighbourGrid;
+		std::vector<uint32_t> candidates;
+		// Where the serial relaxation's grid saw each particle, and how far past a radius its cells reach as a share of it
+		ParticleArray<Vector2f> gridPositions;
+		static constexpr float relaxationSlack = 0.1f;
+		SleepRegions sleepRegions;
+		ParticlePager pager;
+		ParticleArray<uint32_t> pagingDestination;
+		// Scratch for moving prevPositions along with the particles
+		ParticleArray<uint32_t> reorderMoves{ false };
+		uint32_t particleOrder = 0;
+		// Per pool thread while placement is on, particles its chunks covered this step and the time they took
+		std::vector<uint64_t> threadParticles;
+		std::vector<uint64_t> threadNanoseconds;
+		// Particle pages checked for their node every step
+		static const uint32_t placementSamples = 64;
+
+		ExecutionMode executionMode = ExecutionMode::Serial;
+		static const uint32_t deterministicChunkSize = 256;
+		ParticleArray<Vector2f> displacements;
+		struct AtomicVector2f
+		{
+			std::atomic<float> x;
+			std::atomic<float> y;
+		};
+		ParticleArray<AtomicVector2f> scatter;
+		std::vector<float> chunkEnergy;
+		float kineticEnergy = 0.0f;
 		std::unordered_map<uint32_t, std::vector<uint32_t>> neighbourList;
 	private:
 		Simulation() {};
@@ -0,0 +1,119 @@
+#include "benchmark.h"
+#include <cstdio>
+#include <fstream>
+
+namespace Stats
+{
+	void BenchmarkResult::clear()
+	{
+		metrics.clear();
+		info.clear();
+	}
+
+	void BenchmarkResult::setInfo(const std::string& key, double value)
+	{
+		char number[64];
+		snprintf(number, sizeof(number), "%.6g", value);
+		setInfoJson(key, number);
+	}
+
+	void BenchmarkResult::setInfo(const std::string& key, const std::string& value)
+	{
+		std::string quoted = "\"";
+		for (char c : value)
+		{
+			if (c == '"' || c == '\\')
+			{
+				quoted += '\\';
+			}
+			quoted += c;
+		}
+		setInfoJson(key, quoted + "\"");
+	}
+
+	void BenchmarkResult::setInfoJson(const std::string& key, const std::string& json)
+	{
+		for (std::pair<std::string, std::string>& entry : info)
+		{
+			if (entry.first == key)
+			{
+				entry.second = json;
+				return;
+			}
+		}
+		info.push_back({ key, json });
+	}
+
+	BenchmarkResult::Metric& BenchmarkResult::find(const std::string& metric, bool counter)
+	{
+		for (Metric& existing : metrics)
+		{
+			if (existing.name == metric)
+			{
+				return existing;
+			}
+		}
+		metrics.push_back({ metric, {}, counter });
+		return metrics.back();
+	}
+
+	void BenchmarkResult::add(const std::string& metric, uint64_t nanoseconds)
+	{
+		find(metric, false).samples.push_back((double)nanoseconds);
+	}
+
+	void BenchmarkResult::addCounter(const std::string& metric, double value)
+	{
+		find(metric, true).samples.push_back(value);
+	}
+
+	const std::vector<double>* BenchmarkResult::getSamples(const std::string& metric) const
+	{
+		for (const Metric& existing : metrics)
+		{
+			if (existing.name == metric)
+			{
+				return &existing.samples;
+			}
+		}
+		return nullptr;
+	}
+
+	bool BenchmarkResult::writeJson(const char* path) const
+	{
+		std::ofstream file(path);
+		if (!file)
+		{
+			return false;
+		}
+
+		file << "{\n  \"version\": 1,\n  \"unit\": \"ns\",\n  \"info\": {";
+		for (size_t i = 0; i < info.size(); i++)
+		{
+			file << (i > 0 ? ", " : " ") << "\"" << info[i].first << "\": " << info[i].second;
+		}
+		file << " },\n  \"metrics\": {\n";
+
+		for (size_t m = 0; m < metrics.size(); m++)
+		{
+			file << "    \"" << metrics[m].name << "\": [";
+			for (size_t s = 0; s < metrics[m].samples.size(); s++)
+			{
+				char number[64];
+				if (metrics[m].counter)
+				{
+					snprintf(number, sizeof(number), "%.6g", metrics[m].samples[s]);
+				}
+				else
+				{
+					snprintf(number, sizeof(number), "%llu", (unsigned long long)metrics[m].samples[s]);
+				}
+				file << (s > 0 ? ", " : "") << number;
+			}
+			file << "]" << (m + 1 < metrics.size() ? "," : "") << "\n";
+		}
+		file << "  }\n}\n";
+
+		return true;
+	}
+}
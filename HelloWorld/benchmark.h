@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Stats
+{
+	// Repeated nanosecond samples per metric, written as JSON for BenchCompare.
+	// Every sample is kept so the comparison can judge noise from the spread rather than a single mean.
+	// Hardware counter metrics sit alongside the timings, named after what they measure: "<phase>.ipc",
+	// where lower is worse, and "<phase>.llc_misses_per_particle", where higher is.
+	class BenchmarkResult
+	{
+	public:
+		void clear();
+		void setInfo(const std::string& key, double value);
+		void setInfo(const std::string& key, const std::string& value);
+		void add(const std::string& metric, uint64_t nanoseconds);
+		void addCounter(const std::string& metric, double value);
+		// Null if nothing was added under that name
+		const std::vector<double>* getSamples(const std::string& metric) const;
+
+		bool writeJson(const char* path) const;
+
+	private:
+		void setInfoJson(const std::string& key, const std::string& json);
+
+		struct Metric
+		{
+			std::string name;
+			std::vector<double> samples;
+			// Counter ratios rather than whole nanoseconds
+			bool counter = false;
+		};
+
+		Metric& find(const std::string& metric, bool counter);
+
+		// Kept in the order they were first added so the output reads like the frame
+		std::vector<Metric> metrics;
+		// Values already written as JSON
+		std::vector<std::pair<std::string, std::string>> info;
+	};
+}
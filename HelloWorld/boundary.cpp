@@ -16,12 +16,99 @@ namespace Render
 	}
 	void Boundary::move(const Vector2f& newPos)
 	{
-		this->center = newPos;
+		this->placed = newPos;
 		recalcSize();
 	}
+	void Boundary::setMotion(const BoundaryMotion& newMotion)
+	{
+		motion = newMotion;
+		setTime(0.0);
+	}
+	void Boundary::setPeriodic(bool x, bool y)
+	{
+		periodicX = x;
+		periodicY = y;
+	}
+	PeriodicDomain Boundary::getPeriodic() const
+	{
+		PeriodicDomain domain;
+		domain.x = periodicX && motion.isStill();
+		domain.y = periodicY && motion.isStill();
+		domain.origin = { topLeft.x, topLeft.y };
+		domain.size = { 2.0f * width, 2.0f * height };
+		return domain;
+	}
+	void Boundary::advance(float dt)
+	{
+		if (motion.isStill())
+		{
+			return;
+		}
+		const Vector2f lastCenter = center;
+		const float lastAngle = angle;
+		time += dt;
+		recalcSize();
+		previousCenter = lastCenter;
+		previousAngle = lastAngle;
+	}
+	void Boundary::setTime(double newTime)
+	{
+		time = newTime;
+		recalcSize();
+	}
+	Vector2f Boundary::toLocal(const Vector2f& world) const
+	{
+		const Vector2f offset = world - center;
+		const float c = std::cos(angle);
+		const float s = std::sin(angle);
+		return { c * offset.x + s * offset.y, -s * offset.x + c * offset.y };
+	}
+	Vector2f Boundary::toWorld(const Vector2f& local) const
+	{
+		const float c = std::cos(angle);
+		const float s = std::sin(angle);
+		return { center.x + c * local.x - s * local.y, center.y + s * local.x + c * local.y };
+	}
+	Vector2f Boundary::toPreviousLocal(const Vector2f& world) const
+	{
+		const Vector2f offset = world - previousCenter;
+		const float c = std::cos(previousAngle);
+		const float s = std::sin(previousAngle);
+		return { c * offset.x + s * offset.y, -s * offset.x + c * offset.y };
+	}
+	Vector2f Boundary::toPreviousWorld(const Vector2f& local) const
+	{
+		const float c = std::cos(previousAngle);
+		const float s = std::sin(previousAngle);
+		return { previousCenter.x + c * local.x - s * local.y, previousCenter.y + s * local.x + c * local.y };
+	}
 	void Boundary::draw()
 	{
-		Play::DrawRect(topLeft, bottomRight, Play::cWhite);
+		const PeriodicDomain periodic = getPeriodic();
+		if (periodic.any())
+		{
+			// Wrapped sides in grey, nothing stops a particle there
+			const Point2D topRight = { bottomRight.x, topLeft.y };
+			const Point2D bottomLeft = { topLeft.x, bottomRight.y };
+			Play::DrawLine(topLeft, topRight, periodic.y ? Play::cGrey : Play::cWhite);
+			Play::DrawLine(bottomLeft, bottomRight, periodic.y ? Play::cGrey : Play::cWhite);
+			Play::DrawLine(topLeft, bottomLeft, periodic.x ? Play::cGrey : Play::cWhite);
+			Play::DrawLine(topRight, bottomRight, periodic.x ? Play::cGrey : Play::cWhite);
+			return;
+		}
+		if (angle == 0.0f)
+		{
+			Play::DrawRect(topLeft, bottomRight, Play::cWhite);
+			return;
+		}
+
+		const Vector2f corners[4] = { toWorld({ -width, -height }), toWorld({ width, -height }), toWorld({ width, height }), toWorld({ -width, height }) };
+		for (int i = 0; i < 4; i++)
+		{
+			const Vector2f& a = corners[i];
+			const Vector2f& b = corners[(i + 1) % 4];
+			Play::DrawLine({ a.x, a.y }, { b.x, b.y }, Play::cWhite);
+		}
 	}
 	Point2D& Boundary::getTopLeft()
 	{
@@ -33,6 +120,24 @@ namespace Render
 	}
 	void Boundary::recalcSize()
 	{
+		const float twoPi = 6.28318531f;
+		const float seconds = (float)time;
+		center = placed;
+		angle = 0.0f;
+		if (motion.swayFrequency != 0.0f)
+		{
+			center += motion.sway * std::sin(twoPi * motion.swayFrequency * seconds);
+		}
+		if (motion.tiltFrequency != 0.0f)
+		{
+			angle += motion.tilt * std::sin(twoPi * motion.tiltFrequency * seconds);
+		}
+		angle += motion.spin * seconds;
+
+		// Anything but advance jumps the box, so the last step's transform follows it
+		previousCenter = center;
+		previousAngle = angle;
+
 		topLeft = { center.x - width, center.y - height };
 		bottomRight = { center.x + width, center.y + height };
 	}
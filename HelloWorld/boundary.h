@@ -3,16 +3,110 @@
 
 namespace Render
 {
+	// How the box moves once the simulation runs, on top of where move() put it. Every part starts
+	// from zero at time zero, so a scene is always placed in the unmoved box.
+	struct BoundaryMotion
+	{
+		// Side to side and up and down, the peak offset in pixels
+		Vector2f sway = { 0.0f, 0.0f };
+		float swayFrequency = 0.0f;
+		// Rocking, the peak angle in radians
+		float tilt = 0.0f;
+		float tiltFrequency = 0.0f;
+		// Steady turning in radians a second
+		float spin = 0.0f;
+
+		bool isStill() const
+		{
+			return ((sway.x == 0.0f && sway.y == 0.0f) || swayFrequency == 0.0f) && (tilt == 0.0f || tiltFrequency == 0.0f) && spin == 0.0f;
+		}
+	};
+
+	// Axes of the box that wrap around instead of having walls. A particle leaving one side comes back
+	// in on the other, and pairs are measured to the nearest copy of each other (the minimum image).
+	struct PeriodicDomain
+	{
+		bool x = false;
+		bool y = false;
+		Vector2f origin = { 0.0f, 0.0f };
+		Vector2f size = { 0.0f, 0.0f };
+
+		bool any() const { return x || y; }
+
+		// The shortest of the offsets between the copies, unchanged on a walled axis
+		Vector2f minimumImage(Vector2f offset) const
+		{
+			if (x)
+			{
+				offset.x -= size.x * std::floor(offset.x / size.x + 0.5f);
+			}
+			if (y)
+			{
+				offset.y -= size.y * std::floor(offset.y / size.y + 0.5f);
+			}
+			return offset;
+		}
+
+		// Back into origin..origin + size on the wrapped axes
+		void wrap(Vector2f& pos) const
+		{
+			if (x)
+			{
+				pos.x -= size.x * std::floor((pos.x - origin.x) / size.x);
+				// Rounding can land exactly on the far edge
+				if (pos.x >= origin.x + size.x)
+				{
+					pos.x = origin.x;
+				}
+			}
+			if (y)
+			{
+				pos.y -= size.y * std::floor((pos.y - origin.y) / size.y);
+				if (pos.y >= origin.y + size.y)
+				{
+					pos.y = origin.y;
+				}
+			}
+		}
+	};
+
 	class Boundary
 	{
 	public:
 		static Boundary& instance();
 
+		// Both jump the box straight there, nothing in it is swept along
 		void resize(float width, float height);
 		void move(const Vector2f& newPos);
 
+		// Starts the motion over from time zero
+		void setMotion(const BoundaryMotion& newMotion);
+		const BoundaryMotion& getMotion() const { return motion; }
+		bool isMoving() const { return !motion.isStill(); }
+
+		// Wrapped axes have no walls. Only while the box stays put, a moving box keeps all four walls.
+		void setPeriodic(bool x, bool y);
+		// The axes wrapping right now and the box they wrap around
+		PeriodicDomain getPeriodic() const;
+
+		// Moves the box on by dt, keeping where it was for the collisions of this step
+		void advance(float dt);
+		// Puts the box where it is at time, as if it had always been there
+		void setTime(double newTime);
+		double getTime() const { return time; }
+
+		// Centre, rotation and half extents now, and as of the last advance
+		const Vector2f& getCenter() const { return center; }
+		float getAngle() const { return angle; }
+		Vector2f getHalfSize() const { return { width, height }; }
+		Vector2f toLocal(const Vector2f& world) const;
+		Vector2f toWorld(const Vector2f& local) const;
+		Vector2f toPreviousLocal(const Vector2f& world) const;
+		Vector2f toPreviousWorld(const Vector2f& local) const;
+
 		void draw();
 
+		// Corners of the box before any rotation
 		Point2D& getTopLeft();
 		Point2D& getBottomRight();
 
@@ -20,7 +114,17 @@ namespace Render
 
 		float width;
 		float height;
-		Vector2f center;
+		// Where move() put it, center is that plus the motion's offset
+		Vector2f placed = { 0.0f, 0.0f };
+		Vector2f center = { 0.0f, 0.0f };
+		float angle = 0.0f;
+
+		BoundaryMotion motion;
+		double time = 0.0;
+		bool periodicX = false;
+		bool periodicY = false;
+		Vector2f previousCenter = { 0.0f, 0.0f };
+		float previousAngle = 0.0f;
 
 		Point2D topLeft;
 		Point2D bottomRight;
@@ -0,0 +1,239 @@
+#include "frameStats.h"
+#include <cstdio>
+
+namespace Stats
+{
+	int Histogram::bucketIndex(uint32_t micros)
+	{
+		if (micros < linearBuckets)
+		{
+			return (int)micros;
+		}
+
+		int msb = subBucketBits + 1;
+		while (msb < 31 && (micros >> (msb + 1)) != 0)
+		{
+			msb++;
+		}
+
+		const int shift = msb - subBucketBits;
+		const int sub = (micros >> shift) & ((1 << subBucketBits) - 1);
+		return linearBuckets + (shift - 1) * (1 << subBucketBits) + sub;
+	}
+
+	uint32_t Histogram::bucketHighest(int index)
+	{
+		if (index < linearBuckets)
+		{
+			return (uint32_t)index;
+		}
+
+		const int octave = (index - linearBuckets) >> subBucketBits;
+		const int sub = (index - linearBuckets) & ((1 << subBucketBits) - 1);
+		const int shift = octave + 1;
+
+		const uint64_t lowest = (uint64_t)((1 << subBucketBits) + sub) << shift;
+		return (uint32_t)(lowest + (1ull << shift) - 1);
+	}
+
+	void Histogram::record(uint32_t micros)
+	{
+		counts[bucketIndex(micros)]++;
+		total++;
+	}
+
+	void Histogram::remove(uint32_t micros)
+	{
+		uint32_t& bucket = counts[bucketIndex(micros)];
+		if (bucket > 0)
+		{
+			bucket--;
+			total--;
+		}
+	}
+
+	void Histogram::clear()
+	{
+		counts.fill(0);
+		total = 0;
+	}
+
+	uint32_t Histogram::percentile(double percent) const
+	{
+		if (total == 0)
+		{
+			return 0;
+		}
+
+		const uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(percent / 100.0 * total));
+
+		uint64_t seen = 0;
+		for (int i = 0; i < bucketCount; i++)
+		{
+			seen += counts[i];
+			if (seen >= rank)
+			{
+				return bucketHighest(i);
+			}
+		}
+		return bucketHighest(bucketCount - 1);
+	}
+
+	uint32_t Histogram::max() const
+	{
+		for (int i = bucketCount - 1; i >= 0; i--)
+		{
+			if (counts[i] > 0)
+			{
+				return bucketHighest(i);
+			}
+		}
+		return 0;
+	}
+
+	FrameRecorder& FrameRecorder::instance()
+	{
+		static FrameRecorder instance;
+
+		return instance;
+	}
+
+	FrameRecorder::FrameRecorder()
+	{
+		setWindows(windows);
+	}
+
+	void FrameRecorder::setWindows(const std::vector<uint32_t>& windowFrames)
+	{
+		windows = windowFrames;
+
+		uint32_t longest = 1;
+		for (uint32_t frames : windows)
+		{
+			longest = std::max(longest, frames);
+		}
+
+		for (PhaseData& data : phases)
+		{
+			data.ring.assign(longest, 0);
+			data.recorded = 0;
+			data.histograms.assign(windows.size(), Histogram());
+		}
+	}
+
+	void FrameRecorder::reset()
+	{
+		setWindows(windows);
+	}
+
+	void FrameRecorder::record(Phase phase, double seconds)
+	{
+		PhaseData& data = phases[(int)phase];
+		const uint32_t micros = (uint32_t)std::min(seconds * 1000000.0, 4294967295.0);
+		const size_t ringSize = data.ring.size();
+
+		// Drop whatever just left each window before the ring slot gets reused
+		for (size_t w = 0; w < windows.size(); w++)
+		{
+			if (data.recorded >= windows[w])
+			{
+				data.histograms[w].remove(data.ring[(data.recorded - windows[w]) % ringSize]);
+			}
+			data.histograms[w].record(micros);
+		}
+
+		data.ring[data.recorded % ringSize] = micros;
+		data.recorded++;
+	}
+
+	Summary FrameRecorder::summary(Phase phase, int window) const
+	{
+		const Histogram& histogram = phases[(int)phase].histograms[window];
+
+		Summary result;
+		result.samples = histogram.count();
+		result.p50 = histogram.percentile(50.0) / 1000.0f;
+		result.p90 = histogram.percentile(90.0) / 1000.0f;
+		result.p99 = histogram.percentile(99.0) / 1000.0f;
+		result.max = histogram.max() / 1000.0f;
+		return result;
+	}
+
+	const char* FrameRecorder::phaseName(Phase phase)
+	{
+		switch (phase)
+		{
+		case Phase::Simulation: return "Simulation";
+		case Phase::Render: return "Render";
+		case Phase::Present: return "Present";
+		case Phase::Frame: return "Frame";
+		default: return "Unknown";
+		}
+	}
+
+	void FrameRecorder::drawOverlay(Point2f pos, int window) const
+	{
+		char line[128];
+		snprintf(line, sizeof(line), "Frame times (ms), last %u frames", windows[window]);
+		Play::DrawDebugText(pos, line, Play::cWhite, false);
+
+		for (int p = 0; p < (int)Phase::Count; p++)
+		{
+			const Summary s = summary((Phase)p, window);
+			snprintf(line, sizeof(line), "%-10s p50 %6.2f  p90 %6.2f  p99 %6.2f  max %6.2f", phaseName((Phase)p), s.p50, s.p90, s.p99, s.max);
+
+			// Red when the tail blows the 60 fps budget
+			Play::DrawDebugText({ pos.x, pos.y + 15.0f * (p + 1) }, line, s.p99 > 16.7f ? Play::cRed : Play::cWhite, false);
+		}
+	}
+
+	bool FrameRecorder::dumpCsv(const char* path) const
+	{
+		std::ofstream file(path);
+		if (!file)
+		{
+			return false;
+		}
+
+		char line[160];
+		file << "phase,window_frames,samples,p50_ms,p90_ms,p99_ms,max_ms\n";
+		for (int p = 0; p < (int)Phase::Count; p++)
+		{
+			for (size_t w = 0; w < windows.size(); w++)
+			{
+				const Summary s = summary((Phase)p, (int)w);
+				snprintf(line, sizeof(line), "%s,%u,%u,%.3f,%.3f,%.3f,%.3f\n", phaseName((Phase)p), windows[w], s.samples, s.p50, s.p90, s.p99, s.max);
+				file << line;
+			}
+		}
+
+		return true;
+	}
+
+	bool FrameRecorder::dumpJson(const char* path) const
+	{
+		std::ofstream file(path);
+		if (!file)
+		{
+			return false;
+		}
+
+		char line[256];
+		file << "{\n  \"phases\": {\n";
+		for (int p = 0; p < (int)Phase::Count; p++)
+		{
+			file << "    \"" << phaseName((Phase)p) << "\": [\n";
+			for (size_t w = 0; w < windows.size(); w++)
+			{
+				const Summary s = summary((Phase)p, (int)w);
+				snprintf(line, sizeof(line), "      { \"window_frames\": %u, \"samples\": %u, \"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f }%s\n",
+					windows[w], s.samples, s.p50, s.p90, s.p99, s.max, w + 1 < windows.size() ? "," : "");
+				file << line;
+			}
+			file << "    ]" << (p + 1 < (int)Phase::Count ? "," : "") << "\n";
+		}
+		file << "  }\n}\n";
+
+		return true;
+	}
+}
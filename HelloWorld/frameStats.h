@@ -0,0 +1,89 @@
+#pragma once
+#include <array>
+#include <vector>
+#include "Play.h"
+
+namespace Stats
+{
+	// Fixed size log-linear histogram of microsecond values (HDR style).
+	// Exact below 64us, after that 32 buckets per power of two, so about 3% relative error up to ~70 minutes.
+	class Histogram
+	{
+	public:
+		void record(uint32_t micros);
+		void remove(uint32_t micros);
+		void clear();
+
+		uint32_t count() const { return total; }
+		// Highest value equivalent to the bucket holding the given percentile (0-100)
+		uint32_t percentile(double percent) const;
+		uint32_t max() const;
+
+	private:
+		static int bucketIndex(uint32_t micros);
+		static uint32_t bucketHighest(int index);
+
+		static const int subBucketBits = 5;
+		static const int linearBuckets = 2 << subBucketBits;
+		static const int bucketCount = linearBuckets + (32 - subBucketBits - 1) * (1 << subBucketBits);
+
+		std::array<uint32_t, bucketCount> counts{};
+		uint32_t total = 0;
+	};
+
+	enum class Phase
+	{
+		Simulation,
+		Render,
+		Present,
+		Frame,
+		Count
+	};
+
+	struct Summary
+	{
+		uint32_t samples = 0;
+		float p50 = 0.0f;
+		float p90 = 0.0f;
+		float p99 = 0.0f;
+		float max = 0.0f;
+	};
+
+	// Rolling frame time recorder, one histogram per phase and window.
+	// Every window covers the last N frames, samples falling out of a window are removed from its histogram.
+	class FrameRecorder
+	{
+	public:
+		static FrameRecorder& instance();
+
+		void setWindows(const std::vector<uint32_t>& windowFrames);
+		const std::vector<uint32_t>& getWindows() const { return windows; }
+
+		void record(Phase phase, double seconds);
+		void reset();
+
+		// Values in milliseconds
+		Summary summary(Phase phase, int window) const;
+
+		void drawOverlay(Point2f pos, int window) const;
+		bool dumpCsv(const char* path) const;
+		bool dumpJson(const char* path) const;
+
+		static const char* phaseName(Phase phase);
+
+	private:
+		struct PhaseData
+		{
+			std::vector<uint32_t> ring;
+			uint64_t recorded = 0;
+			std::vector<Histogram> histograms;
+		};
+
+		std::vector<uint32_t> windows = { 120, 600, 3600 };
+		std::array<PhaseData, (int)Phase::Count> phases;
+
+		FrameRecorder();
+		FrameRecorder(const FrameRecorder& ref) = delete;
+		~FrameRecorder() {};
+	};
+}
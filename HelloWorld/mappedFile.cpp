@@ -0,0 +1,371 @@
+#include "mappedFile.h"
+#include <algorithm>
+#include <vector>
+
+#if defined(_WIN32)
+#include "Play.h"
+#else
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Fluid
+{
+	MappedFile::~MappedFile()
+	{
+		close();
+	}
+
+#if defined(_WIN32)
+	bool MappedFile::open(const std::string& path)
+	{
+		close();
+
+		HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (handle == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(handle, &fileSize) || fileSize.QuadPart == 0)
+		{
+			CloseHandle(handle);
+			return false;
+		}
+
+		HANDLE view = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (view == nullptr)
+		{
+			CloseHandle(handle);
+			return false;
+		}
+
+		data = (const uint8_t*)MapViewOfFile(view, FILE_MAP_READ, 0, 0, 0);
+		if (data == nullptr)
+		{
+			CloseHandle(view);
+			CloseHandle(handle);
+			return false;
+		}
+
+		file = handle;
+		mapping = view;
+		size = (size_t)fileSize.QuadPart;
+		return true;
+	}
+
+	void MappedFile::close()
+	{
+		if (data != nullptr)
+		{
+			UnmapViewOfFile(data);
+			CloseHandle((HANDLE)mapping);
+			CloseHandle((HANDLE)file);
+		}
+		data = nullptr;
+		mapping = nullptr;
+		file = nullptr;
+		size = 0;
+	}
+#else
+	bool MappedFile::open(const std::string& path)
+	{
+		close();
+
+		const int handle = ::open(path.c_str(), O_RDONLY);
+		if (handle < 0)
+		{
+			return false;
+		}
+
+		struct stat info;
+		if (fstat(handle, &info) != 0 || info.st_size == 0)
+		{
+			::close(handle);
+			return false;
+		}
+
+		// The mapping keeps its own reference to the file
+		void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, handle, 0);
+		::close(handle);
+		if (view == MAP_FAILED)
+		{
+			return false;
+		}
+
+		data = (const uint8_t*)view;
+		size = (size_t)info.st_size;
+		return true;
+	}
+
+	void MappedFile::close()
+	{
+		if (data != nullptr)
+		{
+			munmap((void*)data, size);
+		}
+		data = nullptr;
+		size = 0;
+	}
+#endif
+
+	MappedScratchFile::~MappedScratchFile()
+	{
+		close();
+	}
+
+	void MappedScratchFile::swap(MappedScratchFile& other)
+	{
+		std::swap(data, other.data);
+		std::swap(capacity, other.capacity);
+		std::swap(handle, other.handle);
+#if defined(_WIN32)
+		std::swap(mapping, other.mapping);
+#endif
+	}
+
+	bool MappedScratchFile::reserve(size_t bytes)
+	{
+		if (bytes <= capacity)
+		{
+			return true;
+		}
+		return isOpen() && map(bytes);
+	}
+
+#if defined(_WIN32)
+	static size_t osPageSize()
+	{
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return info.dwPageSize;
+	}
+
+	// Windows 8 and later, looked up so older systems just go without the hint
+	struct PrefetchRange
+	{
+		void* address;
+		size_t bytes;
+	};
+	typedef BOOL(WINAPI* PrefetchVirtualMemoryFunction)(HANDLE process, ULONG_PTR count, PrefetchRange* ranges, ULONG flags);
+
+	bool MappedScratchFile::open(const std::string& directory)
+	{
+		close();
+
+		char path[MAX_PATH];
+		if (GetTempFileNameA(directory.c_str(), "pag", 0, path) == 0)
+		{
+			return false;
+		}
+
+		// Temporary keeps the pages in the file cache rather than on disk for as long as there is memory for them
+		HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			DeleteFileA(path);
+			return false;
+		}
+
+		handle = file;
+		return true;
+	}
+
+	bool MappedScratchFile::isOpen() const
+	{
+		return handle != nullptr;
+	}
+
+	void MappedScratchFile::close()
+	{
+		if (data != nullptr)
+		{
+			UnmapViewOfFile(data);
+			CloseHandle((HANDLE)mapping);
+		}
+		if (handle != nullptr)
+		{
+			CloseHandle((HANDLE)handle);
+		}
+		data = nullptr;
+		mapping = nullptr;
+		handle = nullptr;
+		capacity = 0;
+	}
+
+	bool MappedScratchFile::map(size_t bytes)
+	{
+		// A mapping bigger than the file grows the file, and fails there if the disk is full
+		HANDLE view = CreateFileMappingA((HANDLE)handle, nullptr, PAGE_READWRITE, (DWORD)((uint64_t)bytes >> 32), (DWORD)bytes, nullptr);
+		if (view == nullptr)
+		{
+			return false;
+		}
+
+		uint8_t* address = (uint8_t*)MapViewOfFile(view, FILE_MAP_ALL_ACCESS, 0, 0, bytes);
+		if (address == nullptr)
+		{
+			CloseHandle(view);
+			return false;
+		}
+
+		// Both views are of the same file, nothing needs copying across
+		if (data != nullptr)
+		{
+			UnmapViewOfFile(data);
+			CloseHandle((HANDLE)mapping);
+		}
+		data = address;
+		mapping = view;
+		capacity = bytes;
+		return true;
+	}
+
+	void MappedScratchFile::prefetch(size_t offset, size_t bytes) const
+	{
+		static const PrefetchVirtualMemoryFunction prefetchVirtualMemory = (PrefetchVirtualMemoryFunction)GetProcAddress(GetModuleHandleA("kernel32.dll"), "PrefetchVirtualMemory");
+		size_t begin, end;
+		if (prefetchVirtualMemory != nullptr && pageRange(offset, bytes, begin, end))
+		{
+			PrefetchRange range = { data + begin, end - begin };
+			prefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+		}
+	}
+
+	void MappedScratchFile::writeBack(size_t offset, size_t bytes) const
+	{
+		// Nothing to start, pages evicted below go on the modified list and the system's
+		// modified page writer writes them out in the background
+	}
+
+	void MappedScratchFile::evict(size_t offset, size_t bytes) const
+	{
+		// Unlocking pages that were never locked trims them from the working set
+		size_t begin, end;
+		if (pageRange(offset, bytes, begin, end))
+		{
+			VirtualUnlock(data + begin, end - begin);
+		}
+	}
+#else
+	static size_t osPageSize()
+	{
+		return (size_t)sysconf(_SC_PAGESIZE);
+	}
+
+	bool MappedScratchFile::open(const std::string& directory)
+	{
+		close();
+
+		std::string path = directory + "/pages-XXXXXX";
+		std::vector<char> name(path.begin(), path.end());
+		name.push_back('\0');
+		const int file = mkstemp(name.data());
+		if (file < 0)
+		{
+			return false;
+		}
+
+		// Unlinked straight away, the file only lives as long as it is open
+		unlink(name.data());
+		handle = file;
+		return true;
+	}
+
+	bool MappedScratchFile::isOpen() const
+	{
+		return handle >= 0;
+	}
+
+	void MappedScratchFile::close()
+	{
+		if (data != nullptr)
+		{
+			munmap(data, capacity);
+		}
+		if (handle >= 0)
+		{
+			::close(handle);
+		}
+		data = nullptr;
+		handle = -1;
+		capacity = 0;
+	}
+
+	bool MappedScratchFile::map(size_t bytes)
+	{
+#if defined(__linux__)
+		// Blocks claimed up front, so a full disk fails here rather than as a bus error on the first write into a hole
+		if (posix_fallocate(handle, (off_t)capacity, (off_t)(bytes - capacity)) != 0)
+		{
+			return false;
+		}
+#else
+		if (ftruncate(handle, (off_t)bytes) != 0)
+		{
+			return false;
+		}
+#endif
+
+		void* view = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
+		if (view == MAP_FAILED)
+		{
+			return false;
+		}
+
+		// Both mappings are of the same file, nothing needs copying across
+		if (data != nullptr)
+		{
+			munmap(data, capacity);
+		}
+		data = (uint8_t*)view;
+		capacity = bytes;
+		return true;
+	}
+
+	void MappedScratchFile::prefetch(size_t offset, size_t bytes) const
+	{
+		size_t begin, end;
+		if (pageRange(offset, bytes, begin, end))
+		{
+			madvise(data + begin, end - begin, MADV_WILLNEED);
+		}
+	}
+
+	void MappedScratchFile::writeBack(size_t offset, size_t bytes) const
+	{
+		size_t begin, end;
+		if (pageRange(offset, bytes, begin, end))
+		{
+#if defined(__linux__)
+			// Queues the writes and returns, msync's MS_ASYNC does nothing at all on Linux
+			sync_file_range(handle, (off_t)begin, (off_t)(end - begin), SYNC_FILE_RANGE_WRITE);
+#else
+			msync(data + begin, end - begin, MS_ASYNC);
+#endif
+		}
+	}
+
+	void MappedScratchFile::evict(size_t offset, size_t bytes) const
+	{
+		// On a shared file mapping this only drops the pages from the process, what was written is kept in the file
+		size_t begin, end;
+		if (pageRange(offset, bytes, begin, end))
+		{
+			madvise(data + begin, end - begin, MADV_DONTNEED);
+		}
+	}
+#endif
+
+	bool MappedScratchFile::pageRange(size_t offset, size_t bytes, size_t& begin, size_t& end) const
+	{
+		static const size_t pageSize = osPageSize();
+		begin = offset / pageSize * pageSize;
+		end = std::min(capacity, (offset + bytes + pageSize - 1) / pageSize * pageSize);
+		return data != nullptr && begin < end;
+	}
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace Fluid
+{
+	// A whole file mapped read only into memory. Pages are read in by the OS as they are touched,
+	// so opening a big file costs nothing until its contents are used.
+	class MappedFile
+	{
+	public:
+		MappedFile() {}
+		MappedFile(const MappedFile& other) = delete;
+		MappedFile& operator=(const MappedFile& other) = delete;
+		~MappedFile();
+
+		// False if the file doesn't exist, is empty or can't be mapped
+		bool open(const std::string& path);
+		void close();
+
+		bool isOpen() const { return data != nullptr; }
+		const uint8_t* getData() const { return data; }
+		size_t getSize() const { return size; }
+
+	private:
+		const uint8_t* data = nullptr;
+		size_t size = 0;
+#if defined(_WIN32)
+		void* file = nullptr;
+		void* mapping = nullptr;
+#endif
+	};
+
+	// A temporary file mapped for reading and writing, grown as it fills. The OS writes touched pages back
+	// to the file and drops them when memory runs short, so the contents can be far bigger than memory.
+	// The file is gone once closed, or once the process ends however it ends.
+	class MappedScratchFile
+	{
+	public:
+		MappedScratchFile() {}
+		MappedScratchFile(const MappedScratchFile& other) = delete;
+		MappedScratchFile& operator=(const MappedScratchFile& other) = delete;
+		~MappedScratchFile();
+
+		// A new file in the directory, which must exist. False if it can't be made.
+		bool open(const std::string& directory);
+		void close();
+		// Grows the file and the mapping to at least bytes, keeping the contents. Moves getData().
+		// False if the disk is full, the mapping is then as it was.
+		bool reserve(size_t bytes);
+		void swap(MappedScratchFile& other);
+
+		bool isOpen() const;
+		uint8_t* getData() const { return data; }
+		size_t getCapacity() const { return capacity; }
+
+		// Hints only, the contents are the same whatever they do. Ranges are widened to whole OS pages.
+		// Starts reading the range in ahead of use
+		void prefetch(size_t offset, size_t bytes) const;
+		// Starts writing the range's dirty pages to the file without waiting for them
+		void writeBack(size_t offset, size_t bytes) const;
+		// Lets the range go from memory, it is read back from the file if touched again
+		void evict(size_t offset, size_t bytes) const;
+
+	private:
+		// The range widened to whole OS pages and cut to the mapping, false if nothing is left
+		bool pageRange(size_t offset, size_t bytes, size_t& begin, size_t& end) const;
+		bool map(size_t bytes);
+
+		uint8_t* data = nullptr;
+		size_t capacity = 0;
+#if defined(_WIN32)
+		void* handle = nullptr;
+		void* mapping = nullptr;
+#else
+		int handle = -1;
+#endif
+	};
+}
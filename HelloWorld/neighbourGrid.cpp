@@ -0,0 +1,503 @@
+#include "neighbourGrid.h"
+#include "particle.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace Fluid
+{
+	static uint64_t ChunkKey(int32_t x, int32_t y)
+	{
+		return ((uint64_t)(uint32_t)x << 32) | (uint32_t)y;
+	}
+
+	// Fibonacci hashing, the top bits of the product are well mixed even for neighbouring chunks
+	static size_t ChunkSlot(uint64_t key, size_t mask)
+	{
+		return (size_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+	}
+
+	int NeighbourGrid::cellX(float x) const
+	{
+		const float cell = (x - originX) / cellWidth;
+		// NaN and runaway particles end up in the border cells
+		if (!(cell > 0.0f))
+		{
+			return wrapX && cell < 0.0f ? wrapColumn((int)std::floor(std::max(cell, -1e6f))) : 0;
+		}
+		return wrapX ? wrapColumn((int)std::min(cell, 1e6f)) : std::min((int)cell, columns - 1);
+	}
+
+	int NeighbourGrid::cellY(float y) const
+	{
+		const float cell = (y - originY) / cellHeight;
+		if (!(cell > 0.0f))
+		{
+			return wrapY && cell < 0.0f ? wrapRow((int)std::floor(std::max(cell, -1e6f))) : 0;
+		}
+		return wrapY ? wrapRow((int)std::min(cell, 1e6f)) : std::min((int)cell, rows - 1);
+	}
+
+	int NeighbourGrid::wrapColumn(int column) const
+	{
+		if (wrapX)
+		{
+			return ((column % columns) + columns) % columns;
+		}
+		return std::max(0, std::min(column, columns - 1));
+	}
+
+	int NeighbourGrid::wrapRow(int row) const
+	{
+		if (wrapY)
+		{
+			return ((row % rows) + rows) % rows;
+		}
+		return std::max(0, std::min(row, rows - 1));
+	}
+
+	void NeighbourGrid::build(uint32_t count, float radius, const Render::PeriodicDomain& periodic)
+	{
+		float minX = 0.0f, minY = 0.0f, maxX = 0.0f, maxY = 0.0f;
+		bool first = true;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const Vector2f& pos = Render::GetParticle(i).pos;
+			if (!std::isfinite(pos.x) || !std::isfinite(pos.y))
+			{
+				continue;
+			}
+			minX = first ? pos.x : std::min(minX, pos.x);
+			minY = first ? pos.y : std::min(minY, pos.y);
+			maxX = first ? pos.x : std::max(maxX, pos.x);
+			maxY = first ? pos.y : std::max(maxY, pos.y);
+			first = false;
+		}
+
+		// A wrapped axis needs whole cells across the period, and at least three so the cells either side
+		// of one are different cells
+		wrapX = periodic.x && periodic.size.x >= 3.0f * radius;
+		wrapY = periodic.y && periodic.size.y >= 3.0f * radius;
+
+		// A wrapped domain is bounded, and its cells are mostly full, so it is always dense
+		const double denseCells = ((double)(maxX - minX) / radius + 1.0) * ((double)(maxY - minY) / radius + 1.0);
+		const bool wantSparse = !wrapX && !wrapY && (layout == Layout::Sparse
+			|| (layout == Layout::Auto && denseCells > (double)sparseCellsPerParticle * count + sparseMinimumCells));
+		if (wantSparse)
+		{
+			std::vector<uint32_t>().swap(cellStart);
+			buildSparse(count, radius);
+			return;
+		}
+		if (sparse)
+		{
+			sparse = false;
+			std::vector<Chunk>().swap(chunks);
+			std::vector<uint32_t>().swap(liveChunks);
+			std::vector<uint32_t>().swap(freeChunks);
+			std::vector<uint64_t>().swap(slotKeys);
+			std::vector<int32_t>().swap(slotChunks);
+		}
+
+		const float extent = std::max(maxX - minX, maxY - minY);
+		const float cellSize = std::max(radius, extent / (maxCellsPerAxis - 1));
+		cellWidth = cellSize;
+		cellHeight = cellSize;
+		originX = minX;
+		originY = minY;
+		columns = std::max(1, (int)((maxX - minX) / cellSize) + 1);
+		rows = std::max(1, (int)((maxY - minY) / cellSize) + 1);
+		if (wrapX)
+		{
+			columns = std::min(maxCellsPerAxis, (int)(periodic.size.x / radius));
+			cellWidth = periodic.size.x / columns;
+			originX = periodic.origin.x;
+		}
+		if (wrapY)
+		{
+			rows = std::min(maxCellsPerAxis, (int)(periodic.size.y / radius));
+			cellHeight = periodic.size.y / rows;
+			originY = periodic.origin.y;
+		}
+
+		// Counting sort by cell, walking the particles in index order keeps every cell ascending
+		cellStart.assign((size_t)columns * rows + 1, 0);
+		particleCell.resize(count);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const Vector2f& pos = Render::GetParticle(i).pos;
+			particleCell[i] = (uint32_t)(cellY(pos.y) * columns + cellX(pos.x));
+			cellStart[particleCell[i] + 1]++;
+		}
+		for (size_t c = 1; c < cellStart.size(); c++)
+		{
+			cellStart[c] += cellStart[c - 1];
+		}
+
+		entries.resize(count);
+		scratch.assign(cellStart.begin(), cellStart.end() - 1);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			entries[scratch[particleCell[i]]++] = i;
+		}
+	}
+
+	void NeighbourGrid::gather(uint32_t index, std::vector<uint32_t>& out) const
+	{
+		out.clear();
+		if (sparse)
+		{
+			gatherSparse(index, out);
+			std::sort(out.begin(), out.end());
+			return;
+		}
+
+		const int cx = (int)(particleCell[index] % columns);
+		const int cy = (int)(particleCell[index] / columns);
+		for (int dy = -1; dy <= 1; dy++)
+		{
+			const int y = cy + dy;
+			if (!wrapY && (y < 0 || y >= rows))
+			{
+				continue;
+			}
+			const int row = wrapRow(y) * columns;
+
+			if (!wrapX || (cx > 0 && cx < columns - 1))
+			{
+				// The three cells of a row are contiguous in the sorted entries
+				const uint32_t begin = cellStart[row + std::max(cx - 1, 0)];
+				const uint32_t end = cellStart[row + std::min(cx + 1, columns - 1) + 1];
+				out.insert(out.end(), entries.begin() + begin, entries.begin() + end);
+				continue;
+			}
+
+			// Against a wrapped edge one of them is on the far side
+			for (int dx = -1; dx <= 1; dx++)
+			{
+				const int cell = row + wrapColumn(cx + dx);
+				out.insert(out.end(), entries.begin() + cellStart[cell], entries.begin() + cellStart[cell + 1]);
+			}
+		}
+
+		std::sort(out.begin(), out.end());
+	}
+
+	void NeighbourGrid::gatherRect(const Vector2f& topLeft, const Vector2f& bottomRight, std::vector<uint32_t>& out) const
+	{
+		out.clear();
+		if (sparse)
+		{
+			gatherRectSparse(topLeft, bottomRight, out);
+			std::sort(out.begin(), out.end());
+			return;
+		}
+		if (cellStart.empty())
+		{
+			return;
+		}
+
+		// Wrapped, the rectangle can run off one side and on at the other, but never covers a cell twice
+		const int left = wrapX ? (int)std::floor((topLeft.x - originX) / cellWidth) : cellX(topLeft.x);
+		const int right = wrapX ? std::min(left + columns - 1, (int)std::floor((bottomRight.x - originX) / cellWidth)) : cellX(bottomRight.x);
+		const int top = wrapY ? (int)std::floor((topLeft.y - originY) / cellHeight) : cellY(topLeft.y);
+		const int bottom = wrapY ? std::min(top + rows - 1, (int)std::floor((bottomRight.y - originY) / cellHeight)) : cellY(bottomRight.y);
+		for (int y = top; y <= bottom; y++)
+		{
+			const int row = wrapRow(y) * columns;
+			if (!wrapX)
+			{
+				const uint32_t begin = cellStart[row + left];
+				const uint32_t end = cellStart[row + right + 1];
+				out.insert(out.end(), entries.begin() + begin, entries.begin() + end);
+				continue;
+			}
+			for (int x = left; x <= right; x++)
+			{
+				const int cell = row + wrapColumn(x);
+				out.insert(out.end(), entries.begin() + cellStart[cell], entries.begin() + cellStart[cell + 1]);
+			}
+		}
+		std::sort(out.begin(), out.end());
+	}
+
+	size_t NeighbourGrid::getMemoryBytes() const
+	{
+		return (cellStart.capacity() + entries.capacity() + particleCell.capacity() + scratch.capacity()) * sizeof(uint32_t)
+			+ chunks.capacity() * sizeof(Chunk)
+			+ (liveChunks.capacity() + freeChunks.capacity()) * sizeof(uint32_t)
+			+ slotKeys.capacity() * sizeof(uint64_t) + slotChunks.capacity() * sizeof(int32_t);
+	}
+
+	int NeighbourGrid::sparseCell(float coordinate) const
+	{
+		const float cell = coordinate / sparseCellSize;
+		// NaN lands in the chunk at the origin, runaway particles in chunks far out but still in range
+		if (!(cell == cell))
+		{
+			return 0;
+		}
+		return (int)std::floor(std::max(-1e8f, std::min(cell, 1e8f)));
+	}
+
+	int32_t NeighbourGrid::findChunk(int32_t x, int32_t y) const
+	{
+		if (slotKeys.empty())
+		{
+			return -1;
+		}
+		const uint64_t key = ChunkKey(x, y);
+		const size_t mask = slotKeys.size() - 1;
+		for (size_t slot = ChunkSlot(key, mask); ; slot = (slot + 1) & mask)
+		{
+			if (slotChunks[slot] < 0)
+			{
+				return -1;
+			}
+			if (slotKeys[slot] == key)
+			{
+				return slotChunks[slot];
+			}
+		}
+	}
+
+	void NeighbourGrid::insertChunk(uint32_t index)
+	{
+		const uint64_t key = ChunkKey(chunks[index].x, chunks[index].y);
+		const size_t mask = slotKeys.size() - 1;
+		size_t slot = ChunkSlot(key, mask);
+		while (slotChunks[slot] >= 0)
+		{
+			slot = (slot + 1) & mask;
+		}
+		slotKeys[slot] = key;
+		slotChunks[slot] = (int32_t)index;
+	}
+
+	void NeighbourGrid::rehash()
+	{
+		// At most a quarter full afterwards, grown again past half
+		size_t slots = 64;
+		while (slots < liveChunks.size() * 4)
+		{
+			slots *= 2;
+		}
+		slotKeys.assign(slots, 0);
+		slotChunks.assign(slots, -1);
+		for (uint32_t index : liveChunks)
+		{
+			insertChunk(index);
+		}
+	}
+
+	uint32_t NeighbourGrid::acquireChunk(int32_t x, int32_t y)
+	{
+		uint32_t index;
+		if (!freeChunks.empty())
+		{
+			index = freeChunks.back();
+			freeChunks.pop_back();
+		}
+		else
+		{
+			index = (uint32_t)chunks.size();
+			chunks.emplace_back();
+		}
+
+		Chunk& chunk = chunks[index];
+		chunk.x = x;
+		chunk.y = y;
+		chunk.stamp = 0;
+		liveChunks.push_back(index);
+
+		if (liveChunks.size() * 2 > slotKeys.size())
+		{
+			rehash();
+		}
+		else
+		{
+			insertChunk(index);
+		}
+		return index;
+	}
+
+	void NeighbourGrid::buildSparse(uint32_t count, float radius)
+	{
+		sparse = true;
+		columns = 0;
+		rows = 0;
+		buildStamp++;
+		// Chunks keyed on the old cell size would be in the wrong places
+		if (radius != sparseCellSize)
+		{
+			sparseCellSize = radius;
+			liveChunks.clear();
+			freeChunks.clear();
+			chunks.clear();
+			slotKeys.clear();
+			slotChunks.clear();
+		}
+
+		// Keeps some free chunks for the fluid to move into, the rest of the pool goes back to the allocator
+		if (freeChunks.size() > liveChunks.size() * 2 + 64)
+		{
+			std::vector<Chunk> kept;
+			kept.reserve(liveChunks.size() * 2);
+			for (uint32_t& index : liveChunks)
+			{
+				kept.push_back(chunks[index]);
+				index = (uint32_t)kept.size() - 1;
+			}
+			chunks.swap(kept);
+			freeChunks.clear();
+			rehash();
+		}
+
+		// Find or make the chunk of every particle and count the particles per cell. Neighbouring
+		// particles usually share a chunk, so the last one found is tried before the hash.
+		particleCell.resize(count);
+		int32_t lastX = 0, lastY = 0, lastChunk = -1;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const Vector2f& pos = Render::GetParticle(i).pos;
+			const int x = sparseCell(pos.x);
+			const int y = sparseCell(pos.y);
+			const int32_t chunkX = x >> chunkShift;
+			const int32_t chunkY = y >> chunkShift;
+			if (lastChunk < 0 || chunkX != lastX || chunkY != lastY)
+			{
+				lastChunk = findChunk(chunkX, chunkY);
+				if (lastChunk < 0)
+				{
+					lastChunk = (int32_t)acquireChunk(chunkX, chunkY);
+				}
+				lastX = chunkX;
+				lastY = chunkY;
+			}
+
+			Chunk& chunk = chunks[lastChunk];
+			if (chunk.stamp != buildStamp)
+			{
+				chunk.stamp = buildStamp;
+				std::memset(chunk.cellStart, 0, sizeof(chunk.cellStart));
+			}
+			const uint32_t local = (uint32_t)(((y & (chunkSize - 1)) << chunkShift) | (x & (chunkSize - 1)));
+			chunk.cellStart[local + 1]++;
+			particleCell[i] = (uint32_t)lastChunk * chunkCells + local;
+		}
+
+		// Chunks nobody landed in go back to the pool
+		size_t kept = 0;
+		for (uint32_t index : liveChunks)
+		{
+			if (chunks[index].stamp == buildStamp)
+			{
+				liveChunks[kept++] = index;
+			}
+			else
+			{
+				freeChunks.push_back(index);
+			}
+		}
+		if (kept < liveChunks.size())
+		{
+			liveChunks.resize(kept);
+			rehash();
+		}
+
+		// Counting sort over every live cell, chunk after chunk
+		uint32_t offset = 0;
+		scratch.resize(chunks.size() * chunkCells);
+		for (uint32_t index : liveChunks)
+		{
+			Chunk& chunk = chunks[index];
+			chunk.cellStart[0] = offset;
+			for (int c = 1; c <= chunkCells; c++)
+			{
+				chunk.cellStart[c] += chunk.cellStart[c - 1];
+			}
+			offset = chunk.cellStart[chunkCells];
+			std::copy(chunk.cellStart, chunk.cellStart + chunkCells, scratch.begin() + (size_t)index * chunkCells);
+
+			for (int dy = -1; dy <= 1; dy++)
+			{
+				for (int dx = -1; dx <= 1; dx++)
+				{
+					chunk.neighbours[(dy + 1) * 3 + dx + 1] = findChunk(chunk.x + dx, chunk.y + dy);
+				}
+			}
+		}
+
+		entries.resize(count);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			entries[scratch[particleCell[i]]++] = i;
+		}
+	}
+
+	void NeighbourGrid::gatherSparse(uint32_t index, std::vector<uint32_t>& out) const
+	{
+		const uint32_t cell = particleCell[index];
+		const Chunk& chunk = chunks[cell / chunkCells];
+		const int x = (int)(cell & (chunkSize - 1));
+		const int y = (int)((cell >> chunkShift) & (chunkSize - 1));
+
+		if (x > 0 && x < chunkSize - 1 && y > 0 && y < chunkSize - 1)
+		{
+			// Inside the chunk the three cells of a row are contiguous
+			for (int dy = -1; dy <= 1; dy++)
+			{
+				const uint32_t* row = chunk.cellStart + ((y + dy) << chunkShift) + x;
+				out.insert(out.end(), entries.begin() + row[-1], entries.begin() + row[2]);
+			}
+			return;
+		}
+
+		// On the edge, each cell from whichever neighbour chunk holds it
+		for (int dy = -1; dy <= 1; dy++)
+		{
+			const int ny = y + dy;
+			for (int dx = -1; dx <= 1; dx++)
+			{
+				const int nx = x + dx;
+				// -1 is the chunk before, 0..chunkSize - 1 this one, chunkSize the one after
+				const int32_t neighbour = chunk.neighbours[((ny + chunkSize) >> chunkShift) * 3 + ((nx + chunkSize) >> chunkShift)];
+				if (neighbour < 0)
+				{
+					continue;
+				}
+				const uint32_t* start = chunks[neighbour].cellStart + ((ny & (chunkSize - 1)) << chunkShift) + (nx & (chunkSize - 1));
+				out.insert(out.end(), entries.begin() + start[0], entries.begin() + start[1]);
+			}
+		}
+	}
+
+	void NeighbourGrid::gatherRectSparse(const Vector2f& topLeft, const Vector2f& bottomRight, std::vector<uint32_t>& out) const
+	{
+		const int left = sparseCell(topLeft.x);
+		const int right = sparseCell(bottomRight.x);
+		const int top = sparseCell(topLeft.y);
+		const int bottom = sparseCell(bottomRight.y);
+		for (int32_t chunkY = top >> chunkShift; chunkY <= (bottom >> chunkShift); chunkY++)
+		{
+			for (int32_t chunkX = left >> chunkShift; chunkX <= (right >> chunkShift); chunkX++)
+			{
+				const int32_t index = findChunk(chunkX, chunkY);
+				if (index < 0)
+				{
+					continue;
+				}
+				const Chunk& chunk = chunks[index];
+				const int x0 = std::max(left - chunkX * chunkSize, 0);
+				const int x1 = std::min(right - chunkX * chunkSize, chunkSize - 1);
+				const int y0 = std::max(top - chunkY * chunkSize, 0);
+				const int y1 = std::min(bottom - chunkY * chunkSize, chunkSize - 1);
+				for (int y = y0; y <= y1; y++)
+				{
+					const uint32_t* row = chunk.cellStart + (y << chunkShift);
+					out.insert(out.end(), entries.begin() + row[x0], entries.begin() + row[x1 + 1]);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "Play.h"
+#include "boundary.h"
+#include "particleArray.h"
+
+namespace Fluid
+{
+	// Uniform grid over the particles, cells at least one interaction radius wide so every
+	// neighbour of a particle is in the 3x3 cells around it. Built with a counting sort, no per cell allocations.
+	// On a wrapped axis the cells tile the period exactly and the cells past either end are the ones on the
+	// other side (ghost cells by index), so no particle is ever copied.
+	//
+	// Fluid spread thinly over a big area (a long stream across a large map) would leave almost every
+	// cell of the dense grid empty, so the grid switches to fixed size chunks of cells instead, made only
+	// where there are particles. Chunks come from a pool and are found through an open addressing hash,
+	// and chunks left empty by a build go back to the pool. Memory then follows the area the fluid covers
+	// rather than the area of its bounds.
+	class NeighbourGrid
+	{
+	public:
+		enum class Layout
+		{
+			// Sparse once the dense grid would have many more cells than particles
+			Auto,
+			Dense,
+			Sparse
+		};
+
+		void setLayout(Layout newLayout) { layout = newLayout; }
+		Layout getLayout() const { return layout; }
+
+		void build(uint32_t count, float radius, const Render::PeriodicDomain& periodic = Render::PeriodicDomain());
+
+		// Every particle in the 3x3 cells around the particle's cell at build time, ascending index order.
+		// The order matches the brute force loops so the accelerated kernels apply updates in the same sequence.
+		void gather(uint32_t index, std::vector<uint32_t>& out) const;
+		// Every particle in the cells overlapping the rectangle, ascending index order
+		void gatherRect(const Vector2f& topLeft, const Vector2f& bottomRight, std::vector<uint32_t>& out) const;
+
+		bool isSparse() const { return sparse; }
+		// Cells with storage, the whole grid when dense
+		uint32_t getCellCount() const { return sparse ? (uint32_t)liveChunks.size() * chunkCells : (uint32_t)columns * rows; }
+		uint32_t getChunkCount() const { return (uint32_t)liveChunks.size(); }
+		// Bytes held by the grid's buffers
+		size_t getMemoryBytes() const;
+
+	private:
+		int cellX(float x) const;
+		int cellY(float y) const;
+		// A cell index that may be off either end, wrapped or clamped back onto the grid
+		int wrapColumn(int column) const;
+		int wrapRow(int row) const;
+
+		// Particles into the chunks, on a fixed lattice of radius sized cells from the world origin
+		void buildSparse(uint32_t count, float radius);
+		void gatherSparse(uint32_t index, std::vector<uint32_t>& out) const;
+		void gatherRectSparse(const Vector2f& topLeft, const Vector2f& bottomRight, std::vector<uint32_t>& out) const;
+		int sparseCell(float coordinate) const;
+
+		// -1 if there is no chunk there
+		int32_t findChunk(int32_t x, int32_t y) const;
+		uint32_t acquireChunk(int32_t x, int32_t y);
+		void insertChunk(uint32_t index);
+		// Rebuilds the hash from the live chunks, sized for twice as many
+		void rehash();
+
+		// Bounds the cell count when particles fly far apart, cells grow instead
+		static const int maxCellsPerAxis = 1024;
+		// Auto goes sparse past this many dense cells per particle
+		static const int sparseCellsPerParticle = 8;
+		// and small grids stay dense whatever the particle count
+		static const int sparseMinimumCells = 1 << 16;
+		// Chunks are chunkSize x chunkSize cells
+		static const int chunkShift = 3;
+		static const int chunkSize = 1 << chunkShift;
+		static const int chunkCells = chunkSize * chunkSize;
+
+		struct Chunk
+		{
+			int32_t x = 0;
+			int32_t y = 0;
+			// The last build that put a particle in it
+			uint32_t stamp = 0;
+			// The chunks around it, 3x3 with itself in the middle, -1 where there is none. Saves a hash
+			// lookup per neighbour cell when a particle sits on the chunk's edge.
+			int32_t neighbours[9];
+			// Into entries, absolute like the dense cellStart
+			uint32_t cellStart[chunkCells + 1];
+		};
+
+		float cellWidth = 1.0f;
+		float cellHeight = 1.0f;
+		float originX = 0.0f;
+		float originY = 0.0f;
+		int columns = 0;
+		int rows = 0;
+		bool wrapX = false;
+		bool wrapY = false;
+		Layout layout = Layout::Auto;
+		bool sparse = false;
+		float sparseCellSize = 1.0f;
+
+		std::vector<uint32_t> cellStart;
+		// Paged with the particles, entries and scratch go by cell so the pager's hints pass them by
+		ParticleArray<uint32_t> entries{ false };
+		ParticleArray<uint32_t> particleCell;
+		ParticleArray<uint32_t> scratch{ false };
+
+		// The pool, live chunks in build order, and the ones free for reuse
+		std::vector<Chunk> chunks;
+		std::vector<uint32_t> liveChunks;
+		std::vector<uint32_t> freeChunks;
+		uint32_t buildStamp = 0;
+		// Open addressing with linear probing, a power of two slots, -1 for an empty slot
+		std::vector<uint64_t> slotKeys;
+		std::vector<int32_t> slotChunks;
+	};
+}
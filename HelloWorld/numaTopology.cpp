@@ -0,0 +1,229 @@
+#include "numaTopology.h"
+#include <algorithm>
+#include <thread>
+
+#if defined(_WIN32)
+#include "Play.h"
+#include <psapi.h>
+#else
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace Fluid
+{
+	NumaTopology& NumaTopology::instance()
+	{
+		static NumaTopology instance;
+
+		return instance;
+	}
+
+#if defined(_WIN32)
+	NumaTopology::NumaTopology()
+	{
+		ULONG highestNode = 0;
+		GetNumaHighestNodeNumber(&highestNode);
+		nodeFirstCpu.push_back(0);
+		for (ULONG node = 0; node <= highestNode && node < 64; node++)
+		{
+			ULONGLONG mask = 0;
+			if (!GetNumaNodeProcessorMask((UCHAR)node, &mask) || mask == 0)
+			{
+				continue;
+			}
+			for (uint32_t cpu = 0; cpu < 64; cpu++)
+			{
+				if (mask & (1ull << cpu))
+				{
+					cpus.push_back(cpu);
+				}
+			}
+			nodeFirstCpu.push_back((uint32_t)cpus.size());
+			nodeIds.push_back((int)node);
+		}
+
+		if (cpus.empty())
+		{
+			for (uint32_t cpu = 0; cpu < std::min(64u, std::max(1u, std::thread::hardware_concurrency())); cpu++)
+			{
+				cpus.push_back(cpu);
+			}
+			nodeFirstCpu = { 0, (uint32_t)cpus.size() };
+			nodeIds = { 0 };
+		}
+	}
+
+	bool NumaTopology::pinCurrentThread(uint32_t cpu) const
+	{
+		return cpu < 64 && SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+	}
+
+	void NumaTopology::unpinCurrentThread() const
+	{
+		DWORD_PTR process = 0;
+		DWORD_PTR system = 0;
+		if (GetProcessAffinityMask(GetCurrentProcess(), &process, &system))
+		{
+			SetThreadAffinityMask(GetCurrentThread(), process);
+		}
+	}
+
+	void* NumaTopology::allocatePages(size_t bytes)
+	{
+		return VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	}
+
+	void NumaTopology::freePages(void* pages, size_t bytes)
+	{
+		if (pages)
+		{
+			VirtualFree(pages, 0, MEM_RELEASE);
+		}
+	}
+
+	bool NumaTopology::queryPageNodes(const void* const* pages, size_t count, int* nodes)
+	{
+		std::vector<PSAPI_WORKING_SET_EX_INFORMATION> info(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			info[i].VirtualAddress = const_cast<void*>(pages[i]);
+		}
+		if (count == 0 || !K32QueryWorkingSetEx(GetCurrentProcess(), info.data(), (DWORD)(count * sizeof(PSAPI_WORKING_SET_EX_INFORMATION))))
+		{
+			return false;
+		}
+		for (size_t i = 0; i < count; i++)
+		{
+			nodes[i] = info[i].VirtualAttributes.Valid ? (int)info[i].VirtualAttributes.Node : -1;
+		}
+		return true;
+	}
+#else
+	// "0-3,8-11" into its cores
+	static void parseCpuList(const std::string& list, std::vector<uint32_t>& out)
+	{
+		size_t at = 0;
+		while (at < list.size())
+		{
+			size_t end = list.find(',', at);
+			if (end == std::string::npos)
+			{
+				end = list.size();
+			}
+			const std::string range = list.substr(at, end - at);
+			const size_t dash = range.find('-');
+			if (!range.empty() && isdigit((unsigned char)range[0]))
+			{
+				const uint32_t first = (uint32_t)std::stoul(range);
+				const uint32_t last = dash == std::string::npos ? first : (uint32_t)std::stoul(range.substr(dash + 1));
+				for (uint32_t cpu = first; cpu <= last; cpu++)
+				{
+					out.push_back(cpu);
+				}
+			}
+			at = end + 1;
+		}
+	}
+
+	NumaTopology::NumaTopology()
+	{
+		// Listed rather than counted up, node numbers can have gaps
+		std::vector<int> present;
+		std::error_code error;
+		for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator("/sys/devices/system/node", error))
+		{
+			const std::string name = entry.path().filename().string();
+			if (name.size() > 4 && name.compare(0, 4, "node") == 0 && std::all_of(name.begin() + 4, name.end(), [](char c) { return isdigit((unsigned char)c) != 0; }))
+			{
+				present.push_back(atoi(name.c_str() + 4));
+			}
+		}
+		std::sort(present.begin(), present.end());
+
+		nodeFirstCpu.push_back(0);
+		for (int node : present)
+		{
+			std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+			std::string list;
+			if (!file || !std::getline(file, list))
+			{
+				continue;
+			}
+			const size_t before = cpus.size();
+			parseCpuList(list, cpus);
+			// A node with memory and no cores has nothing to run threads on
+			if (cpus.size() > before)
+			{
+				nodeFirstCpu.push_back((uint32_t)cpus.size());
+				nodeIds.push_back(node);
+			}
+		}
+
+		if (cpus.empty())
+		{
+			for (uint32_t cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++)
+			{
+				cpus.push_back(cpu);
+			}
+			nodeFirstCpu = { 0, (uint32_t)cpus.size() };
+			nodeIds = { 0 };
+		}
+	}
+
+	bool NumaTopology::pinCurrentThread(uint32_t cpu) const
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+	}
+
+	void NumaTopology::unpinCurrentThread() const
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (uint32_t cpu : cpus)
+		{
+			CPU_SET(cpu, &set);
+		}
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+
+	void* NumaTopology::allocatePages(size_t bytes)
+	{
+		void* pages = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		return pages == MAP_FAILED ? nullptr : pages;
+	}
+
+	void NumaTopology::freePages(void* pages, size_t bytes)
+	{
+		if (pages)
+		{
+			munmap(pages, bytes);
+		}
+	}
+
+	bool NumaTopology::queryPageNodes(const void* const* pages, size_t count, int* nodes)
+	{
+#if defined(SYS_move_pages)
+		// With no target nodes move_pages only reports where each page is
+		return count > 0 && syscall(SYS_move_pages, 0, (unsigned long)count, pages, nullptr, nodes, 0) == 0;
+#else
+		return false;
+#endif
+	}
+#endif
+
+	uint32_t NumaTopology::getNodeOfCpuSlot(uint32_t slot) const
+	{
+		return (uint32_t)(std::upper_bound(nodeFirstCpu.begin(), nodeFirstCpu.end(), slot) - nodeFirstCpu.begin()) - 1;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Fluid
+{
+	// The machine's NUMA nodes and the cores on each, read once. A machine, or a platform, that doesn't
+	// say is one node holding every core. Only the first 64 cores on Windows, the ones in processor group 0.
+	class NumaTopology
+	{
+	public:
+		static NumaTopology& instance();
+
+		uint32_t getNodeCount() const { return (uint32_t)nodeFirstCpu.size() - 1; }
+		// Every core, node by node
+		const std::vector<uint32_t>& getCpus() const { return cpus; }
+		// Node of getCpus()[slot]. Nodes are counted 0.. over the ones with cores.
+		uint32_t getNodeOfCpuSlot(uint32_t slot) const;
+		// The OS's number for node, what queryPageNodes reports. Differs from node where the numbers have gaps or
+		// a node has memory and no cores.
+		int getNodeId(uint32_t node) const { return nodeIds[node]; }
+
+		// Keeps the calling thread on one core, or lets it run anywhere again. False if the platform refused.
+		bool pinCurrentThread(uint32_t cpu) const;
+		void unpinCurrentThread() const;
+
+		// Zeroed pages that aren't backed by memory yet: each lands on the node of the thread that first writes it
+		static void* allocatePages(size_t bytes);
+		static void freePages(void* pages, size_t bytes);
+		static size_t getPageSize() { return 4096; }
+		// The node holding each page, negative for a page not in memory yet. False if the platform can't tell.
+		static bool queryPageNodes(const void* const* pages, size_t count, int* nodes);
+
+	private:
+		// Cores node by node, node n's are cpus[nodeFirstCpu[n]..nodeFirstCpu[n + 1])
+		std::vector<uint32_t> cpus;
+		std::vector<uint32_t> nodeFirstCpu;
+		std::vector<int> nodeIds;
+
+		NumaTopology();
+		NumaTopology(const NumaTopology& other) = delete;
+	};
+}
@@ -0,0 +1,403 @@
+#include "obstacles.h"
+#include "threadPool.h"
+
+namespace Fluid
+{
+	static float segmentDistance(const Vector2f& pos, const Vector2f& a, const Vector2f& b)
+	{
+		const Vector2f edge = b - a;
+		const float lengthSqr = edge.LengthSqr();
+		const float t = lengthSqr > 0.0f ? std::max(0.0f, std::min(1.0f, dot(pos - a, edge) / lengthSqr)) : 0.0f;
+		return (pos - (a + edge * t)).Length();
+	}
+
+	float ObstacleShape::distance(const Vector2f& pos) const
+	{
+		float result = 0.0f;
+		switch (type)
+		{
+		case Type::Circle:
+			result = (pos - centre).Length() - radius;
+			break;
+		case Type::Box:
+		{
+			// Into the box's own frame, then the usual distance to an axis aligned box
+			const Vector2f offset = pos - centre;
+			const float c = std::cos(angle);
+			const float s = std::sin(angle);
+			const Vector2f local = { std::fabs(c * offset.x + s * offset.y) - halfSize.x, std::fabs(-s * offset.x + c * offset.y) - halfSize.y };
+			const Vector2f outside = { std::max(local.x, 0.0f), std::max(local.y, 0.0f) };
+			result = outside.Length() + std::min(std::max(local.x, local.y), 0.0f);
+			break;
+		}
+		case Type::Segment:
+			result = points.size() < 2 ? 0.0f : segmentDistance(pos, points[0], points[1]) - radius;
+			break;
+		case Type::Polygon:
+		{
+			// Nearest edge for the size, crossings of a ray to +x for the side
+			float nearest = 1e30f;
+			bool inside = false;
+			for (size_t i = 0, j = points.size() - 1; i < points.size(); j = i++)
+			{
+				const Vector2f& a = points[j];
+				const Vector2f& b = points[i];
+				nearest = std::min(nearest, segmentDistance(pos, a, b));
+				if ((b.y > pos.y) != (a.y > pos.y) && pos.x < a.x + (b.x - a.x) * (pos.y - a.y) / (b.y - a.y))
+				{
+					inside = !inside;
+				}
+			}
+			result = points.size() < 3 ? 1e30f : (inside ? -nearest : nearest);
+			break;
+		}
+		}
+		return container ? -result : result;
+	}
+
+	void ObstacleShape::draw(Play::Colour colour) const
+	{
+		switch (type)
+		{
+		case Type::Circle:
+			Play::DrawCircle({ centre.x, centre.y }, (int)radius, colour);
+			break;
+		case Type::Box:
+		{
+			const float c = std::cos(angle);
+			const float s = std::sin(angle);
+			const Vector2f axisX = { c * halfSize.x, s * halfSize.x };
+			const Vector2f axisY = { -s * halfSize.y, c * halfSize.y };
+			const Vector2f corners[4] = { centre - axisX - axisY, centre + axisX - axisY, centre + axisX + axisY, centre - axisX + axisY };
+			for (int i = 0; i < 4; i++)
+			{
+				const Vector2f& a = corners[i];
+				const Vector2f& b = corners[(i + 1) % 4];
+				Play::DrawLine({ a.x, a.y }, { b.x, b.y }, colour);
+			}
+			break;
+		}
+		case Type::Segment:
+			if (points.size() >= 2)
+			{
+				Play::DrawLine({ points[0].x, points[0].y }, { points[1].x, points[1].y }, colour);
+				Play::DrawCircle({ points[0].x, points[0].y }, (int)radius, colour);
+				Play::DrawCircle({ points[1].x, points[1].y }, (int)radius, colour);
+			}
+			break;
+		case Type::Polygon:
+			for (size_t i = 0, j = points.size() - 1; i < points.size(); j = i++)
+			{
+				Play::DrawLine({ points[j].x, points[j].y }, { points[i].x, points[i].y }, colour);
+			}
+			break;
+		}
+	}
+
+	// Squared distance transform of one line. f holds 0 on the pixels being measured to and a huge value
+	// elsewhere, out gets the squared distance to the nearest of them. Lower envelope of parabolas,
+	// v and z are scratch of n and n + 1.
+	static void distanceTransform(const double* f, double* out, int n, int* v, double* z)
+	{
+		int k = 0;
+		v[0] = 0;
+		z[0] = -1e30;
+		z[1] = 1e30;
+		for (int q = 1; q < n; q++)
+		{
+			double s = ((f[q] + (double)q * q) - (f[v[k]] + (double)v[k] * v[k])) / (2.0 * q - 2.0 * v[k]);
+			while (s <= z[k])
+			{
+				k--;
+				s = ((f[q] + (double)q * q) - (f[v[k]] + (double)v[k] * v[k])) / (2.0 * q - 2.0 * v[k]);
+			}
+			k++;
+			v[k] = q;
+			z[k] = s;
+			z[k + 1] = 1e30;
+		}
+
+		k = 0;
+		for (int q = 0; q < n; q++)
+		{
+			while (z[k + 1] < q)
+			{
+				k++;
+			}
+			out[q] = (double)(q - v[k]) * (q - v[k]) + f[v[k]];
+		}
+	}
+
+	// Squared distance from every pixel to the nearest one where target is true, columns then rows,
+	// each line on its own so the pool takes a batch of lines at a time
+	static void distanceTransform(const std::vector<uint8_t>& target, int width, int height, std::vector<double>& out)
+	{
+		const double far = 1e20;
+		out.resize((size_t)width * height);
+		const uint32_t linesPerChunk = 32;
+
+		ThreadPool::instance().run(((uint32_t)width + linesPerChunk - 1) / linesPerChunk, [&](uint32_t chunk)
+		{
+			std::vector<double> f(height), d(height), z(height + 1);
+			std::vector<int> v(height);
+			const int end = std::min(width, (int)((chunk + 1) * linesPerChunk));
+			for (int x = chunk * linesPerChunk; x < end; x++)
+			{
+				for (int y = 0; y < height; y++)
+				{
+					f[y] = target[(size_t)y * width + x] ? 0.0 : far;
+				}
+				distanceTransform(f.data(), d.data(), height, v.data(), z.data());
+				for (int y = 0; y < height; y++)
+				{
+					out[(size_t)y * width + x] = d[y];
+				}
+			}
+		});
+
+		ThreadPool::instance().run(((uint32_t)height + linesPerChunk - 1) / linesPerChunk, [&](uint32_t chunk)
+		{
+			std::vector<double> d(width), z(width + 1);
+			std::vector<int> v(width);
+			const int end = std::min(height, (int)((chunk + 1) * linesPerChunk));
+			for (int y = chunk * linesPerChunk; y < end; y++)
+			{
+				double* row = out.data() + (size_t)y * width;
+				distanceTransform(row, d.data(), width, v.data(), z.data());
+				std::copy(d.begin(), d.end(), row);
+			}
+		});
+	}
+
+	void ObstacleMask::build(const Pixel* pixels, int newWidth, int newHeight, int stride, uint8_t alphaThreshold)
+	{
+		width = std::max(newWidth, 0);
+		height = std::max(newHeight, 0);
+		distances.assign((size_t)width * height, 1e30f);
+		if (width == 0 || height == 0)
+		{
+			return;
+		}
+
+		std::vector<uint8_t> solid((size_t)width * height);
+		std::vector<uint8_t> empty((size_t)width * height);
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				const bool opaque = pixels[(size_t)y * stride + x].a >= alphaThreshold;
+				solid[(size_t)y * width + x] = opaque;
+				empty[(size_t)y * width + x] = !opaque;
+			}
+		}
+
+		// Distance to the other kind of pixel, less half a pixel so the surface sits between them
+		std::vector<double> toSolid;
+		std::vector<double> toFree;
+		distanceTransform(solid, width, height, toSolid);
+		distanceTransform(empty, width, height, toFree);
+		for (size_t i = 0; i < distances.size(); i++)
+		{
+			distances[i] = solid[i] ? -(float)(std::sqrt(toFree[i]) - 0.5) : (float)(std::sqrt(toSolid[i]) - 0.5);
+		}
+	}
+
+	int FindSprite(const char* name)
+	{
+		std::string wanted = name;
+		for (char& c : wanted) c = (char)toupper(c);
+
+		PlayGraphics& graphics = PlayGraphics::Instance();
+		for (int id = 0; id < graphics.GetTotalLoadedSprites(); id++)
+		{
+			if (graphics.GetSpriteName(id) == wanted)
+			{
+				return id;
+			}
+		}
+		return -1;
+	}
+
+	bool ObstacleMask::buildFromSprite(const char* name, uint8_t alphaThreshold)
+	{
+		const int id = FindSprite(name);
+		if (id < 0)
+		{
+			return false;
+		}
+		const PixelData* data = PlayGraphics::Instance().GetSpritePixelData(id);
+		build(data->pPixels, Play::GetSpriteWidth(id), Play::GetSpriteHeight(id), data->width, alphaThreshold);
+		spriteId = id;
+		return true;
+	}
+
+	float ObstacleMask::distance(const Vector2f& pos) const
+	{
+		if (distances.empty())
+		{
+			return container ? -1e30f : 1e30f;
+		}
+
+		// Off the image, the nearest edge pixel plus the way to it. Pixel centres are half a pixel in.
+		const float fx = (pos.x - topLeft.x) / scale - 0.5f;
+		const float fy = (pos.y - topLeft.y) / scale - 0.5f;
+		const float cx = std::max(0.0f, std::min(fx, (float)(width - 1)));
+		const float cy = std::max(0.0f, std::min(fy, (float)(height - 1)));
+		const float away = std::sqrt((fx - cx) * (fx - cx) + (fy - cy) * (fy - cy));
+
+		const int x = std::min((int)cx, std::max(width - 2, 0));
+		const int y = std::min((int)cy, std::max(height - 2, 0));
+		const int x1 = std::min(x + 1, width - 1);
+		const int y1 = std::min(y + 1, height - 1);
+		const float tx = cx - x;
+		const float ty = cy - y;
+		const float top = distances[(size_t)y * width + x] * (1.0f - tx) + distances[(size_t)y * width + x1] * tx;
+		const float bottom = distances[(size_t)y1 * width + x] * (1.0f - tx) + distances[(size_t)y1 * width + x1] * tx;
+
+		const float result = (top * (1.0f - ty) + bottom * ty + away) * scale;
+		return container ? -result : result;
+	}
+
+	void ObstacleMask::draw() const
+	{
+		if (spriteId >= 0)
+		{
+			Play::DrawSpriteRotated(spriteId, { topLeft.x, topLeft.y }, 0, 0.0f, scale);
+		}
+		else
+		{
+			Play::DrawRect({ topLeft.x, topLeft.y }, { topLeft.x + width * scale, topLeft.y + height * scale }, Play::cGrey);
+		}
+	}
+
+	ObstacleField& ObstacleField::instance()
+	{
+		static ObstacleField field;
+		return field;
+	}
+
+	void ObstacleField::clear()
+	{
+		shapes.clear();
+		masks.clear();
+		distances.clear();
+		columns = 0;
+		rows = 0;
+	}
+
+	void ObstacleField::add(const ObstacleShape& shape)
+	{
+		shapes.push_back(shape);
+	}
+
+	void ObstacleField::add(ObstacleMask&& mask)
+	{
+		masks.push_back(std::move(mask));
+	}
+
+	void ObstacleField::bake(const Vector2f& topLeft, const Vector2f& bottomRight, float newCellSize)
+	{
+		distances.clear();
+		if ((shapes.empty() && masks.empty()) || newCellSize <= 0.0f)
+		{
+			return;
+		}
+
+		// A couple of cells past the walls so particles pressed against them still sample inside the grid
+		const float margin = 2.0f * newCellSize;
+		cellSize = newCellSize;
+		inverseCellSize = 1.0f / cellSize;
+		origin = { topLeft.x - margin, topLeft.y - margin };
+		columns = std::max(1, (int)std::ceil((bottomRight.x - topLeft.x + 2.0f * margin) * inverseCellSize));
+		rows = std::max(1, (int)std::ceil((bottomRight.y - topLeft.y + 2.0f * margin) * inverseCellSize));
+		distances.resize((size_t)(columns + 1) * (rows + 1));
+
+		// The solid is the union of the shapes, so the nearest one wins. A row per chunk.
+		ThreadPool::instance().run((uint32_t)rows + 1, [this](uint32_t row)
+		{
+			float* out = distances.data() + (size_t)row * (columns + 1);
+			for (int column = 0; column <= columns; column++)
+			{
+				const Vector2f pos = { origin.x + column * cellSize, origin.y + row * cellSize };
+				float nearest = 1e30f;
+				for (const ObstacleShape& shape : shapes)
+				{
+					nearest = std::min(nearest, shape.distance(pos));
+				}
+				for (const ObstacleMask& mask : masks)
+				{
+					nearest = std::min(nearest, mask.distance(pos));
+				}
+				out[column] = nearest;
+			}
+		});
+	}
+
+	float ObstacleField::sample(const Vector2f& pos) const
+	{
+		Vector2f normal;
+		return sample(pos, normal);
+	}
+
+	float ObstacleField::sample(const Vector2f& pos, Vector2f& normal) const
+	{
+		const float fx = (pos.x - origin.x) * inverseCellSize;
+		const float fy = (pos.y - origin.y) * inverseCellSize;
+		// Written so NaN fails the test too
+		if (distances.empty() || !(fx >= 0.0f && fy >= 0.0f && fx < (float)columns && fy < (float)rows))
+		{
+			normal = { 0.0f, -1.0f };
+			return 1e30f;
+		}
+
+		const int x = (int)fx;
+		const int y = (int)fy;
+		const float tx = fx - x;
+		const float ty = fy - y;
+		const float* row = distances.data() + (size_t)y * (columns + 1) + x;
+		const float d00 = row[0];
+		const float d10 = row[1];
+		const float d01 = row[columns + 1];
+		const float d11 = row[columns + 2];
+
+		// Gradient of the bilinear patch, it points away from the solid
+		const float gx = (d10 - d00) * (1.0f - ty) + (d11 - d01) * ty;
+		const float gy = (d01 - d00) * (1.0f - tx) + (d11 - d10) * tx;
+		const float length = std::sqrt(gx * gx + gy * gy);
+		normal = length > 1e-6f ? Vector2f(gx / length, gy / length) : Vector2f(0.0f, -1.0f);
+
+		return (d00 * (1.0f - tx) + d10 * tx) * (1.0f - ty) + (d01 * (1.0f - tx) + d11 * tx) * ty;
+	}
+
+	bool ObstacleField::collide(Vector2f& pos, Vector2f& vel, float radius, float damping) const
+	{
+		Vector2f normal;
+		const float distance = sample(pos, normal);
+		if (distance >= radius)
+		{
+			return false;
+		}
+
+		pos += normal * (radius - distance);
+
+		// Only the part heading into the wall bounces, sliding along it is left alone
+		const float into = dot(vel, normal);
+		if (into < 0.0f)
+		{
+			vel -= normal * (into * (1.0f + damping));
+		}
+		return true;
+	}
+
+	void ObstacleField::draw() const
+	{
+		for (const ObstacleMask& mask : masks)
+		{
+			mask.draw();
+		}
+		for (const ObstacleShape& shape : shapes)
+		{
+			shape.draw(Play::cGrey);
+		}
+	}
+}
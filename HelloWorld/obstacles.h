@@ -0,0 +1,107 @@
+#pragma once
+#include <vector>
+#include "Play.h"
+
+namespace Fluid
+{
+	// A static solid shape. As a container the inside is free and everything outside is solid.
+	struct ObstacleShape
+	{
+		enum class Type { Circle, Box, Segment, Polygon };
+
+		Type type = Type::Circle;
+		// Circle: centre and radius. Box: centre, half extents and angle in radians.
+		// Segment: the two ends and a thickness, the round ended line of that radius around them.
+		// Polygon: the corners in order, either winding.
+		Vector2f centre = { 0.0f, 0.0f };
+		Vector2f halfSize = { 0.0f, 0.0f };
+		float radius = 0.0f;
+		float angle = 0.0f;
+		std::vector<Vector2f> points;
+		bool container = false;
+
+		// Negative inside the solid part, positive in the free part, the distance to the surface either way
+		float distance(const Vector2f& pos) const;
+		void draw(Play::Colour colour) const;
+	};
+
+	// The loaded sprite with that name, any case, or -1. Play::GetSpriteId asserts on a missing name instead.
+	int FindSprite(const char* name);
+
+	// A solid from an image's alpha channel. Pixels at or above the threshold are solid, or free for a
+	// container. The exact distance to the nearest pixel of the other kind is worked out for every pixel
+	// in two linear passes (Felzenszwalb and Huttenlocher), so a big mask builds in milliseconds.
+	struct ObstacleMask
+	{
+		Vector2f topLeft = { 0.0f, 0.0f };
+		// World units per image pixel
+		float scale = 1.0f;
+		bool container = false;
+		// Drawn in place of an outline when the mask came from a sprite
+		int spriteId = -1;
+
+		int width = 0;
+		int height = 0;
+		// Signed distance in pixels at every pixel centre, negative inside the opaque part
+		std::vector<float> distances;
+
+		// stride is the pixels from one row to the next, wider than width for a frame of a strip
+		void build(const Pixel* pixels, int width, int height, int stride, uint8_t alphaThreshold);
+		// From the first frame of a loaded sprite, false if there is no sprite by that name
+		bool buildFromSprite(const char* name, uint8_t alphaThreshold);
+
+		float distance(const Vector2f& pos) const;
+		void draw() const;
+	};
+
+	// Every obstacle baked into one grid of signed distances, so colliding a particle is one bilinear
+	// lookup whatever the obstacles look like. Solid where the distance is negative. Outside the grid
+	// nothing is solid, the boundary box still keeps particles in.
+	class ObstacleField
+	{
+	public:
+		static ObstacleField& instance();
+
+		void clear();
+		void add(const ObstacleShape& shape);
+		void add(ObstacleMask&& mask);
+		const std::vector<ObstacleShape>& getShapes() const { return shapes; }
+		const std::vector<ObstacleMask>& getMasks() const { return masks; }
+
+		// Evaluates every shape and mask at the corners of cellSize cells covering topLeft..bottomRight plus a margin
+		void bake(const Vector2f& topLeft, const Vector2f& bottomRight, float cellSize);
+		bool isBaked() const { return !distances.empty(); }
+
+		// Bilinear distance at pos, a large positive value off the grid
+		float sample(const Vector2f& pos) const;
+		// Distance and the surface normal pointing out of the solid, from the same cell
+		float sample(const Vector2f& pos, Vector2f& normal) const;
+
+		// Pushes a particle of the radius out of the solid and reflects the velocity into the wall,
+		// damped by damping. True if it touched.
+		bool collide(Vector2f& pos, Vector2f& vel, float radius, float damping) const;
+
+		void draw() const;
+
+		int getColumns() const { return columns; }
+		int getRows() const { return rows; }
+		float getCellSize() const { return cellSize; }
+		const std::vector<float>& getDistances() const { return distances; }
+
+	private:
+		std::vector<ObstacleShape> shapes;
+		std::vector<ObstacleMask> masks;
+
+		// (columns + 1) * (rows + 1) corner samples
+		std::vector<float> distances;
+		Vector2f origin = { 0.0f, 0.0f };
+		float cellSize = 4.0f;
+		float inverseCellSize = 0.25f;
+		int columns = 0;
+		int rows = 0;
+
+		ObstacleField() {};
+		ObstacleField(const ObstacleField& ref) = delete;
+		~ObstacleField() {};
+	};
+}
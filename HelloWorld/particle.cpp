@@ -1,30 +1,179 @@
 #include "particle.h"
+#include "mappedFile.h"
+#include "numaTopology.h"
+#include "particleArray.h"
+#include "threadPool.h"
+#include <algorithm>
+#include <cstring>
 
 namespace Render
 {
+	// In memory, in pages placed by the threads using them, or in the pages of a scratch file once paging is on.
+	// particles points at whichever holds them.
 	static std::vector<particle> particlesAlloc;
+	static particle* placedParticles = nullptr;
+	static size_t placedCapacity = 0;
+	static Fluid::MappedScratchFile particlePages;
+	static std::string pagingDirectory;
+	static particle* particles = nullptr;
+	static uint32_t particleCount = 0;
+	// Scratch for reordering paged particles in place, paged with them
+	static Fluid::ParticleArray<uint32_t> reorderMoves(false);
+
+	// Big enough that the per chunk call is noise, small enough to spread a few thousand over the threads
+	static const uint32_t fillChunkSize = 16384;
+	// Placed pages are copied in chunks this small, so each thread's share of them lines up with its share
+	// of the simulation's chunks to within a few pages
+	static const uint32_t placeChunkSize = 1024;
+
+	// New pages for capacity particles with source[0..count) copied in, each chunk by the thread the pinned pool
+	// gives it, which is then the first to touch those pages. order, if given, is where each new particle comes from.
+	static particle* placeParticles(const particle* source, const uint32_t* order, uint32_t count, size_t capacity)
+	{
+		particle* pages = (particle*)Fluid::NumaTopology::allocatePages(capacity * sizeof(particle));
+		if (pages == nullptr)
+		{
+			return nullptr;
+		}
+		Fluid::ThreadPool::instance().run((count + placeChunkSize - 1) / placeChunkSize, [&](uint32_t chunk)
+		{
+			const uint32_t end = std::min(count, (chunk + 1) * placeChunkSize);
+			for (uint32_t i = chunk * placeChunkSize; i < end; i++)
+			{
+				pages[i] = source[order ? order[i] : i];
+			}
+		});
+		return pages;
+	}
+
+	static void freePlacedParticles()
+	{
+		Fluid::NumaTopology::freePages(placedParticles, placedCapacity * sizeof(particle));
+		placedParticles = nullptr;
+		placedCapacity = 0;
+	}
+
+	// Placed pages for at least capacity particles, false if there was no memory for them
+	static bool reservePlaced(size_t capacity)
+	{
+		if (capacity <= placedCapacity)
+		{
+			return true;
+		}
+		capacity = std::max(capacity, placedCapacity + placedCapacity / 2);
+		particle* pages = placeParticles(particles, nullptr, particleCount, capacity);
+		if (pages == nullptr)
+		{
+			return false;
+		}
+		freePlacedParticles();
+		placedParticles = pages;
+		placedCapacity = capacity;
+		particles = placedParticles;
+		return true;
+	}
+
+	// Room for count particles, the ones past the old count are for the caller to fill.
+	// A scratch file that can't grow (a full disk) sends the store back to memory.
+	static void resizeStore(uint32_t count)
+	{
+		if (particlePages.isOpen())
+		{
+			const size_t bytes = (size_t)count * sizeof(particle);
+			const size_t capacity = particlePages.getCapacity();
+			if (bytes <= capacity || particlePages.reserve(std::max({ bytes, capacity + capacity / 2, Fluid::ParticleArrayBase::minimumPagedBytes })) || particlePages.reserve(bytes))
+			{
+				particles = (particle*)particlePages.getData();
+				particleCount = count;
+				return;
+			}
+			printf("Error: Can't grow the particle pages to %zu bytes, moving the particles back into memory", bytes);
+			SetParticlePaging("");
+		}
+		else if (placedParticles)
+		{
+			if (reservePlaced(count))
+			{
+				particleCount = count;
+				return;
+			}
+			printf("Error: Can't grow the placed particles to %u, moving them back into the heap", count);
+			SetParticlePlacement(false);
+		}
+
+		particlesAlloc.resize(count);
+		particles = particlesAlloc.data();
+		particleCount = count;
+	}
 
 	uint32_t CreateParticle(const Point2f& pos)
 	{
 		particle particle;
 		particle.pos = pos;
 
-		const uint32_t particleID = (uint32_t)particlesAlloc.size();
-		particlesAlloc.push_back(particle);
+		const uint32_t particleID = particleCount;
+		resizeStore(particleCount + 1);
+		particles[particleID] = particle;
 
 		return particleID;
 	}
 
+	uint32_t CreateParticles(uint32_t count, const std::function<void(uint32_t offset, uint32_t count, particle* out)>& fill)
+	{
+		const uint32_t first = particleCount;
+		resizeStore(first + count);
+
+		// The vector made its new particles already, the scratch file and placed pages have whatever was there before
+		const bool unset = particlePages.isOpen() || placedParticles != nullptr;
+		particle* data = particles + first;
+		Fluid::ThreadPool::instance().run((count + fillChunkSize - 1) / fillChunkSize, [&](uint32_t chunk)
+		{
+			const uint32_t start = chunk * fillChunkSize;
+			const uint32_t size = std::min(fillChunkSize, count - start);
+			if (unset)
+			{
+				std::fill(data + start, data + start + size, particle());
+			}
+			fill(start, size, data + start);
+		});
+
+		return first;
+	}
+
+	void ReserveParticles(uint32_t count)
+	{
+		if (particlePages.isOpen())
+		{
+			particlePages.reserve((size_t)count * sizeof(particle));
+			particles = (particle*)particlePages.getData();
+		}
+		else if (placedParticles)
+		{
+			reservePlaced(count);
+		}
+		else
+		{
+			particlesAlloc.reserve(count);
+			particles = particlesAlloc.data();
+		}
+	}
+
 	particle& GetParticle(int id)
 	{
-		return particlesAlloc[id];
+		return particles[id];
+	}
+
+	uint32_t ParticleCount()
+	{
+		return particleCount;
 	}
 
 	void RemoveParticle(int32_t id)
 	{
-		if (id < particlesAlloc.size())
+		if (id < particleCount)
 		{
-			particlesAlloc.erase(particlesAlloc.begin() + id);
+			memmove(particles + id, particles + id + 1, (particleCount - id - 1) * sizeof(particle));
+			resizeStore(particleCount - 1);
 		}
 		else
 		{
@@ -32,8 +181,185 @@ namespace Render
 			printf("Error: Invalid particle ID, %i", id);
 		}
 	}
+	void TruncateParticles(uint32_t count)
+	{
+		if (count < particleCount)
+		{
+			resizeStore(count);
+		}
+	}
+
 	void ClearParticles()
 	{
+		// The scratch file and placed pages keep their size, like the vector keeps its capacity
 		particlesAlloc.clear();
+		particleCount = 0;
+	}
+
+	bool SetParticlePaging(const std::string& directory)
+	{
+		if (directory.empty())
+		{
+			if (particlePages.isOpen())
+			{
+				particlesAlloc.assign(particles, particles + particleCount);
+				particlePages.close();
+				particles = particlesAlloc.data();
+			}
+			pagingDirectory.clear();
+			Fluid::ParticleArrayBase::pageAll("");
+			return true;
+		}
+
+		if (particlePages.isOpen() && directory == pagingDirectory)
+		{
+			return true;
+		}
+
+		// The simulation's per particle arrays go with the particles, or all stay in memory
+		Fluid::MappedScratchFile pages;
+		if (!pages.open(directory) || !pages.reserve(std::max((size_t)particleCount * sizeof(particle), Fluid::ParticleArrayBase::minimumPagedBytes))
+			|| !Fluid::ParticleArrayBase::pageAll(directory))
+		{
+			Fluid::ParticleArrayBase::pageAll(pagingDirectory);
+			return false;
+		}
+		if (particleCount > 0)
+		{
+			memcpy(pages.getData(), particles, (size_t)particleCount * sizeof(particle));
+		}
+
+		// Whatever held the particles before goes, a scratch file in another directory closes with pages
+		particlePages.swap(pages);
+		particlesAlloc.clear();
+		particlesAlloc.shrink_to_fit();
+		freePlacedParticles();
+		particles = (particle*)particlePages.getData();
+		pagingDirectory = directory;
+		return true;
+	}
+
+	bool IsParticlePaging()
+	{
+		return particlePages.isOpen();
+	}
+
+	bool SetParticlePlacement(bool place)
+	{
+		if (particlePages.isOpen())
+		{
+			return false;
+		}
+		if (place == (placedParticles != nullptr))
+		{
+			return true;
+		}
+
+		if (!place)
+		{
+			particlesAlloc.assign(particles, particles + particleCount);
+			freePlacedParticles();
+			particles = particlesAlloc.data();
+			return true;
+		}
+
+		const size_t capacity = std::max<size_t>(particleCount, placeChunkSize);
+		particle* pages = placeParticles(particles, nullptr, particleCount, capacity);
+		if (pages == nullptr)
+		{
+			return false;
+		}
+		placedParticles = pages;
+		placedCapacity = capacity;
+		particles = placedParticles;
+		particlesAlloc.clear();
+		particlesAlloc.shrink_to_fit();
+		return true;
+	}
+
+	bool IsParticlePlacement()
+	{
+		return placedParticles != nullptr;
+	}
+
+	size_t GetPagedParticleBytes()
+	{
+		return particlePages.getCapacity() + Fluid::ParticleArrayBase::pagedBytesAll();
+	}
+
+	void PrefetchParticles(uint32_t first, uint32_t count)
+	{
+		if (particlePages.isOpen())
+		{
+			particlePages.prefetch((size_t)first * sizeof(particle), (size_t)count * sizeof(particle));
+			Fluid::ParticleArrayBase::prefetchAll(first, count);
+		}
+	}
+
+	void ReleaseParticles(uint32_t first, uint32_t count)
+	{
+		if (particlePages.isOpen())
+		{
+			particlePages.writeBack((size_t)first * sizeof(particle), (size_t)count * sizeof(particle));
+			particlePages.evict((size_t)first * sizeof(particle), (size_t)count * sizeof(particle));
+			Fluid::ParticleArrayBase::releaseAll(first, count);
+		}
+	}
+
+	bool ReorderParticles(const uint32_t* destination, uint32_t count)
+	{
+		if (count != particleCount)
+		{
+			return false;
+		}
+
+		// Paged particles are moved around within the file rather than copied into a second one the size of
+		// the store. A run that is in place is written back, the next sweep's hints then let it go cheaply.
+		if (particlePages.isOpen())
+		{
+			Fluid::ReorderInPlace(particles, destination, count, reorderMoves, [](uint32_t first, uint32_t end)
+			{
+				particlePages.writeBack((size_t)first * sizeof(particle), (size_t)(end - first) * sizeof(particle));
+			});
+			return true;
+		}
+
+		// Placed pages are gathered into new ones, each chunk by the thread that will use it from now on
+		if (placedParticles)
+		{
+			std::vector<uint32_t> order(count);
+			for (uint32_t i = 0; i < count; i++)
+			{
+				order[destination[i]] = i;
+			}
+			particle* pages = placeParticles(particles, order.data(), count, placedCapacity);
+			if (pages == nullptr)
+			{
+				return false;
+			}
+			const size_t capacity = placedCapacity;
+			freePlacedParticles();
+			placedParticles = pages;
+			placedCapacity = capacity;
+			particles = placedParticles;
+			return true;
+		}
+
+		// Copied into a second vector, which then takes over
+		std::vector<particle> alloc(count);
+		particle* target = alloc.data();
+		const particle* source = particles;
+		Fluid::ThreadPool::instance().run((count + fillChunkSize - 1) / fillChunkSize, [&](uint32_t chunk)
+		{
+			const uint32_t end = std::min(count, (chunk + 1) * fillChunkSize);
+			for (uint32_t i = chunk * fillChunkSize; i < end; i++)
+			{
+				target[destination[i]] = source[i];
+			}
+		});
+
+		particlesAlloc.swap(alloc);
+		particles = particlesAlloc.data();
+		return true;
 	}
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 #pragma once
-#include "Play.h"
+#include <functional>
+#include <string>
 #include <vector>
+#include "Play.h"
 
 namespace Render
 {
@@ -9,11 +11,42 @@ namespace Render
 		Vector2f pos;
 		Vector2f vel = {0.0f, 0.0f};
 		float d = 1.0f;
+		float dNear = 0.0f;
 		float p = 0.0f;
 	};
 
 	uint32_t CreateParticle(const Point2f& pos);
+	// Grows the store once and fills the new particles in parallel chunks. fill(offset, count, out) gets
+	// default particles out[0..count), the batch's particles offset..offset+count. It runs on several
+	// threads at once so it may only depend on the offset it is given. Returns the first new id.
+	uint32_t CreateParticles(uint32_t count, const std::function<void(uint32_t offset, uint32_t count, particle* out)>& fill);
+	void ReserveParticles(uint32_t count);
 	particle& GetParticle(int id);
+	uint32_t ParticleCount();
 	void RemoveParticle(int32_t id);
+	// Drops every particle from count on
+	void TruncateParticles(uint32_t count);
 	void ClearParticles();
+
+	// Moves the store into the pages of a scratch file in directory, for more particles than fit in memory,
+	// or back into memory for an empty directory. Every Fluid::ParticleArray goes with it. False if a file
+	// can't be made, the store and the arrays then stay where they were.
+	bool SetParticlePaging(const std::string& directory);
+	bool IsParticlePaging();
+	// Size of the scratch files, the store's and the arrays', 0 in memory
+	size_t GetPagedParticleBytes();
+	// Moves the store into pages that land on the NUMA node of the thread first writing them, copied over by the
+	// thread pool so each part lands with the thread that runs it once the pool is pinned, or back onto the heap.
+	// Reordering and growing copy into new pages the same way. False while paging, which keeps the store.
+	bool SetParticlePlacement(bool place);
+	bool IsParticlePlacement();
+	// Hints for the pages holding particles first..first+count, in the store and the arrays that follow the
+	// particles, nothing in memory
+	void PrefetchParticles(uint32_t first, uint32_t count);
+	// Starts writing them back to the files and lets them go from memory
+	void ReleaseParticles(uint32_t first, uint32_t count);
+	// Particle i goes to destination[i], destination holds every index once. Paged particles are moved in
+	// place, see Fluid::ReorderInPlace. False if there was no room for the reordered copy, the store is then
+	// as it was.
+	bool ReorderParticles(const uint32_t* destination, uint32_t count);
 }
\ No newline at end of file
@@ -0,0 +1,196 @@
+#include "particleArray.h"
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+namespace Fluid
+{
+	struct ParticleArrays
+	{
+		std::mutex lock;
+		std::vector<ParticleArrayBase*> arrays;
+		// Where arrays page to, empty while they are in memory
+		std::string directory;
+	};
+
+	static ParticleArrays& registry()
+	{
+		static ParticleArrays arrays;
+		return arrays;
+	}
+
+	ParticleArrayBase::ParticleArrayBase(size_t elementSize, bool followsParticles)
+		: elementSize(elementSize), followsParticles(followsParticles)
+	{
+		ParticleArrays& arrays = registry();
+		std::lock_guard<std::mutex> guard(arrays.lock);
+		arrays.arrays.push_back(this);
+		if (!arrays.directory.empty())
+		{
+			page(arrays.directory);
+		}
+	}
+
+	ParticleArrayBase::~ParticleArrayBase()
+	{
+		ParticleArrays& arrays = registry();
+		std::lock_guard<std::mutex> guard(arrays.lock);
+		arrays.arrays.erase(std::find(arrays.arrays.begin(), arrays.arrays.end(), this));
+	}
+
+	bool ParticleArrayBase::pageAll(const std::string& directory)
+	{
+		ParticleArrays& arrays = registry();
+		std::lock_guard<std::mutex> guard(arrays.lock);
+		arrays.directory = directory;
+		bool paged = true;
+		for (ParticleArrayBase* array : arrays.arrays)
+		{
+			paged = array->page(directory) && paged;
+		}
+		return paged;
+	}
+
+	void ParticleArrayBase::prefetchAll(uint32_t first, uint32_t count)
+	{
+		ParticleArrays& arrays = registry();
+		std::lock_guard<std::mutex> guard(arrays.lock);
+		for (const ParticleArrayBase* array : arrays.arrays)
+		{
+			if (array->followsParticles && array->pages.isOpen() && first < array->count)
+			{
+				const size_t elements = std::min<size_t>(count, array->count - first);
+				array->pages.prefetch(first * array->elementSize, elements * array->elementSize);
+			}
+		}
+	}
+
+	void ParticleArrayBase::releaseAll(uint32_t first, uint32_t count)
+	{
+		ParticleArrays& arrays = registry();
+		std::lock_guard<std::mutex> guard(arrays.lock);
+		for (const ParticleArrayBase* array : arrays.arrays)
+		{
+			if (array->followsParticles && array->pages.isOpen() && first < array->count)
+			{
+				const size_t elements = std::min<size_t>(count, array->count - first);
+				array->pages.writeBack(first * array->elementSize, elements * array->elementSize);
+				array->pages.evict(first * array->elementSize, elements * array->elementSize);
+			}
+		}
+	}
+
+	size_t ParticleArrayBase::particleBytesAll()
+	{
+		ParticleArrays& arrays = registry();
+		std::lock_guard<std::mutex> guard(arrays.lock);
+		size_t bytes = 0;
+		for (const ParticleArrayBase* array : arrays.arrays)
+		{
+			bytes += array->followsParticles && array->count > 0 ? array->elementSize : 0;
+		}
+		return bytes;
+	}
+
+	size_t ParticleArrayBase::pagedBytesAll()
+	{
+		ParticleArrays& arrays = registry();
+		std::lock_guard<std::mutex> guard(arrays.lock);
+		size_t bytes = 0;
+		for (const ParticleArrayBase* array : arrays.arrays)
+		{
+			bytes += array->pages.getCapacity();
+		}
+		return bytes;
+	}
+
+	bool ParticleArrayBase::page(const std::string& directory)
+	{
+		if (directory.empty())
+		{
+			if (pages.isOpen())
+			{
+				std::unique_ptr<uint8_t[]> memory(count > 0 ? new uint8_t[count * elementSize] : nullptr);
+				if (count > 0)
+				{
+					memcpy(memory.get(), bytes, count * elementSize);
+				}
+				pages.close();
+				heap.swap(memory);
+				bytes = heap.get();
+				reserved = count;
+			}
+			return true;
+		}
+
+		// Another directory's file closes with pages
+		MappedScratchFile file;
+		if (!file.open(directory) || !file.reserve(std::max(reserved * elementSize, minimumPagedBytes)))
+		{
+			return false;
+		}
+		if (count > 0)
+		{
+			memcpy(file.getData(), bytes, count * elementSize);
+		}
+		pages.swap(file);
+		heap.reset();
+		bytes = pages.getData();
+		reserved = pages.getCapacity() / elementSize;
+		return true;
+	}
+
+	bool ParticleArrayBase::reserveElements(size_t elements)
+	{
+		if (elements <= reserved)
+		{
+			return true;
+		}
+
+		bool grown = true;
+		if (pages.isOpen())
+		{
+			const size_t bytesNeeded = elements * elementSize;
+			const size_t capacity = pages.getCapacity();
+			if (pages.reserve(std::max({ bytesNeeded, capacity + capacity / 2, minimumPagedBytes })) || pages.reserve(bytesNeeded))
+			{
+				bytes = pages.getData();
+				reserved = pages.getCapacity() / elementSize;
+				return true;
+			}
+			printf("Error: Can't grow a paged particle array to %zu bytes, moving it back into memory", bytesNeeded);
+			page("");
+			grown = false;
+		}
+
+		// Like a vector, by half again
+		const size_t capacity = std::max(elements, reserved + reserved / 2);
+		std::unique_ptr<uint8_t[]> memory(new uint8_t[capacity * elementSize]);
+		if (count > 0)
+		{
+			memcpy(memory.get(), bytes, count * elementSize);
+		}
+		heap.swap(memory);
+		bytes = heap.get();
+		reserved = capacity;
+		return grown;
+	}
+
+	void ParticleArrayBase::resizeElements(size_t elements, bool zero)
+	{
+		reserveElements(elements);
+		if (zero && elements > count)
+		{
+			memset(bytes + count * elementSize, 0, (elements - count) * elementSize);
+		}
+		count = elements;
+	}
+
+	void ParticleArrayBase::writeBack(size_t first, size_t end) const
+	{
+		if (pages.isOpen() && first < end)
+		{
+			pages.writeBack(first * elementSize, (end - first) * elementSize);
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,185 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "mappedFile.h"
+
+namespace Fluid
+{
+	// The untyped part of ParticleArray. Every array is registered while it exists, so paging the particles
+	// pages them all, and the pager's hints for a run of particles reach every array that follows them.
+	class ParticleArrayBase
+	{
+	public:
+		ParticleArrayBase(const ParticleArrayBase& other) = delete;
+		ParticleArrayBase& operator=(const ParticleArrayBase& other) = delete;
+
+		// Every array into its own scratch file in directory, arrays made later too, or back into memory for
+		// an empty directory. False if any file can't be made, that array stays in memory.
+		static bool pageAll(const std::string& directory);
+		// Hints for particles first..first+count in every array that follows the particles
+		static void prefetchAll(uint32_t first, uint32_t count);
+		static void releaseAll(uint32_t first, uint32_t count);
+		// Bytes a particle takes over every array that follows the particles
+		static size_t particleBytesAll();
+		// Size of every scratch file
+		static size_t pagedBytesAll();
+
+		bool isPaged() const { return pages.isOpen(); }
+
+		// A scratch file grows by half again and never by less than this, so it isn't remapped for every particle
+		static constexpr size_t minimumPagedBytes = 1 << 20;
+
+	protected:
+		ParticleArrayBase(size_t elementSize, bool followsParticles);
+		~ParticleArrayBase();
+
+		// Room for at least elements, keeping the contents. False if a scratch file can't grow, the array is
+		// then moved back into memory and tried there.
+		bool reserveElements(size_t elements);
+		// Grows or shrinks to elements, new ones zeroed if zero is set
+		void resizeElements(size_t elements, bool zero);
+		// Starts writing elements first..end back to the file, nothing in memory
+		void writeBack(size_t first, size_t end) const;
+
+		uint8_t* bytes = nullptr;
+		size_t count = 0;
+		size_t reserved = 0;
+
+	private:
+		bool page(const std::string& directory);
+
+		const size_t elementSize;
+		// Element i is particle i's, so the pager's hints fit
+		const bool followsParticles;
+		std::unique_ptr<uint8_t[]> heap;
+		MappedScratchFile pages;
+	};
+
+	// A buffer with an element per particle, or per grid cell, on the heap or in the pages of its own scratch
+	// file while the particles are paged (see Render::SetParticlePaging). The subset of std::vector the
+	// simulation uses. Elements are moved with memcpy and never destroyed, and new ones start zeroed.
+	template <typename T>
+	class ParticleArray : public ParticleArrayBase
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "Elements are never destroyed");
+
+	public:
+		// followsParticles: element i is particle i's rather than a grid cell's or a sorted run's
+		explicit ParticleArray(bool followsParticles = true) : ParticleArrayBase(sizeof(T), followsParticles) {}
+
+		size_t size() const { return count; }
+		size_t capacity() const { return reserved; }
+		bool empty() const { return count == 0; }
+
+		T* data() { return (T*)bytes; }
+		const T* data() const { return (const T*)bytes; }
+		T& operator[](size_t i) { return data()[i]; }
+		const T& operator[](size_t i) const { return data()[i]; }
+		T* begin() { return data(); }
+		T* end() { return data() + count; }
+		const T* begin() const { return data(); }
+		const T* end() const { return data() + count; }
+
+		void reserve(size_t elements) { reserveElements(elements); }
+		void resize(size_t elements) { resizeElements(elements, true); }
+		void resize(size_t elements, const T& value)
+		{
+			const size_t old = count;
+			resizeElements(elements, false);
+			if (elements > old)
+			{
+				std::fill(data() + old, data() + elements, value);
+			}
+		}
+		void assign(size_t elements, const T& value)
+		{
+			count = 0;
+			resize(elements, value);
+		}
+		template <typename Iterator>
+		void assign(Iterator first, Iterator last)
+		{
+			count = 0;
+			resizeElements((size_t)(last - first), false);
+			std::copy(first, last, data());
+		}
+		void clear() { count = 0; }
+
+		// Element i goes to destination[i], see ReorderInPlace
+		void reorder(const uint32_t* destination, uint32_t elements, ParticleArray<uint32_t>& moves);
+	};
+
+	// Moves the element at i to destination[i], destination holds every index once. In place and in two
+	// passes that each touch the data in a few streams, so a store bigger than memory is read and written
+	// about twice whatever the permutation: the first swaps every element into its bucket of destinations,
+	// filling each bucket from the front, and the second settles each bucket in its own pages. moves is
+	// scratch, it ends up holding 0..count-1. finished(first, end) is called as each bucket is done and
+	// won't be touched again.
+	template <typename T, typename Finished>
+	void ReorderInPlace(T* data, const uint32_t* destination, uint32_t count, ParticleArray<uint32_t>& moves, Finished&& finished)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "Elements are moved by copying");
+		// A few dozen buckets. Each has a write head in data and in moves that stays dirty until it moves on,
+		// and the OS may write a whole large page back for every head it finds dirty, so the heads must be
+		// few. A bucket is settled in memory, so it mustn't be too big either.
+		const uint32_t maxBuckets = 64;
+		uint32_t bucketShift = 16;
+		while (((size_t)count >> bucketShift) >= maxBuckets)
+		{
+			bucketShift++;
+		}
+		const uint32_t bucketSize = 1u << bucketShift;
+		moves.assign(destination, destination + count);
+		uint32_t* to = moves.data();
+
+		const uint32_t buckets = (uint32_t)(((size_t)count + bucketSize - 1) >> bucketShift);
+		std::vector<uint32_t> next(buckets);
+		for (uint32_t bucket = 0; bucket < buckets; bucket++)
+		{
+			next[bucket] = bucket << bucketShift;
+		}
+		for (uint32_t bucket = 0; bucket < buckets; bucket++)
+		{
+			// Every slot of the bucket from the front, an element that belongs further on swaps with the next
+			// free slot of its own bucket and whatever was there is looked at in turn
+			const uint32_t first = bucket << bucketShift;
+			const uint32_t end = std::min(count, first + bucketSize);
+			while (next[bucket] < end)
+			{
+				const uint32_t i = next[bucket];
+				const uint32_t target = to[i] >> bucketShift;
+				if (target == bucket)
+				{
+					next[bucket]++;
+					continue;
+				}
+				const uint32_t j = next[target]++;
+				std::swap(data[i], data[j]);
+				std::swap(to[i], to[j]);
+			}
+
+			// Then within the bucket, each element swapped straight to its place
+			for (uint32_t i = first; i < end; i++)
+			{
+				while (to[i] != i)
+				{
+					const uint32_t j = to[i];
+					std::swap(data[i], data[j]);
+					std::swap(to[i], to[j]);
+				}
+			}
+			finished(first, end);
+		}
+	}
+
+	template <typename T>
+	void ParticleArray<T>::reorder(const uint32_t* destination, uint32_t elements, ParticleArray<uint32_t>& moves)
+	{
+		ReorderInPlace(data(), destination, elements, moves, [this](uint32_t first, uint32_t end) { writeBack(first, end); });
+	}
+}
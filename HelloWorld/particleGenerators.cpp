@@ -0,0 +1,154 @@
+#include <random>
+#include "particleGenerators.h"
+
+namespace Render
+{
+	// splitmix64 finaliser, a well mixed value from the seed and id alone
+	static float hashUnit(uint32_t seed, uint32_t id, uint32_t axis)
+	{
+		uint64_t x = ((uint64_t)seed << 32 | id) * 2 + axis + 0x9E3779B97F4A7C15ull;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+		x ^= x >> 31;
+		return (float)(x >> 40) / (float)(1 << 24);
+	}
+
+	uint32_t CreateGrid(uint32_t count, uint32_t columns, const Vector2f& origin, float spacing, float jitter, uint32_t seed, const Vector2f& vel)
+	{
+		columns = std::max(columns, 1u);
+		const float jitterDistance = jitter * spacing;
+
+		return CreateParticles(count, [&, columns](uint32_t offset, uint32_t chunkCount, particle* out)
+		{
+			for (uint32_t i = 0; i < chunkCount; i++)
+			{
+				const uint32_t index = offset + i;
+				Vector2f pos = { origin.x + (index % columns) * spacing, origin.y + (index / columns) * spacing };
+				if (jitterDistance > 0.0f)
+				{
+					pos.x += (hashUnit(seed, index, 0) - 0.5f) * jitterDistance;
+					pos.y += (hashUnit(seed, index, 1) - 0.5f) * jitterDistance;
+				}
+				out[i].pos = pos;
+				out[i].vel = vel;
+			}
+		});
+	}
+
+	uint32_t CreateAt(const std::vector<Vector2f>& positions, const Vector2f& origin, const Vector2f& vel)
+	{
+		const uint32_t count = (uint32_t)positions.size();
+		return CreateParticles(count, [&](uint32_t offset, uint32_t chunkCount, particle* out)
+		{
+			const Vector2f* source = positions.data() + offset;
+			for (uint32_t i = 0; i < chunkCount; i++)
+			{
+				out[i].pos = origin + source[i];
+				out[i].vel = vel;
+			}
+		});
+	}
+
+	std::vector<Vector2f> PoissonDiskSamples(const Vector2f& size, float radius, uint32_t seed, uint32_t maxCount)
+	{
+		std::vector<Vector2f> samples;
+		if (radius <= 0.0f || size.x <= 0.0f || size.y <= 0.0f)
+		{
+			return samples;
+		}
+
+		// A cell this size holds at most one sample, so the background grid stores one index per cell
+		const float cellSize = radius / std::sqrt(2.0f);
+		const int columns = (int)std::ceil(size.x / cellSize);
+		const int rows = (int)std::ceil(size.y / cellSize);
+		std::vector<int32_t> cells((size_t)columns * rows, -1);
+		samples.reserve((size_t)(size.x * size.y / (radius * radius)));
+
+		std::mt19937 random(seed);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		std::vector<uint32_t> active;
+
+		auto add = [&](const Vector2f& pos)
+		{
+			cells[(size_t)(pos.y / cellSize) * columns + (size_t)(pos.x / cellSize)] = (int32_t)samples.size();
+			active.push_back((uint32_t)samples.size());
+			samples.push_back(pos);
+		};
+
+		auto fits = [&](const Vector2f& pos)
+		{
+			if (pos.x < 0.0f || pos.y < 0.0f || pos.x >= size.x || pos.y >= size.y)
+			{
+				return false;
+			}
+			const int cx = (int)(pos.x / cellSize);
+			const int cy = (int)(pos.y / cellSize);
+			for (int y = std::max(cy - 2, 0); y <= std::min(cy + 2, rows - 1); y++)
+			{
+				for (int x = std::max(cx - 2, 0); x <= std::min(cx + 2, columns - 1); x++)
+				{
+					const int32_t other = cells[(size_t)y * columns + x];
+					if (other >= 0 && (samples[other] - pos).LengthSqr() < radius * radius)
+					{
+						return false;
+					}
+				}
+			}
+			return true;
+		};
+
+		add({ unit(random) * size.x, unit(random) * size.y });
+
+		// Up to 30 tries in the annulus around a random active sample before retiring it
+		const int attempts = 30;
+		while (!active.empty() && (maxCount == 0 || samples.size() < maxCount))
+		{
+			const size_t pick = (size_t)(unit(random) * active.size()) % active.size();
+			const Vector2f centre = samples[active[pick]];
+
+			bool placed = false;
+			for (int attempt = 0; attempt < attempts; attempt++)
+			{
+				const float angle = unit(random) * 6.2831853f;
+				const float distance = radius * (1.0f + unit(random));
+				const Vector2f candidate = { centre.x + std::cos(angle) * distance, centre.y + std::sin(angle) * distance };
+				if (fits(candidate))
+				{
+					add(candidate);
+					placed = true;
+					break;
+				}
+			}
+
+			if (!placed)
+			{
+				active[pick] = active.back();
+				active.pop_back();
+			}
+		}
+
+		return samples;
+	}
+
+	std::vector<Vector2f> ImageSamples(const Pixel* pixels, int width, int height, int stride, float spacing, uint8_t alphaThreshold)
+	{
+		std::vector<Vector2f> samples;
+		if (pixels == nullptr || spacing <= 0.0f)
+		{
+			return samples;
+		}
+
+		for (float y = spacing * 0.5f; y < height; y += spacing)
+		{
+			const Pixel* row = pixels + (size_t)y * stride;
+			for (float x = spacing * 0.5f; x < width; x += spacing)
+			{
+				if (row[(size_t)x].a >= alphaThreshold)
+				{
+					samples.push_back({ x, y });
+				}
+			}
+		}
+		return samples;
+	}
+}
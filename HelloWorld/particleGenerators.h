@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "particle.h"
+
+namespace Render
+{
+	// Bulk particle layouts, each one makes a single CreateParticles call. None of them touch the
+	// simulation, pass the returned first id and the count on to Simulation::AddCircles.
+
+	// count particles in rows of columns from origin, all moving at vel. jitter moves each one by up to that
+	// fraction of the spacing, hashed from seed and the id so the layout doesn't depend on the thread count.
+	uint32_t CreateGrid(uint32_t count, uint32_t columns, const Vector2f& origin, float spacing, float jitter = 0.0f, uint32_t seed = 0, const Vector2f& vel = { 0.0f, 0.0f });
+
+	// Copies positions offset by origin, all moving at vel
+	uint32_t CreateAt(const std::vector<Vector2f>& positions, const Vector2f& origin, const Vector2f& vel = { 0.0f, 0.0f });
+
+	// Blue noise inside a size.x by size.y box, no two points closer than radius (Bridson's algorithm).
+	// Stops early at maxCount, 0 fills the box.
+	std::vector<Vector2f> PoissonDiskSamples(const Vector2f& size, float radius, uint32_t seed, uint32_t maxCount = 0);
+
+	// One point every spacing pixels where the image's alpha is at least alphaThreshold. stride is the pixels
+	// from one row to the next, wider than width for a frame of a strip.
+	std::vector<Vector2f> ImageSamples(const Pixel* pixels, int width, int height, int stride, float spacing, uint8_t alphaThreshold = 128);
+}
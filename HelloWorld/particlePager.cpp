@@ -0,0 +1,189 @@
+#include "particlePager.h"
+#include "particle.h"
+#include <algorithm>
+#include <cmath>
+
+namespace Fluid
+{
+	void ParticlePager::setEnabled(bool enable, size_t residentBytes)
+	{
+		if (!enable)
+		{
+			reset();
+		}
+		enabled = enable;
+		residentBudget = residentBytes;
+	}
+
+	void ParticlePager::reset()
+	{
+		pageHaloFirst.clear();
+		pageHaloEnd.clear();
+		sortedCount = 0;
+		stepsSinceSort = 0;
+		residentFirst = residentEnd = 0;
+	}
+
+	bool ParticlePager::needsSort(uint32_t count) const
+	{
+		// A few emitted particles at a time wait for the next sort, pages past the sorted ones get a plain halo meanwhile
+		return (enabled || banded) && (stepsSinceSort >= sortInterval || count < sortedCount || count >= sortedCount + pageParticles);
+	}
+
+	void ParticlePager::sort(uint32_t count, float cellSize, const Render::PeriodicDomain& periodic, ParticleArray<uint32_t>& destination)
+	{
+		// The fluid's bounds, anything not finite is left in the first band
+		Vector2f low = { INFINITY, INFINITY };
+		Vector2f high = { -INFINITY, -INFINITY };
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const Vector2f& pos = Render::GetParticle(i).pos;
+			if (std::isfinite(pos.x) && std::isfinite(pos.y))
+			{
+				low = { std::min(low.x, pos.x), std::min(low.y, pos.y) };
+				high = { std::max(high.x, pos.x), std::max(high.y, pos.y) };
+			}
+		}
+
+		// Bands across the longer side so there are more of them and each is smaller. A wrapped axis would make
+		// the first and last bands neighbours, a halo that isn't one run of pages, so the other axis goes first.
+		bool alongX = high.x - low.x >= high.y - low.y;
+		if (alongX ? periodic.x && !periodic.y : periodic.y && !periodic.x)
+		{
+			alongX = !alongX;
+		}
+		const float origin = alongX ? low.x : low.y;
+		const float extent = std::max(0.0f, alongX ? high.x - low.x : high.y - low.y);
+		const float bandSize = std::max(cellSize, extent / (maxBands - 1));
+		const int bands = std::min(maxBands, (int)(extent / bandSize) + 1);
+
+		// Counting sort by band, stable
+		bandOf.resize(count);
+		bandStart.assign((size_t)bands + 1, 0);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const Vector2f& pos = Render::GetParticle(i).pos;
+			const float band = ((alongX ? pos.x : pos.y) - origin) / bandSize;
+			bandOf[i] = band > 0.0f ? (uint32_t)std::min(band, (float)(bands - 1)) : 0;
+			bandStart[bandOf[i] + 1]++;
+		}
+		for (int band = 0; band < bands; band++)
+		{
+			bandStart[band + 1] += bandStart[band];
+		}
+		// Written in index order, and each band's next slot only moves on, so a paged store is read once
+		destination.resize(count);
+		{
+			std::vector<uint32_t> next(bandStart.begin(), bandStart.end() - 1);
+			for (uint32_t i = 0; i < count; i++)
+			{
+				destination[i] = next[bandOf[i]]++;
+			}
+		}
+
+		// Each page's halo, from the first particle of the band before its first band to the last of the band after its last
+		pageCount = (count + pageParticles - 1) >> pageShift;
+		pageHaloFirst.resize(pageCount);
+		pageHaloEnd.resize(pageCount);
+		const auto bandAt = [&](uint32_t i) { return (uint32_t)(std::upper_bound(bandStart.begin(), bandStart.end(), i) - bandStart.begin()) - 1; };
+		for (uint32_t page = 0; page < pageCount; page++)
+		{
+			const uint32_t firstBand = bandAt(page << pageShift);
+			const uint32_t lastBand = bandAt(std::min(count, (page + 1) << pageShift) - 1);
+			pageHaloFirst[page] = bandStart[firstBand > 0 ? firstBand - 1 : 0] >> pageShift;
+			pageHaloEnd[page] = std::min(pageCount, (bandStart[std::min<uint32_t>(lastBand + 2, bands)] + pageParticles - 1) >> pageShift);
+		}
+
+		sortedCount = count;
+		stepsSinceSort = 0;
+		// The resident pages moved with the particles
+		residentFirst = residentEnd = 0;
+	}
+
+	void ParticlePager::beginSweep(uint32_t lagging)
+	{
+		if (!enabled)
+		{
+			return;
+		}
+		laggingPages = lagging;
+		pageCount = (Render::ParticleCount() + pageParticles - 1) >> pageShift;
+		// The store and every array that follows the particles
+		releasing = (size_t)Render::ParticleCount() * (sizeof(Render::particle) + ParticleArrayBase::particleBytesAll()) > residentBudget;
+		currentPage.store(noPage, std::memory_order_relaxed);
+	}
+
+	void ParticlePager::advance(uint32_t page)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		const uint32_t current = currentPage.load(std::memory_order_relaxed);
+		// A thread still on an older chunk, or another thread already moved the window on
+		if ((current != noPage && page <= current) || page >= pageCount)
+		{
+			return;
+		}
+		currentPage.store(page, std::memory_order_relaxed);
+
+		const uint32_t keepFirst = std::min(haloFirst(page), page > laggingPages ? page - laggingPages : 0);
+		const uint32_t keepEnd = haloEnd(std::min(page + lookaheadPages, pageCount - 1));
+		if (current == noPage)
+		{
+			// Whatever the last sweep left in memory outside where this one starts
+			release(residentFirst, std::min(residentEnd, keepFirst));
+			release(std::max(residentFirst, keepEnd), residentEnd);
+			prefetch(keepFirst, keepEnd);
+			residentFirst = keepFirst;
+			residentEnd = keepEnd;
+			return;
+		}
+
+		release(residentFirst, keepFirst);
+		prefetch(std::max(residentEnd, keepFirst), keepEnd);
+		residentFirst = std::max(residentFirst, keepFirst);
+		residentEnd = std::max(residentEnd, keepEnd);
+	}
+
+	uint32_t ParticlePager::haloFirst(uint32_t page) const
+	{
+		if (page < pageHaloFirst.size())
+		{
+			return std::min(pageHaloFirst[page], page);
+		}
+		return page > 0 ? page - 1 : 0;
+	}
+
+	uint32_t ParticlePager::haloEnd(uint32_t page) const
+	{
+		if (page < pageHaloEnd.size())
+		{
+			return std::min(std::max(pageHaloEnd[page], page + 1), pageCount);
+		}
+		return std::min(page + 2, pageCount);
+	}
+
+	void ParticlePager::prefetch(uint32_t first, uint32_t end)
+	{
+		if (first < end)
+		{
+			Render::PrefetchParticles(first << pageShift, (end - first) << pageShift);
+			prefetchedPages += end - first;
+		}
+	}
+
+	void ParticlePager::release(uint32_t first, uint32_t end)
+	{
+		if (releasing && first < end)
+		{
+			Render::ReleaseParticles(first << pageShift, (end - first) << pageShift);
+			releasedPages += end - first;
+		}
+	}
+
+	void ParticlePager::takeCounts(uint32_t& prefetched, uint32_t& released)
+	{
+		prefetched = prefetchedPages;
+		released = releasedPages;
+		prefetchedPages = 0;
+		releasedPages = 0;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,99 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "boundary.h"
+#include "particleArray.h"
+
+namespace Fluid
+{
+	// Schedules the pages of a paged particle store (see Render::SetParticlePaging) around the step's sweeps.
+	// Every so often the particles are sorted into bands of grid cells across the fluid's longer side, so a
+	// run of indices is a strip of space and every neighbour of a page's particles is within the pages of
+	// the bands either side of it: the page's halo. Each sweep over the particles in index order then reads
+	// a window that slides along the store. The pager prefetches the halo of the pages coming up and writes
+	// back and lets go of the pages the sweep is done with, so memory holds a few bands rather than the store.
+	// Everything it does is a hint, a page it got wrong is just read from the file when touched.
+	class ParticlePager
+	{
+	public:
+		static const uint32_t pageShift = 12;
+		// Particles a page, the granularity of every hint
+		static const uint32_t pageParticles = 1 << pageShift;
+
+		// Off for a store in memory, every call is then a no-op. Pages are only let go once the store is
+		// bigger than the resident budget, a store that fits is left to stay in memory.
+		void setEnabled(bool enable, size_t residentBytes);
+		bool isEnabled() const { return enabled; }
+
+		// Keeps sorting into bands while off too, so each thread's share of the particles stays one strip of
+		// space for NUMA placement. Nothing is prefetched or let go.
+		void setBanded(bool band) { banded = band; }
+		// The particles were all replaced, the bands are gone and the steps to the next sort count from zero
+		void reset();
+		// Whether the bands are old enough, or enough particles came or went, to sort again
+		bool needsSort(uint32_t count) const;
+		// Particle i goes to destination[i]. Stable, so within a band the particles keep the order they had,
+		// which the last sort left close to the order they are in across the band.
+		void sort(uint32_t count, float cellSize, const Render::PeriodicDomain& periodic, ParticleArray<uint32_t>& destination);
+		// Every step, counts towards the next sort
+		void stepped() { stepsSinceSort++; }
+
+		// Before each sweep over the particles in index order. Lagging pages are how far behind the newest
+		// page a thread still working on an older chunk can be, nothing that close is let go.
+		void beginSweep(uint32_t laggingPages = 0);
+		// The sweep got to particle i
+		void reach(uint32_t i)
+		{
+			if (enabled && (i >> pageShift) != currentPage.load(std::memory_order_relaxed))
+			{
+				advance(i >> pageShift);
+			}
+		}
+
+		// Pages prefetched and released since the last call
+		void takeCounts(uint32_t& prefetched, uint32_t& released);
+
+	private:
+		void advance(uint32_t page);
+		// Pages first..end the particles in page and its neighbours can be in
+		uint32_t haloFirst(uint32_t page) const;
+		uint32_t haloEnd(uint32_t page) const;
+		void prefetch(uint32_t first, uint32_t end);
+		void release(uint32_t first, uint32_t end);
+
+		// Pages of halo read ahead of the sweep
+		static const uint32_t lookaheadPages = 2;
+		// Steps between sorts, particles drift only a little way out of their band in that time
+		static const uint32_t sortInterval = 32;
+		// Bounds the band count on a huge box, bands grow instead
+		static const int maxBands = 1 << 20;
+
+		bool enabled = false;
+		bool banded = false;
+		size_t residentBudget = 0;
+		uint32_t sortedCount = 0;
+		uint32_t stepsSinceSort = 0;
+		// Per page as of the last sort, pages added since get the pages either side
+		std::vector<uint32_t> pageHaloFirst;
+		std::vector<uint32_t> pageHaloEnd;
+		// Sort scratch
+		ParticleArray<uint32_t> bandOf;
+		std::vector<uint32_t> bandStart;
+
+		static const uint32_t noPage = 0xFFFFFFFF;
+		std::atomic<uint32_t> currentPage{ noPage };
+		std::mutex lock;
+		uint32_t laggingPages = 0;
+		uint32_t pageCount = 0;
+		// The store is over the budget, this sweep lets pages go
+		bool releasing = false;
+		// The pages the pager has read in and not let go of yet
+		uint32_t residentFirst = 0;
+		uint32_t residentEnd = 0;
+		uint32_t prefetchedPages = 0;
+		uint32_t releasedPages = 0;
+	};
+}
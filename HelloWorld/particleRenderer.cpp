@@ -0,0 +1,178 @@
+#include "particleRenderer.h"
+#include "particle.h"
+#include "stampCache.h"
+#include "profiler.h"
+#include "threadPool.h"
+#include <cfloat>
+
+namespace Render
+{
+	ParticleRenderer& ParticleRenderer::instance()
+	{
+		static ParticleRenderer instance;
+
+		return instance;
+	}
+
+	void ParticleRenderer::draw(PixelData* target, const Fluid::ParticleArray<Vector2f>& positions, Pixel solidColour)
+	{
+		PROFILE_ZONE("Particles");
+		if (!initialized)
+		{
+			buildLut();
+			initialized = true;
+		}
+
+		if (!StampCache::instance().isBuilt())
+		{
+			return;
+		}
+
+		const uint32_t count = (uint32_t)positions.size();
+
+		if (mode == ColourMode::Solid)
+		{
+			for (uint32_t i = 0; i < count; i++)
+			{
+				blitStamp(target, positions[i], solidColour.bits);
+			}
+			return;
+		}
+
+		{
+			PROFILE_ZONE("Scalars");
+			gatherScalars();
+		}
+
+		const float scale = rangeMax > rangeMin ? 255.0f / (rangeMax - rangeMin) : 0.0f;
+		for (uint32_t i = 0; i < count && i < scalars.size(); i++)
+		{
+			const int index = std::min(std::max((int)((scalars[i] - rangeMin) * scale), 0), 255);
+			blitStamp(target, positions[i], lut[index].bits);
+		}
+	}
+
+	void ParticleRenderer::cycleMode()
+	{
+		mode = (ColourMode)(((int)mode + 1) % (int)ColourMode::Count);
+	}
+
+	void ParticleRenderer::setRadius(int newRadius)
+	{
+		const StampCache& cache = StampCache::instance();
+		radius = std::min(std::max(newRadius, cache.getMinRadius()), cache.getMaxRadius());
+	}
+
+	const char* ParticleRenderer::getModeName() const
+	{
+		switch (mode)
+		{
+		case ColourMode::Speed: return "Speed";
+		case ColourMode::Density: return "Density";
+		case ColourMode::NearDensity: return "Near density";
+		case ColourMode::Pressure: return "Pressure";
+		default: return "Solid";
+		}
+	}
+
+	void ParticleRenderer::buildLut()
+	{
+		// Blue for the low end through green and yellow to red for the high end
+		const float stops[5][3] =
+		{
+			{ 48, 18, 59 },
+			{ 40, 130, 240 },
+			{ 60, 230, 140 },
+			{ 240, 200, 40 },
+			{ 200, 30, 20 }
+		};
+
+		for (int i = 0; i < 256; i++)
+		{
+			const float t = i / 255.0f * 4.0f;
+			const int stop = std::min((int)t, 3);
+			const float f = t - stop;
+
+			const float r = stops[stop][0] + (stops[stop + 1][0] - stops[stop][0]) * f;
+			const float g = stops[stop][1] + (stops[stop + 1][1] - stops[stop][1]) * f;
+			const float b = stops[stop][2] + (stops[stop + 1][2] - stops[stop][2]) * f;
+
+			lut[i] = Pixel(r, g, b);
+		}
+	}
+
+	void ParticleRenderer::gatherScalars()
+	{
+		const uint32_t count = ParticleCount();
+		scalars.resize(count);
+
+		if (count == 0)
+		{
+			rangeMin = rangeMax = 0.0f;
+			return;
+		}
+
+		const ColourMode scalarMode = mode;
+		auto reduce = [this, scalarMode, count](uint32_t first, uint32_t last)
+		{
+			float low = FLT_MAX;
+			float high = -FLT_MAX;
+
+			for (uint32_t i = first; i < last && i < count; i++)
+			{
+				const particle& p = GetParticle(i);
+
+				float value = 0.0f;
+				switch (scalarMode)
+				{
+				case ColourMode::Speed: value = p.vel.Length(); break;
+				case ColourMode::Density: value = p.d; break;
+				case ColourMode::NearDensity: value = p.dNear; break;
+				case ColourMode::Pressure: value = p.p; break;
+				default: break;
+				}
+
+				scalars[i] = value;
+				low = std::min(low, value);
+				high = std::max(high, value);
+			}
+
+			return std::make_pair(low, high);
+		};
+
+		// A chunk each, so the usual few thousand particles are one chunk the pool runs inline
+		const uint32_t chunk = 16384;
+		const uint32_t chunks = (count + chunk - 1) / chunk;
+		chunkRanges.resize(chunks);
+		Fluid::ThreadPool::instance().run(chunks, [this, &reduce, chunk](uint32_t c)
+		{
+			chunkRanges[c] = reduce(c * chunk, (c + 1) * chunk);
+		});
+
+		std::pair<float, float> range = chunkRanges[0];
+		for (const std::pair<float, float>& part : chunkRanges)
+		{
+			range.first = std::min(range.first, part.first);
+			range.second = std::max(range.second, part.second);
+		}
+
+		rangeMin = range.first;
+		rangeMax = range.second;
+	}
+
+	void ParticleRenderer::blitStamp(PixelData* target, const Vector2f& pos, uint32_t colour)
+	{
+		// Whole pixel part places the stamp, the fraction picks one of the sub-pixel variants
+		const StampCache& cache = StampCache::instance();
+		const int size = cache.getSize(radius);
+
+		const float floorX = std::floor(pos.x);
+		const float floorY = std::floor(pos.y);
+		const int subX = std::min((int)((pos.x - floorX) * StampCache::subSteps), StampCache::subSteps - 1);
+		const int subY = std::min((int)((pos.y - floorY) * StampCache::subSteps), StampCache::subSteps - 1);
+
+		const int x = (int)floorX - size / 2;
+		const int y = (int)floorY - size / 2;
+		cache.blit(target, cache.getStamp(radius, subX, subY), size, x, y, colour);
+	}
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include "Play.h"
+#include "particleArray.h"
+#include <vector>
+
+namespace Render
+{
+	enum class ColourMode
+	{
+		Solid,
+		Speed,
+		Density,
+		NearDensity,
+		Pressure,
+		Count
+	};
+
+	// Draws every particle as an anti-aliased disc from the StampCache. In the scalar modes each particle
+	// is tinted through a 256 entry colour table, the scalar range is found with a parallel min/max pass.
+	class ParticleRenderer
+	{
+	public:
+		static ParticleRenderer& instance();
+
+		void draw(PixelData* target, const Fluid::ParticleArray<Vector2f>& positions, Pixel solidColour);
+
+		void cycleMode();
+		void setMode(ColourMode newMode) { mode = newMode; }
+		ColourMode getMode() const { return mode; }
+		const char* getModeName() const;
+
+		void setRadius(int newRadius);
+		int getRadius() const { return radius; }
+
+		float getRangeMin() const { return rangeMin; }
+		float getRangeMax() const { return rangeMax; }
+
+	private:
+		void buildLut();
+		void gatherScalars();
+		void blitStamp(PixelData* target, const Vector2f& pos, uint32_t colour);
+
+		int radius = 4;
+
+		ColourMode mode = ColourMode::Solid;
+
+		Pixel lut[256];
+		bool initialized = false;
+
+		std::vector<float> scalars;
+		// Lowest and highest scalar of each of gatherScalars' chunks
+		std::vector<std::pair<float, float>> chunkRanges;
+		float rangeMin = 0.0f;
+		float rangeMax = 0.0f;
+
+		ParticleRenderer() {};
+		ParticleRenderer(const ParticleRenderer& ref) = delete;
+		~ParticleRenderer() {};
+	};
+}
@@ -0,0 +1,298 @@
+#include "perfCounters.h"
+#include <chrono>
+#include <mutex>
+
+#if defined(_WIN32)
+#include "Play.h"
+#elif defined(__linux__) && FLUID_HW_COUNTERS
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace Stats
+{
+	enum CounterSlot
+	{
+		SlotCycles,
+		SlotInstructions,
+		SlotCacheMisses,
+		SlotBranchMisses
+	};
+
+	static uint64_t wallClockNs()
+	{
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void CounterSample::add(const CounterSample& other)
+	{
+		nanoseconds += other.nanoseconds;
+		cycles += other.cycles;
+		instructions += other.instructions;
+		cacheMisses += other.cacheMisses;
+		branchMisses += other.branchMisses;
+
+		hasCycles |= other.hasCycles;
+		hasInstructions |= other.hasInstructions;
+		hasCacheMisses |= other.hasCacheMisses;
+		hasBranchMisses |= other.hasBranchMisses;
+	}
+
+	CounterSample CounterSample::between(const CounterSample& start, const CounterSample& end)
+	{
+		CounterSample delta;
+		delta.nanoseconds = end.nanoseconds - start.nanoseconds;
+		delta.cycles = end.cycles - start.cycles;
+		delta.instructions = end.instructions - start.instructions;
+		delta.cacheMisses = end.cacheMisses - start.cacheMisses;
+		delta.branchMisses = end.branchMisses - start.branchMisses;
+		delta.hasCycles = start.hasCycles && end.hasCycles;
+		delta.hasInstructions = start.hasInstructions && end.hasInstructions;
+		delta.hasCacheMisses = start.hasCacheMisses && end.hasCacheMisses;
+		delta.hasBranchMisses = start.hasBranchMisses && end.hasBranchMisses;
+		return delta;
+	}
+
+	struct WorkerTotals
+	{
+		std::mutex lock;
+		CounterSample sum;
+		// A worker that hasn't a counter leaves every total of it short
+		bool hasCycles = true;
+		bool hasInstructions = true;
+		bool hasCacheMisses = true;
+		bool hasBranchMisses = true;
+	};
+
+	static WorkerTotals& workerTotals()
+	{
+		static WorkerTotals totals;
+		return totals;
+	}
+
+	void HardwareCounters::addWorkerSample(const CounterSample& sample)
+	{
+		WorkerTotals& totals = workerTotals();
+		std::lock_guard<std::mutex> guard(totals.lock);
+		totals.sum.add(sample);
+		totals.hasCycles = totals.hasCycles && sample.hasCycles;
+		totals.hasInstructions = totals.hasInstructions && sample.hasInstructions;
+		totals.hasCacheMisses = totals.hasCacheMisses && sample.hasCacheMisses;
+		totals.hasBranchMisses = totals.hasBranchMisses && sample.hasBranchMisses;
+	}
+
+	void HardwareCounters::readWorkers(CounterSample& out)
+	{
+		WorkerTotals& totals = workerTotals();
+		std::lock_guard<std::mutex> guard(totals.lock);
+		out = totals.sum;
+		out.hasCycles = totals.hasCycles;
+		out.hasInstructions = totals.hasInstructions;
+		out.hasCacheMisses = totals.hasCacheMisses;
+		out.hasBranchMisses = totals.hasBranchMisses;
+	}
+
+	HardwareCounters& HardwareCounters::forThisThread()
+	{
+		static thread_local HardwareCounters counters;
+
+		return counters;
+	}
+
+	HardwareCounters::HardwareCounters()
+	{
+		open();
+	}
+
+	HardwareCounters::~HardwareCounters()
+	{
+		close();
+	}
+
+	const char* HardwareCounters::getBackendName() const
+	{
+		if (!available)
+		{
+			return "wall clock";
+		}
+#if defined(_WIN32)
+		return "thread cycles";
+#else
+		return "perf_event";
+#endif
+	}
+
+#if defined(__linux__) && FLUID_HW_COUNTERS
+	static int openCounter(uint32_t type, uint64_t config, int groupFd)
+	{
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.disabled = groupFd == -1 ? 1 : 0;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP;
+
+		// This thread only, on whatever cpu it runs on
+		return (int)syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+	}
+
+	void HardwareCounters::open()
+	{
+		const uint64_t configs[4] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+
+		// The first counter that opens leads the group, the rest are read together with it.
+		// Counters the cpu or kernel refuses are simply left out.
+		for (int i = 0; i < 4; i++)
+		{
+			const int fd = openCounter(PERF_TYPE_HARDWARE, configs[i], leader);
+			if (fd == -1)
+			{
+				continue;
+			}
+
+			if (leader == -1)
+			{
+				leader = fd;
+			}
+			fds[i] = fd;
+			slot[i] = opened++;
+		}
+
+		if (leader == -1)
+		{
+			return;
+		}
+
+		ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		available = true;
+	}
+
+	void HardwareCounters::close()
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			if (fds[i] != -1)
+			{
+				::close(fds[i]);
+				fds[i] = -1;
+			}
+		}
+		leader = -1;
+		available = false;
+	}
+
+	void HardwareCounters::read(CounterSample& out) const
+	{
+		out.nanoseconds = wallClockNs();
+		if (!available || !enabled)
+		{
+			return;
+		}
+
+		struct
+		{
+			uint64_t count;
+			uint64_t values[4];
+		} group;
+
+		if (::read(leader, &group, sizeof(group)) < (ssize_t)sizeof(uint64_t))
+		{
+			return;
+		}
+
+		auto value = [&group, this](int counter, uint64_t& field, bool& valid)
+		{
+			if (slot[counter] != -1 && (uint64_t)slot[counter] < group.count)
+			{
+				field = group.values[slot[counter]];
+				valid = true;
+			}
+		};
+
+		value(SlotCycles, out.cycles, out.hasCycles);
+		value(SlotInstructions, out.instructions, out.hasInstructions);
+		value(SlotCacheMisses, out.cacheMisses, out.hasCacheMisses);
+		value(SlotBranchMisses, out.branchMisses, out.hasBranchMisses);
+	}
+#elif defined(_WIN32) && FLUID_HW_COUNTERS
+	void HardwareCounters::open()
+	{
+		// No user mode access to the PMU here, the scheduler's cycle count for the thread is what we get
+		ULONG64 cycles = 0;
+		available = QueryThreadCycleTime(GetCurrentThread(), &cycles) != 0;
+	}
+
+	void HardwareCounters::close()
+	{
+		available = false;
+	}
+
+	void HardwareCounters::read(CounterSample& out) const
+	{
+		out.nanoseconds = wallClockNs();
+		if (!available || !enabled)
+		{
+			return;
+		}
+
+		ULONG64 cycles = 0;
+		if (QueryThreadCycleTime(GetCurrentThread(), &cycles))
+		{
+			out.cycles = cycles;
+			out.hasCycles = true;
+		}
+	}
+#else
+	void HardwareCounters::open()
+	{
+	}
+
+	void HardwareCounters::close()
+	{
+	}
+
+	void HardwareCounters::read(CounterSample& out) const
+	{
+		out.nanoseconds = wallClockNs();
+	}
+#endif
+
+	ScopedCounters::ScopedCounters(CounterSample& target)
+		: target(target)
+	{
+		HardwareCounters::readWorkers(workersStart);
+		HardwareCounters::forThisThread().read(start);
+	}
+
+	ScopedCounters::~ScopedCounters()
+	{
+		CounterSample end;
+		HardwareCounters::forThisThread().read(end);
+		CounterSample workersEnd;
+		HardwareCounters::readWorkers(workersEnd);
+
+		CounterSample delta = CounterSample::between(start, end);
+		// The wall clock is this thread's, the workers ran inside it
+		const CounterSample workers = CounterSample::between(workersStart, workersEnd);
+		if (workers.nanoseconds > 0)
+		{
+			delta.cycles += workers.cycles;
+			delta.instructions += workers.instructions;
+			delta.cacheMisses += workers.cacheMisses;
+			delta.branchMisses += workers.branchMisses;
+			delta.hasCycles = delta.hasCycles && workers.hasCycles;
+			delta.hasInstructions = delta.hasInstructions && workers.hasInstructions;
+			delta.hasCacheMisses = delta.hasCacheMisses && workers.hasCacheMisses;
+			delta.hasBranchMisses = delta.hasBranchMisses && workers.hasBranchMisses;
+		}
+
+		target.add(delta);
+	}
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <cstdint>
+
+// Set to 0 to leave the hardware counters out, phases are then timed with the wall clock only
+#ifndef FLUID_HW_COUNTERS
+#define FLUID_HW_COUNTERS 1
+#endif
+
+namespace Stats
+{
+	struct CounterSample
+	{
+		uint64_t nanoseconds = 0;
+		uint64_t cycles = 0;
+		uint64_t instructions = 0;
+		uint64_t cacheMisses = 0;
+		uint64_t branchMisses = 0;
+
+		bool hasCycles = false;
+		bool hasInstructions = false;
+		bool hasCacheMisses = false;
+		bool hasBranchMisses = false;
+
+		void add(const CounterSample& other);
+		// What the counters did from start to end, the has* fields set where both had them
+		static CounterSample between(const CounterSample& start, const CounterSample& end);
+		void clear() { *this = CounterSample(); }
+
+		float ipc() const { return hasCycles && hasInstructions && cycles > 0 ? (float)instructions / cycles : 0.0f; }
+		float milliseconds() const { return nanoseconds / 1000000.0f; }
+	};
+
+	// Hardware counters for the calling thread.
+	// Linux: perf_event_open group of cycles, instructions, last level cache misses and branch misses.
+	// Windows: thread cycle count only. Anything that can't be opened falls back to wall clock time.
+	class HardwareCounters
+	{
+	public:
+		static HardwareCounters& forThisThread();
+
+		void setEnabled(bool enable) { enabled = enable; }
+		bool isEnabled() const { return enabled; }
+		bool isAvailable() const { return available; }
+		const char* getBackendName() const;
+
+		// Running totals since the counters were opened, only the has* fields that are set are valid
+		void read(CounterSample& out) const;
+
+		// Counters of work other threads did for the calling one, the thread pool adds what each worker counted
+		// over its share of a run. A scope on the calling thread counts what was added while it was open, so a
+		// phase's figures cover every thread that worked on it. The has* fields are only set while every
+		// sample added had them.
+		static void addWorkerSample(const CounterSample& sample);
+		static void readWorkers(CounterSample& out);
+
+	private:
+		void open();
+		void close();
+
+		bool enabled = true;
+		bool available = false;
+
+		int leader = -1;
+		int fds[4] = { -1, -1, -1, -1 };
+		int slot[4] = { -1, -1, -1, -1 };
+		int opened = 0;
+
+		HardwareCounters();
+		HardwareCounters(const HardwareCounters& ref) = delete;
+		~HardwareCounters();
+	};
+
+	// Adds the counter deltas of the scope to a sample, this thread's and the pool workers' together
+	class ScopedCounters
+	{
+	public:
+		explicit ScopedCounters(CounterSample& target);
+		~ScopedCounters();
+
+	private:
+		CounterSample& target;
+		CounterSample start;
+		CounterSample workersStart;
+	};
+}
@@ -0,0 +1,205 @@
+#include "profiler.h"
+#include <cstdio>
+#include <cstring>
+
+namespace Stats
+{
+	static thread_local ThreadBuffer* localBuffer = nullptr;
+
+	bool ThreadBuffer::push(const ZoneEvent& event)
+	{
+		const uint64_t h = head.load(std::memory_order_relaxed);
+		const uint64_t t = tail.load(std::memory_order_acquire);
+		if (h - t >= capacity)
+		{
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		events[h % capacity] = event;
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	void ThreadBuffer::drain(std::vector<ZoneEvent>& out)
+	{
+		const uint64_t t = tail.load(std::memory_order_relaxed);
+		const uint64_t h = head.load(std::memory_order_acquire);
+
+		for (uint64_t i = t; i < h; i++)
+		{
+			out.push_back(events[i % capacity]);
+		}
+		tail.store(h, std::memory_order_release);
+	}
+
+	Profiler& Profiler::instance()
+	{
+		static Profiler instance;
+
+		return instance;
+	}
+
+	Profiler::Profiler()
+	{
+		frameStart = now();
+		lastFrameStart = frameStart;
+		lastFrameEnd = frameStart;
+	}
+
+	uint64_t Profiler::now()
+	{
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	ThreadBuffer& Profiler::threadBuffer()
+	{
+		if (localBuffer == nullptr)
+		{
+			// Only taken the first time a thread opens a zone, buffers live as long as the profiler
+			std::lock_guard<std::mutex> lock(registryLock);
+			buffers.push_back(std::make_unique<ThreadBuffer>());
+			localBuffer = buffers.back().get();
+			localBuffer->threadIndex = (uint32_t)buffers.size() - 1;
+		}
+		return *localBuffer;
+	}
+
+	void Profiler::endFrame()
+	{
+		// Make sure the calling thread is thread 0 in the views even when it never opened a zone
+		threadBuffer();
+
+		lastFrame.clear();
+		{
+			std::lock_guard<std::mutex> lock(registryLock);
+			for (const std::unique_ptr<ThreadBuffer>& buffer : buffers)
+			{
+				drained.clear();
+				buffer->drain(drained);
+				for (const ZoneEvent& event : drained)
+				{
+					lastFrame.push_back({ event, buffer->threadIndex });
+				}
+			}
+		}
+
+		lastFrameStart = frameStart;
+		lastFrameEnd = now();
+		frameStart = lastFrameEnd;
+
+		if (historyFrames > 0)
+		{
+			history.push_back(lastFrame);
+			while (history.size() > historyFrames)
+			{
+				history.pop_front();
+			}
+		}
+	}
+
+	Pixel Profiler::zoneColour(const char* name)
+	{
+		// Stable colour per zone name
+		uint32_t hash = 2166136261u;
+		for (const char* c = name; *c; c++)
+		{
+			hash = (hash ^ (uint8_t)*c) * 16777619u;
+		}
+		return Pixel((int)(64 + (hash & 0x7F)), (int)(64 + ((hash >> 8) & 0x7F)), (int)(64 + ((hash >> 16) & 0x7F)));
+	}
+
+	void Profiler::drawTimingBar(Point2f pos, Point2f size) const
+	{
+		PlayGraphics& graphics = PlayGraphics::Instance();
+		const float rowHeight = size.height / 2.0f;
+		const float pixelsPerNs = size.width / 16666667.0f;
+
+		for (const CapturedEvent& captured : lastFrame)
+		{
+			const ZoneEvent& event = captured.event;
+			if (captured.threadIndex != 0 || event.depth > 1)
+			{
+				continue;
+			}
+
+			const float x0 = pos.x + std::max((int64_t)(event.begin - lastFrameStart), (int64_t)0) * pixelsPerNs;
+			const float x1 = pos.x + (int64_t)(event.end - lastFrameStart) * pixelsPerNs;
+			const float y0 = pos.y + event.depth * rowHeight;
+			if (x0 > pos.x + size.width)
+			{
+				continue;
+			}
+
+			graphics.DrawRect({ x0, y0 }, { std::min(x1, pos.x + size.width), y0 + rowHeight }, zoneColour(event.name), true);
+		}
+
+		graphics.DrawRect({ pos.x, pos.y }, { pos.x + size.width, pos.y + size.height }, PIX_BLACK, false);
+		graphics.DrawRect({ pos.x - 1, pos.y - 1 }, { pos.x + size.width + 1, pos.y + size.height + 1 }, PIX_WHITE, false);
+	}
+
+	float Profiler::getZoneTime(const char* name) const
+	{
+		uint64_t total = 0;
+		for (const CapturedEvent& captured : lastFrame)
+		{
+			if (strcmp(captured.event.name, name) == 0)
+			{
+				total += captured.event.end - captured.event.begin;
+			}
+		}
+		return total / 1000000.0f;
+	}
+
+	bool Profiler::exportChromeTrace(const char* path) const
+	{
+		std::ofstream file(path);
+		if (!file)
+		{
+			return false;
+		}
+
+		uint64_t origin = lastFrameEnd;
+		for (const std::vector<CapturedEvent>& frame : history)
+		{
+			for (const CapturedEvent& captured : frame)
+			{
+				origin = std::min(origin, captured.event.begin);
+			}
+		}
+
+		char line[256];
+		bool first = true;
+		file << "{\"traceEvents\":[\n";
+
+		for (const std::vector<CapturedEvent>& frame : history)
+		{
+			for (const CapturedEvent& captured : frame)
+			{
+				const ZoneEvent& event = captured.event;
+				const double ts = (double)(int64_t)(event.begin - origin) / 1000.0;
+				const double dur = (double)(event.end - event.begin) / 1000.0;
+
+				snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+					first ? "" : ",\n", event.name, ts, dur, captured.threadIndex);
+				file << line;
+				first = false;
+			}
+		}
+
+		file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+		return true;
+	}
+
+	ScopedZone::ScopedZone(const char* name)
+		: buffer(Profiler::instance().threadBuffer()), name(name), begin(Profiler::now())
+	{
+		depth = buffer.depth++;
+	}
+
+	ScopedZone::~ScopedZone()
+	{
+		buffer.depth--;
+		buffer.push({ name, begin, Profiler::now(), depth });
+	}
+}
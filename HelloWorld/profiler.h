@@ -0,0 +1,113 @@
+#pragma once
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Play.h"
+
+// Set to 0 to compile every PROFILE_ZONE out
+#ifndef FLUID_PROFILER
+#define FLUID_PROFILER 1
+#endif
+
+namespace Stats
+{
+	struct ZoneEvent
+	{
+		const char* name;
+		uint64_t begin;
+		uint64_t end;
+		uint32_t depth;
+	};
+
+	// Single producer (the owning thread), single consumer (the profiler collecting at the end of a frame).
+	// Zones are pushed when they close, a full buffer drops the zone instead of blocking.
+	class ThreadBuffer
+	{
+	public:
+		bool push(const ZoneEvent& event);
+		void drain(std::vector<ZoneEvent>& out);
+
+		uint32_t depth = 0;
+		uint32_t threadIndex = 0;
+		std::atomic<uint64_t> dropped{ 0 };
+
+	private:
+		static const uint32_t capacity = 1 << 14;
+
+		ZoneEvent events[capacity];
+		std::atomic<uint64_t> head{ 0 };
+		std::atomic<uint64_t> tail{ 0 };
+	};
+
+	// Collects nestable zones from every thread. The last frame is kept for the timing bar
+	// and a bounded history of frames can be exported as a Chrome trace (chrome://tracing, Perfetto).
+	class Profiler
+	{
+	public:
+		static Profiler& instance();
+
+		// Monotonic nanoseconds
+		static uint64_t now();
+
+		ThreadBuffer& threadBuffer();
+
+		// Call once per frame from the main thread, drains every thread buffer
+		void endFrame();
+
+		// Top level zones of the main thread in the top row, their children below, full width is 16.667ms
+		void drawTimingBar(Point2f pos, Point2f size) const;
+		// Milliseconds spent in the named zone during the last frame, all threads
+		float getZoneTime(const char* name) const;
+
+		bool exportChromeTrace(const char* path) const;
+
+		void setHistoryFrames(size_t frames) { historyFrames = frames; }
+
+	private:
+		struct CapturedEvent
+		{
+			ZoneEvent event;
+			uint32_t threadIndex;
+		};
+
+		static Pixel zoneColour(const char* name);
+
+		std::mutex registryLock;
+		std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+
+		uint64_t frameStart = 0;
+		uint64_t lastFrameStart = 0;
+		uint64_t lastFrameEnd = 0;
+		std::vector<ZoneEvent> drained;
+		std::vector<CapturedEvent> lastFrame;
+		std::deque<std::vector<CapturedEvent>> history;
+		size_t historyFrames = 600;
+
+		Profiler();
+		Profiler(const Profiler& ref) = delete;
+		~Profiler() {};
+	};
+
+	class ScopedZone
+	{
+	public:
+		explicit ScopedZone(const char* name);
+		~ScopedZone();
+
+	private:
+		ThreadBuffer& buffer;
+		const char* name;
+		uint64_t begin;
+		uint32_t depth;
+	};
+}
+
+#if FLUID_PROFILER
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name) Stats::ScopedZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#else
+#define PROFILE_ZONE(name)
+#endif
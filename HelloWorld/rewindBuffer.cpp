@@ -0,0 +1,297 @@
+#include "rewindBuffer.h"
+#include "Simulation.h"
+#include "boundary.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace Fluid
+{
+	// Residuals are packed 64 at a time at the width of the largest one in the block, a leading byte
+	// holds the width. Blocks run along one field of every particle, so a quiet field packs to a few bits.
+	static const uint32_t blockSize = 64;
+
+	static void packResiduals(const std::vector<uint32_t>& values, std::vector<uint8_t>& out)
+	{
+		for (size_t begin = 0; begin < values.size(); begin += blockSize)
+		{
+			const size_t end = std::min(values.size(), begin + blockSize);
+			uint32_t combined = 0;
+			for (size_t v = begin; v < end; v++)
+			{
+				combined |= values[v];
+			}
+			uint32_t width = 0;
+			while (width < 32 && (combined >> width) != 0)
+			{
+				width++;
+			}
+			out.push_back((uint8_t)width);
+
+			uint64_t buffer = 0;
+			uint32_t buffered = 0;
+			for (size_t v = begin; v < end && width > 0; v++)
+			{
+				buffer |= (uint64_t)values[v] << buffered;
+				buffered += width;
+				while (buffered >= 8)
+				{
+					out.push_back((uint8_t)buffer);
+					buffer >>= 8;
+					buffered -= 8;
+				}
+			}
+			if (buffered > 0)
+			{
+				out.push_back((uint8_t)buffer);
+			}
+		}
+	}
+
+	static void unpackResiduals(const uint8_t* in, std::vector<uint32_t>& values)
+	{
+		for (size_t begin = 0; begin < values.size(); begin += blockSize)
+		{
+			const size_t end = std::min(values.size(), begin + blockSize);
+			const uint32_t width = *in++;
+			const uint64_t mask = (1ull << width) - 1;
+
+			uint64_t buffer = 0;
+			uint32_t buffered = 0;
+			for (size_t v = begin; v < end; v++)
+			{
+				while (buffered < width)
+				{
+					buffer |= (uint64_t)(*in++) << buffered;
+					buffered += 8;
+				}
+				values[v] = (uint32_t)(buffer & mask);
+				buffer >>= width;
+				buffered -= width;
+			}
+		}
+	}
+
+	// Zigzag so small negative residuals stay small
+	static uint32_t zigzag(int32_t value)
+	{
+		return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+	}
+
+	static int32_t unzigzag(uint32_t bits)
+	{
+		return (int32_t)(bits >> 1) ^ -(int32_t)(bits & 1);
+	}
+
+	RewindBuffer::RewindBuffer(const RewindOptions& newOptions) : options(newOptions)
+	{
+		options.keyframeInterval = std::max(options.keyframeInterval, 1u);
+		const float fields[fieldCount] = { options.positionQuantum, options.positionQuantum, options.velocityQuantum, options.velocityQuantum, options.densityQuantum, options.densityQuantum, options.pressureQuantum };
+		memcpy(quanta, fields, sizeof(quanta));
+	}
+
+	void RewindBuffer::quantise(const Render::particle& particle, int32_t* out) const
+	{
+		const float fields[fieldCount] = { particle.pos.x, particle.pos.y, particle.vel.x, particle.vel.y, particle.d, particle.dNear, particle.p };
+		for (int f = 0; f < fieldCount; f++)
+		{
+			// Clamped so a residual always fits in 32 bits, the keyframes still hold blown up values exactly
+			const double scaled = std::isfinite(fields[f]) ? std::round(fields[f] / quanta[f]) : 0.0;
+			out[f] = (int32_t)std::max(-536870912.0, std::min(536870911.0, scaled));
+		}
+	}
+
+	void RewindBuffer::dequantise(const int32_t* in, Render::particle& particle) const
+	{
+		particle.pos = { in[0] * quanta[0], in[1] * quanta[1] };
+		particle.vel = { in[2] * quanta[2], in[3] * quanta[3] };
+		particle.d = in[4] * quanta[4];
+		particle.dNear = in[5] * quanta[5];
+		particle.p = in[6] * quanta[6];
+	}
+
+	void RewindBuffer::record(uint64_t step)
+	{
+		while (!frames.empty() && frames.back().step >= step)
+		{
+			bytes -= frames.back().getBytes();
+			rawBytes -= (size_t)frames.back().particles * sizeof(Render::particle);
+			frames.pop_back();
+			// The encoder's history is gone with it
+			previous.clear();
+		}
+
+		const uint32_t count = Render::ParticleCount();
+		Frame frame;
+		frame.step = step;
+		frame.particles = count;
+		RigidBodies::instance().getState(frame.bodies);
+		frame.boundaryTime = Render::Boundary::instance().getTime();
+
+		// A new group when the interval is up, after a gap or rewind, when particles were added or paging reordered them
+		const uint32_t order = Simulation::getInstance().GetParticleOrder();
+		const bool continues = !frames.empty() && frames.back().step + 1 == step && frames.back().particles == count && previous.size() == (size_t)count * fieldCount
+			&& particleOrder == order;
+		particleOrder = order;
+		frame.keyframe = true;
+		if (continues)
+		{
+			uint32_t deltas = 0;
+			for (auto it = frames.rbegin(); it != frames.rend() && !it->keyframe; ++it)
+			{
+				deltas++;
+			}
+			frame.keyframe = deltas + 1 >= options.keyframeInterval;
+		}
+
+		std::vector<int32_t> current((size_t)count * fieldCount);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			quantise(Render::GetParticle(i), &current[(size_t)i * fieldCount]);
+		}
+
+		if (frame.keyframe)
+		{
+			frame.data.resize((size_t)count * sizeof(Render::particle));
+			if (count > 0)
+			{
+				memcpy(frame.data.data(), &Render::GetParticle(0), frame.data.size());
+			}
+			frame.springs = Simulation::getInstance().GetSpringPairs();
+			hasBeforePrevious = false;
+		}
+		else
+		{
+			// Field by field across the particles
+			std::vector<uint32_t> residuals(current.size());
+			size_t r = 0;
+			for (int f = 0; f < fieldCount; f++)
+			{
+				for (size_t v = f; v < current.size(); v += fieldCount)
+				{
+					const int32_t predicted = hasBeforePrevious ? 2 * previous[v] - beforePrevious[v] : previous[v];
+					residuals[r++] = zigzag(current[v] - predicted);
+				}
+			}
+			packResiduals(residuals, frame.data);
+			frame.data.shrink_to_fit();
+			hasBeforePrevious = true;
+		}
+		beforePrevious.swap(previous);
+		previous.swap(current);
+
+		bytes += frame.getBytes();
+		rawBytes += (size_t)count * sizeof(Render::particle);
+		frames.push_back(std::move(frame));
+
+		while (bytes > options.memoryBudget && frames.size() > 1)
+		{
+			dropOldestGroup();
+		}
+	}
+
+	void RewindBuffer::dropOldestGroup()
+	{
+		do
+		{
+			bytes -= frames.front().getBytes();
+			rawBytes -= (size_t)frames.front().particles * sizeof(Render::particle);
+			frames.pop_front();
+		} while (!frames.empty() && !frames.front().keyframe);
+
+		if (frames.empty())
+		{
+			previous.clear();
+		}
+	}
+
+	bool RewindBuffer::restore(uint64_t step)
+	{
+		if (frames.empty() || step < frames.front().step || step > frames.back().step)
+		{
+			return false;
+		}
+
+		// Steps only go up, but a group can start after a gap
+		auto found = std::lower_bound(frames.begin(), frames.end(), step, [](const Frame& frame, uint64_t value) { return frame.step < value; });
+		if (found == frames.end() || found->step != step)
+		{
+			return false;
+		}
+		const size_t target = (size_t)(found - frames.begin());
+
+		size_t keyframe = target;
+		while (!frames[keyframe].keyframe)
+		{
+			keyframe--;
+		}
+
+		const Frame& key = frames[keyframe];
+		const uint32_t count = key.particles;
+		std::vector<Render::particle> particles(count);
+		if (count > 0)
+		{
+			memcpy(particles.data(), key.data.data(), key.data.size());
+		}
+
+		if (target != keyframe)
+		{
+			std::vector<int32_t> last((size_t)count * fieldCount);
+			std::vector<int32_t> beforeLast((size_t)count * fieldCount);
+			for (uint32_t i = 0; i < count; i++)
+			{
+				quantise(particles[i], &last[(size_t)i * fieldCount]);
+			}
+
+			std::vector<uint32_t> residuals(last.size());
+			for (size_t frame = keyframe + 1; frame <= target; frame++)
+			{
+				unpackResiduals(frames[frame].data.data(), residuals);
+				const bool linear = frame > keyframe + 1;
+				size_t r = 0;
+				for (int f = 0; f < fieldCount; f++)
+				{
+					for (size_t v = f; v < last.size(); v += fieldCount)
+					{
+						const int32_t predicted = linear ? 2 * last[v] - beforeLast[v] : last[v];
+						beforeLast[v] = last[v];
+						last[v] = predicted + unzigzag(residuals[r++]);
+					}
+				}
+			}
+
+			for (uint32_t i = 0; i < count; i++)
+			{
+				dequantise(&last[(size_t)i * fieldCount], particles[i]);
+			}
+		}
+
+		Simulation& simulation = Simulation::getInstance();
+		Render::ClearParticles();
+		simulation.ClearData();
+		const uint32_t first = Render::CreateParticles(count, [&particles](uint32_t offset, uint32_t chunkCount, Render::particle* out)
+		{
+			memcpy(out, particles.data() + offset, chunkCount * sizeof(Render::particle));
+		});
+		simulation.AddCircles(first, count);
+		simulation.SetSpringPairs(key.springs.data(), key.springs.size());
+		RigidBodies::instance().setState(found->bodies);
+		Render::Boundary::instance().setTime(found->boundaryTime);
+		return true;
+	}
+
+	void RewindBuffer::clear()
+	{
+		frames.clear();
+		previous.clear();
+		beforePrevious.clear();
+		hasBeforePrevious = false;
+		bytes = 0;
+		rawBytes = 0;
+	}
+
+	float RewindBuffer::getCompressionRatio() const
+	{
+		return bytes > 0 ? (float)rawBytes / (float)bytes : 0.0f;
+	}
+}
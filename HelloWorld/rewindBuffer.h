@@ -0,0 +1,86 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include "particle.h"
+#include "springPair.h"
+#include "rigidBodies.h"
+
+namespace Fluid
+{
+	struct RewindOptions
+	{
+		// A full, exact copy of the state every this many steps, quantised deltas in between
+		uint32_t keyframeInterval = 30;
+		// The oldest keyframe and its deltas are dropped once the history grows past this
+		size_t memoryBudget = 64 * 1024 * 1024;
+
+		// Delta frames round to these steps, the error never builds up past half of one
+		float positionQuantum = 1.0f / 256.0f;
+		float velocityQuantum = 1.0f / 16.0f;
+		float densityQuantum = 1.0f / 128.0f;
+		float pressureQuantum = 1.0f / 64.0f;
+	};
+
+	// History of the particle state for stepping backwards. Each delta frame stores, per field, the
+	// difference between the quantised value and a straight line through the two frames before it,
+	// bit packed in small blocks, so steady motion costs a few bits a field. Keyframes are exact and
+	// carry the springs, a restored delta frame is exact to the quantum and keeps its keyframe's springs.
+	// Rigid bodies and the boundary's motion are stored exactly in every frame.
+	class RewindBuffer
+	{
+	public:
+		explicit RewindBuffer(const RewindOptions& options = RewindOptions());
+
+		// Adds the simulation's current state as step. Recording a step at or before the newest drops
+		// everything from there on, so stepping forward after a rewind starts a new branch.
+		void record(uint64_t step);
+		// Rebuilds step from the nearest keyframe before it into the particle store and simulation
+		bool restore(uint64_t step);
+		void clear();
+
+		bool isEmpty() const { return frames.empty(); }
+		uint64_t getFirstStep() const { return frames.empty() ? 0 : frames.front().step; }
+		uint64_t getLastStep() const { return frames.empty() ? 0 : frames.back().step; }
+		size_t getFrameCount() const { return frames.size(); }
+		size_t getBytes() const { return bytes; }
+		// Compared with a raw copy of every particle in every frame
+		float getCompressionRatio() const;
+
+	private:
+		static const int fieldCount = 7;
+
+		struct Frame
+		{
+			uint64_t step = 0;
+			bool keyframe = false;
+			uint32_t particles = 0;
+			std::vector<uint8_t> data;
+			std::vector<SpringPair> springs;
+			// Exact in every frame, there are only ever a few dozen
+			std::vector<RigidBodyState> bodies;
+			// Where a moving boundary box is in its motion
+			double boundaryTime = 0.0;
+
+			size_t getBytes() const { return data.capacity() + springs.capacity() * sizeof(SpringPair) + bodies.capacity() * sizeof(RigidBodyState) + sizeof(Frame); }
+		};
+
+		void quantise(const Render::particle& particle, int32_t* out) const;
+		void dequantise(const int32_t* in, Render::particle& particle) const;
+		void dropOldestGroup();
+
+		RewindOptions options;
+		float quanta[fieldCount];
+
+		std::deque<Frame> frames;
+		size_t bytes = 0;
+		size_t rawBytes = 0;
+
+		// Quantised state of the newest frame and the one before it, the encoder's prediction
+		std::vector<int32_t> previous;
+		std::vector<int32_t> beforePrevious;
+		bool hasBeforePrevious = false;
+		// The simulation's particle order the encoder's history is in
+		uint32_t particleOrder = 0;
+	};
+}
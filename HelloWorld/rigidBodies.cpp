@@ -0,0 +1,433 @@
+#include "rigidBodies.h"
+#include "obstacles.h"
+#include "boundary.h"
+#include "particle.h"
+#include "threadPool.h"
+
+namespace Fluid
+{
+	static float cross(const Vector2f& a, const Vector2f& b)
+	{
+		return a.x * b.y - a.y * b.x;
+	}
+
+	static Vector2f rotate(const Vector2f& v, float c, float s)
+	{
+		return { c * v.x - s * v.y, s * v.x + c * v.y };
+	}
+
+	Vector2f RigidBody::toWorld(const Vector2f& local) const
+	{
+		return pos + rotate(local, std::cos(angle), std::sin(angle));
+	}
+
+	float RigidBody::distance(const Vector2f& worldPos, Vector2f& normal) const
+	{
+		if (type == Type::Circle)
+		{
+			const Vector2f offset = worldPos - pos;
+			const float length = offset.Length();
+			normal = length > 1e-6f ? offset / length : Vector2f(0.0f, -1.0f);
+			return length - radius;
+		}
+
+		const float c = std::cos(angle);
+		const float s = std::sin(angle);
+		const Vector2f local = rotate(worldPos - pos, c, -s);
+
+		// Inside a convex shape the nearest surface is the edge plane it is least behind
+		float deepest = -1e30f;
+		size_t deepestEdge = 0;
+		for (size_t i = 0; i < corners.size(); i++)
+		{
+			const float plane = dot(local - corners[i], normals[i]);
+			if (plane > deepest)
+			{
+				deepest = plane;
+				deepestEdge = i;
+			}
+		}
+		if (deepest <= 0.0f)
+		{
+			normal = rotate(normals[deepestEdge], c, s);
+			return deepest;
+		}
+
+		float nearest = 1e30f;
+		Vector2f closest = local;
+		for (size_t i = 0; i < corners.size(); i++)
+		{
+			const Vector2f& a = corners[i];
+			const Vector2f edge = corners[(i + 1) % corners.size()] - a;
+			const float t = std::max(0.0f, std::min(1.0f, dot(local - a, edge) / edge.LengthSqr()));
+			const Vector2f point = a + edge * t;
+			const float lengthSqr = (local - point).LengthSqr();
+			if (lengthSqr < nearest)
+			{
+				nearest = lengthSqr;
+				closest = point;
+			}
+		}
+		nearest = std::sqrt(nearest);
+		normal = rotate(nearest > 1e-6f ? (local - closest) / nearest : normals[deepestEdge], c, s);
+		return nearest;
+	}
+
+	void RigidBody::draw(Play::Colour colour) const
+	{
+		if (type == Type::Circle)
+		{
+			// A spoke so the spin shows
+			const Vector2f rim = toWorld({ radius, 0.0f });
+			Play::DrawCircle({ pos.x, pos.y }, (int)radius, colour);
+			Play::DrawLine({ pos.x, pos.y }, { rim.x, rim.y }, colour);
+			return;
+		}
+
+		for (size_t i = 0; i < corners.size(); i++)
+		{
+			const Vector2f a = toWorld(corners[i]);
+			const Vector2f b = toWorld(corners[(i + 1) % corners.size()]);
+			Play::DrawLine({ a.x, a.y }, { b.x, b.y }, colour);
+		}
+	}
+
+	RigidBodies& RigidBodies::instance()
+	{
+		static RigidBodies rigidBodies;
+		return rigidBodies;
+	}
+
+	void RigidBodies::clear()
+	{
+		bodies.clear();
+		prevPositions.clear();
+		prevAngles.clear();
+		work.clear();
+	}
+
+	void RigidBodies::add(RigidBody body, float particleRadius)
+	{
+		const float fluidMassPerArea = 1.0f / (4.0f * particleRadius * particleRadius);
+		float area = 0.0f;
+		float inertia = 0.0f;
+
+		if (body.type == RigidBody::Type::Circle)
+		{
+			area = 3.14159265f * body.radius * body.radius;
+			inertia = 0.5f * body.radius * body.radius;
+			body.boundingRadius = body.radius;
+		}
+		else
+		{
+			if (body.type == RigidBody::Type::Box)
+			{
+				const Vector2f& h = body.halfSize;
+				body.points = { { -h.x, -h.y }, { h.x, -h.y }, { h.x, h.y }, { -h.x, h.y } };
+			}
+
+			// Area, centroid and second moment from the triangles fanned out of the body's origin
+			Vector2f centroid = { 0.0f, 0.0f };
+			float moment = 0.0f;
+			for (size_t i = 0; i < body.points.size(); i++)
+			{
+				const Vector2f& a = body.points[i];
+				const Vector2f& b = body.points[(i + 1) % body.points.size()];
+				const float twiceArea = cross(a, b);
+				area += 0.5f * twiceArea;
+				centroid += (a + b) * (twiceArea / 6.0f);
+				moment += twiceArea * (dot(a, a) + dot(a, b) + dot(b, b)) / 12.0f;
+			}
+			centroid /= area;
+			// Per unit mass, moved from the origin to the centroid
+			inertia = moment / area - centroid.LengthSqr();
+			area = std::fabs(area);
+
+			// Recentred on the centre of mass, pos follows so nothing moves on screen
+			body.pos = body.toWorld(centroid);
+			body.corners.clear();
+			body.normals.clear();
+			body.boundingRadius = 0.0f;
+			for (const Vector2f& point : body.points)
+			{
+				body.corners.push_back(point - centroid);
+				body.boundingRadius = std::max(body.boundingRadius, (point - centroid).Length());
+			}
+			for (size_t i = 0; i < body.corners.size(); i++)
+			{
+				const Vector2f edge = body.corners[(i + 1) % body.corners.size()] - body.corners[i];
+				Vector2f normal = { edge.y, -edge.x };
+				normal.Normalize();
+				// Either winding, the centre is inside
+				if (dot(normal, body.corners[i]) < 0.0f)
+				{
+					normal = -normal;
+				}
+				body.normals.push_back(normal);
+			}
+		}
+
+		const float mass = std::max(1e-3f, body.density * area * fluidMassPerArea);
+		body.inverseMass = 1.0f / mass;
+		body.inverseInertia = 1.0f / std::max(1e-3f, mass * inertia);
+
+		bodies.push_back(body);
+		prevPositions.push_back(body.pos);
+		prevAngles.push_back(body.angle);
+	}
+
+	void RigidBodies::predict(float dt, float gravity)
+	{
+		for (size_t b = 0; b < bodies.size(); b++)
+		{
+			RigidBody& body = bodies[b];
+			prevPositions[b] = body.pos;
+			prevAngles[b] = body.angle;
+			body.vel.y += gravity * dt;
+			body.pos += body.vel * dt;
+			body.angle += body.angularVel * dt;
+		}
+	}
+
+	float RigidBodies::effectiveInverseMass(const RigidBody& body, const Vector2f& point, const Vector2f& normal) const
+	{
+		const float arm = cross(point - body.pos, normal);
+		return body.inverseMass + body.inverseInertia * arm * arm;
+	}
+
+	void RigidBodies::applyCorrection(RigidBody& body, const Vector2f& point, const Vector2f& normal, float lambda) const
+	{
+		body.angle += body.inverseInertia * cross(point - body.pos, normal) * lambda;
+		body.pos += normal * (body.inverseMass * lambda);
+	}
+
+	uint32_t RigidBodies::collideParticles(const NeighbourGrid& grid, uint32_t count, float particleRadius, float margin, bool parallel)
+	{
+		work.resize(bodies.size());
+		const Render::PeriodicDomain periodic = Render::Boundary::instance().getPeriodic();
+
+		// A particle has a mass of one. Each contact is split by inverse mass, the particle's share moves
+		// it out and the rest turns and moves the body the other way.
+		auto collideBody = [&](uint32_t b)
+		{
+			const RigidBody& body = bodies[b];
+			BodyContacts& local = work[b];
+			local.contacts.clear();
+			local.move = { 0.0f, 0.0f };
+			local.turn = 0.0f;
+
+			const float extent = body.boundingRadius + particleRadius + margin;
+			grid.gatherRect(body.pos - Vector2f(extent, extent), body.pos + Vector2f(extent, extent), local.candidates);
+
+			float deepest = 0.0f;
+			for (uint32_t index : local.candidates)
+			{
+				if (index >= count)
+				{
+					continue;
+				}
+				// The copy of the particle nearest the body, across a wrapped edge if need be
+				const Vector2f pos = body.pos + periodic.minimumImage(Render::GetParticle(index).pos - body.pos);
+				Vector2f normal;
+				const float depth = particleRadius - body.distance(pos, normal);
+				if (!(depth > 0.0f))
+				{
+					continue;
+				}
+
+				const Vector2f surface = pos - normal * (particleRadius - depth);
+				const float lambda = depth / (1.0f + effectiveInverseMass(body, surface, normal));
+				local.contacts.push_back({ index, normal * lambda });
+				local.move -= normal * (body.inverseMass * lambda);
+				local.turn -= body.inverseInertia * cross(surface - body.pos, normal) * lambda;
+				deepest = std::max(deepest, depth);
+			}
+
+			// Summed over many contacts a light body would overshoot, it never moves further than the deepest one
+			const float moved = local.move.Length();
+			if (moved > deepest)
+			{
+				local.move *= deepest / moved;
+			}
+			const float turned = std::fabs(local.turn) * body.boundingRadius;
+			if (turned > deepest)
+			{
+				local.turn *= deepest / turned;
+			}
+		};
+
+		if (parallel)
+		{
+			ThreadPool::instance().run((uint32_t)bodies.size(), collideBody);
+		}
+		else
+		{
+			for (uint32_t b = 0; b < (uint32_t)bodies.size(); b++)
+			{
+				collideBody(b);
+			}
+		}
+
+		uint32_t total = 0;
+		for (size_t b = 0; b < bodies.size(); b++)
+		{
+			bodies[b].pos += work[b].move;
+			bodies[b].angle += work[b].turn;
+			for (const Contact& contact : work[b].contacts)
+			{
+				Render::GetParticle(contact.particle).pos += contact.push;
+			}
+			total += (uint32_t)work[b].contacts.size();
+		}
+		return total;
+	}
+
+	void RigidBodies::solve(float dt, float velocityDamping)
+	{
+		// Walls in the box's own frame, it can be turned
+		const Render::Boundary& boundary = Render::Boundary::instance();
+		const Vector2f half = boundary.getHalfSize();
+		const float c = std::cos(boundary.getAngle());
+		const float s = std::sin(boundary.getAngle());
+		const Render::PeriodicDomain periodic = boundary.getPeriodic();
+		const Vector2f wallNormals[4] = { rotate({ 1.0f, 0.0f }, c, s), rotate({ -1.0f, 0.0f }, c, s), rotate({ 0.0f, 1.0f }, c, s), rotate({ 0.0f, -1.0f }, c, s) };
+		const ObstacleField& obstacles = ObstacleField::instance();
+
+		// A circle collides as its centre grown by the radius, the other shapes by their corners
+		std::vector<Vector2f> features;
+		auto gatherFeatures = [&features](const RigidBody& body)
+		{
+			features.clear();
+			if (body.type == RigidBody::Type::Circle)
+			{
+				features.push_back(body.pos);
+				return body.radius;
+			}
+			for (const Vector2f& corner : body.corners)
+			{
+				features.push_back(body.toWorld(corner));
+			}
+			return 0.0f;
+		};
+
+		const int iterations = 2;
+		for (int iteration = 0; iteration < iterations; iteration++)
+		{
+			for (RigidBody& body : bodies)
+			{
+				const float featureRadius = gatherFeatures(body);
+				for (const Vector2f& feature : features)
+				{
+					const Vector2f local = boundary.toLocal(feature);
+					const float walls[4] = { -half.x - (local.x - featureRadius), (local.x + featureRadius) - half.x, -half.y - (local.y - featureRadius), (local.y + featureRadius) - half.y };
+					for (int w = 0; w < 4; w++)
+					{
+						const bool wrapped = w < 2 ? periodic.x : periodic.y;
+						if (!wrapped && walls[w] > 0.0f)
+						{
+							const Vector2f surface = feature - wallNormals[w] * featureRadius;
+							applyCorrection(body, surface, wallNormals[w], walls[w] / effectiveInverseMass(body, surface, wallNormals[w]));
+						}
+					}
+
+					Vector2f normal;
+					const float depth = obstacles.isBaked() ? featureRadius - obstacles.sample(feature, normal) : 0.0f;
+					if (depth > 0.0f)
+					{
+						const Vector2f surface = feature - normal * featureRadius;
+						applyCorrection(body, surface, normal, depth / effectiveInverseMass(body, surface, normal));
+					}
+				}
+			}
+
+			for (size_t a = 0; a < bodies.size(); a++)
+			{
+				for (size_t b = a + 1; b < bodies.size(); b++)
+				{
+					RigidBody& first = bodies[a];
+					RigidBody& second = bodies[b];
+					const float reach = first.boundingRadius + second.boundingRadius;
+					if ((first.pos - second.pos).LengthSqr() > reach * reach)
+					{
+						continue;
+					}
+
+					// One body's features against the other's exact distance. A circle's centre covers every
+					// contact with it, between two polygons the corners of each are tried against the other.
+					auto separate = [&](RigidBody& mover, RigidBody& other)
+					{
+						const float featureRadius = gatherFeatures(mover);
+						for (const Vector2f& feature : features)
+						{
+							Vector2f normal;
+							const float depth = featureRadius - other.distance(feature, normal);
+							if (depth > 0.0f)
+							{
+								const Vector2f surface = feature - normal * featureRadius;
+								const float lambda = depth / (effectiveInverseMass(mover, surface, normal) + effectiveInverseMass(other, surface, normal));
+								applyCorrection(mover, surface, normal, lambda);
+								applyCorrection(other, surface, -normal, lambda);
+							}
+						}
+					};
+
+					if (first.type == RigidBody::Type::Circle)
+					{
+						separate(first, second);
+					}
+					else if (second.type == RigidBody::Type::Circle)
+					{
+						separate(second, first);
+					}
+					else
+					{
+						separate(first, second);
+						separate(second, first);
+					}
+				}
+			}
+		}
+
+		if (dt <= 0.0f)
+		{
+			return;
+		}
+		for (size_t b = 0; b < bodies.size(); b++)
+		{
+			RigidBody& body = bodies[b];
+			body.vel = (body.pos - prevPositions[b]) / dt * velocityDamping;
+			body.angularVel = (body.angle - prevAngles[b]) / dt * velocityDamping;
+			periodic.wrap(body.pos);
+		}
+	}
+
+	void RigidBodies::draw() const
+	{
+		for (const RigidBody& body : bodies)
+		{
+			body.draw(Play::cWhite);
+		}
+	}
+
+	void RigidBodies::getState(std::vector<RigidBodyState>& out) const
+	{
+		out.resize(bodies.size());
+		for (size_t b = 0; b < bodies.size(); b++)
+		{
+			out[b] = { bodies[b].pos, bodies[b].vel, bodies[b].angle, bodies[b].angularVel };
+		}
+	}
+
+	void RigidBodies::setState(const std::vector<RigidBodyState>& state)
+	{
+		for (size_t b = 0; b < bodies.size() && b < state.size(); b++)
+		{
+			bodies[b].pos = state[b].pos;
+			bodies[b].vel = state[b].vel;
+			bodies[b].angle = state[b].angle;
+			bodies[b].angularVel = state[b].angularVel;
+			prevPositions[b] = state[b].pos;
+			prevAngles[b] = state[b].angle;
+		}
+	}
+}
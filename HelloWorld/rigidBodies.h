@@ -0,0 +1,108 @@
+#pragma once
+#include <vector>
+#include "Play.h"
+#include "neighbourGrid.h"
+
+namespace Fluid
+{
+	// A solid that moves with the fluid. Particles it touches are pushed out and push it back by the
+	// same amount, so it floats, sinks or gets carried along depending on its density.
+	struct RigidBody
+	{
+		enum class Type { Circle, Box, Polygon };
+
+		Type type = Type::Circle;
+		Vector2f pos = { 0.0f, 0.0f };
+		Vector2f vel = { 0.0f, 0.0f };
+		// Radians, clockwise on screen
+		float angle = 0.0f;
+		float angularVel = 0.0f;
+		// Circle: radius. Box: half extents. Polygon: convex corners around pos in the body's own frame.
+		float radius = 0.0f;
+		Vector2f halfSize = { 0.0f, 0.0f };
+		std::vector<Vector2f> points;
+		// Relative to the fluid, below 1 floats
+		float density = 0.5f;
+
+		// Worked out by RigidBodies::add
+		float inverseMass = 0.0f;
+		float inverseInertia = 0.0f;
+		float boundingRadius = 0.0f;
+		// Box and polygon corners around the centre of mass, anticlockwise on screen, and the outward edge normals
+		std::vector<Vector2f> corners;
+		std::vector<Vector2f> normals;
+
+		// Negative inside, and the normal pointing out of the body at the nearest surface
+		float distance(const Vector2f& worldPos, Vector2f& normal) const;
+		Vector2f toWorld(const Vector2f& local) const;
+		void draw(Play::Colour colour) const;
+	};
+
+	// What changes from step to step, for saving and restoring the bodies with the particles
+	struct RigidBodyState
+	{
+		Vector2f pos;
+		Vector2f vel;
+		float angle;
+		float angularVel;
+	};
+
+	// Every body in the scene, stepped alongside the particles. Contacts with the fluid come from the
+	// neighbour grid cells under each body's bounds, bodies run in parallel with their own correction
+	// sums and the particle corrections are applied afterwards in body order, so the result never
+	// depends on the thread count.
+	class RigidBodies
+	{
+	public:
+		static RigidBodies& instance();
+
+		void clear();
+		// Fills in the mass and corners. The fluid's mass is one particle per particle diameter squared.
+		void add(RigidBody body, float particleRadius);
+		const std::vector<RigidBody>& getBodies() const { return bodies; }
+		bool isEmpty() const { return bodies.empty(); }
+
+		// Gravity and a free move, before the particles are pushed about
+		void predict(float dt, float gravity);
+		// Pushes particles out of every body and the bodies back, grid as built for this step's relaxation.
+		// margin covers how far particles have moved since the grid was built. Returns the contacts.
+		uint32_t collideParticles(const NeighbourGrid& grid, uint32_t count, float particleRadius, float margin, bool parallel);
+		// Bodies against the walls, the obstacles and each other, then velocities from how far they moved
+		void solve(float dt, float velocityDamping);
+
+		void draw() const;
+
+		void getState(std::vector<RigidBodyState>& out) const;
+		void setState(const std::vector<RigidBodyState>& state);
+
+	private:
+		struct Contact
+		{
+			uint32_t particle;
+			Vector2f push;
+		};
+
+		// Each body's share of the particle pass, only its own task writes it
+		struct BodyContacts
+		{
+			std::vector<uint32_t> candidates;
+			std::vector<Contact> contacts;
+			Vector2f move = { 0.0f, 0.0f };
+			float turn = 0.0f;
+		};
+
+		// Moves a body by lambda along normal at the world point, out of whatever it touched
+		void applyCorrection(RigidBody& body, const Vector2f& point, const Vector2f& normal, float lambda) const;
+		float effectiveInverseMass(const RigidBody& body, const Vector2f& point, const Vector2f& normal) const;
+
+		std::vector<RigidBody> bodies;
+		std::vector<Vector2f> prevPositions;
+		std::vector<float> prevAngles;
+
+		std::vector<BodyContacts> work;
+
+		RigidBodies() {};
+		RigidBodies(const RigidBodies& ref) = delete;
+		~RigidBodies() {};
+	};
+}
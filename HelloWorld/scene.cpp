@@ -0,0 +1,610 @@
+#include "scene.h"
+#include "boundary.h"
+#include "settledCache.h"
+#include "particleGenerators.h"
+#include <filesystem>
+
+namespace Fluid
+{
+	// Poisson and fill shapes as offsets from their corner, nothing for a fill whose sprite isn't loaded
+	static std::vector<Vector2f> shapeSamples(const SceneShape& shape)
+	{
+		if (shape.type == SceneShape::Type::Poisson)
+		{
+			return Render::PoissonDiskSamples(shape.size, shape.spacing, shape.seed);
+		}
+
+		const int id = FindSprite(shape.sprite.c_str());
+		if (id < 0)
+		{
+			return {};
+		}
+		// Sampled in image pixels, the first frame only
+		const PixelData* data = PlayGraphics::Instance().GetSpritePixelData(id);
+		std::vector<Vector2f> samples = Render::ImageSamples(data->pPixels, Play::GetSpriteWidth(id), Play::GetSpriteHeight(id), data->width,
+			shape.spacing / shape.scale, (uint8_t)shape.alphaThreshold);
+		for (Vector2f& sample : samples)
+		{
+			sample *= shape.scale;
+		}
+		return samples;
+	}
+
+	static void forEachShapeParticle(const SceneShape& shape, const std::function<void(const Vector2f& pos, const Vector2f& vel)>& place)
+	{
+		if (shape.type == SceneShape::Type::Poisson || shape.type == SceneShape::Type::Fill)
+		{
+			for (const Vector2f& sample : shapeSamples(shape))
+			{
+				place(shape.pos + sample, shape.vel);
+			}
+			return;
+		}
+
+		if (shape.type == SceneShape::Type::Block)
+		{
+			for (int y = 0; y < shape.rows; y++)
+			{
+				for (int x = 0; x < shape.columns; x++)
+				{
+					place({ shape.pos.x + x * shape.spacing, shape.pos.y + y * shape.spacing }, shape.vel);
+				}
+			}
+			return;
+		}
+
+		// Square lattice clipped to the disc
+		const int steps = (int)(shape.radius / shape.spacing);
+		for (int y = -steps; y <= steps; y++)
+		{
+			for (int x = -steps; x <= steps; x++)
+			{
+				const Vector2f offset = { x * shape.spacing, y * shape.spacing };
+				if (offset.Length() > shape.radius)
+				{
+					continue;
+				}
+
+				Vector2f vel = shape.vel;
+				if (shape.type == SceneShape::Type::Vortex)
+				{
+					// Solid body rotation, the rim moves at the given speed
+					vel += Vector2f(-offset.y, offset.x) * (shape.spin / shape.radius);
+				}
+				place(shape.pos + offset, vel);
+			}
+		}
+	}
+
+	uint32_t SceneDescription::countParticles() const
+	{
+		uint32_t count = 0;
+		for (const SceneShape& shape : shapes)
+		{
+			forEachShapeParticle(shape, [&count](const Vector2f&, const Vector2f&) { count++; });
+		}
+		return count;
+	}
+
+	bool LoadSceneFile(const std::string& path, SceneDescription& out, std::string& error)
+	{
+		std::ifstream file(path);
+		if (!file)
+		{
+			error = "can't open " + path;
+			return false;
+		}
+
+		std::stringstream text;
+		text << file.rdbuf();
+		if (!ParseScene(text.str(), out, error))
+		{
+			error = path + ": " + error;
+			return false;
+		}
+		return true;
+	}
+
+	bool ParseScene(const std::string& text, SceneDescription& out, std::string& error)
+	{
+		out = SceneDescription();
+
+		std::istringstream lines(text);
+		std::string line;
+		int lineNumber = 0;
+		float bodyDensity = 0.5f;
+		while (std::getline(lines, line))
+		{
+			lineNumber++;
+			const size_t comment = line.find('#');
+			if (comment != std::string::npos)
+			{
+				line.erase(comment);
+			}
+
+			std::istringstream words(line);
+			std::string command;
+			if (!(words >> command))
+			{
+				continue;
+			}
+
+			auto fail = [&](const std::string& message)
+			{
+				error = "line " + std::to_string(lineNumber) + ": " + message;
+				return false;
+			};
+
+			if (command == "name")
+			{
+				std::getline(words >> std::ws, out.name);
+			}
+			else if (command == "boundary")
+			{
+				if (!(words >> out.boundary.x >> out.boundary.y) || out.boundary.x <= 0.0f || out.boundary.y <= 0.0f)
+				{
+					return fail("boundary needs a positive width and height");
+				}
+			}
+			else if (command == "solver")
+			{
+				std::string key;
+				float value;
+				while (words >> key)
+				{
+					if (!(words >> value))
+					{
+						return fail("solver " + key + " has no value");
+					}
+
+					SolverParameters& solver = out.solver;
+					if (key == "gravity") solver.gravity = value;
+					else if (key == "rest_density") solver.restDensity = value;
+					else if (key == "pressure") solver.pressure = value;
+					else if (key == "near_pressure") solver.nearPressure = value;
+					else if (key == "velocity_damping") solver.velocityDamping = value;
+					else if (key == "wall_damping") solver.wallDamping = value;
+					else if (key == "particle_radius" && value >= 0.0f) solver.particleRadius = value;
+					else if (key == "step_rate" && value > 0.0f) solver.stepRate = value;
+					else if (key == "sleep_steps" && value >= 0.0f) solver.sleepSteps = (int)value;
+					else if (key == "sleep_distance" && value >= 0.0f) solver.sleepDistance = value;
+					else return fail("unknown solver setting " + key);
+				}
+			}
+			else if (command == "block")
+			{
+				SceneShape shape;
+				shape.type = SceneShape::Type::Block;
+				if (!(words >> shape.pos.x >> shape.pos.y >> shape.columns >> shape.rows >> shape.spacing) || shape.columns <= 0 || shape.rows <= 0 || shape.spacing <= 0.0f)
+				{
+					return fail("block needs x y columns rows spacing");
+				}
+				if (words >> shape.vel.x >> shape.vel.y && words >> shape.jitter)
+				{
+					if (!(words >> shape.seed) || shape.jitter < 0.0f || shape.jitter > 1.0f)
+					{
+						return fail("block jitter needs a fraction of 0 to 1 and a seed");
+					}
+				}
+				out.shapes.push_back(shape);
+			}
+			else if (command == "poisson")
+			{
+				SceneShape shape;
+				shape.type = SceneShape::Type::Poisson;
+				if (!(words >> shape.pos.x >> shape.pos.y >> shape.size.x >> shape.size.y >> shape.spacing) || shape.size.x <= 0.0f || shape.size.y <= 0.0f || shape.spacing <= 0.0f)
+				{
+					return fail("poisson needs x y width height spacing");
+				}
+				if (words >> shape.seed)
+				{
+					words >> shape.vel.x >> shape.vel.y;
+				}
+				out.shapes.push_back(shape);
+			}
+			else if (command == "fill")
+			{
+				SceneShape shape;
+				shape.type = SceneShape::Type::Fill;
+				if (!(words >> shape.sprite >> shape.pos.x >> shape.pos.y >> shape.spacing) || shape.spacing <= 0.0f)
+				{
+					return fail("fill needs a sprite name, x, y and spacing");
+				}
+				if (words >> shape.scale)
+				{
+					words >> shape.alphaThreshold;
+				}
+				if (shape.scale <= 0.0f || shape.alphaThreshold < 1 || shape.alphaThreshold > 255)
+				{
+					return fail("fill needs a positive scale and a threshold of 1 to 255");
+				}
+				out.shapes.push_back(shape);
+			}
+			else if (command == "circle" || command == "vortex")
+			{
+				SceneShape shape;
+				shape.type = command == "circle" ? SceneShape::Type::Circle : SceneShape::Type::Vortex;
+				if (!(words >> shape.pos.x >> shape.pos.y >> shape.radius >> shape.spacing) || shape.radius <= 0.0f || shape.spacing <= 0.0f)
+				{
+					return fail(command + " needs cx cy radius spacing");
+				}
+				if (shape.type == SceneShape::Type::Vortex)
+				{
+					if (!(words >> shape.spin))
+					{
+						return fail("vortex needs a speed");
+					}
+				}
+				else
+				{
+					words >> shape.vel.x >> shape.vel.y;
+				}
+				out.shapes.push_back(shape);
+			}
+			else if (command == "obstacle" || command == "container")
+			{
+				ObstacleShape shape;
+				shape.container = command == "container";
+				std::string type;
+				words >> type;
+				bool valid = true;
+				if (type == "circle")
+				{
+					shape.type = ObstacleShape::Type::Circle;
+					valid = (words >> shape.centre.x >> shape.centre.y >> shape.radius) && shape.radius > 0.0f;
+				}
+				else if (type == "box")
+				{
+					shape.type = ObstacleShape::Type::Box;
+					float degrees = 0.0f;
+					valid = (words >> shape.centre.x >> shape.centre.y >> shape.halfSize.x >> shape.halfSize.y) && shape.halfSize.x > 0.0f && shape.halfSize.y > 0.0f;
+					words >> degrees;
+					shape.halfSize *= 0.5f;
+					shape.angle = degrees * 3.14159265f / 180.0f;
+				}
+				else if (type == "segment")
+				{
+					shape.type = ObstacleShape::Type::Segment;
+					shape.points.resize(2);
+					valid = (words >> shape.points[0].x >> shape.points[0].y >> shape.points[1].x >> shape.points[1].y >> shape.radius) && shape.radius > 0.0f;
+				}
+				else if (type == "sprite")
+				{
+					SceneMask mask;
+					mask.container = shape.container;
+					if (!(words >> mask.sprite >> mask.pos.x >> mask.pos.y))
+					{
+						return fail(command + " sprite needs a name, x and y");
+					}
+					if (words >> mask.scale)
+					{
+						words >> mask.alphaThreshold;
+					}
+					if (mask.scale <= 0.0f || mask.alphaThreshold < 1 || mask.alphaThreshold > 255)
+					{
+						return fail(command + " sprite needs a positive scale and a threshold of 1 to 255");
+					}
+					out.masks.push_back(mask);
+					continue;
+				}
+				else if (type == "polygon")
+				{
+					shape.type = ObstacleShape::Type::Polygon;
+					Vector2f point;
+					while (words >> point.x >> point.y)
+					{
+						shape.points.push_back(point);
+					}
+					valid = shape.points.size() >= 3;
+				}
+				else
+				{
+					return fail(command + " needs circle, box, segment, polygon or sprite");
+				}
+				if (!valid)
+				{
+					return fail(command + " " + type + " has missing or invalid values");
+				}
+				out.obstacles.push_back(shape);
+			}
+			else if (command == "body")
+			{
+				RigidBody body;
+				body.density = bodyDensity;
+				std::string type;
+				words >> type;
+				bool valid = true;
+				if (type == "circle")
+				{
+					body.type = RigidBody::Type::Circle;
+					valid = (words >> body.pos.x >> body.pos.y >> body.radius) && body.radius > 0.0f;
+				}
+				else if (type == "box")
+				{
+					body.type = RigidBody::Type::Box;
+					float degrees = 0.0f;
+					valid = (words >> body.pos.x >> body.pos.y >> body.halfSize.x >> body.halfSize.y) && body.halfSize.x > 0.0f && body.halfSize.y > 0.0f;
+					words >> degrees;
+					body.halfSize *= 0.5f;
+					body.angle = degrees * 3.14159265f / 180.0f;
+				}
+				else if (type == "polygon")
+				{
+					// Corners in scene coordinates, add recentres them on the centre of mass
+					body.type = RigidBody::Type::Polygon;
+					Vector2f point;
+					while (words >> point.x >> point.y)
+					{
+						body.points.push_back(point);
+					}
+					valid = body.points.size() >= 3;
+				}
+				else
+				{
+					return fail("body needs circle, box or polygon");
+				}
+				if (!valid)
+				{
+					return fail("body " + type + " has missing or invalid values");
+				}
+				out.bodies.push_back(body);
+			}
+			else if (command == "body_density")
+			{
+				if (!(words >> bodyDensity) || bodyDensity <= 0.0f)
+				{
+					return fail("body_density needs a positive value");
+				}
+			}
+			else if (command == "motion")
+			{
+				std::string kind;
+				words >> kind;
+				Render::BoundaryMotion& motion = out.motion;
+				if (kind == "sway")
+				{
+					if (!(words >> motion.sway.x >> motion.sway.y >> motion.swayFrequency) || motion.swayFrequency <= 0.0f)
+					{
+						return fail("motion sway needs dx dy and a positive frequency");
+					}
+				}
+				else if (kind == "tilt")
+				{
+					float degrees = 0.0f;
+					if (!(words >> degrees >> motion.tiltFrequency) || motion.tiltFrequency <= 0.0f)
+					{
+						return fail("motion tilt needs degrees and a positive frequency");
+					}
+					motion.tilt = degrees * 3.14159265f / 180.0f;
+				}
+				else if (kind == "spin")
+				{
+					float degrees = 0.0f;
+					if (!(words >> degrees))
+					{
+						return fail("motion spin needs degrees per second");
+					}
+					motion.spin = degrees * 3.14159265f / 180.0f;
+				}
+				else
+				{
+					return fail("motion needs sway, tilt or spin");
+				}
+			}
+			else if (command == "periodic")
+			{
+				std::string axes;
+				words >> axes;
+				if (axes != "x" && axes != "y" && axes != "xy")
+				{
+					return fail("periodic needs x, y or xy");
+				}
+				out.periodicX = axes != "y";
+				out.periodicY = axes != "x";
+			}
+			else if (command == "paging")
+			{
+				if (!(words >> out.pagingResidentMB) || out.pagingResidentMB < 0.0f)
+				{
+					return fail("paging needs a resident size in MB");
+				}
+				std::string directory;
+				if (words >> directory)
+				{
+					out.pagingDirectory = directory;
+				}
+				out.paging = true;
+			}
+			else if (command == "obstacle_cell")
+			{
+				if (!(words >> out.obstacleCellSize) || out.obstacleCellSize <= 0.0f)
+				{
+					return fail("obstacle_cell needs a positive size");
+				}
+			}
+			else if (command == "settle")
+			{
+				if (!(words >> out.settleSteps) || out.settleSteps <= 0)
+				{
+					return fail("settle needs a step count");
+				}
+				out.settleAfter = out.shapes.size();
+			}
+			else if (command == "emitter")
+			{
+				SceneEmitter emitter;
+				if (!(words >> emitter.pos.x >> emitter.pos.y >> emitter.vel.x >> emitter.vel.y >> emitter.rate >> emitter.count) || emitter.rate <= 0.0f)
+				{
+					return fail("emitter needs x y vx vy rate count");
+				}
+				words >> emitter.width;
+				out.emitters.push_back(emitter);
+			}
+			else
+			{
+				return fail("unknown command " + command);
+			}
+		}
+
+		return true;
+	}
+
+	uint32_t Scene::spawn(const Vector2f& pos, const Vector2f& vel)
+	{
+		const uint32_t id = Render::CreateParticle({ origin.x + pos.x, origin.y + pos.y });
+		Render::GetParticle(id).vel = vel;
+		Simulation::getInstance().AddCircle(id);
+		return id;
+	}
+
+	void Scene::apply(const SceneDescription& newDescription, const Vector2f& centre)
+	{
+		description = newDescription;
+		loaded = true;
+		settleCached = false;
+		warning.clear();
+
+		// Boundary sizes are half extents
+		Render::Boundary::instance().resize(description.boundary.x / 2.0f, description.boundary.y / 2.0f);
+		Render::Boundary::instance().move(centre);
+		Render::Boundary::instance().setMotion(description.motion);
+		Render::Boundary::instance().setPeriodic(description.periodicX, description.periodicY);
+		const Point2D& topLeft = Render::Boundary::instance().getTopLeft();
+		origin = { topLeft.x, topLeft.y };
+
+		Simulation& simulation = Simulation::getInstance();
+		Render::ClearParticles();
+		simulation.ClearData();
+		simulation.SetParameters(description.solver);
+
+		// Before any particles are made, so they go straight where they are kept
+		std::string pagingDirectory;
+		if (description.paging)
+		{
+			std::error_code error;
+			std::filesystem::create_directories(description.pagingDirectory, error);
+			pagingDirectory = description.pagingDirectory;
+		}
+		if (!simulation.SetPaging(pagingDirectory, (size_t)(description.pagingResidentMB * 1024.0f * 1024.0f)))
+		{
+			warning = "can't page to " + description.pagingDirectory + ", particles kept in memory";
+		}
+
+		ObstacleField& obstacles = ObstacleField::instance();
+		obstacles.clear();
+		for (ObstacleShape shape : description.obstacles)
+		{
+			shape.centre += origin;
+			for (Vector2f& point : shape.points)
+			{
+				point += origin;
+			}
+			obstacles.add(shape);
+		}
+		for (const SceneMask& sceneMask : description.masks)
+		{
+			ObstacleMask mask;
+			if (!mask.buildFromSprite(sceneMask.sprite.c_str(), (uint8_t)sceneMask.alphaThreshold))
+			{
+				warning = "no sprite called " + sceneMask.sprite + ", obstacle skipped";
+				continue;
+			}
+			mask.topLeft = origin + sceneMask.pos;
+			mask.scale = sceneMask.scale;
+			mask.container = sceneMask.container;
+			obstacles.add(std::move(mask));
+		}
+		const Point2D& bottomRight = Render::Boundary::instance().getBottomRight();
+		obstacles.bake(origin, { bottomRight.x, bottomRight.y }, description.obstacleCellSize);
+
+		RigidBodies& bodies = RigidBodies::instance();
+		bodies.clear();
+		for (RigidBody body : description.bodies)
+		{
+			body.pos += origin;
+			bodies.add(body, description.solver.particleRadius);
+		}
+
+		uint32_t emitted = 0;
+		for (const SceneEmitter& emitter : description.emitters)
+		{
+			emitted += emitter.count;
+		}
+		Render::ReserveParticles(description.countParticles() + emitted);
+
+		for (size_t i = 0; i < description.shapes.size(); i++)
+		{
+			if (description.settleSteps > 0 && i == description.settleAfter)
+			{
+				settleCached = SettledStateCache::instance().settle(description.settleSteps, 1.0f / description.solver.stepRate);
+			}
+			place(description.shapes[i]);
+		}
+		if (description.settleSteps > 0 && description.settleAfter >= description.shapes.size())
+		{
+			settleCached = SettledStateCache::instance().settle(description.settleSteps, 1.0f / description.solver.stepRate);
+		}
+
+		emitterDue.assign(description.emitters.size(), 0.0f);
+		emitterSpawned.assign(description.emitters.size(), 0);
+	}
+
+	void Scene::place(const SceneShape& shape)
+	{
+		Simulation& simulation = Simulation::getInstance();
+		uint32_t first = 0;
+		uint32_t count = 0;
+		const Vector2f start = { origin.x + shape.pos.x, origin.y + shape.pos.y };
+		if (shape.type == SceneShape::Type::Block)
+		{
+			// Blocks are the big ones, placed straight from the index in parallel
+			count = (uint32_t)(shape.columns * shape.rows);
+			first = Render::CreateGrid(count, (uint32_t)shape.columns, start, shape.spacing, shape.jitter, shape.seed, shape.vel);
+		}
+		else if (shape.type == SceneShape::Type::Poisson || shape.type == SceneShape::Type::Fill)
+		{
+			const std::vector<Vector2f> samples = shapeSamples(shape);
+			if (shape.type == SceneShape::Type::Fill && FindSprite(shape.sprite.c_str()) < 0)
+			{
+				warning = "no sprite called " + shape.sprite + ", fill skipped";
+			}
+			count = (uint32_t)samples.size();
+			first = Render::CreateAt(samples, start, shape.vel);
+		}
+		else
+		{
+			std::vector<Render::particle> placed;
+			forEachShapeParticle(shape, [this, &placed](const Vector2f& pos, const Vector2f& vel)
+			{
+				Render::particle particle;
+				particle.pos = { origin.x + pos.x, origin.y + pos.y };
+				particle.vel = vel;
+				placed.push_back(particle);
+			});
+			count = (uint32_t)placed.size();
+			first = Render::CreateParticles(count, [&placed](uint32_t offset, uint32_t chunkCount, Render::particle* out)
+			{
+				std::copy(placed.begin() + offset, placed.begin() + offset + chunkCount, out);
+			});
+		}
+		simulation.AddCircles(first, count);
+	}
+
+	void Scene::emit(float dt)
+	{
+		for (size_t e = 0; e < description.emitters.size(); e++)
+		{
+			const SceneEmitter& emitter = description.emitters[e];
+			emitterDue[e] += emitter.rate * dt;
+
+			// Spread along the emitter so a burst doesn't stack particles on one spot
+			while (emitterDue[e] >= 1.0f && emitterSpawned[e] < emitter.count)
+			{
+				const float along = emitter.width > 0.0f ? (emitterSpawned[e] * 7 % 16) / 15.0f - 0.5f : 0.0f;
+				spawn({ emitter.pos.x + along * emitter.width, emitter.pos.y }, emitter.vel);
+				emitterDue[e] -= 1.0f;
+				emitterSpawned[e]++;
+			}
+		}
+	}
+}
@@ -0,0 +1,145 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Simulation.h"
+#include "boundary.h"
+
+namespace Fluid
+{
+	// Plain text scene files, one command per line, '#' starts a comment.
+	// Coordinates are pixels from the top left corner of the boundary, +y is down.
+	//
+	//   name     <text>
+	//   boundary <width> <height>
+	//   solver   <key> <value> ...        gravity, rest_density, pressure, near_pressure,
+	//                                     velocity_damping, wall_damping, step_rate,
+	//                                     sleep_steps, sleep_distance (settled regions stop stepping)
+	//   block    <x> <y> <columns> <rows> <spacing> [vx vy] [jitter seed]
+	//                                     jitter moves each particle by up to that fraction of the spacing
+	//   poisson  <x> <y> <width> <height> <spacing> [seed] [vx vy]
+	//                                     blue noise filling the box, no two particles closer than spacing
+	//   fill     <sprite> <x> <y> <spacing> [scale] [alpha threshold]
+	//                                     a particle every spacing pixels over the sprite's opaque pixels
+	//   circle   <cx> <cy> <radius> <spacing> [vx vy]
+	//   vortex   <cx> <cy> <radius> <spacing> <speed>     rim speed, positive turns clockwise on screen
+	//   emitter  <x> <y> <vx> <vy> <rate> <count> [width] rate per second, spread across width
+	//   settle   <steps>                  relax the shapes above for that many steps before placing the
+	//                                     rest, cached in Data/Cache after the first load
+	//   obstacle <shape>                  a solid, baked into the distance field, one of
+	//              circle <cx> <cy> <radius>
+	//              box <cx> <cy> <width> <height> [degrees]
+	//              segment <x0> <y0> <x1> <y1> <radius>
+	//              polygon <x0> <y0> <x1> <y1> <x2> <y2> ...
+	//              sprite <name> <x> <y> [scale] [alpha threshold]   opaque pixels are solid
+	//   container <shape>                 the same shapes, solid outside and free inside
+	//   obstacle_cell <size>              distance field cell size, 4 by default
+	//   body     <shape>                  a rigid body moved by the fluid, one of
+	//              circle <cx> <cy> <radius>
+	//              box <cx> <cy> <width> <height> [degrees]
+	//              polygon <x0> <y0> <x1> <y1> <x2> <y2> ...  convex
+	//   body_density <value>              density of the bodies after it relative to the fluid, 0.5 by default
+	//   motion   <kind>                   moves the boundary box while the scene runs, any of
+	//              sway <dx> <dy> <frequency>      back and forth, peak offset in pixels
+	//              tilt <degrees> <frequency>      rocking about the centre
+	//              spin <degrees per second>
+	//   periodic <x|y|xy>                 particles leaving one side come back in the other, a still box only
+	//   paging   <resident MB> [directory] particles in the pages of a scratch file in directory (Data/Paging
+	//                                     by default), let go to disk once there are more than resident MB
+	struct SceneShape
+	{
+		enum class Type { Block, Circle, Vortex, Poisson, Fill };
+
+		Type type = Type::Block;
+		Vector2f pos = { 0.0f, 0.0f };
+		int columns = 0;
+		int rows = 0;
+		float radius = 0.0f;
+		float spacing = 10.0f;
+		Vector2f vel = { 0.0f, 0.0f };
+		float spin = 0.0f;
+		float jitter = 0.0f;
+		uint32_t seed = 0;
+		// The poisson box
+		Vector2f size = { 0.0f, 0.0f };
+		// The fill's sprite, drawn scale world units per pixel
+		std::string sprite;
+		float scale = 1.0f;
+		int alphaThreshold = 128;
+	};
+
+	struct SceneEmitter
+	{
+		Vector2f pos = { 0.0f, 0.0f };
+		Vector2f vel = { 0.0f, 0.0f };
+		float rate = 0.0f;
+		uint32_t count = 0;
+		float width = 0.0f;
+	};
+
+	struct SceneMask
+	{
+		std::string sprite;
+		Vector2f pos = { 0.0f, 0.0f };
+		float scale = 1.0f;
+		int alphaThreshold = 128;
+		bool container = false;
+	};
+
+	struct SceneDescription
+	{
+		std::string name;
+		Vector2f boundary = { 800.0f, 800.0f };
+		Render::BoundaryMotion motion;
+		bool periodicX = false;
+		bool periodicY = false;
+		bool paging = false;
+		float pagingResidentMB = 0.0f;
+		std::string pagingDirectory = "Data/Paging";
+		SolverParameters solver;
+		std::vector<SceneShape> shapes;
+		std::vector<SceneEmitter> emitters;
+		std::vector<ObstacleShape> obstacles;
+		std::vector<SceneMask> masks;
+		std::vector<RigidBody> bodies;
+		float obstacleCellSize = 4.0f;
+		int settleSteps = 0;
+		// How many of the shapes go in before settling
+		size_t settleAfter = 0;
+
+		// Particles placed up front, emitters not included
+		uint32_t countParticles() const;
+	};
+
+	// False with a message naming the line when the file can't be read or a line doesn't parse
+	bool LoadSceneFile(const std::string& path, SceneDescription& out, std::string& error);
+	bool ParseScene(const std::string& text, SceneDescription& out, std::string& error);
+
+	// A description applied to the simulation, plus the emitters' progress
+	class Scene
+	{
+	public:
+		// Resizes the boundary around centre, replaces every particle, sets the solver parameters and settles
+		void apply(const SceneDescription& description, const Vector2f& centre);
+		// Spawns whatever the emitters owe after another dt seconds, call once per simulation step
+		void emit(float dt);
+
+		const SceneDescription& getDescription() const { return description; }
+		bool isLoaded() const { return loaded; }
+		// Anything apply had to skip, like a sprite mask with no sprite by that name
+		const std::string& getWarning() const { return warning; }
+		// Whether the last apply took its settled state from the cache
+		bool wasSettleCached() const { return settleCached; }
+
+	private:
+		uint32_t spawn(const Vector2f& pos, const Vector2f& vel);
+		void place(const SceneShape& shape);
+
+		SceneDescription description;
+		Vector2f origin = { 0.0f, 0.0f };
+		std::vector<float> emitterDue;
+		std::vector<uint32_t> emitterSpawned;
+		bool loaded = false;
+		bool settleCached = false;
+		std::string warning;
+	};
+}
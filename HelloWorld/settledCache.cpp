@@ -0,0 +1,203 @@
+#include "settledCache.h"
+#include "mappedFile.h"
+#include "Simulation.h"
+#include "validation.h"
+#include "boundary.h"
+#include <cstdio>
+#include <cstring>
+
+namespace Fluid
+{
+	// Bump when the meaning of the stored state changes, old files are then rebuilt
+	static const uint32_t cacheVersion = 1;
+
+	struct SettledHeader
+	{
+		char magic[4] = { 'F', 'S', 'E', 'T' };
+		uint32_t version = cacheVersion;
+		uint64_t key = 0;
+		uint32_t particleSize = sizeof(Render::particle);
+		uint32_t springSize = sizeof(SpringPair);
+		uint32_t particles = 0;
+		uint32_t springs = 0;
+	};
+
+	SettledStateCache& SettledStateCache::instance()
+	{
+		static SettledStateCache cache;
+		return cache;
+	}
+
+	uint64_t SettledStateCache::getKey(int steps, float dt) const
+	{
+		uint64_t hash = HashParticleState();
+		auto mix = [&hash](const void* data, size_t bytes)
+		{
+			const uint8_t* bytesIn = (const uint8_t*)data;
+			for (size_t b = 0; b < bytes; b++)
+			{
+				hash = (hash ^ bytesIn[b]) * 1099511628211ull;
+			}
+		};
+
+		const SolverParameters& parameters = Simulation::getInstance().GetParameters();
+		const float solver[] = { parameters.gravity, parameters.restDensity, parameters.pressure, parameters.nearPressure, parameters.velocityDamping, parameters.wallDamping, parameters.particleRadius };
+		const Point2D& topLeft = Render::Boundary::instance().getTopLeft();
+		const Point2D& bottomRight = Render::Boundary::instance().getBottomRight();
+		const float walls[] = { topLeft.x, topLeft.y, bottomRight.x, bottomRight.y };
+		const uint32_t count = Render::ParticleCount();
+
+		mix(solver, sizeof(solver));
+		mix(walls, sizeof(walls));
+		mix(&steps, sizeof(steps));
+		mix(&dt, sizeof(dt));
+		mix(&count, sizeof(count));
+
+		// Obstacles by what the particles feel, the baked distances
+		const ObstacleField& obstacles = ObstacleField::instance();
+		if (obstacles.isBaked())
+		{
+			const float cellSize = obstacles.getCellSize();
+			mix(&cellSize, sizeof(cellSize));
+			mix(obstacles.getDistances().data(), obstacles.getDistances().size() * sizeof(float));
+		}
+
+		// Sleeping settles differently, scenes without it keep the keys they had
+		if (parameters.sleepSteps > 0)
+		{
+			const float sleep[] = { (float)parameters.sleepSteps, parameters.sleepDistance };
+			mix(sleep, sizeof(sleep));
+		}
+		// and so do paging and NUMA placement, which sort the particles into bands as they go
+		const Simulation& simulation = Simulation::getInstance();
+		if (simulation.IsPaging() || simulation.IsNumaPlacement())
+		{
+			const char banded[] = "banded";
+			mix(banded, sizeof(banded));
+		}
+
+		// Wrapped edges settle differently, closed boxes keep the keys they had
+		const Render::PeriodicDomain periodic = Render::Boundary::instance().getPeriodic();
+		if (periodic.any())
+		{
+			const uint8_t axes[] = { (uint8_t)periodic.x, (uint8_t)periodic.y };
+			mix(axes, sizeof(axes));
+		}
+		return hash;
+	}
+
+	std::string SettledStateCache::getPath(uint64_t key) const
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.settled", (unsigned long long)key);
+		return (std::filesystem::path(directory) / name).string();
+	}
+
+	bool SettledStateCache::settle(int steps, float dt)
+	{
+		if (steps <= 0 || Render::ParticleCount() == 0)
+		{
+			return false;
+		}
+
+		Simulation& simulation = Simulation::getInstance();
+		// Rigid bodies and a moving box move while settling and the file only holds particles, so those scenes always settle live
+		if (!RigidBodies::instance().isEmpty() || Render::Boundary::instance().isMoving())
+		{
+			for (int i = 0; i < steps; i++)
+			{
+				simulation.Update(dt);
+			}
+			return false;
+		}
+
+		const uint64_t key = getKey(steps, dt);
+		if (load(key))
+		{
+			return true;
+		}
+
+		for (int i = 0; i < steps; i++)
+		{
+			simulation.Update(dt);
+		}
+
+		// Reloaded so a fresh run and a cached run start from exactly the same simulation state
+		if (store(key))
+		{
+			load(key);
+		}
+		return false;
+	}
+
+	bool SettledStateCache::load(uint64_t key)
+	{
+		MappedFile file;
+		if (!file.open(getPath(key)) || file.getSize() < sizeof(SettledHeader))
+		{
+			return false;
+		}
+
+		SettledHeader header;
+		const SettledHeader expected;
+		memcpy(&header, file.getData(), sizeof(header));
+		if (memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 || header.version != expected.version || header.key != key
+			|| header.particleSize != expected.particleSize || header.springSize != expected.springSize || header.particles != Render::ParticleCount()
+			|| file.getSize() != sizeof(SettledHeader) + (size_t)header.particles * header.particleSize + (size_t)header.springs * header.springSize)
+		{
+			return false;
+		}
+
+		// Straight from the mapped pages into the store, in parallel chunks
+		const Render::particle* particles = (const Render::particle*)(file.getData() + sizeof(SettledHeader));
+		Simulation& simulation = Simulation::getInstance();
+		Render::ClearParticles();
+		simulation.ClearData();
+		const uint32_t first = Render::CreateParticles(header.particles, [particles](uint32_t offset, uint32_t count, Render::particle* out)
+		{
+			memcpy(out, particles + offset, count * sizeof(Render::particle));
+		});
+		simulation.AddCircles(first, header.particles);
+		simulation.SetSpringPairs((const SpringPair*)(particles + header.particles), header.springs);
+		return true;
+	}
+
+	bool SettledStateCache::store(uint64_t key) const
+	{
+		std::error_code error;
+		std::filesystem::create_directories(directory, error);
+
+		// Written next to the final name and renamed, a half written file is never picked up
+		const std::string path = getPath(key);
+		const std::string temporary = path + ".tmp";
+		{
+			std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+			if (!file)
+			{
+				return false;
+			}
+
+			const std::vector<SpringPair>& springs = Simulation::getInstance().GetSpringPairs();
+			SettledHeader header;
+			header.key = key;
+			header.particles = Render::ParticleCount();
+			header.springs = (uint32_t)springs.size();
+			file.write((const char*)&header, sizeof(header));
+			if (header.particles > 0)
+			{
+				file.write((const char*)&Render::GetParticle(0), (std::streamsize)header.particles * sizeof(Render::particle));
+			}
+			if (header.springs > 0)
+			{
+				file.write((const char*)springs.data(), (std::streamsize)header.springs * sizeof(SpringPair));
+			}
+			if (!file)
+			{
+				return false;
+			}
+		}
+
+		std::filesystem::rename(temporary, path, error);
+		return !error;
+	}
+}
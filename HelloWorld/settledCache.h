@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+namespace Fluid
+{
+	// Relaxed starting states on disk, so a scene placed on a loose lattice doesn't spend its first
+	// seconds collapsing. The key covers everything that decides where the particles come to rest:
+	// the placed particles, the solver parameters, the boundary, the step count and dt.
+	// A file from a different build layout or a different key is ignored and rebuilt.
+	class SettledStateCache
+	{
+	public:
+		static SettledStateCache& instance();
+
+		// Where the files go, relative to the working directory like the rest of Data
+		void setDirectory(const std::string& path) { directory = path; }
+		const std::string& getDirectory() const { return directory; }
+
+		// Replaces the particles and springs now in the simulation with their state after steps steps of dt.
+		// Maps the cached file when there is one, otherwise runs the steps and writes it. True if it came from the cache.
+		bool settle(int steps, float dt);
+
+		uint64_t getKey(int steps, float dt) const;
+		std::string getPath(uint64_t key) const;
+
+	private:
+		bool load(uint64_t key);
+		bool store(uint64_t key) const;
+
+		std::string directory = "Data/Cache";
+
+		SettledStateCache() {};
+		SettledStateCache(const SettledStateCache& ref) = delete;
+		~SettledStateCache() {};
+	};
+}
@@ -0,0 +1,179 @@
+#include "slabDomain.h"
+#include "Simulation.h"
+#include "boundary.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace Fluid
+{
+	SlabDomain::SlabDomain(Transport& newTransport) : transport(newTransport)
+	{
+	}
+
+	void SlabDomain::layout()
+	{
+		Render::Boundary& boundary = Render::Boundary::instance();
+		const int rank = transport.getRank();
+		const int size = transport.getSize();
+		boxLeft = boundary.getTopLeft().x;
+		boxWidth = boundary.getBottomRight().x - boxLeft;
+		slabLeft = boxLeft + boxWidth * rank / size;
+		slabRight = boxLeft + boxWidth * (rank + 1) / size;
+
+		// One rank has the whole box, its own periodic wrap does the rest
+		wrapped = boundary.getPeriodic().x && size > 1;
+		leftRank = rank > 0 ? rank - 1 : wrapped ? size - 1 : -1;
+		rightRank = rank < size - 1 ? rank + 1 : wrapped ? 0 : -1;
+	}
+
+	int SlabDomain::slabOf(float x) const
+	{
+		// Outside the box, NaN included, counts as the nearest end slab
+		const float slab = (x - boxLeft) / boxWidth * transport.getSize();
+		return slab > 0.0f ? std::min((int)std::min(slab, 1e6f), transport.getSize() - 1) : 0;
+	}
+
+	SlabDomain::Side SlabDomain::sideOf(float x) const
+	{
+		const int rank = transport.getRank();
+		const int slab = slabOf(x);
+		if (slab == rank)
+		{
+			return Side::Stay;
+		}
+		if (slab == leftRank)
+		{
+			return Side::Left;
+		}
+		if (slab == rightRank)
+		{
+			return Side::Right;
+		}
+		// More than a slab in one step, it gets there over the next few, the short way round on a wrapped box
+		if (wrapped)
+		{
+			const int size = transport.getSize();
+			return (slab - rank + size) % size <= size / 2 ? Side::Right : Side::Left;
+		}
+		return slab < rank ? Side::Left : Side::Right;
+	}
+
+	void SlabDomain::keepOwnSlab()
+	{
+		layout();
+
+		Simulation& simulation = Simulation::getInstance();
+		// The band sort, paged or placed, would mix the ghosts in with the slab's own particles
+		simulation.SetPaging("", 0);
+		simulation.SetNumaPlacement(false);
+
+		const uint32_t count = simulation.GetParticleCount();
+		order.clear();
+		leaving.clear();
+		for (uint32_t i = 0; i < count; i++)
+		{
+			(slabOf(Render::GetParticle(i).pos.x) == transport.getRank() ? order : leaving).push_back(i);
+		}
+		owned = (uint32_t)order.size();
+		order.insert(order.end(), leaving.begin(), leaving.end());
+		simulation.ReorderParticles(order.data(), (uint32_t)order.size());
+		simulation.TruncateParticles(owned);
+		ghosts = 0;
+		migrated = 0;
+	}
+
+	uint32_t SlabDomain::exchange()
+	{
+		// Every rank sends before it receives, the transport never holds a send up
+		if (leftRank >= 0)
+		{
+			transport.send(leftRank, toLeft.data(), toLeft.size() * sizeof(Render::particle));
+		}
+		if (rightRank >= 0)
+		{
+			transport.send(rightRank, toRight.data(), toRight.size() * sizeof(Render::particle));
+		}
+
+		// Two ranks on a wrapped box are each other's left and right, and get two messages from each other
+		Simulation& simulation = Simulation::getInstance();
+		uint32_t received = 0;
+		for (int from : { leftRank, rightRank })
+		{
+			if (from < 0)
+			{
+				continue;
+			}
+			transport.receive(from, incoming);
+			const uint32_t count = (uint32_t)(incoming.size() / sizeof(Render::particle));
+			const Render::particle* particles = (const Render::particle*)incoming.data();
+			const uint32_t first = Render::CreateParticles(count, [particles](uint32_t offset, uint32_t count, Render::particle* out)
+			{
+				memcpy(out, particles + offset, count * sizeof(Render::particle));
+			});
+			simulation.AddCircles(first, count);
+			received += count;
+		}
+		return received;
+	}
+
+	const StepStats& SlabDomain::step(float dt)
+	{
+		PROFILE_ZONE("Slab exchange");
+		const uint64_t begin = Stats::Profiler::now();
+		Simulation& simulation = Simulation::getInstance();
+		layout();
+
+		// Leavers to the end of the store and off, new arrivals on after the ones that stayed
+		const uint32_t count = simulation.GetParticleCount();
+		order.clear();
+		leaving.clear();
+		toLeft.clear();
+		toRight.clear();
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const Render::particle& particle = Render::GetParticle(i);
+			const Side side = sideOf(particle.pos.x);
+			if (side == Side::Stay)
+			{
+				order.push_back(i);
+				continue;
+			}
+			leaving.push_back(i);
+			(side == Side::Left ? toLeft : toRight).push_back(particle);
+		}
+		if (!leaving.empty())
+		{
+			const uint32_t staying = (uint32_t)order.size();
+			order.insert(order.end(), leaving.begin(), leaving.end());
+			simulation.ReorderParticles(order.data(), (uint32_t)order.size());
+			simulation.TruncateParticles(staying);
+		}
+		migrated = exchange();
+		owned = simulation.GetParticleCount();
+
+		// Ghosts, copies of whatever is within the halo of either edge
+		const float halo = haloRadii * simulation.GetInteractionRadius();
+		toLeft.clear();
+		toRight.clear();
+		for (uint32_t i = 0; i < owned; i++)
+		{
+			const Render::particle& particle = Render::GetParticle(i);
+			if (leftRank >= 0 && particle.pos.x < slabLeft + halo)
+			{
+				toLeft.push_back(particle);
+			}
+			if (rightRank >= 0 && particle.pos.x >= slabRight - halo)
+			{
+				toRight.push_back(particle);
+			}
+		}
+		ghosts = exchange();
+		exchangeNanoseconds = Stats::Profiler::now() - begin;
+
+		const StepStats& stats = simulation.Update(dt);
+		simulation.TruncateParticles(owned);
+		return stats;
+	}
+}
\ No newline at end of file
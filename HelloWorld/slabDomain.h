@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "particle.h"
+#include "stepStats.h"
+#include "transport.h"
+
+namespace Fluid
+{
+	// One simulation split across the transport's ranks into slabs of the boundary box along x, a slab a rank.
+	// Every step a rank hands the particles that left its slab to the neighbour they went towards, then swaps
+	// copies of the particles near its edges with both neighbours and steps its own particles with those ghosts
+	// around them. The halo is two interaction radii wide, so every particle its own particles feel has all of
+	// its own neighbours too and the seam sees the densities one process would. The ghosts are dropped again
+	// after the step. Each rank applies the whole scene and keeps its slab, nothing else has to be sent around.
+	class SlabDomain
+	{
+	public:
+		explicit SlabDomain(Transport& transport);
+
+		// After every rank applied the same scene, each keeps the particles in its own slab
+		void keepOwnSlab();
+		// Migration and halo exchange, then the simulation's step
+		const StepStats& step(float dt);
+
+		float getSlabLeft() const { return slabLeft; }
+		float getSlabRight() const { return slabRight; }
+		uint32_t getOwnedParticles() const { return owned; }
+		uint32_t getGhostParticles() const { return ghosts; }
+		// Particles that came into the slab in the last step
+		uint32_t getMigratedParticles() const { return migrated; }
+		// Time the last step spent sorting out, sending and adding particles, before the simulation's step
+		uint64_t getExchangeNanoseconds() const { return exchangeNanoseconds; }
+
+	private:
+		enum class Side { Stay, Left, Right };
+
+		// Slab edges from the boundary box, evenly split
+		void layout();
+		int slabOf(float x) const;
+		// Where a particle at x goes, towards the slab it is in
+		Side sideOf(float x) const;
+		// Sends to both neighbours and adds whatever they sent, returns how many particles came
+		uint32_t exchange();
+
+		static constexpr float haloRadii = 2.0f;
+
+		Transport& transport;
+		float boxLeft = 0.0f;
+		float boxWidth = 0.0f;
+		float slabLeft = 0.0f;
+		float slabRight = 0.0f;
+		bool wrapped = false;
+		// -1 past the ends of a box that doesn't wrap
+		int leftRank = -1;
+		int rightRank = -1;
+
+		std::vector<Render::particle> toLeft;
+		std::vector<Render::particle> toRight;
+		std::vector<uint32_t> order;
+		std::vector<uint32_t> leaving;
+		std::vector<uint8_t> incoming;
+
+		uint32_t owned = 0;
+		uint32_t ghosts = 0;
+		uint32_t migrated = 0;
+		uint64_t exchangeNanoseconds = 0;
+	};
+}
@@ -0,0 +1,344 @@
+#include "slabRun.h"
+#include "slabDomain.h"
+#include "profiler.h"
+#include "threadPool.h"
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#if defined(_WIN32)
+#include "Play.h"
+#else
+#include <csignal>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace Fluid
+{
+#if defined(_WIN32)
+	typedef void* ProcessHandle;
+
+	static unsigned long currentProcessId()
+	{
+		return GetCurrentProcessId();
+	}
+
+	static bool spawnSelf(const std::vector<std::string>& arguments, ProcessHandle& process)
+	{
+		char path[MAX_PATH];
+		if (GetModuleFileNameA(nullptr, path, MAX_PATH) == 0)
+		{
+			return false;
+		}
+
+		std::string commandLine = "\"" + std::string(path) + "\"";
+		for (const std::string& argument : arguments)
+		{
+			commandLine += " \"" + argument + "\"";
+		}
+
+		STARTUPINFOA startup = {};
+		startup.cb = sizeof(startup);
+		PROCESS_INFORMATION info = {};
+		if (!CreateProcessA(path, &commandLine[0], nullptr, nullptr, FALSE, CREATE_NO_WINDOW, nullptr, nullptr, &startup, &info))
+		{
+			return false;
+		}
+		CloseHandle(info.hThread);
+		process = info.hProcess;
+		return true;
+	}
+
+	static void waitFor(ProcessHandle process)
+	{
+		WaitForSingleObject((HANDLE)process, INFINITE);
+		CloseHandle((HANDLE)process);
+	}
+
+	static void kill(ProcessHandle process)
+	{
+		TerminateProcess((HANDLE)process, 1);
+		CloseHandle((HANDLE)process);
+	}
+#else
+	typedef pid_t ProcessHandle;
+
+	static unsigned long currentProcessId()
+	{
+		return (unsigned long)getpid();
+	}
+
+	static bool spawnSelf(const std::vector<std::string>& arguments, ProcessHandle& process)
+	{
+		const char* path = "/proc/self/exe";
+		std::vector<char*> argv;
+		argv.push_back(const_cast<char*>(path));
+		for (const std::string& argument : arguments)
+		{
+			argv.push_back(const_cast<char*>(argument.c_str()));
+		}
+		argv.push_back(nullptr);
+		return posix_spawn(&process, path, nullptr, nullptr, argv.data(), environ) == 0;
+	}
+
+	static void waitFor(ProcessHandle process)
+	{
+		int status = 0;
+		waitpid(process, &status, 0);
+	}
+
+	static void kill(ProcessHandle process)
+	{
+		::kill(process, SIGKILL);
+		waitFor(process);
+	}
+#endif
+
+	SceneDescription TileScene(const SceneDescription& description, int copies)
+	{
+		SceneDescription tiled = description;
+		tiled.boundary.x = description.boundary.x * copies;
+		tiled.bodies.clear();
+		tiled.emitters.clear();
+		tiled.masks.clear();
+		tiled.shapes.clear();
+		tiled.obstacles.clear();
+
+		// The shapes before the settle first, for every copy, then the rest
+		const size_t settleAfter = std::min(description.settleAfter, description.shapes.size());
+		const std::pair<size_t, size_t> parts[] = { { 0, settleAfter }, { settleAfter, description.shapes.size() } };
+		for (const std::pair<size_t, size_t>& part : parts)
+		{
+			for (int copy = 0; copy < copies; copy++)
+			{
+				for (size_t s = part.first; s < part.second; s++)
+				{
+					SceneShape shape = description.shapes[s];
+					shape.pos.x += description.boundary.x * copy;
+					tiled.shapes.push_back(shape);
+				}
+			}
+		}
+		tiled.settleAfter = description.settleAfter * copies;
+
+		for (int copy = 0; copy < copies; copy++)
+		{
+			for (ObstacleShape obstacle : description.obstacles)
+			{
+				// A container is solid everywhere outside it, the other copies included
+				if (obstacle.container && copies > 1)
+				{
+					continue;
+				}
+				obstacle.centre.x += description.boundary.x * copy;
+				for (Vector2f& point : obstacle.points)
+				{
+					point.x += description.boundary.x * copy;
+				}
+				tiled.obstacles.push_back(obstacle);
+			}
+		}
+
+		// Slabs move particles around themselves, sleeping regions would only ever be woken by it
+		tiled.solver.sleepSteps = 0;
+		tiled.paging = false;
+		tiled.name = description.name + " x" + std::to_string(copies);
+		return tiled;
+	}
+
+	bool RunSlabRank(Transport& transport, const SlabRunOptions& options, std::vector<uint64_t>* stepNanoseconds, std::vector<uint64_t>* exchangeNanoseconds)
+	{
+		SceneDescription description;
+		std::string error;
+		if (!LoadSceneFile(options.sceneFile, description, error))
+		{
+			return false;
+		}
+		const SceneDescription tiled = TileScene(description, options.copies);
+		const Vector2f centre = { tiled.boundary.x / 2.0f, tiled.boundary.y / 2.0f };
+
+		// Rank 0 first, so a settled scene is worked out and cached once and the others load it
+		Scene scene;
+		if (transport.getRank() == 0)
+		{
+			scene.apply(tiled, centre);
+		}
+		transport.barrier();
+		if (transport.getRank() != 0)
+		{
+			scene.apply(tiled, centre);
+		}
+
+		Simulation& simulation = Simulation::getInstance();
+		simulation.SetExecutionMode(options.mode);
+		ThreadPool::instance().setThreadCount(options.threads);
+		SlabDomain domain(transport);
+		domain.keepOwnSlab();
+
+		const float dt = 1.0f / tiled.solver.stepRate;
+		for (int i = 0; i < options.warmupSteps; i++)
+		{
+			domain.step(dt);
+		}
+
+		std::vector<uint64_t> steps(options.steps);
+		std::vector<uint64_t> exchanges(options.steps);
+		transport.barrier();
+		for (int i = 0; i < options.steps; i++)
+		{
+			const uint64_t begin = Stats::Profiler::now();
+			domain.step(dt);
+			steps[i] = Stats::Profiler::now() - begin;
+			exchanges[i] = domain.getExchangeNanoseconds();
+		}
+
+		// The slowest rank's time for every step
+		if (transport.getRank() != 0)
+		{
+			transport.send(0, steps.data(), steps.size() * sizeof(uint64_t));
+			transport.send(0, exchanges.data(), exchanges.size() * sizeof(uint64_t));
+		}
+		else
+		{
+			std::vector<uint8_t> incoming;
+			for (int from = 1; from < transport.getSize(); from++)
+			{
+				for (std::vector<uint64_t>* times : { &steps, &exchanges })
+				{
+					transport.receive(from, incoming);
+					const uint64_t* theirs = (const uint64_t*)incoming.data();
+					for (size_t i = 0; i < times->size() && i < incoming.size() / sizeof(uint64_t); i++)
+					{
+						(*times)[i] = std::max((*times)[i], theirs[i]);
+					}
+				}
+			}
+			if (stepNanoseconds)
+			{
+				*stepNanoseconds = steps;
+			}
+			if (exchangeNanoseconds)
+			{
+				*exchangeNanoseconds = exchanges;
+			}
+		}
+		transport.barrier();
+		return true;
+	}
+
+	static bool runWeakScaling(const SlabRunOptions& options, int maxProcesses, Stats::BenchmarkResult& result)
+	{
+		SceneDescription description;
+		std::string error;
+		if (!LoadSceneFile(options.sceneFile, description, error))
+		{
+			return false;
+		}
+		result.setInfo("scene", description.name);
+		result.setInfo("particles_per_process", TileScene(description, 1).countParticles());
+		result.setInfo("steps", options.steps);
+		result.setInfo("execution_mode", (double)options.mode);
+		const uint32_t threadsPerProcess = std::max(options.threads / (uint32_t)std::max(maxProcesses, 1), 1u);
+		result.setInfo("threads", options.threads);
+		result.setInfo("threads_per_process", threadsPerProcess);
+
+		for (int processes = 1; processes <= maxProcesses; processes *= 2)
+		{
+			SlabRunOptions run = options;
+			run.copies = processes;
+			run.threads = threadsPerProcess;
+
+			// Named after this process and the run, so two of them at once never meet
+			const std::string name = std::to_string(currentProcessId()) + "-" + std::to_string(processes);
+			SharedMemoryTransport transport;
+			if (!transport.open(name, 0, processes, run.ringBytes))
+			{
+				return false;
+			}
+
+			std::vector<ProcessHandle> children;
+			for (int rank = 1; rank < processes; rank++)
+			{
+				const std::vector<std::string> arguments = { "--slab", name, std::to_string(rank), std::to_string(processes), run.sceneFile,
+					std::to_string(run.copies), std::to_string(run.warmupSteps), std::to_string(run.steps), std::to_string((int)run.mode), std::to_string(run.threads) };
+				ProcessHandle child;
+				if (!spawnSelf(arguments, child))
+				{
+					// The ones already started would wait at the first barrier for good
+					for (ProcessHandle started : children)
+					{
+						kill(started);
+					}
+					return false;
+				}
+				children.push_back(child);
+			}
+
+			std::vector<uint64_t> steps;
+			std::vector<uint64_t> exchanges;
+			const bool ran = RunSlabRank(transport, run, &steps, &exchanges);
+			for (ProcessHandle child : children)
+			{
+				waitFor(child);
+			}
+			if (!ran)
+			{
+				return false;
+			}
+
+			const std::string suffix = " " + std::to_string(processes);
+			for (size_t i = 0; i < steps.size(); i++)
+			{
+				result.add("Step" + suffix, steps[i]);
+				result.add("Exchange" + suffix, exchanges[i]);
+			}
+		}
+		return true;
+	}
+
+	bool RunWeakScaling(const SlabRunOptions& options, int maxProcesses, Stats::BenchmarkResult& result)
+	{
+		// Rank 0 is this process, its runs change the pool and turn placement off for their own slab
+		Simulation& simulation = Simulation::getInstance();
+		ThreadPool& pool = ThreadPool::instance();
+		const ExecutionMode savedMode = simulation.GetExecutionMode();
+		const uint32_t savedThreads = pool.getThreadCount();
+		const bool savedPlacement = simulation.IsNumaPlacement();
+
+		const bool ran = runWeakScaling(options, maxProcesses, result);
+
+		pool.setThreadCount(savedThreads);
+		simulation.SetExecutionMode(savedMode);
+		simulation.SetNumaPlacement(savedPlacement);
+		return ran;
+	}
+
+	bool RunSlabRankFromCommandLine(int argc, char* argv[])
+	{
+		// --slab <name> <rank> <processes> <scene file> <copies> <warmup steps> <steps> <execution mode> <threads>
+		if (argc < 11 || strcmp(argv[1], "--slab") != 0)
+		{
+			return false;
+		}
+
+		SlabRunOptions options;
+		const std::string name = argv[2];
+		const int rank = atoi(argv[3]);
+		const int processes = atoi(argv[4]);
+		options.sceneFile = argv[5];
+		options.copies = atoi(argv[6]);
+		options.warmupSteps = atoi(argv[7]);
+		options.steps = atoi(argv[8]);
+		options.mode = (ExecutionMode)std::min(std::max(atoi(argv[9]), 0), 2);
+		options.threads = (uint32_t)std::max(atoi(argv[10]), 1);
+
+		SharedMemoryTransport transport;
+		if (transport.open(name, rank, processes, options.ringBytes))
+		{
+			RunSlabRank(transport, options, nullptr, nullptr);
+		}
+		return true;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "scene.h"
+#include "transport.h"
+#include "benchmark.h"
+
+namespace Fluid
+{
+	struct SlabRunOptions
+	{
+		std::string sceneFile;
+		// Copies of the scene side by side, one a process for weak scaling
+		int copies = 1;
+		int warmupSteps = 30;
+		int steps = 200;
+		ExecutionMode mode = ExecutionMode::Serial;
+		// A rank's worker threads. RunWeakScaling takes it as the threads for all the ranks together.
+		uint32_t threads = 1;
+		// Per sender and receiver pair, the biggest slab's halo goes through in one piece at this size
+		size_t ringBytes = 4 * 1024 * 1024;
+	};
+
+	// Copies of the scene side by side along x, each in a box as wide as the original. Rigid bodies, emitters
+	// and sprite masks are left out, every rank applies the whole scene and they would be in all of them at once,
+	// and so are container obstacles past one copy, each would make the other copies solid.
+	SceneDescription TileScene(const SceneDescription& description, int copies);
+
+	// Runs one rank of a slab decomposed scene to the end, every rank with the same options. Rank 0 gets every
+	// step's time on the slowest rank, the ranks move in lockstep so that is the step's time, and the same for
+	// the exchanges. False if the scene didn't load.
+	bool RunSlabRank(Transport& transport, const SlabRunOptions& options, std::vector<uint64_t>* stepNanoseconds, std::vector<uint64_t>* exchangeNanoseconds);
+
+	// Weak scaling: 1, 2, 4... processes up to maxProcesses, a copy of the scene each, this process as rank 0
+	// and the others started from this executable with --slab. Every rank of every run gets an equal share
+	// of options.threads for maxProcesses ranks, so the biggest run doesn't oversubscribe the machine and only
+	// the process count changes between runs. Adds "Step <n>" and "Exchange <n>" samples for n processes.
+	// False if a run couldn't be started. This process's thread count, execution mode and placement are put
+	// back afterwards, the scene is left tiled.
+	bool RunWeakScaling(const SlabRunOptions& options, int maxProcesses, Stats::BenchmarkResult& result);
+
+	// For the entry point, true if the command line was a --slab rank, which has then run to the end
+	bool RunSlabRankFromCommandLine(int argc, char* argv[]);
+}
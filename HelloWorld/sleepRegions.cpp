@@ -0,0 +1,214 @@
+#include "sleepRegions.h"
+#include "particle.h"
+#include <algorithm>
+#include <cmath>
+
+namespace Fluid
+{
+	void SleepRegions::wakeAll()
+	{
+		std::fill(calmSteps.begin(), calmSteps.end(), 0);
+		std::fill(sleeping.begin(), sleeping.end(), 0);
+		std::fill(asleep.begin(), asleep.end(), 0);
+		trackedParticles = 0;
+		sleepingParticles = 0;
+		sleepingRegions = 0;
+	}
+
+	void SleepRegions::reorder(const uint32_t* destination, uint32_t count)
+	{
+		// Only the anchors last between steps, the rest is worked out again by begin
+		if (count != trackedParticles)
+		{
+			wakeAll();
+			return;
+		}
+		anchors.reorder(destination, count, moves);
+	}
+
+	void SleepRegions::layout(const Point2D& topLeft, const Point2D& bottomRight)
+	{
+		origin = { topLeft.x, topLeft.y };
+		extent = { bottomRight.x - topLeft.x, bottomRight.y - topLeft.y };
+		regionSize = std::max(minRegionSize, std::max(extent.x, extent.y) / maxRegionsPerAxis);
+		columns = std::max(1, (int)std::ceil(extent.x / regionSize));
+		rows = std::max(1, (int)std::ceil(extent.y / regionSize));
+
+		const size_t regions = (size_t)columns * rows;
+		calmSteps.assign(regions, 0);
+		sleeping.assign(regions, 0);
+		active.assign(regions, 0);
+		occupants.assign(regions, 0);
+		trackedParticles = 0;
+	}
+
+	int SleepRegions::regionOf(const Vector2f& pos) const
+	{
+		// Anything outside the box, NaN included, counts as in the nearest border region
+		const float x = (pos.x - origin.x) / regionSize;
+		const float y = (pos.y - origin.y) / regionSize;
+		const int column = x > 0.0f ? std::min((int)std::min(x, 1e6f), columns - 1) : 0;
+		const int row = y > 0.0f ? std::min((int)std::min(y, 1e6f), rows - 1) : 0;
+		return row * columns + column;
+	}
+
+	void SleepRegions::wakeAround(int region)
+	{
+		const int column = region % columns;
+		const int row = region / columns;
+		for (int dy = -1; dy <= 1; dy++)
+		{
+			int y = row + dy;
+			if (periodic.y && rows > 2)
+			{
+				y = (y + rows) % rows;
+			}
+			if (y < 0 || y >= rows)
+			{
+				continue;
+			}
+			for (int dx = -1; dx <= 1; dx++)
+			{
+				int x = column + dx;
+				if (periodic.x && columns > 2)
+				{
+					x = (x + columns) % columns;
+				}
+				if (x < 0 || x >= columns)
+				{
+					continue;
+				}
+				calmSteps[y * columns + x] = 0;
+				sleeping[y * columns + x] = 0;
+			}
+		}
+	}
+
+	void SleepRegions::begin(uint32_t count, int steps, const Render::PeriodicDomain& newPeriodic)
+	{
+		Render::Boundary& boundary = Render::Boundary::instance();
+		const Point2D& topLeft = boundary.getTopLeft();
+		const Point2D& bottomRight = boundary.getBottomRight();
+		periodic = newPeriodic;
+		asleep.assign(count, 0);
+		sleepingParticles = 0;
+
+		// Off, or a box that moves under the fluid, nothing sleeps and nothing counts towards sleeping
+		if (steps <= 0 || boundary.isMoving())
+		{
+			wakeAll();
+			return;
+		}
+
+		if (calmSteps.empty() || origin.x != topLeft.x || origin.y != topLeft.y
+			|| extent.x != bottomRight.x - topLeft.x || extent.y != bottomRight.y - topLeft.y)
+		{
+			layout(topLeft, bottomRight);
+		}
+		// Removed particles shift every index after them
+		if (count < trackedParticles)
+		{
+			wakeAll();
+		}
+
+		particleRegion.resize(count);
+		anchors.resize(count);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const Vector2f& pos = Render::GetParticle(i).pos;
+			particleRegion[i] = (uint32_t)regionOf(pos);
+			if (i >= trackedParticles)
+			{
+				anchors[i] = pos;
+				wakeAround((int)particleRegion[i]);
+			}
+		}
+		trackedParticles = count;
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			if (sleeping[particleRegion[i]])
+			{
+				asleep[i] = 1;
+				Render::GetParticle(i).vel = { 0.0f, 0.0f };
+				sleepingParticles++;
+			}
+		}
+	}
+
+	void SleepRegions::end(uint32_t count, const ParticleArray<Vector2f>& prevPositions, float calmDistance, int steps)
+	{
+		if (steps <= 0 || calmSteps.empty() || Render::Boundary::instance().isMoving())
+		{
+			return;
+		}
+
+		std::fill(active.begin(), active.end(), 0);
+		std::fill(occupants.begin(), occupants.end(), 0);
+		// By position rather than velocity, which a wall has just flipped for every particle resting on it
+		const float calmDistanceSqr = calmDistance * calmDistance;
+		for (uint32_t i = 0; i < count && i < prevPositions.size(); i++)
+		{
+			const Render::particle& particle = Render::GetParticle(i);
+			// A sleeping particle should not have moved at all, whatever did it woke it
+			const Vector2f moved = periodic.minimumImage(particle.pos - prevPositions[i]);
+			const bool moving = asleep[i] ? (moved.x != 0.0f || moved.y != 0.0f)
+				: periodic.minimumImage(particle.pos - anchors[i]).LengthSqr() > calmDistanceSqr;
+
+			const int region = regionOf(particle.pos);
+			occupants[region]++;
+			if (moving)
+			{
+				active[region] = 1;
+				active[particleRegion[i]] = 1;
+			}
+		}
+
+		for (int region = 0; region < (int)active.size(); region++)
+		{
+			if (active[region])
+			{
+				wakeAround(region);
+			}
+		}
+
+		// Regions woken this step, here or for a new particle, count again from where their particles are now
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const Vector2f& pos = Render::GetParticle(i).pos;
+			if (calmSteps[regionOf(pos)] == 0)
+			{
+				anchors[i] = pos;
+			}
+		}
+
+		sleepingRegions = 0;
+		for (size_t region = 0; region < calmSteps.size(); region++)
+		{
+			calmSteps[region] = (uint16_t)std::min<int>(calmSteps[region] + 1, 0xFFFF);
+			if (calmSteps[region] > steps)
+			{
+				sleeping[region] = 1;
+			}
+			sleepingRegions += sleeping[region] && occupants[region] > 0 ? 1 : 0;
+		}
+	}
+
+	void SleepRegions::draw() const
+	{
+		for (int row = 0; row < rows; row++)
+		{
+			for (int column = 0; column < columns; column++)
+			{
+				const int region = row * columns + column;
+				if (!sleeping[region] || occupants[region] == 0)
+				{
+					continue;
+				}
+				const Vector2f topLeft = origin + Vector2f(column * regionSize, row * regionSize);
+				const Vector2f bottomRight = { std::min(topLeft.x + regionSize, origin.x + extent.x), std::min(topLeft.y + regionSize, origin.y + extent.y) };
+				Play::DrawRect({ topLeft.x, topLeft.y }, { bottomRight.x - 1.0f, bottomRight.y - 1.0f }, Play::Colour(0, 0, 25), true);
+			}
+		}
+	}
+}
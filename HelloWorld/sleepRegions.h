@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "Play.h"
+#include "boundary.h"
+#include "particleArray.h"
+
+namespace Fluid
+{
+	// Coarse regions over the boundary box that stop stepping once the fluid in them has settled.
+	// A region falls asleep after every particle in it and in the eight regions around it has stayed
+	// within the calm distance of where it was when the region started counting, for the set number of
+	// steps. Settled fluid still jitters by a fraction of a pixel every step, more so with the parallel
+	// relaxation, so that is measured from a fixed anchor rather than step to step: jitter that goes
+	// nowhere counts as calm, a slow creep that adds up does not. Sleeping particles stay where they are, the
+	// step skips them and the fluid around them feels them as still neighbours pushing with their last
+	// pressure. A particle moving in or next to a sleeping region wakes it, and so does anything that
+	// moves a sleeping particle from outside (a body, a restore), a new particle and a moving box.
+	class SleepRegions
+	{
+	public:
+		// Every region awake and counting from zero, after particles were replaced or the solver changed
+		void wakeAll();
+		// Particle i is now at destination[i]
+		void reorder(const uint32_t* destination, uint32_t count);
+
+		// Decides which particles sleep through this step, steps of 0 sleeps none
+		void begin(uint32_t count, int steps, const Render::PeriodicDomain& periodic);
+		// From how far every particle has got, keeps regions awake or puts them to sleep
+		void end(uint32_t count, const ParticleArray<Vector2f>& prevPositions, float calmDistance, int steps);
+
+		// Only valid between begin and end, and only while any() is true
+		bool isAsleep(uint32_t particle) const { return asleep[particle] != 0; }
+		bool any() const { return sleepingParticles > 0; }
+		uint32_t getSleepingParticles() const { return sleepingParticles; }
+		uint32_t getSleepingRegions() const { return sleepingRegions; }
+
+		// Sleeping regions with particles in, filled dim blue, drawn before the particles
+		void draw() const;
+
+	private:
+		// Lays the regions out over the box, every region awake
+		void layout(const Point2D& topLeft, const Point2D& bottomRight);
+		int regionOf(const Vector2f& pos) const;
+		// The region and the eight around it, wrapped on periodic axes
+		void wakeAround(int region);
+
+		// Regions at least a couple of interaction radii wide, fewer and bigger on a huge box
+		static const int maxRegionsPerAxis = 256;
+		static constexpr float minRegionSize = 32.0f;
+
+		float regionSize = minRegionSize;
+		Vector2f origin = { 0.0f, 0.0f };
+		Vector2f extent = { 0.0f, 0.0f };
+		int columns = 0;
+		int rows = 0;
+		Render::PeriodicDomain periodic;
+
+		// Per region
+		std::vector<uint16_t> calmSteps;
+		std::vector<uint8_t> sleeping;
+		std::vector<uint8_t> active;
+		std::vector<uint32_t> occupants;
+
+		// Per particle, for this step
+		ParticleArray<uint32_t> particleRegion;
+		ParticleArray<uint8_t> asleep;
+		// Where each particle was when its region last started counting calm steps
+		ParticleArray<Vector2f> anchors;
+		// Scratch for reordering the anchors in place
+		ParticleArray<uint32_t> moves{ false };
+		// Particles there were last step, any past that are new and wake where they are
+		uint32_t trackedParticles = 0;
+
+		uint32_t sleepingParticles = 0;
+		uint32_t sleepingRegions = 0;
+	};
+}
@@ -0,0 +1,151 @@
+#include "stampCache.h"
+#include <emmintrin.h>
+
+namespace Render
+{
+	StampCache& StampCache::instance()
+	{
+		static StampCache instance;
+
+		return instance;
+	}
+
+	StampCache::~StampCache()
+	{
+		_mm_free(memory);
+	}
+
+	void StampCache::build(int minR, int maxR)
+	{
+		_mm_free(memory);
+
+		minRadius = minR;
+		maxRadius = maxR;
+		offsets.clear();
+		sizes.clear();
+
+		// Room for the disc, the sub-pixel shift and the anti-aliased fringe, rounded up to whole SIMD lanes
+		size_t total = 0;
+		for (int r = minRadius; r <= maxRadius; r++)
+		{
+			const int size = (2 * r + 2 + 3) & ~3;
+			sizes.push_back(size);
+			offsets.push_back(total);
+			total += (size_t)size * size * subSteps * subSteps;
+		}
+
+		memory = (uint32_t*)_mm_malloc(total * sizeof(uint32_t), 16);
+
+		for (int r = minRadius; r <= maxRadius; r++)
+		{
+			const int size = getSize(r);
+			const float half = (float)(size / 2);
+
+			for (int subY = 0; subY < subSteps; subY++)
+			{
+				for (int subX = 0; subX < subSteps; subX++)
+				{
+					const float centreX = half + (subX + 0.5f) / subSteps;
+					const float centreY = half + (subY + 0.5f) / subSteps;
+					renderStamp(const_cast<uint32_t*>(getStamp(r, subX, subY)), size, (float)r, centreX, centreY);
+				}
+			}
+		}
+	}
+
+	int StampCache::getSize(int radius) const
+	{
+		return sizes[radius - minRadius];
+	}
+
+	const uint32_t* StampCache::getStamp(int radius, int subX, int subY) const
+	{
+		const int size = getSize(radius);
+		return memory + offsets[radius - minRadius] + (size_t)(subY * subSteps + subX) * size * size;
+	}
+
+	void StampCache::renderStamp(uint32_t* stamp, int size, float radius, float centreX, float centreY)
+	{
+		// 8x8 supersampling per pixel, only done once when the cache is built
+		const int samples = 8;
+		const float radiusSq = radius * radius;
+
+		for (int y = 0; y < size; y++)
+		{
+			for (int x = 0; x < size; x++)
+			{
+				int inside = 0;
+				for (int sy = 0; sy < samples; sy++)
+				{
+					for (int sx = 0; sx < samples; sx++)
+					{
+						const float dx = x + (sx + 0.5f) / samples - centreX;
+						const float dy = y + (sy + 0.5f) / samples - centreY;
+						inside += (dx * dx + dy * dy < radiusSq);
+					}
+				}
+
+				const uint32_t coverage = (inside * 255 + samples * samples / 2) / (samples * samples);
+				stamp[y * size + x] = coverage * 0x01010101;
+			}
+		}
+	}
+
+	void StampCache::blit(PixelData* target, const uint32_t* stamp, int size, int x, int y, uint32_t colour) const
+	{
+		if (x >= 0 && y >= 0 && x + size <= target->width && y + size <= target->height)
+		{
+			// dest * (255 - a) + colour * a on 16 bit lanes, two pixels per register half.
+			// The stamp already holds the coverage in every channel so it is unpacked straight into the alpha lanes.
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i full = _mm_set1_epi16(255);
+			const __m128i div255 = _mm_set1_epi16((short)0x8081);
+			const __m128i tint = _mm_unpacklo_epi8(_mm_set1_epi32((int)colour), zero);
+
+			uint32_t* row = &target->pPixels[y * target->width + x].bits;
+			const uint32_t* src = stamp;
+
+			for (int r = 0; r < size; r++, row += target->width)
+			{
+				for (int c = 0; c < size; c += 4, src += 4)
+				{
+					const __m128i alpha = _mm_load_si128((const __m128i*)src);
+					const __m128i dest = _mm_loadu_si128((const __m128i*)(row + c));
+
+					const __m128i alphaLo = _mm_unpacklo_epi8(alpha, zero);
+					const __m128i alphaHi = _mm_unpackhi_epi8(alpha, zero);
+
+					__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(dest, zero), _mm_sub_epi16(full, alphaLo)), _mm_mullo_epi16(tint, alphaLo));
+					__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(dest, zero), _mm_sub_epi16(full, alphaHi)), _mm_mullo_epi16(tint, alphaHi));
+
+					// Exact divide by 255 for 16 bit values
+					lo = _mm_srli_epi16(_mm_mulhi_epu16(lo, div255), 7);
+					hi = _mm_srli_epi16(_mm_mulhi_epu16(hi, div255), 7);
+
+					_mm_storeu_si128((__m128i*)(row + c), _mm_packus_epi16(lo, hi));
+				}
+			}
+			return;
+		}
+
+		// Clipped against the edge of the buffer
+		for (int r = std::max(0, -y); r < size && y + r < target->height; r++)
+		{
+			for (int c = std::max(0, -x); c < size && x + c < target->width; c++)
+			{
+				const uint32_t a = stamp[r * size + c] & 0xFF;
+				if (a == 0)
+				{
+					continue;
+				}
+
+				Pixel& dest = target->pPixels[(y + r) * target->width + x + c];
+				const Pixel tint = colour;
+				dest.r = (uint8_t)((dest.r * (255 - a) + tint.r * a) / 255);
+				dest.g = (uint8_t)((dest.g * (255 - a) + tint.g * a) / 255);
+				dest.b = (uint8_t)((dest.b * (255 - a) + tint.b * a) / 255);
+				dest.a = 0xFF;
+			}
+		}
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "Play.h"
+#include <vector>
+
+namespace Render
+{
+	// Pre-built anti-aliased discs for a range of radii, each at a 4x4 grid of sub-pixel offsets.
+	// Stamps are premultiplied white (coverage in every channel) so tinting is a single multiply,
+	// rows are a multiple of four pixels and the whole cache lives in one 16 byte aligned block.
+	class StampCache
+	{
+	public:
+		static StampCache& instance();
+
+		void build(int minRadius, int maxRadius);
+		bool isBuilt() const { return memory != nullptr; }
+
+		int getMinRadius() const { return minRadius; }
+		int getMaxRadius() const { return maxRadius; }
+
+		// Width and height of every stamp for the radius
+		int getSize(int radius) const;
+		// Stamp for the radius where the disc centre sits at fractions (subX + 0.5) / 4, (subY + 0.5) / 4 of a pixel
+		const uint32_t* getStamp(int radius, int subX, int subY) const;
+
+		// Blends a stamp tinted with colour into the target, top left of the stamp at x, y
+		void blit(PixelData* target, const uint32_t* stamp, int size, int x, int y, uint32_t colour) const;
+
+		static const int subSteps = 4;
+
+	private:
+		void renderStamp(uint32_t* stamp, int size, float radius, float centreX, float centreY);
+
+		int minRadius = 0;
+		int maxRadius = -1;
+
+		uint32_t* memory = nullptr;
+		std::vector<size_t> offsets;
+		std::vector<int> sizes;
+
+		StampCache() {};
+		StampCache(const StampCache& ref) = delete;
+		~StampCache();
+	};
+}
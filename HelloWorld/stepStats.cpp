@@ -0,0 +1,111 @@
+#include "stepStats.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace Fluid
+{
+	std::mutex StepCounters::registryLock;
+	std::vector<StepCounters*> StepCounters::registry;
+
+	const char* StepPhaseName(StepPhase phase)
+	{
+		switch (phase)
+		{
+		case StepPhase::Gravity: return "Gravity";
+		case StepPhase::Viscosity: return "Viscosity";
+		case StepPhase::Predict: return "Predict";
+		case StepPhase::SpringAdjustment: return "Spring adjustment";
+		case StepPhase::SpringDisplacement: return "Spring displacement";
+		case StepPhase::Relaxation: return "Relaxation";
+		case StepPhase::Collisions: return "Collisions";
+		default: return "Unknown";
+		}
+	}
+
+	StepCounters& StepCounters::local()
+	{
+		// Counters outlive their thread so nothing counted is lost when a worker exits mid run
+		static thread_local StepCounters* counters = nullptr;
+		if (counters == nullptr)
+		{
+			std::lock_guard<std::mutex> lock(registryLock);
+			counters = new StepCounters();
+			registry.push_back(counters);
+		}
+		return *counters;
+	}
+
+	void StepCounters::mergeAndClear(StepCounters& out)
+	{
+		std::lock_guard<std::mutex> lock(registryLock);
+		for (StepCounters* counters : registry)
+		{
+			out.candidatePairs += counters->candidatePairs;
+			out.pairsInRadius += counters->pairsInRadius;
+			out.maxNeighbours = std::max(out.maxNeighbours, counters->maxNeighbours);
+			out.springsCreated += counters->springsCreated;
+			out.springsBroken += counters->springsBroken;
+			out.boundaryCollisions += counters->boundaryCollisions;
+			out.bodyContacts += counters->bodyContacts;
+			*counters = StepCounters();
+		}
+	}
+
+	// JSON has no NaN or infinity, a blown up step writes null for them
+	static void writeNumber(std::ostream& out, double value, int decimals)
+	{
+		if (!std::isfinite(value))
+		{
+			out << "null";
+			return;
+		}
+		char number[64];
+		snprintf(number, sizeof(number), "%.*f", decimals, value);
+		out << number;
+	}
+
+	void StepStats::writeJson(std::ostream& out) const
+	{
+		out << "{ \"step\": " << step << ", \"dt\": ";
+		writeNumber(out, dt, 6);
+		out << ", \"particles\": " << particles
+			<< ", \"candidate_pairs\": " << candidatePairs
+			<< ", \"pairs_in_radius\": " << pairsInRadius
+			<< ", \"average_neighbours\": ";
+		writeNumber(out, averageNeighbours, 3);
+		out << ", \"max_neighbours\": " << maxNeighbours
+			<< ", \"springs_created\": " << springsCreated
+			<< ", \"springs_broken\": " << springsBroken
+			<< ", \"spring_count\": " << springCount
+			<< ", \"boundary_collisions\": " << boundaryCollisions
+			<< ", \"body_contacts\": " << bodyContacts
+			<< ", \"kinetic_energy\": ";
+		writeNumber(out, kineticEnergy, 3);
+		out << ", \"threads\": " << threads
+			<< ", \"arena_bytes\": " << arenaBytes
+			<< ", \"grid_chunks\": " << gridChunks
+			<< ", \"sleeping_particles\": " << sleepingParticles
+			<< ", \"paged_bytes\": " << pagedBytes
+			<< ", \"pages_prefetched\": " << pagesPrefetched
+			<< ", \"pages_released\": " << pagesReleased
+			<< ", \"total_ns\": " << totalNanoseconds
+			<< ", \"numa_nodes\": " << numaNodes
+			<< ", \"remote_page_fraction\": ";
+		writeNumber(out, remotePageFraction, 3);
+
+		out << ", \"node_particles_per_second\": [";
+		for (uint32_t node = 0; node < numaNodes; node++)
+		{
+			out << (node > 0 ? ", " : " ");
+			writeNumber(out, nodeParticlesPerSecond[node], 0);
+		}
+		out << (numaNodes > 0 ? " ]" : "]") << ", \"phase_ns\": { ";
+
+		for (int p = 0; p < (int)StepPhase::Count; p++)
+		{
+			out << (p > 0 ? ", " : "") << "\"" << StepPhaseName((StepPhase)p) << "\": " << phaseNanoseconds[p];
+		}
+		out << " } }";
+	}
+}
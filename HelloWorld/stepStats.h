@@ -0,0 +1,89 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+namespace Fluid
+{
+	enum class StepPhase
+	{
+		Gravity,
+		Viscosity,
+		Predict,
+		SpringAdjustment,
+		SpringDisplacement,
+		Relaxation,
+		Collisions,
+		Count
+	};
+
+	const char* StepPhaseName(StepPhase phase);
+
+	// What one call to Simulation::Update did
+	struct StepStats
+	{
+		uint64_t step = 0;
+		float dt = 0.0f;
+		uint32_t particles = 0;
+
+		// Neighbour search, taken from the density pass of the relaxation
+		uint64_t candidatePairs = 0;
+		uint64_t pairsInRadius = 0;
+		float averageNeighbours = 0.0f;
+		uint32_t maxNeighbours = 0;
+
+		uint32_t springsCreated = 0;
+		uint32_t springsBroken = 0;
+		uint32_t springCount = 0;
+		uint32_t boundaryCollisions = 0;
+		// Particles pushed out of rigid bodies
+		uint32_t bodyContacts = 0;
+		float kineticEnergy = 0.0f;
+		uint32_t threads = 1;
+
+		uint64_t phaseNanoseconds[(int)StepPhase::Count] = {};
+		uint64_t totalNanoseconds = 0;
+
+		// Bytes held by the simulation's working buffers, the neighbour grid included
+		size_t arenaBytes = 0;
+		// Chunks of the neighbour grid with particles in, 0 while the grid is dense
+		uint32_t gridChunks = 0;
+		// Particles skipped because their region was asleep
+		uint32_t sleepingParticles = 0;
+		// Size of the particles' scratch file while paged, 0 in memory
+		size_t pagedBytes = 0;
+		// Pages of particles read ahead of the sweeps and let go behind them
+		uint32_t pagesPrefetched = 0;
+		uint32_t pagesReleased = 0;
+		// While NUMA placement is on in a parallel mode: the nodes, the share of sampled particle pages on another
+		// node than the thread that steps them (negative if the platform can't tell) and each node's particles a second
+		static const uint32_t maxNumaNodes = 8;
+		uint32_t numaNodes = 0;
+		float remotePageFraction = -1.0f;
+		float nodeParticlesPerSecond[maxNumaNodes] = {};
+
+		void writeJson(std::ostream& out) const;
+	};
+
+	// Plain counters bumped by whichever thread runs a phase. Each thread gets its own copy,
+	// the simulation sums and clears them all once the step is done.
+	struct StepCounters
+	{
+		uint64_t candidatePairs = 0;
+		uint64_t pairsInRadius = 0;
+		uint32_t maxNeighbours = 0;
+		uint32_t springsCreated = 0;
+		uint32_t springsBroken = 0;
+		uint32_t boundaryCollisions = 0;
+		uint32_t bodyContacts = 0;
+
+		static StepCounters& local();
+		// Only call while no other thread is stepping
+		static void mergeAndClear(StepCounters& out);
+
+	private:
+		static std::mutex registryLock;
+		static std::vector<StepCounters*> registry;
+	};
+}
@@ -0,0 +1,256 @@
+#include "surfaceRenderer.h"
+#include "profiler.h"
+#include <emmintrin.h>
+
+namespace Render
+{
+	SurfaceRenderer& SurfaceRenderer::instance()
+	{
+		static SurfaceRenderer instance;
+
+		return instance;
+	}
+
+	void SurfaceRenderer::resize(int screenWidth, int screenHeight, int cellSize)
+	{
+		width = screenWidth;
+		height = screenHeight;
+		cell = cellSize;
+
+		gridWidth = (width + cell - 1) / cell + 1 + 2 * margin;
+		gridHeight = (height + cell - 1) / cell + 1 + 2 * margin;
+
+		// Rows padded to a multiple of four floats so the vertical pass never needs a scalar tail
+		stride = (gridWidth + 3) & ~3;
+
+		density.assign(stride * gridHeight, 0.0f);
+		scratch.assign(stride * gridHeight, 0.0f);
+		rowSegments.resize(gridHeight);
+	}
+
+	void SurfaceRenderer::draw(PixelData* target, const Fluid::ParticleArray<Vector2f>& positions, Pixel colour)
+	{
+		if (density.empty())
+		{
+			return;
+		}
+
+		PROFILE_ZONE("Surface");
+		{
+			PROFILE_ZONE("Splat");
+			splat(positions);
+		}
+		{
+			PROFILE_ZONE("Blur");
+			blur();
+		}
+		{
+			PROFILE_ZONE("Contour");
+			extractContour();
+		}
+		{
+			PROFILE_ZONE("Fill");
+			fillScanlines(target, colour);
+		}
+	}
+
+	void SurfaceRenderer::splat(const Fluid::ParticleArray<Vector2f>& positions)
+	{
+		std::fill(density.begin(), density.end(), 0.0f);
+
+		// Scaled so a block of particles at rest spacing ends up at a density of about one
+		const float weight = (particleSpacing * particleSpacing) / (float)(cell * cell);
+		const float invCell = 1.0f / cell;
+		const float maxX = (float)(gridWidth - margin - 1);
+		const float maxY = (float)(gridHeight - margin - 1);
+
+		for (const Vector2f& pos : positions)
+		{
+			const float gx = pos.x * invCell + margin;
+			const float gy = pos.y * invCell + margin;
+			if (gx < margin || gy < margin || gx >= maxX || gy >= maxY)
+			{
+				continue;
+			}
+
+			const int x = (int)gx;
+			const int y = (int)gy;
+			const float fx = gx - x;
+			const float fy = gy - y;
+
+			node(x, y) += weight * (1.0f - fx) * (1.0f - fy);
+			node(x + 1, y) += weight * fx * (1.0f - fy);
+			node(x, y + 1) += weight * (1.0f - fx) * fy;
+			node(x + 1, y + 1) += weight * fx * fy;
+		}
+	}
+
+	void SurfaceRenderer::blur()
+	{
+		// Binomial 1-4-6-4-1 kernel, run once along x into scratch and once along y back into density
+		const float w0 = 6.0f / 16.0f;
+		const float w1 = 4.0f / 16.0f;
+		const float w2 = 1.0f / 16.0f;
+		const __m128 k0 = _mm_set1_ps(w0);
+		const __m128 k1 = _mm_set1_ps(w1);
+		const __m128 k2 = _mm_set1_ps(w2);
+
+		for (int y = 0; y < gridHeight; y++)
+		{
+			const float* in = &density[y * stride];
+			float* out = &scratch[y * stride];
+
+			int x = kernelRadius;
+			for (; x + 4 <= gridWidth - kernelRadius; x += 4)
+			{
+				__m128 sum = _mm_mul_ps(_mm_loadu_ps(in + x), k0);
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(in + x - 1), _mm_loadu_ps(in + x + 1)), k1));
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(in + x - 2), _mm_loadu_ps(in + x + 2)), k2));
+				_mm_storeu_ps(out + x, sum);
+			}
+			for (; x < gridWidth - kernelRadius; x++)
+			{
+				out[x] = in[x] * w0 + (in[x - 1] + in[x + 1]) * w1 + (in[x - 2] + in[x + 2]) * w2;
+			}
+		}
+
+		for (int y = kernelRadius; y < gridHeight - kernelRadius; y++)
+		{
+			const float* r0 = &scratch[y * stride];
+			const float* rUp1 = r0 - stride;
+			const float* rDown1 = r0 + stride;
+			const float* rUp2 = r0 - 2 * stride;
+			const float* rDown2 = r0 + 2 * stride;
+			float* out = &density[y * stride];
+
+			for (int x = 0; x < stride; x += 4)
+			{
+				__m128 sum = _mm_mul_ps(_mm_loadu_ps(r0 + x), k0);
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(rUp1 + x), _mm_loadu_ps(rDown1 + x)), k1));
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(rUp2 + x), _mm_loadu_ps(rDown2 + x)), k2));
+				_mm_storeu_ps(out + x, sum);
+			}
+		}
+	}
+
+	void SurfaceRenderer::extractContour()
+	{
+		const float iso = isoLevel;
+		const float size = (float)cell;
+
+		// Both cells sharing an edge interpolate it in the same direction, so the contour has no cracks
+		auto lerp = [iso](float a, float b)
+		{
+			const float range = b - a;
+			return range != 0.0f ? (iso - a) / range : 0.5f;
+		};
+
+		for (int y = 0; y < gridHeight - 1; y++)
+		{
+			std::vector<Segment>& segments = rowSegments[y];
+			segments.clear();
+
+			const float top = (y - margin) * size;
+			const float bottom = top + size;
+
+			for (int x = 0; x < gridWidth - 1; x++)
+			{
+				const float a = node(x, y);			// Top left
+				const float b = node(x + 1, y);		// Top right
+				const float c = node(x + 1, y + 1);	// Bottom right
+				const float d = node(x, y + 1);		// Bottom left
+
+				const int index = (a >= iso) << 3 | (b >= iso) << 2 | (c >= iso) << 1 | (d >= iso);
+				if (index == 0 || index == 15)
+				{
+					continue;
+				}
+
+				const float left = (x - margin) * size;
+				const float right = left + size;
+
+				const Vector2f eTop = { left + lerp(a, b) * size, top };
+				const Vector2f eRight = { right, top + lerp(b, c) * size };
+				const Vector2f eBottom = { left + lerp(d, c) * size, bottom };
+				const Vector2f eLeft = { left, top + lerp(a, d) * size };
+
+				auto add = [&segments](const Vector2f& p0, const Vector2f& p1)
+				{
+					segments.push_back({ p0.x, p0.y, p1.x, p1.y });
+				};
+
+				const bool centreInside = (a + b + c + d) * 0.25f >= iso;
+
+				switch (index)
+				{
+				case 1: case 14: add(eLeft, eBottom); break;
+				case 2: case 13: add(eBottom, eRight); break;
+				case 3: case 12: add(eLeft, eRight); break;
+				case 4: case 11: add(eTop, eRight); break;
+				case 6: case 9: add(eTop, eBottom); break;
+				case 7: case 8: add(eLeft, eTop); break;
+				case 5:
+					// Saddle, inside corners are top right and bottom left
+					if (centreInside) { add(eLeft, eTop); add(eBottom, eRight); }
+					else { add(eTop, eRight); add(eLeft, eBottom); }
+					break;
+				case 10:
+					// Saddle, inside corners are top left and bottom right
+					if (centreInside) { add(eTop, eRight); add(eLeft, eBottom); }
+					else { add(eLeft, eTop); add(eBottom, eRight); }
+					break;
+				}
+			}
+		}
+	}
+
+	void SurfaceRenderer::fillScanlines(PixelData* target, Pixel colour)
+	{
+		const int targetWidth = std::min(width, target->width);
+		const int targetHeight = std::min(height, target->height);
+
+		for (int y = 0; y < gridHeight - 1; y++)
+		{
+			const std::vector<Segment>& segments = rowSegments[y];
+			if (segments.empty())
+			{
+				continue;
+			}
+
+			const int rowStart = std::max((y - margin) * cell, 0);
+			const int rowEnd = std::min((y - margin + 1) * cell, targetHeight);
+
+			for (int py = rowStart; py < rowEnd; py++)
+			{
+				// Sample through the pixel centre, half open on y so shared vertices are only counted once
+				const float sampleY = py + 0.5f;
+
+				crossings.clear();
+				for (const Segment& s : segments)
+				{
+					const float yMin = std::min(s.y0, s.y1);
+					const float yMax = std::max(s.y0, s.y1);
+					if (sampleY < yMin || sampleY >= yMax)
+					{
+						continue;
+					}
+
+					crossings.push_back(s.x0 + (sampleY - s.y0) * (s.x1 - s.x0) / (s.y1 - s.y0));
+				}
+
+				std::sort(crossings.begin(), crossings.end());
+
+				uint32_t* line = &target->pPixels[py * target->width].bits;
+				for (size_t i = 0; i + 1 < crossings.size(); i += 2)
+				{
+					const int xStart = std::max((int)std::ceil(crossings[i] - 0.5f), 0);
+					const int xEnd = std::min((int)std::ceil(crossings[i + 1] - 0.5f), targetWidth);
+					if (xEnd > xStart)
+					{
+						std::fill(line + xStart, line + xEnd, colour.bits);
+					}
+				}
+			}
+		}
+	}
+}
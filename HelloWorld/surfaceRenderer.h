@@ -0,0 +1,62 @@
+#pragma once
+#include "Play.h"
+#include "particleArray.h"
+#include <vector>
+
+namespace Render
+{
+	// Draws the fluid as one surface instead of one disc per particle.
+	// Particles are splatted into a low resolution density grid, blurred with a separable kernel,
+	// and the iso-contour (marching squares) is filled scanline by scanline into the draw buffer.
+	// Cost follows the screen resolution, not the particle count.
+	class SurfaceRenderer
+	{
+	public:
+		static SurfaceRenderer& instance();
+
+		void resize(int screenWidth, int screenHeight, int cellSize = 4);
+		void draw(PixelData* target, const Fluid::ParticleArray<Vector2f>& positions, Pixel colour);
+
+		void setIsoLevel(float level) { isoLevel = level; }
+		void setParticleSpacing(float spacing) { particleSpacing = spacing; }
+
+	private:
+		struct Segment
+		{
+			float x0, y0;
+			float x1, y1;
+		};
+
+		void splat(const Fluid::ParticleArray<Vector2f>& positions);
+		void blur();
+		void extractContour();
+		void fillScanlines(PixelData* target, Pixel colour);
+
+		float& node(int x, int y) { return density[y * stride + x]; }
+
+		// Kernel radius of the blur, the grid gets a margin one node wider so the outer ring stays empty
+		// and every contour closes inside the grid.
+		static const int kernelRadius = 2;
+		static const int margin = kernelRadius + 1;
+
+		int width = 0;
+		int height = 0;
+		int cell = 4;
+
+		int gridWidth = 0;
+		int gridHeight = 0;
+		int stride = 0;
+
+		float isoLevel = 0.4f;
+		float particleSpacing = 8.0f;
+
+		std::vector<float> density;
+		std::vector<float> scratch;
+		std::vector<std::vector<Segment>> rowSegments;
+		std::vector<float> crossings;
+
+		SurfaceRenderer() {};
+		SurfaceRenderer(const SurfaceRenderer& ref) = delete;
+		~SurfaceRenderer() {};
+	};
+}
@@ -0,0 +1,208 @@
+#include "threadPool.h"
+#include "profiler.h"
+#include "numaTopology.h"
+#include "perfCounters.h"
+#include <algorithm>
+
+namespace Fluid
+{
+	ThreadPool& ThreadPool::instance()
+	{
+		static ThreadPool instance;
+
+		return instance;
+	}
+
+	ThreadPool::ThreadPool()
+	{
+		setThreadCount(0);
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		stopWorkers();
+	}
+
+	// Which pool thread this is, set once when a worker starts
+	static thread_local uint32_t currentThread = 0;
+
+	void ThreadPool::setThreadCount(uint32_t count)
+	{
+		if (count == 0)
+		{
+			count = std::max(1u, std::thread::hardware_concurrency());
+		}
+		if (count == getThreadCount())
+		{
+			return;
+		}
+
+		stopWorkers();
+		startWorkers(count);
+	}
+
+	void ThreadPool::startWorkers(uint32_t count)
+	{
+		stopping = false;
+		const std::vector<uint32_t>& cpus = NumaTopology::instance().getCpus();
+		for (uint32_t i = 1; i < count; i++)
+		{
+			workers.emplace_back(&ThreadPool::workerLoop, this, generation, i, pinned ? (int)cpus[getCpuSlot(i, count)] : -1);
+		}
+	}
+
+	void ThreadPool::setPinned(bool pin)
+	{
+		if (pin == pinned)
+		{
+			return;
+		}
+
+		// The workers pin themselves as they start
+		const uint32_t count = getThreadCount();
+		stopWorkers();
+		pinned = pin;
+		startWorkers(count);
+
+		const NumaTopology& topology = NumaTopology::instance();
+		if (pinned)
+		{
+			topology.pinCurrentThread(topology.getCpus()[getCpuSlot(0, count)]);
+		}
+		else
+		{
+			topology.unpinCurrentThread();
+		}
+	}
+
+	uint32_t ThreadPool::getCpuSlot(uint32_t thread, uint32_t threads)
+	{
+		// Evenly spaced over the cores, so a pool smaller than the machine still uses every node
+		const uint32_t cpus = (uint32_t)NumaTopology::instance().getCpus().size();
+		return threads <= cpus ? (uint32_t)((uint64_t)thread * cpus / threads) : thread % cpus;
+	}
+
+	uint32_t ThreadPool::getChunkThread(uint32_t chunk, uint32_t chunkCount) const
+	{
+		// Thread t starts at the chunk ceil(t * chunkCount / threads), so one chunk goes to the caller
+		return chunkCount > 0 ? (uint32_t)((uint64_t)chunk * getThreadCount() / chunkCount) : 0;
+	}
+
+	uint32_t ThreadPool::getThreadNode(uint32_t thread) const
+	{
+		return pinned ? NumaTopology::instance().getNodeOfCpuSlot(getCpuSlot(thread, getThreadCount())) : 0;
+	}
+
+	uint32_t ThreadPool::getCurrentThread()
+	{
+		return currentThread;
+	}
+
+	void ThreadPool::stopWorkers()
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		wake.notify_all();
+
+		for (std::thread& worker : workers)
+		{
+			worker.join();
+		}
+		workers.clear();
+	}
+
+	void ThreadPool::runChunks(uint32_t thread)
+	{
+		if (pinned)
+		{
+			const uint64_t threads = getThreadCount();
+			const uint32_t first = (uint32_t)((thread * jobChunks + threads - 1) / threads);
+			const uint32_t end = (uint32_t)(((thread + 1) * jobChunks + threads - 1) / threads);
+			for (uint32_t chunk = first; chunk < end; chunk++)
+			{
+				(*job)(chunk);
+			}
+		}
+		else
+		{
+			for (uint32_t chunk = nextChunk.fetch_add(1); chunk < jobChunks; chunk = nextChunk.fetch_add(1))
+			{
+				(*job)(chunk);
+			}
+		}
+	}
+
+	void ThreadPool::run(uint32_t chunkCount, const std::function<void(uint32_t)>& work)
+	{
+		if (chunkCount == 0)
+		{
+			return;
+		}
+
+		if (workers.empty() || chunkCount == 1)
+		{
+			for (uint32_t chunk = 0; chunk < chunkCount; chunk++)
+			{
+				work(chunk);
+			}
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			job = &work;
+			jobChunks = chunkCount;
+			nextChunk.store(0);
+			busyWorkers = (uint32_t)workers.size();
+			generation++;
+		}
+		wake.notify_all();
+
+		runChunks(0);
+
+		std::unique_lock<std::mutex> guard(lock);
+		finished.wait(guard, [this] { return busyWorkers == 0; });
+		job = nullptr;
+	}
+
+	void ThreadPool::workerLoop(uint64_t seen, uint32_t thread, int cpu)
+	{
+		currentThread = thread;
+		if (cpu >= 0)
+		{
+			NumaTopology::instance().pinCurrentThread((uint32_t)cpu);
+		}
+
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				wake.wait(guard, [this, seen] { return stopping || generation != seen; });
+				if (stopping)
+				{
+					return;
+				}
+				seen = generation;
+			}
+
+			{
+				PROFILE_ZONE("Worker");
+				// Counted here and handed to the caller's phase, which only sees its own thread
+				Stats::HardwareCounters& counters = Stats::HardwareCounters::forThisThread();
+				Stats::CounterSample start, end;
+				counters.read(start);
+				runChunks(thread);
+				counters.read(end);
+				Stats::HardwareCounters::addWorkerSample(Stats::CounterSample::between(start, end));
+			}
+
+			std::lock_guard<std::mutex> guard(lock);
+			if (--busyWorkers == 0)
+			{
+				finished.notify_one();
+			}
+		}
+	}
+}
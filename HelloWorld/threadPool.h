@@ -0,0 +1,69 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Fluid
+{
+	// Persistent worker threads for the parallel simulation modes. The calling thread takes part in
+	// every run, so a thread count of 1 runs everything inline without touching the workers.
+	class ThreadPool
+	{
+	public:
+		static ThreadPool& instance();
+
+		// Total threads including the caller, 0 picks the hardware concurrency
+		void setThreadCount(uint32_t count);
+		uint32_t getThreadCount() const { return (uint32_t)workers.size() + 1; }
+
+		// Calls work(chunk) once for every chunk in [0, chunkCount) and returns when all are done.
+		// Chunks are claimed in order by whichever thread is free, which thread runs which chunk is not fixed,
+		// unless the pool is pinned.
+		void run(uint32_t chunkCount, const std::function<void(uint32_t)>& work);
+
+		// Pins every thread to a core, spread evenly over the cores node by node, and gives each thread the same
+		// share of every run: thread t runs the chunks getChunkThread puts on it, in order. Memory a thread writes
+		// first lands on its node, and the next run over as many chunks comes back to it from the same thread.
+		// The calling thread is pinned as thread 0, it should be the one that calls run.
+		void setPinned(bool pin);
+		bool isPinned() const { return pinned; }
+		// Thread that runs chunk of chunkCount while pinned, 0 is the caller and 1.. the workers
+		uint32_t getChunkThread(uint32_t chunk, uint32_t chunkCount) const;
+		// Node of the core thread is pinned to, 0 while not pinned
+		uint32_t getThreadNode(uint32_t thread) const;
+		// The calling thread's index, 0 for any thread that isn't a worker
+		static uint32_t getCurrentThread();
+
+	private:
+		void startWorkers(uint32_t count);
+		// Starts from the generation current when it was created so it never picks up a finished run.
+		// Pins itself to cpu first, unless it is negative.
+		void workerLoop(uint64_t seen, uint32_t thread, int cpu);
+		void runChunks(uint32_t thread);
+		void stopWorkers();
+		// Slot in NumaTopology::getCpus() of the core thread of threads is pinned to
+		static uint32_t getCpuSlot(uint32_t thread, uint32_t threads);
+
+		std::vector<std::thread> workers;
+		bool pinned = false;
+
+		std::mutex lock;
+		std::condition_variable wake;
+		std::condition_variable finished;
+
+		const std::function<void(uint32_t)>* job = nullptr;
+		uint32_t jobChunks = 0;
+		std::atomic<uint32_t> nextChunk{ 0 };
+		uint32_t busyWorkers = 0;
+		uint64_t generation = 0;
+		bool stopping = false;
+
+		ThreadPool();
+		ThreadPool(const ThreadPool& ref) = delete;
+		~ThreadPool();
+	};
+}
@@ -0,0 +1,308 @@
+#include "transport.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#if defined(_WIN32)
+#include "Play.h"
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Fluid
+{
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "The rings need lock free atomics to be shared between processes");
+
+	// The header gets a cache line of its own, then the rings' counters, then their data
+	static const size_t headerBytes = 64;
+
+	SharedMemoryTransport::~SharedMemoryTransport()
+	{
+		close();
+	}
+
+	size_t SharedMemoryTransport::regionBytes(int size, size_t ringBytes)
+	{
+		const size_t rings = (size_t)size * size;
+		return headerBytes + rings * sizeof(Ring) + rings * ringBytes;
+	}
+
+	SharedMemoryTransport::Ring& SharedMemoryTransport::ring(int from, int to) const
+	{
+		return *(Ring*)(region + headerBytes + sizeof(Ring) * ((size_t)from * size + to));
+	}
+
+	uint8_t* SharedMemoryTransport::ringData(int from, int to) const
+	{
+		const size_t rings = (size_t)size * size;
+		return region + headerBytes + rings * sizeof(Ring) + ((size_t)from * size + to) * ringBytes;
+	}
+
+	bool SharedMemoryTransport::open(const std::string& newName, int newRank, int newSize, size_t newRingBytes, int timeoutMilliseconds)
+	{
+		close();
+		if (newSize < 1 || newRank < 0 || newRank >= newSize || newRingBytes == 0)
+		{
+			return false;
+		}
+
+		rank = newRank;
+		size = newSize;
+		ringBytes = newRingBytes;
+		bytes = regionBytes(size, ringBytes);
+		outboxes.assign(size, std::vector<uint8_t>());
+		outboxSent.assign(size, 0);
+
+#if defined(_WIN32)
+		name = "Local\\fluid-" + newName;
+		if (rank == 0)
+		{
+			// Backed by the page file, zeroed to start with
+			HANDLE view = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD)((uint64_t)bytes >> 32), (DWORD)bytes, name.c_str());
+			if (view == nullptr)
+			{
+				return false;
+			}
+			mapping = view;
+		}
+		else
+		{
+			const auto giveUp = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMilliseconds);
+			while ((mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str())) == nullptr)
+			{
+				if (std::chrono::steady_clock::now() > giveUp)
+				{
+					return false;
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+
+		region = (uint8_t*)MapViewOfFile((HANDLE)mapping, FILE_MAP_ALL_ACCESS, 0, 0, bytes);
+		if (region == nullptr)
+		{
+			CloseHandle((HANDLE)mapping);
+			mapping = nullptr;
+			return false;
+		}
+#else
+		name = "/fluid-" + newName;
+		int handle = -1;
+		if (rank == 0)
+		{
+			// Anything left by a run that crashed goes first
+			shm_unlink(name.c_str());
+			handle = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+			if (handle < 0 || ftruncate(handle, (off_t)bytes) != 0)
+			{
+				if (handle >= 0)
+				{
+					::close(handle);
+					shm_unlink(name.c_str());
+				}
+				return false;
+			}
+		}
+		else
+		{
+			// Until rank 0 has made it at its full size
+			const auto giveUp = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMilliseconds);
+			struct stat info;
+			while ((handle = shm_open(name.c_str(), O_RDWR, 0600)) < 0 || fstat(handle, &info) != 0 || (size_t)info.st_size < bytes)
+			{
+				if (handle >= 0)
+				{
+					::close(handle);
+				}
+				if (std::chrono::steady_clock::now() > giveUp)
+				{
+					return false;
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+
+		// The mapping keeps the region alive, the handle isn't needed past here
+		void* view = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
+		::close(handle);
+		if (view == MAP_FAILED)
+		{
+			if (rank == 0)
+			{
+				shm_unlink(name.c_str());
+			}
+			return false;
+		}
+		region = (uint8_t*)view;
+#endif
+
+		Header& header = *(Header*)region;
+		if (rank == 0)
+		{
+			new (region) Header();
+			header.size = (uint32_t)size;
+			header.ringBytes = ringBytes;
+			header.arrived.store(0);
+			header.generation.store(0);
+			for (int from = 0; from < size; from++)
+			{
+				for (int to = 0; to < size; to++)
+				{
+					Ring& r = *new (&ring(from, to)) Ring();
+					r.head.store(0);
+					r.tail.store(0);
+				}
+			}
+			header.ready.store(readyMagic, std::memory_order_release);
+			return true;
+		}
+
+		// The region exists a moment before rank 0 has set it up
+		const auto giveUp = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMilliseconds);
+		while (header.ready.load(std::memory_order_acquire) != readyMagic)
+		{
+			if (std::chrono::steady_clock::now() > giveUp)
+			{
+				close();
+				return false;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		if (header.size != (uint32_t)size || header.ringBytes != ringBytes)
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void SharedMemoryTransport::close()
+	{
+		if (region != nullptr)
+		{
+#if defined(_WIN32)
+			UnmapViewOfFile(region);
+#else
+			munmap(region, bytes);
+#endif
+		}
+#if defined(_WIN32)
+		if (mapping != nullptr)
+		{
+			CloseHandle((HANDLE)mapping);
+		}
+		mapping = nullptr;
+#else
+		// The name goes, ranks that have it mapped keep it until they close
+		if (region != nullptr && rank == 0)
+		{
+			shm_unlink(name.c_str());
+		}
+#endif
+		region = nullptr;
+		bytes = 0;
+		outboxes.clear();
+		outboxSent.clear();
+	}
+
+	void SharedMemoryTransport::send(int to, const void* data, size_t count)
+	{
+		// Length first, then the bytes
+		std::vector<uint8_t>& outbox = outboxes[to];
+		const uint64_t length = count;
+		outbox.insert(outbox.end(), (const uint8_t*)&length, (const uint8_t*)&length + sizeof(length));
+		outbox.insert(outbox.end(), (const uint8_t*)data, (const uint8_t*)data + count);
+		pump();
+	}
+
+	void SharedMemoryTransport::pump()
+	{
+		for (int to = 0; to < size; to++)
+		{
+			std::vector<uint8_t>& outbox = outboxes[to];
+			size_t& sent = outboxSent[to];
+			if (sent == outbox.size())
+			{
+				continue;
+			}
+
+			// Only this rank moves head, only the receiver moves tail
+			Ring& r = ring(rank, to);
+			uint8_t* data = ringData(rank, to);
+			const uint64_t head = r.head.load(std::memory_order_relaxed);
+			const uint64_t tail = r.tail.load(std::memory_order_acquire);
+			const size_t count = std::min((size_t)(ringBytes - (head - tail)), outbox.size() - sent);
+			const size_t offset = (size_t)(head % ringBytes);
+			const size_t first = std::min(count, ringBytes - offset);
+			memcpy(data + offset, outbox.data() + sent, first);
+			memcpy(data, outbox.data() + sent + first, count - first);
+			r.head.store(head + count, std::memory_order_release);
+
+			sent += count;
+			if (sent == outbox.size())
+			{
+				outbox.clear();
+				sent = 0;
+			}
+		}
+	}
+
+	void SharedMemoryTransport::read(int from, void* out, size_t count)
+	{
+		Ring& r = ring(from, rank);
+		const uint8_t* data = ringData(from, rank);
+		uint8_t* target = (uint8_t*)out;
+		while (count > 0)
+		{
+			const uint64_t head = r.head.load(std::memory_order_acquire);
+			const uint64_t tail = r.tail.load(std::memory_order_relaxed);
+			const size_t available = std::min((size_t)(head - tail), count);
+			if (available == 0)
+			{
+				// Whoever this rank waits on may be waiting for this rank's outbox
+				pump();
+				std::this_thread::yield();
+				continue;
+			}
+
+			const size_t offset = (size_t)(tail % ringBytes);
+			const size_t first = std::min(available, ringBytes - offset);
+			memcpy(target, data + offset, first);
+			memcpy(target + first, data, available - first);
+			r.tail.store(tail + available, std::memory_order_release);
+			target += available;
+			count -= available;
+		}
+	}
+
+	void SharedMemoryTransport::receive(int from, std::vector<uint8_t>& out)
+	{
+		uint64_t length = 0;
+		read(from, &length, sizeof(length));
+		out.resize((size_t)length);
+		read(from, out.data(), out.size());
+	}
+
+	void SharedMemoryTransport::barrier()
+	{
+		// The last to arrive starts the next generation, which lets the rest go
+		Header& header = *(Header*)region;
+		const uint32_t generation = header.generation.load(std::memory_order_acquire);
+		if (header.arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == (uint32_t)size)
+		{
+			header.arrived.store(0, std::memory_order_relaxed);
+			header.generation.store(generation + 1, std::memory_order_release);
+			return;
+		}
+		while (header.generation.load(std::memory_order_acquire) == generation)
+		{
+			pump();
+			std::this_thread::yield();
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,94 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Fluid
+{
+	// Messages between the processes sharing one simulation, each process a rank from 0 to size - 1.
+	// Messages between two ranks arrive in the order they were sent. Sends never wait for the receiver,
+	// so every rank can send all it has before it receives anything.
+	class Transport
+	{
+	public:
+		virtual ~Transport() {}
+
+		virtual int getRank() const = 0;
+		virtual int getSize() const = 0;
+
+		virtual void send(int rank, const void* data, size_t bytes) = 0;
+		// Waits for the next message from rank
+		virtual void receive(int rank, std::vector<uint8_t>& out) = 0;
+		// Waits until every rank has got here
+		virtual void barrier() = 0;
+	};
+
+	// Ranks on one host, through a named shared memory region holding a ring for every sender and receiver pair.
+	// What doesn't fit in a ring waits in the sender's outbox and goes in as the receiver drains it, moved along
+	// whenever the sender is itself waiting to receive or at a barrier.
+	class SharedMemoryTransport : public Transport
+	{
+	public:
+		SharedMemoryTransport() {}
+		SharedMemoryTransport(const SharedMemoryTransport& other) = delete;
+		SharedMemoryTransport& operator=(const SharedMemoryTransport& other) = delete;
+		~SharedMemoryTransport();
+
+		// Rank 0 makes the region, the others wait for it to appear. Every rank passes the same name, size and ring size.
+		// False if the region can't be made, or didn't appear within the timeout.
+		bool open(const std::string& name, int rank, int size, size_t ringBytes, int timeoutMilliseconds = 10000);
+		void close();
+		bool isOpen() const { return region != nullptr; }
+
+		int getRank() const override { return rank; }
+		int getSize() const override { return size; }
+		void send(int rank, const void* data, size_t bytes) override;
+		void receive(int rank, std::vector<uint8_t>& out) override;
+		void barrier() override;
+
+	private:
+		struct Header
+		{
+			std::atomic<uint32_t> ready;
+			uint32_t size;
+			uint64_t ringBytes;
+			std::atomic<uint32_t> arrived;
+			std::atomic<uint32_t> generation;
+		};
+
+		// Head and tail count bytes since the start, on their own cache lines
+		struct alignas(64) Ring
+		{
+			std::atomic<uint64_t> head;
+			char headPadding[64 - sizeof(std::atomic<uint64_t>)];
+			std::atomic<uint64_t> tail;
+			char tailPadding[64 - sizeof(std::atomic<uint64_t>)];
+		};
+
+		static size_t regionBytes(int size, size_t ringBytes);
+		Ring& ring(int from, int to) const;
+		uint8_t* ringData(int from, int to) const;
+
+		// Moves as much of every outbox into its ring as fits
+		void pump();
+		// Reads exactly bytes from the ring from rank, pumping while it waits
+		void read(int from, void* out, size_t bytes);
+
+		static const uint32_t readyMagic = 0x534C4142;
+
+		uint8_t* region = nullptr;
+		size_t bytes = 0;
+		int rank = 0;
+		int size = 1;
+		size_t ringBytes = 0;
+		// Per destination, bytes not in the ring yet
+		std::vector<std::vector<uint8_t>> outboxes;
+		std::vector<size_t> outboxSent;
+		std::string name;
+#if defined(_WIN32)
+		void* mapping = nullptr;
+#endif
+	};
+}
@@ -0,0 +1,406 @@
+#include "validation.h"
+#include "Simulation.h"
+#include "threadPool.h"
+#include "boundary.h"
+#include "rigidBodies.h"
+#include <cmath>
+#include <cstring>
+#include <random>
+
+namespace Fluid
+{
+	DifferentialTest::DifferentialTest(const DifferentialOptions& options)
+		: options(options)
+	{
+	}
+
+	void DifferentialTest::addScene(const std::string& name, const std::vector<Render::particle>& particles)
+	{
+		scenes.push_back({ name, particles });
+	}
+
+	std::vector<Render::particle> BlockScene(int count, int rowSize, float gap)
+	{
+		const Point2D& topLeft = Render::Boundary::instance().getTopLeft();
+		const Point2D& bottomRight = Render::Boundary::instance().getBottomRight();
+		const Vector2f centre = { (topLeft.x + bottomRight.x) / 2.0f, (topLeft.y + bottomRight.y) / 2.0f };
+		const int rows = (count + rowSize - 1) / rowSize;
+
+		std::vector<Render::particle> block;
+		for (int i = 0; i < count; i++)
+		{
+			Render::particle particle;
+			particle.pos = { centre.x + (i % rowSize - rowSize / 2) * gap, centre.y + (i / rowSize - rows / 2) * gap };
+			block.push_back(particle);
+		}
+		return block;
+	}
+
+	std::vector<Render::particle> RandomScene(uint32_t count, uint32_t seed)
+	{
+		const Point2D& topLeft = Render::Boundary::instance().getTopLeft();
+		const Point2D& bottomRight = Render::Boundary::instance().getBottomRight();
+
+		std::mt19937 random(seed);
+		std::uniform_real_distribution<float> x(topLeft.x + 4.0f, bottomRight.x - 5.0f);
+		std::uniform_real_distribution<float> y(topLeft.y + 4.0f, bottomRight.y - 5.0f);
+		std::uniform_real_distribution<float> speed(-60.0f, 60.0f);
+
+		std::vector<Render::particle> scatter;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			Render::particle particle;
+			particle.pos = { x(random), y(random) };
+			particle.vel = { speed(random), speed(random) };
+			scatter.push_back(particle);
+		}
+		return scatter;
+	}
+
+	void LoadParticles(const std::vector<Render::particle>& particles)
+	{
+		Simulation& simulation = Simulation::getInstance();
+		Render::ClearParticles();
+		simulation.ClearData();
+
+		const uint32_t first = Render::CreateParticles((uint32_t)particles.size(), [&particles](uint32_t offset, uint32_t count, Render::particle* out)
+		{
+			std::copy(particles.begin() + offset, particles.begin() + offset + count, out);
+		});
+		simulation.AddCircles(first, (uint32_t)particles.size());
+	}
+
+	std::vector<Render::particle> CaptureParticles()
+	{
+		std::vector<Render::particle> particles(Render::ParticleCount());
+		for (uint32_t i = 0; i < particles.size(); i++)
+		{
+			particles[i] = Render::GetParticle(i);
+		}
+		return particles;
+	}
+
+	uint64_t HashParticleState()
+	{
+		uint64_t hash = 14695981039346656037ull;
+		auto mix = [&hash](float value)
+		{
+			uint32_t bits;
+			memcpy(&bits, &value, sizeof(bits));
+			for (int b = 0; b < 4; b++)
+			{
+				hash = (hash ^ ((bits >> (b * 8)) & 0xFF)) * 1099511628211ull;
+			}
+		};
+
+		for (uint32_t i = 0; i < Render::ParticleCount(); i++)
+		{
+			const Render::particle& particle = Render::GetParticle(i);
+			mix(particle.pos.x);
+			mix(particle.pos.y);
+			mix(particle.vel.x);
+			mix(particle.vel.y);
+			mix(particle.d);
+			mix(particle.dNear);
+			mix(particle.p);
+		}
+		return hash;
+	}
+
+	void DifferentialTest::addDefaultScenes()
+	{
+		addScene("block", BlockScene());
+		addScene("random", RandomScene(options.randomParticles, options.seed));
+		// Squeezed well under the rest spacing, the first relaxation throws particles a long way mid sweep
+		addScene("packed", BlockScene(400, 20, 2.0f));
+	}
+
+	PhaseError DifferentialTest::compare(const std::string& phase, const std::vector<Render::particle>& reference, const std::vector<Render::particle>& accelerated, bool densities) const
+	{
+		PhaseError error;
+		error.phase = phase;
+
+		for (size_t i = 0; i < reference.size() && i < accelerated.size(); i++)
+		{
+			const Render::particle& a = reference[i];
+			const Render::particle& b = accelerated[i];
+			error.maxPosition = std::max(error.maxPosition, (double)(a.pos - b.pos).Length());
+			error.maxVelocity = std::max(error.maxVelocity, (double)(a.vel - b.vel).Length());
+			if (densities)
+			{
+				const double scale = std::max(1.0, (double)std::fabs(a.d));
+				const double scaleNear = std::max(1.0, (double)std::fabs(a.dNear));
+				error.maxDensity = std::max(error.maxDensity, std::fabs(a.d - b.d) / scale);
+				error.maxDensity = std::max(error.maxDensity, std::fabs(a.dNear - b.dNear) / scaleNear);
+			}
+		}
+
+		// NaN never compares greater, catch it explicitly
+		error.passed = reference.size() == accelerated.size()
+			&& std::isfinite(error.maxPosition) && std::isfinite(error.maxVelocity) && std::isfinite(error.maxDensity)
+			&& error.maxPosition <= options.positionTolerance
+			&& error.maxVelocity <= options.velocityTolerance
+			&& error.maxDensity <= options.densityTolerance;
+		return error;
+	}
+
+	const std::vector<SceneReport>& DifferentialTest::run()
+	{
+		Simulation& simulation = Simulation::getInstance();
+		const NeighbourSearch savedSearch = simulation.GetNeighbourSearch();
+		const ExecutionMode savedMode = simulation.GetExecutionMode();
+		const NeighbourGrid::Layout savedLayout = simulation.GetGridLayout();
+		Render::Boundary& boundary = Render::Boundary::instance();
+		const double savedTime = boundary.getTime();
+		RigidBodies& bodies = RigidBodies::instance();
+		std::vector<RigidBodyState> savedBodies;
+		bodies.getState(savedBodies);
+		simulation.SetExecutionMode(ExecutionMode::Serial);
+		simulation.SetGridLayout(NeighbourGrid::Layout::Dense);
+		reports.clear();
+
+		// Every Update moves the box along its path and the bodies with the fluid, so each run starts from
+		// them as well as the particles
+		std::vector<Render::particle> start;
+		double startTime = 0.0;
+		std::vector<RigidBodyState> startBodies;
+		auto rewind = [&]
+		{
+			boundary.setTime(startTime);
+			bodies.setState(startBodies);
+			LoadParticles(start);
+		};
+
+		// Runs the same work from the same snapshot with both searches
+		auto both = [&](auto&& work, std::vector<Render::particle>& reference, std::vector<Render::particle>& accelerated,
+			std::vector<SpringPair>& referenceSprings, std::vector<SpringPair>& acceleratedSprings)
+		{
+			simulation.SetNeighbourSearch(NeighbourSearch::Reference);
+			rewind();
+			work();
+			reference = CaptureParticles();
+			referenceSprings = simulation.GetSpringPairs();
+
+			simulation.SetNeighbourSearch(NeighbourSearch::Grid);
+			rewind();
+			work();
+			accelerated = CaptureParticles();
+			acceleratedSprings = simulation.GetSpringPairs();
+		};
+
+		for (const Scene& scene : scenes)
+		{
+			SceneReport report;
+			report.scene = scene.name;
+			report.particles = (uint32_t)scene.particles.size();
+
+			simulation.SetNeighbourSearch(NeighbourSearch::Reference);
+			LoadParticles(scene.particles);
+			for (int i = 0; i < options.settleSteps; i++)
+			{
+				simulation.Update(options.dt);
+			}
+			start = CaptureParticles();
+			startTime = boundary.getTime();
+			bodies.getState(startBodies);
+
+			std::vector<Render::particle> reference, accelerated;
+			std::vector<SpringPair> referenceSprings, acceleratedSprings;
+
+			both([&] { simulation.RunPhase(StepPhase::Viscosity, options.dt); }, reference, accelerated, referenceSprings, acceleratedSprings);
+			report.phases.push_back(compare("Viscosity", reference, accelerated, false));
+
+			// Once to create the springs, again to adjust their rest lengths, then displace
+			both([&]
+			{
+				simulation.RunPhase(StepPhase::SpringAdjustment, options.dt);
+				simulation.RunPhase(StepPhase::SpringAdjustment, options.dt);
+				simulation.RunPhase(StepPhase::SpringDisplacement, options.dt);
+			}, reference, accelerated, referenceSprings, acceleratedSprings);
+			PhaseError springs = compare("Springs", reference, accelerated, false);
+			springs.springCountDifference = (int)acceleratedSprings.size() - (int)referenceSprings.size();
+			for (size_t i = 0; i < referenceSprings.size() && i < acceleratedSprings.size(); i++)
+			{
+				springs.maxRestLength = std::max(springs.maxRestLength, (double)(referenceSprings[i].restSpring - acceleratedSprings[i].restSpring).Length());
+			}
+			springs.passed = springs.passed && springs.springCountDifference == 0 && springs.maxRestLength <= options.positionTolerance;
+			report.phases.push_back(springs);
+
+			both([&] { simulation.RunPhase(StepPhase::Relaxation, options.dt); }, reference, accelerated, referenceSprings, acceleratedSprings);
+			report.phases.push_back(compare("Relaxation", reference, accelerated, true));
+
+			both([&]
+			{
+				for (int i = 0; i < options.steps; i++)
+				{
+					simulation.Update(options.dt);
+				}
+			}, reference, accelerated, referenceSprings, acceleratedSprings);
+			report.phases.push_back(compare("Steps x" + std::to_string(options.steps), reference, accelerated, true));
+
+			// The sparse chunks gather in the same order as the dense cells, so the grid's two layouts must agree
+			// exactly too, in the serial sweep and in the parallel kernels
+			for (ExecutionMode mode : { ExecutionMode::Serial, ExecutionMode::Deterministic })
+			{
+				simulation.SetExecutionMode(mode);
+				simulation.SetNeighbourSearch(NeighbourSearch::Grid);
+				for (NeighbourGrid::Layout layout : { NeighbourGrid::Layout::Dense, NeighbourGrid::Layout::Sparse })
+				{
+					simulation.SetGridLayout(layout);
+					rewind();
+					for (int i = 0; i < options.steps; i++)
+					{
+						simulation.Update(options.dt);
+					}
+					(layout == NeighbourGrid::Layout::Dense ? reference : accelerated) = CaptureParticles();
+				}
+				const char* name = mode == ExecutionMode::Serial ? "Sparse x" : "Sparse det x";
+				report.phases.push_back(compare(name + std::to_string(options.steps), reference, accelerated, true));
+			}
+			simulation.SetExecutionMode(ExecutionMode::Serial);
+			simulation.SetGridLayout(NeighbourGrid::Layout::Dense);
+
+			for (const PhaseError& phase : report.phases)
+			{
+				report.passed = report.passed && phase.passed;
+			}
+			reports.push_back(report);
+		}
+
+		simulation.SetNeighbourSearch(savedSearch);
+		simulation.SetExecutionMode(savedMode);
+		simulation.SetGridLayout(savedLayout);
+		boundary.setTime(savedTime);
+		bodies.setState(savedBodies);
+		return reports;
+	}
+
+	bool DifferentialTest::passed() const
+	{
+		for (const SceneReport& report : reports)
+		{
+			if (!report.passed)
+			{
+				return false;
+			}
+		}
+		return !reports.empty();
+	}
+
+	bool DifferentialTest::writeReport(const char* path) const
+	{
+		std::ofstream file(path);
+		if (!file)
+		{
+			return false;
+		}
+
+		char line[256];
+		snprintf(line, sizeof(line), "Differential test, grid neighbour search against the brute force reference, sparse grid against dense\n"
+			"tolerances: position %g, velocity %g, density %g (relative)\n\n", options.positionTolerance, options.velocityTolerance, options.densityTolerance);
+		file << line;
+
+		for (const SceneReport& report : reports)
+		{
+			snprintf(line, sizeof(line), "scene %s, %u particles: %s\n", report.scene.c_str(), report.particles, report.passed ? "PASS" : "FAIL");
+			file << line;
+			for (const PhaseError& phase : report.phases)
+			{
+				snprintf(line, sizeof(line), "  %-14s position %.3e  velocity %.3e  density %.3e  rest length %.3e  springs %+d  %s\n",
+					phase.phase.c_str(), phase.maxPosition, phase.maxVelocity, phase.maxDensity, phase.maxRestLength, phase.springCountDifference, phase.passed ? "ok" : "FAIL");
+				file << line;
+			}
+		}
+
+		file << (passed() ? "\nPASS\n" : "\nFAIL\n");
+		return true;
+	}
+
+	DeterminismTest::DeterminismTest(const DeterminismOptions& options)
+		: options(options)
+	{
+	}
+
+	const std::vector<DeterminismRun>& DeterminismTest::run()
+	{
+		Simulation& simulation = Simulation::getInstance();
+		ThreadPool& pool = ThreadPool::instance();
+		const ExecutionMode savedMode = simulation.GetExecutionMode();
+		const uint32_t savedThreads = pool.getThreadCount();
+
+		const std::vector<Render::particle> scene = RandomScene(options.particles, options.seed);
+		runs.clear();
+
+		for (ExecutionMode mode : { ExecutionMode::Deterministic, ExecutionMode::Parallel })
+		{
+			for (uint32_t threads : options.threadCounts)
+			{
+				pool.setThreadCount(threads);
+				simulation.SetExecutionMode(mode);
+				LoadParticles(scene);
+
+				const auto begin = std::chrono::steady_clock::now();
+				for (int i = 0; i < options.steps; i++)
+				{
+					simulation.Update(options.dt);
+				}
+				const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+				DeterminismRun result;
+				result.mode = mode;
+				result.threads = threads;
+				result.hash = HashParticleState();
+				result.stepsPerSecond = seconds > 0.0 ? options.steps / seconds : 0.0;
+				runs.push_back(result);
+			}
+		}
+
+		pool.setThreadCount(savedThreads);
+		simulation.SetExecutionMode(savedMode);
+		return runs;
+	}
+
+	bool DeterminismTest::passed() const
+	{
+		bool any = false;
+		uint64_t expected = 0;
+		for (const DeterminismRun& result : runs)
+		{
+			if (result.mode != ExecutionMode::Deterministic)
+			{
+				continue;
+			}
+			if (any && result.hash != expected)
+			{
+				return false;
+			}
+			expected = result.hash;
+			any = true;
+		}
+		return any;
+	}
+
+	bool DeterminismTest::writeReport(const char* path) const
+	{
+		std::ofstream file(path);
+		if (!file)
+		{
+			return false;
+		}
+
+		char line[256];
+		snprintf(line, sizeof(line), "Determinism test, %u random particles, %d steps of %.5f s\n\n", options.particles, options.steps, options.dt);
+		file << line;
+		file << "mode           threads  state hash          steps/s\n";
+
+		for (const DeterminismRun& result : runs)
+		{
+			snprintf(line, sizeof(line), "%-14s %7u  %016llx  %9.1f\n", result.mode == ExecutionMode::Deterministic ? "Deterministic" : "Parallel",
+				result.threads, (unsigned long long)result.hash, result.stepsPerSecond);
+			file << line;
+		}
+
+		file << (passed() ? "\nPASS, deterministic hashes match for every thread count\n" : "\nFAIL, deterministic hashes differ between thread counts\n");
+		return true;
+	}
+}
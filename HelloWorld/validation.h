@@ -0,0 +1,119 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "particle.h"
+#include "Simulation.h"
+
+namespace Fluid
+{
+	// A block like the default grid, centred in the boundary
+	std::vector<Render::particle> BlockScene(int count = 400, int rowSize = 20, float gap = 10.0f);
+	// Uniformly scattered inside the boundary with random velocities
+	std::vector<Render::particle> RandomScene(uint32_t count, uint32_t seed);
+
+	// Replaces everything in the particle store and the simulation with the given particles
+	void LoadParticles(const std::vector<Render::particle>& particles);
+	std::vector<Render::particle> CaptureParticles();
+
+	// FNV-1a over the bits of every particle's position, velocity, densities and pressure
+	uint64_t HashParticleState();
+
+	struct DifferentialOptions
+	{
+		uint32_t randomParticles = 400;
+		uint32_t seed = 1234;
+		// Reference steps run on each scene before the state is snapshotted, so there is motion to compare
+		int settleSteps = 10;
+		// Full steps run with each neighbour search before the final positions are compared
+		int steps = 30;
+		float dt = 1.0f / 60.0f;
+
+		// The grid visits the same pairs in the same order as the reference, so anything but an exact match is a bug
+		float positionTolerance = 0.0f;
+		float velocityTolerance = 0.0f;
+		float densityTolerance = 0.0f;	// Relative
+	};
+
+	struct PhaseError
+	{
+		std::string phase;
+		double maxPosition = 0.0;
+		double maxVelocity = 0.0;
+		double maxDensity = 0.0;
+		double maxRestLength = 0.0;
+		int springCountDifference = 0;
+		bool passed = true;
+	};
+
+	struct SceneReport
+	{
+		std::string scene;
+		uint32_t particles = 0;
+		std::vector<PhaseError> phases;
+		bool passed = true;
+	};
+
+	// Runs the accelerated kernels and the brute force reference on identical copies of a scene and
+	// reports the largest difference per phase, then runs the grid's sparse layout against its dense one. The simulation and particle store are left holding the
+	// last scene, reset them afterwards.
+	class DifferentialTest
+	{
+	public:
+		explicit DifferentialTest(const DifferentialOptions& options);
+
+		void addScene(const std::string& name, const std::vector<Render::particle>& particles);
+		// A block like the default grid and a random scatter with random velocities, both inside the boundary
+		void addDefaultScenes();
+
+		const std::vector<SceneReport>& run();
+		bool passed() const;
+		bool writeReport(const char* path) const;
+
+	private:
+		struct Scene
+		{
+			std::string name;
+			std::vector<Render::particle> particles;
+		};
+
+		PhaseError compare(const std::string& phase, const std::vector<Render::particle>& reference, const std::vector<Render::particle>& accelerated, bool densities) const;
+
+		DifferentialOptions options;
+		std::vector<Scene> scenes;
+		std::vector<SceneReport> reports;
+	};
+
+	struct DeterminismOptions
+	{
+		std::vector<uint32_t> threadCounts = { 1, 2, 3, 4, 8 };
+		uint32_t particles = 2000;
+		uint32_t seed = 1234;
+		int steps = 120;
+		float dt = 1.0f / 60.0f;
+	};
+
+	struct DeterminismRun
+	{
+		ExecutionMode mode = ExecutionMode::Deterministic;
+		uint32_t threads = 1;
+		uint64_t hash = 0;
+		double stepsPerSecond = 0.0;
+	};
+
+	// Runs the same scene for N steps at several thread counts in the Deterministic and Parallel modes.
+	// Passes when every Deterministic run hashes the same, the Parallel runs are there for their throughput.
+	// Like DifferentialTest it leaves its last scene behind.
+	class DeterminismTest
+	{
+	public:
+		explicit DeterminismTest(const DeterminismOptions& options);
+
+		const std::vector<DeterminismRun>& run();
+		bool passed() const;
+		bool writeReport(const char* path) const;
+
+	private:
+		DeterminismOptions options;
+		std::vector<DeterminismRun> runs;
+	};
+}
@@ -0,0 +1,33 @@
+#include "Play.h"
+
+PlayGraphics& PlayGraphics::Instance()
+{
+	static PlayGraphics graphics;
+	return graphics;
+}
+
+const std::string& PlayGraphics::GetSpriteName( int spriteId )
+{
+	static const std::string none;
+	return none;
+}
+
+const PixelData* PlayGraphics::GetSpritePixelData( int spriteId ) const
+{
+	static const PixelData none;
+	return &none;
+}
+
+namespace Play
+{
+	Colour cBlack{ 0, 0, 0 };
+	Colour cRed{ 100, 0, 0 };
+	Colour cGreen{ 0, 100, 0 };
+	Colour cBlue{ 0, 0, 100 };
+	Colour cMagenta{ 100, 0, 100 };
+	Colour cCyan{ 0, 100, 100 };
+	Colour cYellow{ 100, 100, 0 };
+	Colour cOrange{ 100, 50, 0 };
+	Colour cWhite{ 100, 100, 100 };
+	Colour cGrey{ 50, 50, 50 };
+}
@@ -0,0 +1,137 @@
+// Stands in for Play.h when the simulation is built without a window, as SlabRunner is on Linux.
+// The maths and pixel types match Play.h's so the simulation steps the same; drawing does nothing and no
+// sprites are ever loaded, so scenes that need one report it the way they do when it's missing.
+#pragma once
+
+// The same standard headers Play.h brings in, the simulation leans on some of them
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <thread>
+#include <future>
+#include <cassert>
+
+struct Vector2f
+{
+	Vector2f() {}
+	Vector2f( float x, float y ) : x( x ), y( y ) {}
+	Vector2f( int x, int y ) : x( static_cast<float>( x ) ), y( static_cast<float>( y ) ) {}
+	Vector2f( float x, int y ) : x( x ), y( static_cast<float>( y ) ) {}
+	Vector2f( int x, float y ) : x( static_cast<float>( x ) ), y( y ) {}
+
+	union
+	{
+		float v[2];
+		struct { float x; float y; };
+		struct { float width; float height; };
+	};
+
+	float Length() const { return std::sqrt( Dot( *this ) ); }
+	float LengthSqr() const { return Dot( *this ); }
+	void Normalize();
+	Vector2f Perpendicular() const { return Vector2f( -y, x ); }
+	bool AboutEqualTo( const Vector2f& rhs, const float tolerance ) const { return std::abs( x - rhs.x ) <= tolerance && std::abs( y - rhs.y ) <= tolerance; }
+	float Dot( const Vector2f& rhs ) const { float ret = 0.f; ret += x * rhs.x; ret += y * rhs.y; return ret; }
+};
+
+using Point2f = Vector2f;
+using Point2D = Vector2f;
+using Vector2D = Vector2f;
+
+inline Vector2f operator + ( const Vector2f& lhs, const Vector2f& rhs ) { return Vector2f( lhs.x + rhs.x, lhs.y + rhs.y ); }
+inline Vector2f& operator += ( Vector2f& lhs, const Vector2f& rhs ) { lhs.x += rhs.x; lhs.y += rhs.y; return lhs; }
+inline Vector2f operator - ( const Vector2f& lhs, const Vector2f& rhs ) { return Vector2f( lhs.x - rhs.x, lhs.y - rhs.y ); }
+inline Vector2f& operator -= ( Vector2f& lhs, const Vector2f& rhs ) { lhs.x -= rhs.x; lhs.y -= rhs.y; return lhs; }
+inline Vector2f operator - ( const Vector2f& op ) { return Vector2f( -op.x, -op.y ); }
+inline Vector2f operator * ( const Vector2f& lhs, const Vector2f& rhs ) { return Vector2f( lhs.x * rhs.x, lhs.y * rhs.y ); }
+inline Vector2f operator *= ( Vector2f& lhs, const Vector2f& rhs ) { lhs.x *= rhs.x; lhs.y *= rhs.y; return lhs; }
+inline Vector2f operator / ( const Vector2f& lhs, const Vector2f& rhs ) { return Vector2f( lhs.x / rhs.x, lhs.y / rhs.y ); }
+inline Vector2f operator /= ( Vector2f& lhs, const Vector2f& rhs ) { lhs.x /= rhs.x; lhs.y /= rhs.y; return lhs; }
+inline Vector2f operator * ( const Vector2f& lhs, const float rhs ) { return Vector2f( lhs.x * rhs, lhs.y * rhs ); }
+inline Vector2f operator * ( const float lhs, const Vector2f& rhs ) { return rhs * lhs; }
+inline Vector2f operator *= ( Vector2f& lhs, const float& rhs ) { lhs.x *= rhs; lhs.y *= rhs; return lhs; }
+inline Vector2f operator / ( const Vector2f& lhs, const float rhs ) { return Vector2f( lhs.x / rhs, lhs.y / rhs ); }
+inline Vector2f operator / ( const float lhs, const Vector2f& rhs ) { return Vector2f( lhs / rhs.x, lhs / rhs.y ); }
+inline Vector2f operator /= ( Vector2f& lhs, const float& rhs ) { lhs.x /= rhs; lhs.y /= rhs; return lhs; }
+inline bool operator == ( const Vector2f& lhs, const Vector2f& rhs ) { return lhs.x == rhs.x && lhs.y == rhs.y; }
+inline bool operator != ( const Vector2f& lhs, const Vector2f& rhs ) { return !( lhs == rhs ); }
+
+inline void Vector2f::Normalize() { *this /= Length(); }
+inline float dot( const Vector2f& lhs, const Vector2f& rhs ) { return lhs.Dot( rhs ); }
+inline float lengthSqr( const Vector2f& v ) { return dot( v, v ); }
+inline float length( const Vector2f& v ) { return std::sqrt( dot( v, v ) ); }
+inline Vector2f normalize( const Vector2f& v ) { return v / v.Length(); }
+
+struct Pixel
+{
+	Pixel() {}
+	Pixel( const uint32_t& bits ) : bits( bits ) {}
+	Pixel( int r, int g, int b ) : Pixel( 0xFF, r, g, b ) {}
+	Pixel( int a, int r, int g, int b ) : bits( static_cast<uint32_t>( ( a & 0xFF ) << 24 | ( r & 0xFF ) << 16 | ( g & 0xFF ) << 8 | ( b & 0xFF ) ) ) {}
+
+	union
+	{
+		uint32_t bits{ 0xFF000000 };
+		struct { uint8_t b, g, r, a; };
+	};
+};
+
+const Pixel PIX_BLACK{ 0x00, 0x00, 0x00 };
+const Pixel PIX_WHITE{ 0xFF, 0xFF, 0xFF };
+const Pixel PIX_RED{ 0xFF, 0x00, 0x00 };
+const Pixel PIX_GREEN{ 0x00, 0x8F, 0x00 };
+const Pixel PIX_BLUE{ 0x00, 0x00, 0xFF };
+const Pixel PIX_MAGENTA{ 0xFF, 0x00, 0xFF };
+const Pixel PIX_CYAN{ 0x00, 0xFF, 0xFF };
+const Pixel PIX_YELLOW{ 0xFF, 0xFF, 0x00 };
+const Pixel PIX_ORANGE{ 0xFF, 0x8F, 0x00 };
+const Pixel PIX_GREY{ 0x80, 0x80, 0x80 };
+const Pixel PIX_TRANS{ 0x00, 0x00, 0x00, 0x00 };
+
+struct PixelData
+{
+	int width{ 0 };
+	int height{ 0 };
+	Pixel* pPixels{ nullptr };
+	bool preMultiplied = false;
+};
+
+class PlayGraphics
+{
+public:
+	static PlayGraphics& Instance();
+
+	int GetTotalLoadedSprites() const { return 0; }
+	const std::string& GetSpriteName( int spriteId );
+	const PixelData* GetSpritePixelData( int spriteId ) const;
+	void DrawRect( Point2f topLeft, Point2f bottomRight, Pixel pix, bool fill = false ) {}
+};
+
+namespace Play
+{
+	struct Colour
+	{
+		Colour( short r, short g, short b ) : red( r ), green( g ), blue( b ) {}
+		Colour( int r, int g, int b ) : red( static_cast<short>( r ) ), green( static_cast<short>( g ) ), blue( static_cast<short>( b ) ) {}
+		short red, green, blue;
+	};
+
+	extern Colour cBlack, cRed, cGreen, cBlue, cMagenta, cCyan, cYellow, cOrange, cWhite, cGrey;
+
+	inline void DrawLine( Point2f start, Point2f end, Colour colour ) {}
+	inline void DrawCircle( Point2f pos, int radius, Colour colour ) {}
+	inline void DrawRect( Point2f topLeft, Point2f bottomRight, Colour colour, bool fill = false ) {}
+	inline void DrawSpriteRotated( int spriteId, Point2f pos, int frame, float angle, float scale = 1.0f, float opacity = 1.0f ) {}
+	inline void DrawDebugText( Point2f pos, const char* text, Colour colour = cWhite, bool centred = true ) {}
+	inline int GetSpriteWidth( int spriteId ) { return 0; }
+	inline int GetSpriteHeight( int spriteId ) { return 0; }
+}
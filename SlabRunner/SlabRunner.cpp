@@ -0,0 +1,144 @@
+// Runs the slab decomposition's weak scaling test without a window (W in the simulation), so it can be
+// measured on Linux machines with more cores than a desktop. Builds against Headless/Play.h in place of
+// Play.h, see the Makefile.
+//
+//   SlabRunner <scene file> [--processes <n>] [--threads <total>] [--steps <n>] [--warmup <n>]
+//              [--mode serial|parallel|deterministic] [--out <json>]
+//
+// Runs 1, 2, 4... processes up to n, 4 by default. Each process steps its own copy of the scene, and the
+// copies sit side by side. The threads, every core by default, are split evenly between the processes
+// of the biggest run, so no run oversubscribes the machine. Run it from HelloWorld so the scene's data
+// paths resolve.
+//
+// The table shows the median step and exchange time on the slowest rank for every process count. The
+// efficiency column is the one process step time over the n process one. Every sample goes to the json,
+// weak_scaling.json by default, for BenchCompare. Ranks are this executable started again with --slab.
+//
+// Exit code: 0 ran, 1 a run failed, 2 bad arguments.
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "slabRun.h"
+
+namespace
+{
+	double median(std::vector<double> values)
+	{
+		if (values.empty())
+		{
+			return 0.0;
+		}
+		std::sort(values.begin(), values.end());
+		const size_t middle = values.size() / 2;
+		return values.size() % 2 == 1 ? values[middle] : (values[middle - 1] + values[middle]) / 2.0;
+	}
+
+	double medianOf(const Stats::BenchmarkResult& result, const std::string& metric)
+	{
+		const std::vector<double>* samples = result.getSamples(metric);
+		return samples != nullptr ? median(*samples) : 0.0;
+	}
+
+	void printUsage()
+	{
+		fprintf(stderr, "usage: SlabRunner <scene file> [--processes <n>] [--threads <total>] [--steps <n>] [--warmup <n>]\n"
+			"                  [--mode serial|parallel|deterministic] [--out <json>]\n");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	// A rank started by a run below
+	if (Fluid::RunSlabRankFromCommandLine(argc, argv))
+	{
+		return 0;
+	}
+
+	Fluid::SlabRunOptions options;
+	options.threads = std::max(std::thread::hardware_concurrency(), 1u);
+	int processes = 4;
+	const char* outPath = "weak_scaling.json";
+
+	for (int i = 1; i < argc; i++)
+	{
+		const bool hasValue = i + 1 < argc;
+		if (strcmp(argv[i], "--processes") == 0 && hasValue)
+		{
+			processes = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && hasValue)
+		{
+			options.threads = (uint32_t)std::max(atoi(argv[++i]), 1);
+		}
+		else if (strcmp(argv[i], "--steps") == 0 && hasValue)
+		{
+			options.steps = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--warmup") == 0 && hasValue)
+		{
+			options.warmupSteps = std::max(atoi(argv[++i]), 0);
+		}
+		else if (strcmp(argv[i], "--mode") == 0 && hasValue)
+		{
+			const std::string mode = argv[++i];
+			if (mode == "serial") options.mode = Fluid::ExecutionMode::Serial;
+			else if (mode == "parallel") options.mode = Fluid::ExecutionMode::Parallel;
+			else if (mode == "deterministic") options.mode = Fluid::ExecutionMode::Deterministic;
+			else
+			{
+				printUsage();
+				return 2;
+			}
+		}
+		else if (strcmp(argv[i], "--out") == 0 && hasValue)
+		{
+			outPath = argv[++i];
+		}
+		else if (argv[i][0] != '-' && options.sceneFile.empty())
+		{
+			options.sceneFile = argv[i];
+		}
+		else
+		{
+			printUsage();
+			return 2;
+		}
+	}
+
+	if (options.sceneFile.empty() || processes < 1 || options.steps < 1)
+	{
+		printUsage();
+		return 2;
+	}
+
+	Stats::BenchmarkResult result;
+	if (!Fluid::RunWeakScaling(options, processes, result))
+	{
+		fprintf(stderr, "SlabRunner: a run of %s failed to start or load\n", options.sceneFile.c_str());
+		return 1;
+	}
+	if (!result.writeJson(outPath))
+	{
+		fprintf(stderr, "SlabRunner: can't write %s\n", outPath);
+		return 1;
+	}
+
+	const uint32_t threadsPerProcess = std::max(options.threads / (uint32_t)processes, 1u);
+	printf("%s, %d steps, %u thread(s) a process\n\n", options.sceneFile.c_str(), options.steps, threadsPerProcess);
+	printf("%9s %12s %14s %10s\n", "processes", "step (ms)", "exchange (ms)", "efficiency");
+
+	const double baseline = medianOf(result, "Step 1");
+	for (int n = 1; n <= processes; n *= 2)
+	{
+		const std::string suffix = " " + std::to_string(n);
+		const double step = medianOf(result, "Step" + suffix);
+		const double exchange = medianOf(result, "Exchange" + suffix);
+		printf("%9d %12.3f %14.3f %9.0f%%\n", n, step / 1e6, exchange / 1e6, step > 0.0 ? baseline / step * 100.0 : 0.0);
+	}
+	printf("\nEvery sample written to %s\n", outPath);
+	return 0;
+}